@@ -0,0 +1,105 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Vector row kernels shared by yuv2rgb.cc and rgb2yuv.cc, and the helper that
+// splits a conversion into row bands. Not part of the public interface.
+//
+// Each kernel converts as many whole vectors as fit in the row and returns the
+// number of pixels it handled; the caller finishes the rest with the scalar
+// code. They compute exactly what the scalar code does.
+
+#ifndef ORG_TENSORFLOW_JNI_IMAGEUTILS_CONVERT_KERNELS_H_
+#define ORG_TENSORFLOW_JNI_IMAGEUTILS_CONVERT_KERNELS_H_
+
+#include <stdint.h>
+
+#include <thread>
+#include <vector>
+
+#include "simd_level.h"
+
+// Converts one row of YUV420SP to ARGB8888. uv points at the chroma row
+// shared by this row's pair; u_first says whether U precedes V in each
+// interleaved sample, after any flip has been accounted for.
+#ifdef IMAGEUTILS_NEON
+int ConvertYUVRowToARGBNeon(const uint8_t* const y, const uint8_t* const uv,
+                            uint32_t* const output, const int width,
+                            const bool u_first);
+#endif
+
+#ifdef IMAGEUTILS_X86_SIMD
+int ConvertYUVRowToARGBSse41(const uint8_t* const y, const uint8_t* const uv,
+                             uint32_t* const output, const int width,
+                             const bool u_first);
+int ConvertYUVRowToARGBAvx2(const uint8_t* const y, const uint8_t* const uv,
+                            uint32_t* const output, const int width,
+                            const bool u_first);
+#endif
+
+// Converts a pair of ARGB8888 rows to their two rows of luminance and the one
+// row of interleaved chroma they share. The count returned is always even.
+#ifdef IMAGEUTILS_NEON
+int ConvertARGBRowPairToYUVNeon(const uint32_t* const input0,
+                                const uint32_t* const input1,
+                                uint8_t* const y0, uint8_t* const y1,
+                                uint8_t* const uv, const int width);
+#endif
+
+#ifdef IMAGEUTILS_X86_SIMD
+int ConvertARGBRowPairToYUVSse41(const uint32_t* const input0,
+                                 const uint32_t* const input1,
+                                 uint8_t* const y0, uint8_t* const y1,
+                                 uint8_t* const uv, const int width);
+int ConvertARGBRowPairToYUVAvx2(const uint32_t* const input0,
+                                const uint32_t* const input1,
+                                uint8_t* const y0, uint8_t* const y1,
+                                uint8_t* const uv, const int width);
+#endif
+
+// Calls convert_rows(first_row, end_row) over bands of rows covering
+// [0, height), running up to num_threads bands at once with the calling
+// thread taking the first. Bands start on even rows so that no two of them
+// share a chroma row.
+template <typename ConvertRows>
+void ForEachRowBand(const int height, const int num_threads,
+                    const ConvertRows& convert_rows) {
+  const int num_row_pairs = (height + 1) / 2;
+  const int num_bands =
+      num_threads < num_row_pairs ? num_threads : num_row_pairs;
+  if (num_bands <= 1) {
+    convert_rows(0, height);
+    return;
+  }
+
+  const int rows_per_band = 2 * ((num_row_pairs + num_bands - 1) / num_bands);
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_bands - 1);
+  for (int first_row = rows_per_band; first_row < height;
+       first_row += rows_per_band) {
+    const int end_row =
+        first_row + rows_per_band < height ? first_row + rows_per_band : height;
+    threads.push_back(std::thread([&convert_rows, first_row, end_row]() {
+      convert_rows(first_row, end_row);
+    }));
+  }
+  convert_rows(0, rows_per_band < height ? rows_per_band : height);
+
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+}
+
+#endif  // ORG_TENSORFLOW_JNI_IMAGEUTILS_CONVERT_KERNELS_H_
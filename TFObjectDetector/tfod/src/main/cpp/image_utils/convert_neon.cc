@@ -0,0 +1,217 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// NEON versions of the YUV420SP <-> ARGB8888 conversions, 16 pixels at a time.
+
+#include "simd_level.h"
+
+#ifdef IMAGEUTILS_NEON
+
+#include <arm_neon.h>
+
+#include "convert_kernels.h"
+
+// YUV to ARGB.
+
+// Shifts 18 bit channel values down to 8 bits. Anything above 2^18 - 1 comes
+// out of the shift above 255 and saturates in the final narrowing, which is
+// the same as clamping first as YUV2RGB in yuv2rgb.cc does.
+static inline uint8x8_t ChannelToByte(const int32x4_t low,
+                                      const int32x4_t high) {
+  const int32x4_t zero = vdupq_n_s32(0);
+  return vqmovun_s16(vcombine_s16(vshrn_n_s32(vmaxq_s32(low, zero), 10),
+                                  vshrn_n_s32(vmaxq_s32(high, zero), 10)));
+}
+
+// Converts 8 pixels with the offsets already removed from Y, U and V.
+static inline void ConvertYUV8PixelsNeon(const int16x8_t y, const int16x8_t u,
+                                         const int16x8_t v,
+                                         uint8x8_t* const r,
+                                         uint8x8_t* const g,
+                                         uint8x8_t* const b) {
+  const int32x4_t y_low = vmull_n_s16(vget_low_s16(y), 1192);
+  const int32x4_t y_high = vmull_n_s16(vget_high_s16(y), 1192);
+
+  *r = ChannelToByte(vmlal_n_s16(y_low, vget_low_s16(v), 1634),
+                     vmlal_n_s16(y_high, vget_high_s16(v), 1634));
+  *g = ChannelToByte(
+      vmlsl_n_s16(vmlsl_n_s16(y_low, vget_low_s16(v), 833),
+                  vget_low_s16(u), 400),
+      vmlsl_n_s16(vmlsl_n_s16(y_high, vget_high_s16(v), 833),
+                  vget_high_s16(u), 400));
+  *b = ChannelToByte(vmlal_n_s16(y_low, vget_low_s16(u), 2066),
+                     vmlal_n_s16(y_high, vget_high_s16(u), 2066));
+}
+
+template <bool kUFirst>
+static inline void ConvertYUV16PixelsNeon(const uint8_t* const y,
+                                          const uint8_t* const uv,
+                                          uint32_t* const output) {
+  const int16x8_t zero = vdupq_n_s16(0);
+  const int16x8_t y_offset = vdupq_n_s16(16);
+  const int16x8_t uv_offset = vdupq_n_s16(128);
+
+  const uint8x16_t y8 = vld1q_u8(y);
+  // Deinterleaves the 8 chroma samples into even and odd bytes.
+  const uint8x8x2_t uv8 = vld2_u8(uv);
+
+  const int16x8_t u = vsubq_s16(
+      vreinterpretq_s16_u16(vmovl_u8(uv8.val[kUFirst ? 0 : 1])), uv_offset);
+  const int16x8_t v = vsubq_s16(
+      vreinterpretq_s16_u16(vmovl_u8(uv8.val[kUFirst ? 1 : 0])), uv_offset);
+
+  // Each chroma sample covers two neighbouring pixels.
+  const int16x8x2_t u_pixels = vzipq_s16(u, u);
+  const int16x8x2_t v_pixels = vzipq_s16(v, v);
+
+  const int16x8_t y_low = vmaxq_s16(
+      vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y8))), y_offset),
+      zero);
+  const int16x8_t y_high = vmaxq_s16(
+      vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y8))), y_offset),
+      zero);
+
+  uint8x8_t r_low, g_low, b_low;
+  uint8x8_t r_high, g_high, b_high;
+  ConvertYUV8PixelsNeon(y_low, u_pixels.val[0], v_pixels.val[0], &r_low,
+                        &g_low, &b_low);
+  ConvertYUV8PixelsNeon(y_high, u_pixels.val[1], v_pixels.val[1], &r_high,
+                        &g_high, &b_high);
+
+  // Little endian 0xAARRGGBB is B, G, R, A in memory.
+  uint8x16x4_t argb;
+  argb.val[0] = vcombine_u8(b_low, b_high);
+  argb.val[1] = vcombine_u8(g_low, g_high);
+  argb.val[2] = vcombine_u8(r_low, r_high);
+  argb.val[3] = vdupq_n_u8(0xff);
+  vst4q_u8(reinterpret_cast<uint8_t*>(output), argb);
+}
+
+template <bool kUFirst>
+static int ConvertYUVRowToARGBNeon(const uint8_t* const y,
+                                   const uint8_t* const uv,
+                                   uint32_t* const output, const int width) {
+  int x = 0;
+  for (; x <= width - 16; x += 16) {
+    ConvertYUV16PixelsNeon<kUFirst>(y + x, uv + x, output + x);
+  }
+  return x;
+}
+
+int ConvertYUVRowToARGBNeon(const uint8_t* const y, const uint8_t* const uv,
+                            uint32_t* const output, const int width,
+                            const bool u_first) {
+  return u_first ? ConvertYUVRowToARGBNeon<true>(y, uv, output, width)
+                 : ConvertYUVRowToARGBNeon<false>(y, uv, output, width);
+}
+
+// ARGB to YUV.
+
+// The chroma term of WriteYUV in rgb2yuv.cc for 8 pixels, with the divide by
+// 4 factored in. Every partial sum fits in 16 bits.
+static inline int16x8_t ChromaTermsNeon(const uint8x8_t r, const uint8x8_t g,
+                                        const uint8x8_t b,
+                                        const int16_t r_weight,
+                                        const int16_t g_weight,
+                                        const int16_t b_weight) {
+  int16x8_t sum = vdupq_n_s16(128);
+  sum = vmlaq_n_s16(sum, vreinterpretq_s16_u16(vmovl_u8(r)), r_weight);
+  sum = vmlaq_n_s16(sum, vreinterpretq_s16_u16(vmovl_u8(g)), g_weight);
+  sum = vmlaq_n_s16(sum, vreinterpretq_s16_u16(vmovl_u8(b)), b_weight);
+  return vaddq_s16(vshrq_n_s16(sum, 10), vdupq_n_s16(32));
+}
+
+// Luminance of 8 pixels. The sum can exceed 2^15, so it is kept unsigned.
+static inline uint8x8_t LuminanceNeon(const uint8x8_t r, const uint8x8_t g,
+                                      const uint8x8_t b) {
+  uint16x8_t sum = vmull_u8(r, vdup_n_u8(66));
+  sum = vmlal_u8(sum, g, vdup_n_u8(129));
+  sum = vmlal_u8(sum, b, vdup_n_u8(25));
+  sum = vaddq_u16(sum, vdupq_n_u16(128));
+  return vadd_u8(vshrn_n_u16(sum, 8), vdup_n_u8(16));
+}
+
+// Converts 16 pixels of one row, writing their luminance and adding their
+// chroma terms to the running sums for pixels 0-7 and 8-15.
+static inline void ConvertARGB16PixelsNeon(const uint32_t* const input,
+                                           uint8_t* const y,
+                                           int16x8_t* const v_sums,
+                                           int16x8_t* const u_sums) {
+  const uint8x16x4_t argb =
+      vld4q_u8(reinterpret_cast<const uint8_t*>(input));
+#ifdef __APPLE__
+  const uint8x16_t r = argb.val[3];
+  const uint8x16_t g = argb.val[2];
+  const uint8x16_t b = argb.val[1];
+#else
+  const uint8x16_t r = argb.val[2];
+  const uint8x16_t g = argb.val[1];
+  const uint8x16_t b = argb.val[0];
+#endif
+
+  vst1q_u8(y, vcombine_u8(
+                  LuminanceNeon(vget_low_u8(r), vget_low_u8(g),
+                                vget_low_u8(b)),
+                  LuminanceNeon(vget_high_u8(r), vget_high_u8(g),
+                                vget_high_u8(b))));
+
+  v_sums[0] = vaddq_s16(v_sums[0],
+                        ChromaTermsNeon(vget_low_u8(r), vget_low_u8(g),
+                                        vget_low_u8(b), 112, -94, -18));
+  v_sums[1] = vaddq_s16(v_sums[1],
+                        ChromaTermsNeon(vget_high_u8(r), vget_high_u8(g),
+                                        vget_high_u8(b), 112, -94, -18));
+  u_sums[0] = vaddq_s16(u_sums[0],
+                        ChromaTermsNeon(vget_low_u8(r), vget_low_u8(g),
+                                        vget_low_u8(b), -38, -74, 112));
+  u_sums[1] = vaddq_s16(u_sums[1],
+                        ChromaTermsNeon(vget_high_u8(r), vget_high_u8(g),
+                                        vget_high_u8(b), -38, -74, 112));
+}
+
+// Adds horizontal neighbours to complete the sums over 8 2x2 blocks.
+static inline uint8x8_t SumBlocksNeon(const int16x8_t* const sums) {
+  const int16x4_t low =
+      vpadd_s16(vget_low_s16(sums[0]), vget_high_s16(sums[0]));
+  const int16x4_t high =
+      vpadd_s16(vget_low_s16(sums[1]), vget_high_s16(sums[1]));
+  return vqmovun_s16(vcombine_s16(low, high));
+}
+
+int ConvertARGBRowPairToYUVNeon(const uint32_t* const input0,
+                                const uint32_t* const input1,
+                                uint8_t* const y0, uint8_t* const y1,
+                                uint8_t* const uv, const int width) {
+  int x = 0;
+  for (; x <= width - 16; x += 16) {
+    int16x8_t v_sums[2] = {vdupq_n_s16(0), vdupq_n_s16(0)};
+    int16x8_t u_sums[2] = {vdupq_n_s16(0), vdupq_n_s16(0)};
+    ConvertARGB16PixelsNeon(input0 + x, y0 + x, v_sums, u_sums);
+    ConvertARGB16PixelsNeon(input1 + x, y1 + x, v_sums, u_sums);
+
+    uint8x8x2_t chroma;
+#ifdef __APPLE__
+    chroma.val[0] = SumBlocksNeon(u_sums);
+    chroma.val[1] = SumBlocksNeon(v_sums);
+#else
+    chroma.val[0] = SumBlocksNeon(v_sums);
+    chroma.val[1] = SumBlocksNeon(u_sums);
+#endif
+    vst2_u8(uv + x, chroma);
+  }
+  return x;
+}
+
+#endif  // IMAGEUTILS_NEON
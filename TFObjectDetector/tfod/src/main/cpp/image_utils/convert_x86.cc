@@ -0,0 +1,440 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// SSE4.1 and AVX2 versions of the NEON kernels in convert_neon.cc. Each kernel
+// is compiled for its own instruction set via target attributes and is only
+// entered once GetSimdLevel() has confirmed CPU support.
+
+#include "simd_level.h"
+
+#ifdef IMAGEUTILS_X86_SIMD
+
+#include <immintrin.h>
+
+#include "convert_kernels.h"
+
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+// Byte shuffles picking the even or odd 16 bit elements of a register, each
+// twice, so that one chroma sample lines up with both pixels it covers.
+#define EVEN_WORDS_TWICE 0, 1, 0, 1, 4, 5, 4, 5, 8, 9, 8, 9, 12, 13, 12, 13
+#define ODD_WORDS_TWICE 2, 3, 2, 3, 6, 7, 6, 7, 10, 11, 10, 11, 14, 15, 14, 15
+
+#ifdef __APPLE__
+static const int kRedShift = 24;
+static const int kGreenShift = 16;
+static const int kBlueShift = 8;
+#else
+static const int kRedShift = 16;
+static const int kGreenShift = 8;
+static const int kBlueShift = 0;
+#endif
+
+// YUV to ARGB.
+
+// Packs two 16 bit weights into a 32 bit value, for multiplying (first,
+// second) pairs of 16 bit elements with madd.
+static inline int WeightPair(const int first, const int second) {
+  return static_cast<int>((static_cast<uint32_t>(second) << 16) |
+                          (static_cast<uint32_t>(first) & 0xffff));
+}
+
+// Converts 4 pixels, given as (Y, U) and (Y, V) 16 bit pairs with the offsets
+// already removed, using the fixed point formulas of YUV2RGB in yuv2rgb.cc.
+TARGET_SSE41 static inline __m128i ConvertYUVQuadSse41(const __m128i yu,
+                                                       const __m128i yv) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max_value = _mm_set1_epi32(262143);
+
+  const __m128i r = _mm_madd_epi16(yv, _mm_set1_epi32(WeightPair(1192, 1634)));
+  const __m128i g = _mm_add_epi32(
+      _mm_madd_epi16(yv, _mm_set1_epi32(WeightPair(1192, -833))),
+      _mm_madd_epi16(yu, _mm_set1_epi32(WeightPair(0, -400))));
+  const __m128i b = _mm_madd_epi16(yu, _mm_set1_epi32(WeightPair(1192, 2066)));
+
+  const __m128i r8 =
+      _mm_srli_epi32(_mm_min_epi32(_mm_max_epi32(r, zero), max_value), 10);
+  const __m128i g8 =
+      _mm_srli_epi32(_mm_min_epi32(_mm_max_epi32(g, zero), max_value), 10);
+  const __m128i b8 =
+      _mm_srli_epi32(_mm_min_epi32(_mm_max_epi32(b, zero), max_value), 10);
+
+  return _mm_or_si128(
+      _mm_or_si128(_mm_set1_epi32(0xff000000), _mm_slli_epi32(r8, 16)),
+      _mm_or_si128(_mm_slli_epi32(g8, 8), b8));
+}
+
+// Converts 16 pixels, along with the 16 chroma bytes they share.
+template <bool kUFirst>
+TARGET_SSE41 static inline void ConvertYUV16PixelsSse41(
+    const uint8_t* const y, const uint8_t* const uv, uint32_t* const output) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i y_offset = _mm_set1_epi16(16);
+  const __m128i uv_offset = _mm_set1_epi16(128);
+  const __m128i even_mask = _mm_setr_epi8(EVEN_WORDS_TWICE);
+  const __m128i odd_mask = _mm_setr_epi8(ODD_WORDS_TWICE);
+  const __m128i u_mask = kUFirst ? even_mask : odd_mask;
+  const __m128i v_mask = kUFirst ? odd_mask : even_mask;
+
+  const __m128i y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y));
+  const __m128i uv8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv));
+
+  for (int half = 0; half < 2; ++half) {
+    const __m128i y16 =
+        half == 0 ? _mm_cvtepu8_epi16(y8) : _mm_unpackhi_epi8(y8, zero);
+    const __m128i uv16 =
+        half == 0 ? _mm_cvtepu8_epi16(uv8) : _mm_unpackhi_epi8(uv8, zero);
+
+    const __m128i luma = _mm_max_epi16(_mm_sub_epi16(y16, y_offset), zero);
+    const __m128i chroma = _mm_sub_epi16(uv16, uv_offset);
+    const __m128i u = _mm_shuffle_epi8(chroma, u_mask);
+    const __m128i v = _mm_shuffle_epi8(chroma, v_mask);
+
+    uint32_t* const out = output + 8 * half;
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                     ConvertYUVQuadSse41(_mm_unpacklo_epi16(luma, u),
+                                         _mm_unpacklo_epi16(luma, v)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4),
+                     ConvertYUVQuadSse41(_mm_unpackhi_epi16(luma, u),
+                                         _mm_unpackhi_epi16(luma, v)));
+  }
+}
+
+template <bool kUFirst>
+TARGET_SSE41 static int ConvertYUVRowToARGBSse41(const uint8_t* const y,
+                                                 const uint8_t* const uv,
+                                                 uint32_t* const output,
+                                                 const int width) {
+  int x = 0;
+  for (; x <= width - 16; x += 16) {
+    ConvertYUV16PixelsSse41<kUFirst>(y + x, uv + x, output + x);
+  }
+  return x;
+}
+
+int ConvertYUVRowToARGBSse41(const uint8_t* const y, const uint8_t* const uv,
+                             uint32_t* const output, const int width,
+                             const bool u_first) {
+  return u_first ? ConvertYUVRowToARGBSse41<true>(y, uv, output, width)
+                 : ConvertYUVRowToARGBSse41<false>(y, uv, output, width);
+}
+
+// As ConvertYUVQuadSse41, but on 8 pixels.
+TARGET_AVX2 static inline __m256i ConvertYUVOctetAvx2(const __m256i yu,
+                                                      const __m256i yv) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max_value = _mm256_set1_epi32(262143);
+
+  const __m256i r =
+      _mm256_madd_epi16(yv, _mm256_set1_epi32(WeightPair(1192, 1634)));
+  const __m256i g = _mm256_add_epi32(
+      _mm256_madd_epi16(yv, _mm256_set1_epi32(WeightPair(1192, -833))),
+      _mm256_madd_epi16(yu, _mm256_set1_epi32(WeightPair(0, -400))));
+  const __m256i b =
+      _mm256_madd_epi16(yu, _mm256_set1_epi32(WeightPair(1192, 2066)));
+
+  const __m256i r8 = _mm256_srli_epi32(
+      _mm256_min_epi32(_mm256_max_epi32(r, zero), max_value), 10);
+  const __m256i g8 = _mm256_srli_epi32(
+      _mm256_min_epi32(_mm256_max_epi32(g, zero), max_value), 10);
+  const __m256i b8 = _mm256_srli_epi32(
+      _mm256_min_epi32(_mm256_max_epi32(b, zero), max_value), 10);
+
+  return _mm256_or_si256(
+      _mm256_or_si256(_mm256_set1_epi32(0xff000000),
+                      _mm256_slli_epi32(r8, 16)),
+      _mm256_or_si256(_mm256_slli_epi32(g8, 8), b8));
+}
+
+template <bool kUFirst>
+TARGET_AVX2 static inline void ConvertYUV16PixelsAvx2(
+    const uint8_t* const y, const uint8_t* const uv, uint32_t* const output) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i even_mask = _mm256_setr_epi8(EVEN_WORDS_TWICE,
+                                             EVEN_WORDS_TWICE);
+  const __m256i odd_mask = _mm256_setr_epi8(ODD_WORDS_TWICE, ODD_WORDS_TWICE);
+
+  const __m256i y16 = _mm256_cvtepu8_epi16(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(y)));
+  const __m256i uv16 = _mm256_cvtepu8_epi16(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv)));
+
+  const __m256i luma =
+      _mm256_max_epi16(_mm256_sub_epi16(y16, _mm256_set1_epi16(16)), zero);
+  const __m256i chroma = _mm256_sub_epi16(uv16, _mm256_set1_epi16(128));
+  const __m256i u =
+      _mm256_shuffle_epi8(chroma, kUFirst ? even_mask : odd_mask);
+  const __m256i v =
+      _mm256_shuffle_epi8(chroma, kUFirst ? odd_mask : even_mask);
+
+  // Unpacking works within 128 bit lanes, so the low results hold pixels 0-3
+  // and 8-11 and the high ones 4-7 and 12-15.
+  const __m256i low = ConvertYUVOctetAvx2(_mm256_unpacklo_epi16(luma, u),
+                                          _mm256_unpacklo_epi16(luma, v));
+  const __m256i high = ConvertYUVOctetAvx2(_mm256_unpackhi_epi16(luma, u),
+                                           _mm256_unpackhi_epi16(luma, v));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(output),
+                      _mm256_permute2x128_si256(low, high, 0x20));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + 8),
+                      _mm256_permute2x128_si256(low, high, 0x31));
+}
+
+template <bool kUFirst>
+TARGET_AVX2 static int ConvertYUVRowToARGBAvx2(const uint8_t* const y,
+                                               const uint8_t* const uv,
+                                               uint32_t* const output,
+                                               const int width) {
+  int x = 0;
+  for (; x <= width - 16; x += 16) {
+    ConvertYUV16PixelsAvx2<kUFirst>(y + x, uv + x, output + x);
+  }
+  return x;
+}
+
+int ConvertYUVRowToARGBAvx2(const uint8_t* const y, const uint8_t* const uv,
+                            uint32_t* const output, const int width,
+                            const bool u_first) {
+  return u_first ? ConvertYUVRowToARGBAvx2<true>(y, uv, output, width)
+                 : ConvertYUVRowToARGBAvx2<false>(y, uv, output, width);
+}
+
+// ARGB to YUV.
+
+// Splits 8 pixels into zero extended 16 bit red, green and blue.
+TARGET_SSE41 static inline void UnpackARGBSse41(const uint32_t* const input,
+                                                __m128i* const r,
+                                                __m128i* const g,
+                                                __m128i* const b) {
+  const __m128i mask = _mm_set1_epi32(0xff);
+  const __m128i pixels1 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+  const __m128i pixels2 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 4));
+
+  *r = _mm_packus_epi32(
+      _mm_and_si128(_mm_srli_epi32(pixels1, kRedShift), mask),
+      _mm_and_si128(_mm_srli_epi32(pixels2, kRedShift), mask));
+  *g = _mm_packus_epi32(
+      _mm_and_si128(_mm_srli_epi32(pixels1, kGreenShift), mask),
+      _mm_and_si128(_mm_srli_epi32(pixels2, kGreenShift), mask));
+  *b = _mm_packus_epi32(
+      _mm_and_si128(_mm_srli_epi32(pixels1, kBlueShift), mask),
+      _mm_and_si128(_mm_srli_epi32(pixels2, kBlueShift), mask));
+}
+
+// The fixed point formulas of WriteYUV in rgb2yuv.cc, on 8 pixels of 16 bit
+// channels. Luminance is computed unsigned as it can exceed 2^15; the
+// chroma terms, per pixel and with the divide by 4 factored in, fit signed.
+TARGET_SSE41 static inline __m128i LuminanceSse41(const __m128i r,
+                                                  const __m128i g,
+                                                  const __m128i b) {
+  const __m128i sum = _mm_add_epi16(
+      _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                    _mm_mullo_epi16(g, _mm_set1_epi16(129))),
+      _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)),
+                    _mm_set1_epi16(128)));
+  return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
+
+TARGET_SSE41 static inline __m128i ChromaTermsSse41(
+    const __m128i r, const __m128i g, const __m128i b, const int r_weight,
+    const int g_weight, const int b_weight) {
+  const __m128i sum = _mm_add_epi16(
+      _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(r_weight)),
+                    _mm_mullo_epi16(g, _mm_set1_epi16(g_weight))),
+      _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(b_weight)),
+                    _mm_set1_epi16(128)));
+  return _mm_add_epi16(_mm_srai_epi16(sum, 10), _mm_set1_epi16(32));
+}
+
+// Converts 8 pixels of one row, writing their luminance and adding their
+// chroma terms to the running block sums.
+TARGET_SSE41 static inline __m128i ConvertARGB8PixelsSse41(
+    const uint32_t* const input, __m128i* const v_sum, __m128i* const u_sum) {
+  __m128i r, g, b;
+  UnpackARGBSse41(input, &r, &g, &b);
+  *v_sum = _mm_add_epi16(*v_sum, ChromaTermsSse41(r, g, b, 112, -94, -18));
+  *u_sum = _mm_add_epi16(*u_sum, ChromaTermsSse41(r, g, b, -38, -74, 112));
+  return LuminanceSse41(r, g, b);
+}
+
+// Interleaves 8 V and 8 U block sums into the 16 chroma bytes of 8 blocks.
+TARGET_SSE41 static inline __m128i InterleaveChromaSse41(const __m128i v,
+                                                         const __m128i u) {
+#ifdef __APPLE__
+  return _mm_packus_epi16(_mm_unpacklo_epi16(u, v), _mm_unpackhi_epi16(u, v));
+#else
+  return _mm_packus_epi16(_mm_unpacklo_epi16(v, u), _mm_unpackhi_epi16(v, u));
+#endif
+}
+
+TARGET_SSE41 static inline void ConvertARGB16ColumnsSse41(
+    const uint32_t* const input0, const uint32_t* const input1,
+    uint8_t* const y0, uint8_t* const y1, uint8_t* const uv) {
+  __m128i v_sums[2];
+  __m128i u_sums[2];
+  __m128i luma0[2];
+  __m128i luma1[2];
+  for (int half = 0; half < 2; ++half) {
+    v_sums[half] = _mm_setzero_si128();
+    u_sums[half] = _mm_setzero_si128();
+    luma0[half] = ConvertARGB8PixelsSse41(input0 + 8 * half, &v_sums[half],
+                                          &u_sums[half]);
+    luma1[half] = ConvertARGB8PixelsSse41(input1 + 8 * half, &v_sums[half],
+                                          &u_sums[half]);
+  }
+
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(y0),
+                   _mm_packus_epi16(luma0[0], luma0[1]));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(y1),
+                   _mm_packus_epi16(luma1[0], luma1[1]));
+
+  // Adding horizontal neighbours completes the sum over each 2x2 block.
+  const __m128i v = _mm_hadd_epi16(v_sums[0], v_sums[1]);
+  const __m128i u = _mm_hadd_epi16(u_sums[0], u_sums[1]);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(uv),
+                   InterleaveChromaSse41(v, u));
+}
+
+TARGET_SSE41 int ConvertARGBRowPairToYUVSse41(const uint32_t* const input0,
+                                              const uint32_t* const input1,
+                                              uint8_t* const y0,
+                                              uint8_t* const y1,
+                                              uint8_t* const uv,
+                                              const int width) {
+  int x = 0;
+  for (; x <= width - 16; x += 16) {
+    ConvertARGB16ColumnsSse41(input0 + x, input1 + x, y0 + x, y1 + x, uv + x);
+  }
+  return x;
+}
+
+// As UnpackARGBSse41, but on 16 pixels.
+TARGET_AVX2 static inline void UnpackARGBAvx2(const uint32_t* const input,
+                                              __m256i* const r,
+                                              __m256i* const g,
+                                              __m256i* const b) {
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256i pixels1 =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input));
+  const __m256i pixels2 =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + 8));
+
+  // Packing works within 128 bit lanes, leaving the 64 bit quarters in the
+  // order 0, 2, 1, 3.
+  *r = _mm256_permute4x64_epi64(
+      _mm256_packus_epi32(
+          _mm256_and_si256(_mm256_srli_epi32(pixels1, kRedShift), mask),
+          _mm256_and_si256(_mm256_srli_epi32(pixels2, kRedShift), mask)),
+      0xD8);
+  *g = _mm256_permute4x64_epi64(
+      _mm256_packus_epi32(
+          _mm256_and_si256(_mm256_srli_epi32(pixels1, kGreenShift), mask),
+          _mm256_and_si256(_mm256_srli_epi32(pixels2, kGreenShift), mask)),
+      0xD8);
+  *b = _mm256_permute4x64_epi64(
+      _mm256_packus_epi32(
+          _mm256_and_si256(_mm256_srli_epi32(pixels1, kBlueShift), mask),
+          _mm256_and_si256(_mm256_srli_epi32(pixels2, kBlueShift), mask)),
+      0xD8);
+}
+
+TARGET_AVX2 static inline __m256i LuminanceAvx2(const __m256i r,
+                                                const __m256i g,
+                                                const __m256i b) {
+  const __m256i sum = _mm256_add_epi16(
+      _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)),
+                       _mm256_mullo_epi16(g, _mm256_set1_epi16(129))),
+      _mm256_add_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(25)),
+                       _mm256_set1_epi16(128)));
+  return _mm256_add_epi16(_mm256_srli_epi16(sum, 8), _mm256_set1_epi16(16));
+}
+
+TARGET_AVX2 static inline __m256i ChromaTermsAvx2(
+    const __m256i r, const __m256i g, const __m256i b, const int r_weight,
+    const int g_weight, const int b_weight) {
+  const __m256i sum = _mm256_add_epi16(
+      _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(r_weight)),
+                       _mm256_mullo_epi16(g, _mm256_set1_epi16(g_weight))),
+      _mm256_add_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(b_weight)),
+                       _mm256_set1_epi16(128)));
+  return _mm256_add_epi16(_mm256_srai_epi16(sum, 10), _mm256_set1_epi16(32));
+}
+
+TARGET_AVX2 static inline __m256i ConvertARGB16PixelsAvx2(
+    const uint32_t* const input, __m256i* const v_sum, __m256i* const u_sum) {
+  __m256i r, g, b;
+  UnpackARGBAvx2(input, &r, &g, &b);
+  *v_sum = _mm256_add_epi16(*v_sum, ChromaTermsAvx2(r, g, b, 112, -94, -18));
+  *u_sum = _mm256_add_epi16(*u_sum, ChromaTermsAvx2(r, g, b, -38, -74, 112));
+  return LuminanceAvx2(r, g, b);
+}
+
+TARGET_AVX2 static inline void ConvertARGB32ColumnsAvx2(
+    const uint32_t* const input0, const uint32_t* const input1,
+    uint8_t* const y0, uint8_t* const y1, uint8_t* const uv) {
+  __m256i v_sums[2];
+  __m256i u_sums[2];
+  __m256i luma0[2];
+  __m256i luma1[2];
+  for (int half = 0; half < 2; ++half) {
+    v_sums[half] = _mm256_setzero_si256();
+    u_sums[half] = _mm256_setzero_si256();
+    luma0[half] = ConvertARGB16PixelsAvx2(input0 + 16 * half, &v_sums[half],
+                                          &u_sums[half]);
+    luma1[half] = ConvertARGB16PixelsAvx2(input1 + 16 * half, &v_sums[half],
+                                          &u_sums[half]);
+  }
+
+  _mm256_storeu_si256(
+      reinterpret_cast<__m256i*>(y0),
+      _mm256_permute4x64_epi64(_mm256_packus_epi16(luma0[0], luma0[1]), 0xD8));
+  _mm256_storeu_si256(
+      reinterpret_cast<__m256i*>(y1),
+      _mm256_permute4x64_epi64(_mm256_packus_epi16(luma1[0], luma1[1]), 0xD8));
+
+  const __m256i v = _mm256_permute4x64_epi64(
+      _mm256_hadd_epi16(v_sums[0], v_sums[1]), 0xD8);
+  const __m256i u = _mm256_permute4x64_epi64(
+      _mm256_hadd_epi16(u_sums[0], u_sums[1]), 0xD8);
+
+  // Unpacking and packing both stay within 128 bit lanes, so these two
+  // cancel out and the blocks come out in order.
+#ifdef __APPLE__
+  const __m256i chroma = _mm256_packus_epi16(_mm256_unpacklo_epi16(u, v),
+                                             _mm256_unpackhi_epi16(u, v));
+#else
+  const __m256i chroma = _mm256_packus_epi16(_mm256_unpacklo_epi16(v, u),
+                                             _mm256_unpackhi_epi16(v, u));
+#endif
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(uv), chroma);
+}
+
+TARGET_AVX2 int ConvertARGBRowPairToYUVAvx2(const uint32_t* const input0,
+                                            const uint32_t* const input1,
+                                            uint8_t* const y0,
+                                            uint8_t* const y1,
+                                            uint8_t* const uv,
+                                            const int width) {
+  int x = 0;
+  for (; x <= width - 32; x += 32) {
+    ConvertARGB32ColumnsAvx2(input0 + x, input1 + x, y0 + x, y1 + x, uv + x);
+  }
+  return x + ConvertARGBRowPairToYUVSse41(input0 + x, input1 + x, y0 + x,
+                                          y1 + x, uv + x, width - x);
+}
+
+#endif  // IMAGEUTILS_X86_SIMD
@@ -23,16 +23,25 @@ limitations under the License.
 #include <android/log.h>
 #include <sstream>
 
+#include <atomic>
+
 #include "rgb2yuv.h"
 #include "yuv2rgb.h"
 
 #define IMAGEUTILS_METHOD(METHOD_NAME) \
     Java_com_google_ftcresearch_tfod_util_ImageUtils_##METHOD_NAME // NOLINT
 
+// Number of threads each conversion below may split its rows across.
+static std::atomic<int> num_conversion_threads(1);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+JNIEXPORT void JNICALL
+IMAGEUTILS_METHOD(setNumConversionThreads)(
+    JNIEnv* env, jclass clazz, jint numThreads);
+
 // Converting YUV to ARGB with Arrays
 JNIEXPORT void JNICALL
 IMAGEUTILS_METHOD(convertYUV420SPToARGB8888)(
@@ -58,10 +67,25 @@ IMAGEUTILS_METHOD(argb8888ToYuv420sp)(
     jobject outputBuffer, jbyteArray outputArray, jboolean isOutputDirect,
     jint width, jint height);
 
+// Converting a crop of YUV straight to an RGB model input tensor
+JNIEXPORT void JNICALL
+IMAGEUTILS_METHOD(yuv420spToRgbTensor)(
+    JNIEnv* env, jclass clazz, jobject inputBuffer, jbyteArray inputArray, jboolean isInputDirect,
+    jint width, jint height, jboolean uvFlipped,
+    jint cropLeft, jint cropTop, jint cropWidth, jint cropHeight,
+    jint outputWidth, jint outputHeight, jboolean floatOutput, jfloat mean, jfloat std,
+    jobject outputBuffer);
+
 #ifdef __cplusplus
 }
 #endif
 
+JNIEXPORT void JNICALL
+IMAGEUTILS_METHOD(setNumConversionThreads)(
+    JNIEnv* env, jclass clazz, jint numThreads) {
+  num_conversion_threads.store(numThreads > 1 ? numThreads : 1);
+}
+
 JNIEXPORT void JNICALL
 IMAGEUTILS_METHOD(convertYUV420SPToARGB8888)(
     JNIEnv* env, jclass clazz, jbyteArray input, jintArray output,
@@ -72,9 +96,10 @@ IMAGEUTILS_METHOD(convertYUV420SPToARGB8888)(
   jboolean outputCopy = JNI_FALSE;
   jint* const o = env->GetIntArrayElements(output, &outputCopy);
 
-  ConvertYUV420SPToARGB8888(reinterpret_cast<uint8_t*>(i),
-                            reinterpret_cast<uint8_t*>(i) + width * height,
-                            reinterpret_cast<uint32_t*>(o), width, height, uvFlipped);
+  ConvertYUV420SPToARGB8888Parallel(reinterpret_cast<uint8_t*>(i),
+                                    reinterpret_cast<uint8_t*>(i) + width * height,
+                                    reinterpret_cast<uint32_t*>(o), width, height, uvFlipped,
+                                    num_conversion_threads.load());
 
   env->ReleaseByteArrayElements(input, i, JNI_ABORT);
   env->ReleaseIntArrayElements(output, o, 0);
@@ -90,8 +115,9 @@ IMAGEUTILS_METHOD(convertARGB8888ToYUV420SP)(
   jboolean outputCopy = JNI_FALSE;
   jbyte* const o = env->GetByteArrayElements(output, &outputCopy);
 
-  ConvertARGB8888ToYUV420SP(reinterpret_cast<uint32_t*>(i),
-                            reinterpret_cast<uint8_t*>(o), width, height);
+  ConvertARGB8888ToYUV420SPParallel(reinterpret_cast<uint32_t*>(i),
+                                    reinterpret_cast<uint8_t*>(o), width, height,
+                                    num_conversion_threads.load());
 
   env->ReleaseIntArrayElements(input, i, JNI_ABORT);
   env->ReleaseByteArrayElements(output, o, 0);
@@ -126,7 +152,8 @@ IMAGEUTILS_METHOD(yuv420spToArgb8888)(
   }
 
   // Actually perform the conversion with one line ...
-  ConvertYUV420SPToARGB8888(input, input + width * height, output, width, height, uvFlipped);
+  ConvertYUV420SPToARGB8888Parallel(input, input + width * height, output, width, height,
+                                    uvFlipped, num_conversion_threads.load());
 
   // Clean up after ourselves, releasing input and output arrays if we actually got them.
   if (!(bool) isInputDirect) {
@@ -167,7 +194,8 @@ IMAGEUTILS_METHOD(argb8888ToYuv420sp)(
   }
 
   // Actually perform the conversion with one line ...
-  ConvertARGB8888ToYUV420SP(input, output, width, height);
+  ConvertARGB8888ToYUV420SPParallel(input, output, width, height,
+                                    num_conversion_threads.load());
 
   // Clean up after ourselves, releasing input and output arrays if we actually got them.
   if (!(bool) isInputDirect) {
@@ -179,3 +207,38 @@ IMAGEUTILS_METHOD(argb8888ToYuv420sp)(
   }
 }
 
+
+JNIEXPORT void JNICALL
+IMAGEUTILS_METHOD(yuv420spToRgbTensor)(
+    JNIEnv* env, jclass clazz, jobject inputBuffer, jbyteArray inputArray, jboolean isInputDirect,
+    jint width, jint height, jboolean uvFlipped,
+    jint cropLeft, jint cropTop, jint cropWidth, jint cropHeight,
+    jint outputWidth, jint outputHeight, jboolean floatOutput, jfloat mean, jfloat std,
+    jobject outputBuffer) {
+
+  // Assign the input pointer depending on whether the ByteBuffer is direct or not.
+  uint8_t* input;
+  if ((bool) isInputDirect) {
+    void* i = env->GetDirectBufferAddress(inputBuffer); // Trusting that this won't be null.
+    input = reinterpret_cast<uint8_t*>(i);
+  } else {
+    jboolean inputCopy = JNI_FALSE;
+    jbyte* i = env->GetByteArrayElements(inputArray, &inputCopy);
+    input = reinterpret_cast<uint8_t*>(i);
+  }
+
+  // The output is the interpreter's input buffer, which is always direct.
+  void* output = env->GetDirectBufferAddress(outputBuffer);
+
+  // The Java wrapper has already checked the crop, so this only fails if it is
+  // bypassed, in which case the output is left as it was.
+  ConvertYUV420SPToRGBTensor(input, input + width * height, width, height, uvFlipped,
+                             cropLeft, cropTop, cropWidth, cropHeight,
+                             outputWidth, outputHeight,
+                             (bool) floatOutput ? RGB_TENSOR_FLOAT : RGB_TENSOR_UINT8,
+                             mean, std, output, num_conversion_threads.load());
+
+  if (!(bool) isInputDirect) {
+    env->ReleaseByteArrayElements(inputArray, reinterpret_cast<jbyte*>(input), JNI_ABORT);
+  }
+}
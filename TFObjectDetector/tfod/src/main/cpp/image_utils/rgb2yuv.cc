@@ -17,6 +17,9 @@ limitations under the License.
 
 #include "rgb2yuv.h"
 
+#include "convert_kernels.h"
+#include "simd_level.h"
+
 static inline void WriteYUV(const int x, const int y, const int width,
                             const int r8, const int g8, const int b8,
                             uint8_t* const pY, uint8_t* const pUV) {
@@ -50,25 +53,90 @@ static inline void WriteYUV(const int x, const int y, const int width,
   pUV[offset + u_offset] += ((-38 * r8 - 74 * g8 + 112 * b8 + 128) >> 10) + 32;
 }
 
-void ConvertARGB8888ToYUV420SP(const uint32_t* const input,
-                               uint8_t* const output, int width, int height) {
-  uint8_t* pY = output;
-  uint8_t* pUV = output + (width * height);
-  const uint32_t* in = input;
-
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      const uint32_t rgb = *in++;
+static inline void WriteYUVPixel(const int x, const int y, const int width,
+                                 const uint32_t rgb, uint8_t* const pY,
+                                 uint8_t* const pUV) {
 #ifdef __APPLE__
-      const int nB = (rgb >> 8) & 0xFF;
-      const int nG = (rgb >> 16) & 0xFF;
-      const int nR = (rgb >> 24) & 0xFF;
+  const int nB = (rgb >> 8) & 0xFF;
+  const int nG = (rgb >> 16) & 0xFF;
+  const int nR = (rgb >> 24) & 0xFF;
 #else
-      const int nR = (rgb >> 16) & 0xFF;
-      const int nG = (rgb >> 8) & 0xFF;
-      const int nB = rgb & 0xFF;
+  const int nR = (rgb >> 16) & 0xFF;
+  const int nG = (rgb >> 8) & 0xFF;
+  const int nB = rgb & 0xFF;
+#endif
+  WriteYUV(x, y, width, nR, nG, nB, pY, pUV);
+}
+
+static int ConvertRowPairSimd(const SimdLevel level,
+                              const uint32_t* const in0,
+                              const uint32_t* const in1, uint8_t* const pY0,
+                              uint8_t* const pY1, uint8_t* const pUV,
+                              const int width) {
+  switch (level) {
+#ifdef IMAGEUTILS_NEON
+    case SIMD_LEVEL_NEON:
+      return ConvertARGBRowPairToYUVNeon(in0, in1, pY0, pY1, pUV, width);
+#endif
+#ifdef IMAGEUTILS_X86_SIMD
+    case SIMD_LEVEL_AVX2:
+      return ConvertARGBRowPairToYUVAvx2(in0, in1, pY0, pY1, pUV, width);
+    case SIMD_LEVEL_SSE41:
+      return ConvertARGBRowPairToYUVSse41(in0, in1, pY0, pY1, pUV, width);
 #endif
-      WriteYUV(x, y, width, nR, nG, nB, pY++, pUV);
+    default:
+      return 0;
+  }
+}
+
+// Converts rows [first_row, end_row), where first_row is even.
+static void ConvertRows(const uint32_t* const input, uint8_t* const output,
+                        const int width, const int height,
+                        const int first_row, const int end_row) {
+  uint8_t* const pY = output;
+  uint8_t* const pUV = output + (width * height);
+  const int blocks_per_row = (width + 1) / 2;
+  const SimdLevel level = GetSimdLevel();
+
+  int y = first_row;
+  for (; y + 1 < end_row; y += 2) {
+    const uint32_t* const in0 = input + y * width;
+    const uint32_t* const in1 = in0 + width;
+    uint8_t* const pY0 = pY + y * width;
+    uint8_t* const pY1 = pY0 + width;
+
+    // The kernels fill whole chroma blocks, so the scalar code picks up at
+    // the start of a block and clears it as usual.
+    const int num_done =
+        ConvertRowPairSimd(level, in0, in1, pY0, pY1,
+                           pUV + 2 * (y / 2) * blocks_per_row, width);
+    for (int x = num_done; x < width; x++) {
+      WriteYUVPixel(x, y, width, in0[x], pY0 + x, pUV);
+    }
+    for (int x = num_done; x < width; x++) {
+      WriteYUVPixel(x, y + 1, width, in1[x], pY1 + x, pUV);
     }
   }
-}
\ No newline at end of file
+
+  // Odd heights leave a last row with no partner.
+  if (y < end_row) {
+    const uint32_t* const in = input + y * width;
+    for (int x = 0; x < width; x++) {
+      WriteYUVPixel(x, y, width, in[x], pY + y * width + x, pUV);
+    }
+  }
+}
+
+void ConvertARGB8888ToYUV420SP(const uint32_t* const input,
+                               uint8_t* const output, int width, int height) {
+  ConvertARGB8888ToYUV420SPParallel(input, output, width, height, 1);
+}
+
+void ConvertARGB8888ToYUV420SPParallel(const uint32_t* const input,
+                                       uint8_t* const output, int width,
+                                       int height, const int num_threads) {
+  ForEachRowBand(height, num_threads,
+                 [=](const int first_row, const int end_row) {
+    ConvertRows(input, output, width, height, first_row, end_row);
+  });
+}
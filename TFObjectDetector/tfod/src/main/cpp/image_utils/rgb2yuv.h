@@ -25,6 +25,12 @@ extern "C" {
 void ConvertARGB8888ToYUV420SP(const uint32_t* const input,
                                uint8_t* const output, int width, int height);
 
+// As above, but converts bands of rows on up to num_threads threads at once,
+// including the calling one. The output is identical for any thread count.
+void ConvertARGB8888ToYUV420SPParallel(const uint32_t* const input,
+                                       uint8_t* const output, int width,
+                                       int height, const int num_threads);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,56 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "simd_level.h"
+
+#include <atomic>
+
+static SimdLevel DetectSimdLevel() {
+#if defined(IMAGEUTILS_NEON)
+  return SIMD_LEVEL_NEON;
+#elif defined(IMAGEUTILS_X86_SIMD)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_LEVEL_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return SIMD_LEVEL_SSE41;
+  }
+  return SIMD_LEVEL_NONE;
+#else
+  return SIMD_LEVEL_NONE;
+#endif
+}
+
+static std::atomic<int> max_simd_level(SIMD_LEVEL_AVX2);
+
+// The next best level on the same architecture.
+static SimdLevel GetFallbackLevel(const SimdLevel level) {
+  return level == SIMD_LEVEL_AVX2 ? SIMD_LEVEL_SSE41 : SIMD_LEVEL_NONE;
+}
+
+SimdLevel GetSimdLevel() {
+  static const SimdLevel detected_level = DetectSimdLevel();
+  const int max_level = max_simd_level.load(std::memory_order_relaxed);
+  SimdLevel level = detected_level;
+  while (level > max_level) {
+    level = GetFallbackLevel(level);
+  }
+  return level;
+}
+
+void SetMaxSimdLevel(const SimdLevel level) {
+  max_simd_level.store(level, std::memory_order_relaxed);
+}
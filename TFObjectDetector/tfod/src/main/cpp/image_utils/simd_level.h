@@ -0,0 +1,52 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Selects which vector instruction set the image conversion routines use.
+
+#ifndef ORG_TENSORFLOW_JNI_IMAGEUTILS_SIMD_LEVEL_H_
+#define ORG_TENSORFLOW_JNI_IMAGEUTILS_SIMD_LEVEL_H_
+
+#if defined(__ARM_NEON)
+#define IMAGEUTILS_NEON
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define IMAGEUTILS_X86_SIMD
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Vector instruction sets the converters have kernels for. Only the ones for
+// the target architecture are ever returned by GetSimdLevel().
+typedef enum {
+  SIMD_LEVEL_NONE = 0,
+  SIMD_LEVEL_NEON = 1,
+  SIMD_LEVEL_SSE41 = 2,
+  SIMD_LEVEL_AVX2 = 3,
+} SimdLevel;
+
+// Returns the best instruction set that is both supported by the CPU and
+// allowed by SetMaxSimdLevel().
+SimdLevel GetSimdLevel();
+
+// Caps the instruction set the converters may use, e.g. to compare kernels
+// against each other or against SIMD_LEVEL_NONE, the plain C versions.
+void SetMaxSimdLevel(const SimdLevel level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ORG_TENSORFLOW_JNI_IMAGEUTILS_SIMD_LEVEL_H_
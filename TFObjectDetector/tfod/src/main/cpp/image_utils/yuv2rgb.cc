@@ -18,6 +18,11 @@ limitations under the License.
 
 #include "yuv2rgb.h"
 
+#include <vector>
+
+#include "convert_kernels.h"
+#include "simd_level.h"
+
 #ifndef MAX
 #define MAX(a, b) ({__typeof__(a) _a = (a); __typeof__(b) _b = (b); _a > _b ? _a : _b; })
 #define MIN(a, b) ({__typeof__(a) _a = (a); __typeof__(b) _b = (b); _a < _b ? _a : _b; })
@@ -54,6 +59,59 @@ static inline uint32_t YUV2RGB(int nY, int nU, int nV) {
   return 0xff000000 | (nR << 16) | (nG << 8) | nB;
 }
 
+// Converts the pixels of one row from first_x onwards. Which of each pair of
+// chroma bytes is U is fixed per call, so it is a template parameter rather
+// than a per-pixel branch.
+template <bool kUFirst>
+static inline void ConvertRowScalar(const uint8_t* const pY,
+                                    const uint8_t* const pUV,
+                                    uint32_t* const out, const int first_x,
+                                    const int width) {
+  for (int x = first_x; x < width; x++) {
+    const uint8_t* const uv = pUV + 2 * (x >> 1);
+    if (kUFirst) {
+      out[x] = YUV2RGB(pY[x], uv[0], uv[1]);
+    } else {
+      out[x] = YUV2RGB(pY[x], uv[1], uv[0]);
+    }
+  }
+}
+
+static int ConvertRowSimd(const SimdLevel level, const uint8_t* const pY,
+                          const uint8_t* const pUV, uint32_t* const out,
+                          const int width, const bool u_first) {
+  switch (level) {
+#ifdef IMAGEUTILS_NEON
+    case SIMD_LEVEL_NEON:
+      return ConvertYUVRowToARGBNeon(pY, pUV, out, width, u_first);
+#endif
+#ifdef IMAGEUTILS_X86_SIMD
+    case SIMD_LEVEL_AVX2:
+      return ConvertYUVRowToARGBAvx2(pY, pUV, out, width, u_first);
+    case SIMD_LEVEL_SSE41:
+      return ConvertYUVRowToARGBSse41(pY, pUV, out, width, u_first);
+#endif
+    default:
+      return 0;
+  }
+}
+
+template <bool kUFirst>
+static void ConvertRows(const uint8_t* const yData,
+                        const uint8_t* const uvData, uint32_t* const output,
+                        const int width, const int first_row,
+                        const int end_row) {
+  const SimdLevel level = GetSimdLevel();
+  for (int y = first_row; y < end_row; y++) {
+    const uint8_t* const pY = yData + y * width;
+    const uint8_t* const pUV = uvData + (y >> 1) * width;
+    uint32_t* const out = output + y * width;
+
+    const int num_done = ConvertRowSimd(level, pY, pUV, out, width, kUFirst);
+    ConvertRowScalar<kUFirst>(pY, pUV, out, num_done, width);
+  }
+}
+
 //  Accepts a YUV 4:2:0 image with a plane of 8 bit Y samples followed by an
 //  interleaved U/V plane containing 8 bit 2x2 subsampled chroma samples,
 //  except the interleave order of U and V is reversed. Converts to a packed
@@ -62,28 +120,140 @@ void ConvertYUV420SPToARGB8888(const uint8_t* const yData,
                                const uint8_t* const uvData,
                                uint32_t* const output, const int width,
                                const int height, const bool uv_flipped) {
-  const uint8_t* pY = yData;
-  const uint8_t* pUV = uvData;
-  uint32_t* out = output;
-
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      int nY = *pY++;
-      int offset = (y >> 1) * width + 2 * (x >> 1);
+  ConvertYUV420SPToARGB8888Parallel(yData, uvData, output, width, height,
+                                    uv_flipped, 1);
+}
+
+void ConvertYUV420SPToARGB8888Parallel(const uint8_t* const yData,
+                                       const uint8_t* const uvData,
+                                       uint32_t* const output, const int width,
+                                       const int height, const bool uv_flipped,
+                                       const int num_threads) {
 #ifdef __APPLE__
-      int nU = pUV[offset];
-      int nV = pUV[offset + 1];
+  const bool u_first = !uv_flipped;
 #else
-      int nV = pUV[offset];
-      int nU = pUV[offset + 1];
+  // U and V channels flipped from where they're supposed to be just means U
+  // comes first.
+  const bool u_first = uv_flipped;
 #endif
 
-      if (uv_flipped) { // U and V channels are flipped from where they're supposed to be.
-        // Flip arguments rather than explicitly swapping.
-        *out++ = YUV2RGB(nY, nV, nU);
+  ForEachRowBand(height, num_threads,
+                 [=](const int first_row, const int end_row) {
+    if (u_first) {
+      ConvertRows<true>(yData, uvData, output, width, first_row, end_row);
+    } else {
+      ConvertRows<false>(yData, uvData, output, width, first_row, end_row);
+    }
+  });
+}
+
+// Maps index i of count evenly spaced samples onto the nearest of length
+// source pixels starting at first, sampling at pixel centers.
+static inline int NearestSourceIndex(const int i, const int count,
+                                     const int first, const int length) {
+  return first + static_cast<int>((2 * static_cast<int64_t>(i) + 1) * length /
+                                  (2 * static_cast<int64_t>(count)));
+}
+
+template <bool kUFirst, RGBTensorFormat kFormat>
+static void ConvertTensorRows(const uint8_t* const yData,
+                              const uint8_t* const uvData, const int width,
+                              const int crop_top, const int crop_height,
+                              const int* const source_x, const int output_width,
+                              const int output_height,
+                              const float* const normalized, void* const output,
+                              const int first_row, const int end_row) {
+  for (int out_y = first_row; out_y < end_row; out_y++) {
+    const int y = NearestSourceIndex(out_y, output_height, crop_top,
+                                     crop_height);
+    const uint8_t* const pY = yData + y * width;
+    const uint8_t* const pUV = uvData + (y >> 1) * width;
+    const int out_offset = out_y * output_width * 3;
+
+    for (int out_x = 0; out_x < output_width; out_x++) {
+      const int x = source_x[out_x];
+      const uint8_t* const uv = pUV + 2 * (x >> 1);
+      const uint32_t argb = kUFirst ? YUV2RGB(pY[x], uv[0], uv[1])
+                                    : YUV2RGB(pY[x], uv[1], uv[0]);
+      const int nR = (argb >> 16) & 0xff;
+      const int nG = (argb >> 8) & 0xff;
+      const int nB = argb & 0xff;
+
+      if (kFormat == RGB_TENSOR_UINT8) {
+        uint8_t* const out =
+            static_cast<uint8_t*>(output) + out_offset + 3 * out_x;
+        out[0] = nR;
+        out[1] = nG;
+        out[2] = nB;
       } else {
-        *out++ = YUV2RGB(nY, nU, nV); // The standardized way.
+        float* const out =
+            static_cast<float*>(output) + out_offset + 3 * out_x;
+        out[0] = normalized[nR];
+        out[1] = normalized[nG];
+        out[2] = normalized[nB];
       }
     }
   }
 }
+
+bool ConvertYUV420SPToRGBTensor(const uint8_t* const yData,
+                                const uint8_t* const uvData, const int width,
+                                const int height, const bool uv_flipped,
+                                const int crop_left, const int crop_top,
+                                const int crop_width, const int crop_height,
+                                const int output_width, const int output_height,
+                                const RGBTensorFormat format, const float mean,
+                                const float stddev, void* const output,
+                                const int num_threads) {
+  if (crop_left < 0 || crop_top < 0 || crop_width <= 0 || crop_height <= 0 ||
+      crop_left + crop_width > width || crop_top + crop_height > height ||
+      output_width <= 0 || output_height <= 0) {
+    return false;
+  }
+
+#ifdef __APPLE__
+  const bool u_first = !uv_flipped;
+#else
+  const bool u_first = uv_flipped;
+#endif
+
+  // Every output row samples the same columns.
+  std::vector<int> source_x(output_width);
+  for (int out_x = 0; out_x < output_width; out_x++) {
+    source_x[out_x] =
+        NearestSourceIndex(out_x, output_width, crop_left, crop_width);
+  }
+
+  // Only 256 distinct values can come out of normalization, computed the
+  // same way as value by value.
+  float normalized[256];
+  if (format == RGB_TENSOR_FLOAT) {
+    for (int value = 0; value < 256; value++) {
+      normalized[value] = (static_cast<float>(value) - mean) / stddev;
+    }
+  }
+
+  const int* const columns = source_x.data();
+  const float* const values = normalized;
+  ForEachRowBand(output_height, num_threads,
+                 [=](const int first_row, const int end_row) {
+    if (u_first && format == RGB_TENSOR_UINT8) {
+      ConvertTensorRows<true, RGB_TENSOR_UINT8>(
+          yData, uvData, width, crop_top, crop_height, columns, output_width,
+          output_height, values, output, first_row, end_row);
+    } else if (u_first) {
+      ConvertTensorRows<true, RGB_TENSOR_FLOAT>(
+          yData, uvData, width, crop_top, crop_height, columns, output_width,
+          output_height, values, output, first_row, end_row);
+    } else if (format == RGB_TENSOR_UINT8) {
+      ConvertTensorRows<false, RGB_TENSOR_UINT8>(
+          yData, uvData, width, crop_top, crop_height, columns, output_width,
+          output_height, values, output, first_row, end_row);
+    } else {
+      ConvertTensorRows<false, RGB_TENSOR_FLOAT>(
+          yData, uvData, width, crop_top, crop_height, columns, output_width,
+          output_height, values, output, first_row, end_row);
+    }
+  });
+  return true;
+}
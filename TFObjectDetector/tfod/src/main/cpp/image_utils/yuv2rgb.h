@@ -32,6 +32,41 @@ void ConvertYUV420SPToARGB8888(const uint8_t* const pY,
                                const uint8_t* const pUV, uint32_t* const output,
                                const int width, const int height, const bool uv_flipped);
 
+// As above, but converts bands of rows on up to num_threads threads at once,
+// including the calling one. The output is identical for any thread count.
+void ConvertYUV420SPToARGB8888Parallel(const uint8_t* const pY,
+                                       const uint8_t* const pUV,
+                                       uint32_t* const output, const int width,
+                                       const int height, const bool uv_flipped,
+                                       const int num_threads);
+
+// Element layouts ConvertYUV420SPToRGBTensor can write. Both are NHWC with
+// channels in R, G, B order.
+typedef enum {
+  // One byte per channel, as is.
+  RGB_TENSOR_UINT8 = 0,
+  // One float per channel, normalized to (value - mean) / stddev.
+  RGB_TENSOR_FLOAT = 1,
+} RGBTensorFormat;
+
+// Converts the crop_width x crop_height rectangle at (crop_left, crop_top) of
+// a width x height YUV420SP image straight to an output_width x output_height
+// RGB tensor, such as a model's input buffer, in one pass. Each output pixel
+// takes the nearest source pixel, as an unfiltered Bitmap.createScaledBitmap
+// does, and converts it exactly as ConvertYUV420SPToARGB8888 would. mean and
+// stddev are only used for RGB_TENSOR_FLOAT. Returns false, writing nothing,
+// if the crop is empty or does not lie within the image, or the output is
+// empty; the planes and output are otherwise not checked.
+bool ConvertYUV420SPToRGBTensor(const uint8_t* const pY,
+                                const uint8_t* const pUV, const int width,
+                                const int height, const bool uv_flipped,
+                                const int crop_left, const int crop_top,
+                                const int crop_width, const int crop_height,
+                                const int output_width, const int output_height,
+                                const RGBTensorFormat format, const float mean,
+                                const float stddev, void* const output,
+                                const int num_threads);
+
 #ifdef __cplusplus
 }
 #endif
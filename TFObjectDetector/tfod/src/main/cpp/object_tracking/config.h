@@ -68,9 +68,6 @@ static const int kRandomNumberSeed = 11111;
 // TODO(andrewharp): Move as many of these settings as possible into a settings
 // object which can be passed in from Java at runtime.
 
-// Whether or not to use ESM instead of LK flow.
-static const bool kUseEsm = false;
-
 // This constant gets added to the diagonal of the Hessian
 // before solving for translation in 2dof ESM.
 // It ensures better behavior especially in the absence of
@@ -88,10 +85,12 @@ static const bool kDoBrightnessNormalize = true;
 // This is a define for now because it helps keep the code streamlined.
 #define NORMALIZE 1
 
-// Number of keypoints to store per frame.
+// Default number of keypoints to store per frame. See
+// KeypointDetectorConfig::max_keypoints.
 static const int kMaxKeypoints = 76;
 
-// Keypoint detection.
+// Default number of candidate keypoints to consider per frame during keypoint
+// detection. See KeypointDetectorConfig::max_candidate_keypoints.
 static const int kMaxTempKeypoints = 1024;
 
 // Number of floats each keypoint takes up when exporting to an array.
@@ -100,7 +99,8 @@ static const int kKeypointStep = 7;
 // Number of frame deltas to keep around in the circular queue.
 static const int kNumFrames = 512;
 
-// Number of iterations to do tracking on each keypoint at each pyramid level.
+// Default most iterations to do tracking on each keypoint at each pyramid
+// level. See OpticalFlowConfig::max_iterations.
 static const int kNumIterations = 3;
 
 // The number of bins (on a side) to divide each bin from the previous
@@ -120,9 +120,32 @@ static const int kNumCacheLevels = 3;
 // transform if such a matrix has been provided to the cache.
 static const int kCacheCutoff = 1;
 
+// Global motion estimation, see MotionEstimator.
+// Number of random three point samples tried when fitting an affine motion.
+static const int kNumMotionHypotheses = 64;
+
+// Distance in pixels within which a correspondence agrees with a motion.
+static const float kMotionInlierThreshold = 1.5f;
+
+// Number of reweighted least squares passes refining the best hypothesis.
+static const int kNumMotionRefinementIterations = 3;
+
+// Least number and fraction of found correspondences that must agree with a
+// motion for it to be trusted.
+static const int kMinMotionInliers = 8;
+static const float kMinMotionInlierFraction = 0.5f;
+
+// Furthest the linear part of a trusted motion may be from the identity.
+static const float kMaxMotionDeformation = 0.2f;
+
+// Longest frame interval, relative to that of the last frame pair, over which
+// its motion is extrapolated to predict the next frame's.
+static const float kMaxMotionExtrapolation = 2.0f;
+
 static const int kNumPyramidLevels = 4;
 
-// The minimum number of keypoints needed in an object's area.
+// Default number of keypoints to pick in any one object's area. See
+// KeypointDetectorConfig::max_keypoints_per_object.
 static const int kMaxKeypointsForObject = 16;
 
 // Minimum number of pyramid levels to use after getting cached value.
@@ -138,7 +161,8 @@ static const int kFlowIntegrationWindowSize = 3;
 static const int kFlowArraySize =
     (2 * kFlowIntegrationWindowSize + 1) * (2 * kFlowIntegrationWindowSize + 1);
 
-// Error that's considered good enough to early abort tracking.
+// Default update, in pixels, that's considered good enough to early abort
+// tracking. See OpticalFlowConfig::convergence_threshold.
 static const float kTrackingAbortThreshold = 0.03f;
 
 // Maximum number of deviations a keypoint-correspondence delta can be from the
@@ -167,6 +191,10 @@ static const int kNumToAddAsCandidates = 1;
 // next to each other?
 static const float kClosestPercent = 0.6f;
 
+// Most cells the spatial grid used to enforce that spacing may have. Cells are
+// widened past the spacing distance for long, thin regions to stay under it.
+static const int kMaxSpacingGridCells = 256;
+
 // How many FAST qualifying pixels must be connected to a pixel for it to be
 // considered a candidate keypoint for Harris filtering.
 static const int kMinNumConnectedForFastKeypoint = 8;
@@ -267,33 +295,103 @@ struct KeypointDetectorConfig {
 
   bool detect_skin;
 
+  // Most keypoints kept per frame across all objects. Every frame pair in the
+  // tracker's history reserves room for this many correspondences.
+  int max_keypoints;
+
+  // Most keypoints picked within any one object's area.
+  int max_keypoints_per_object;
+
+  // Most candidate keypoints scored and ranked per frame before the final
+  // keypoints are picked from them.
+  int max_candidate_keypoints;
+
   explicit KeypointDetectorConfig(const Size& image_size)
       : image_size(image_size),
-        detect_skin(false) {}
+        detect_skin(false),
+        max_keypoints(kMaxKeypoints),
+        max_keypoints_per_object(kMaxKeypointsForObject),
+        max_candidate_keypoints(kMaxTempKeypoints) {}
 };
 
 
+// The solvers OpticalFlow can refine the flow of each point with.
+enum FlowSolver {
+  // Lucas-Kanade, on intensity normalized patches.
+  FLOW_SOLVER_LK = 0,
+
+  // Translational 2dof ESM, with brightness offset normalization if
+  // kDoBrightnessNormalize.
+  FLOW_SOLVER_ESM = 1
+};
+
 struct OpticalFlowConfig {
   const Size image_size;
 
+  FlowSolver solver;
+
+  // Most Gauss-Newton steps the solver takes per point and pyramid level.
+  int max_iterations;
+
+  // A point stops iterating at a level once its update is shorter than this,
+  // in pixels of that level.
+  float convergence_threshold;
+
   explicit OpticalFlowConfig(const Size& image_size)
-      : image_size(image_size) {}
+      : image_size(image_size),
+        solver(FLOW_SOLVER_LK),
+        max_iterations(kNumIterations),
+        convergence_threshold(kTrackingAbortThreshold) {}
 };
 
 struct TrackerConfig {
   const Size image_size;
+
+  // Also holds the keypoint capacities, which size the storage the tracker
+  // allocates when it is constructed. ObjectTracker::GetMemoryUsage() reports
+  // what a given choice costs.
   KeypointDetectorConfig keypoint_detector_config;
+
   OpticalFlowConfig flow_config;
   bool always_track;
 
   float object_box_scale_factor_for_features;
 
+  // Number of worker threads the tracker may use to parallelize per-frame
+  // work. 0 keeps everything on the thread calling NextFrame.
+  int num_worker_threads;
+
+  // Number of frames ObjectTracker::SubmitFrame() may have waiting to be
+  // tracked at once. Each one costs a spare ImageData, allocated on the first
+  // call to SubmitFrame().
+  int max_frames_in_flight;
+
+  // Most objects whose state is published for lock free readers at the end
+  // of each frame. See ObjectTracker::GetPublishedSnapshots().
+  int max_published_objects;
+
+  // Number of recent frames whose luminance is kept, at image_size, so that
+  // objects can be registered in the frame they were detected in. See
+  // ObjectTracker::RegisterNewObjectsInFrame(). Each costs image_size bytes.
+  int num_retained_frames;
+
+  // Whether to fit an affine motion to each frame pair's keypoint
+  // correspondences and use it, extrapolated, as the full-frame alignment of
+  // the next frame when NextFrame() is not given one. This lets the flow
+  // cache skip its coarse levels. See MotionEstimator.
+  bool estimate_global_motion;
+
   explicit TrackerConfig(const Size& image_size)
       : image_size(image_size),
         keypoint_detector_config(image_size),
         flow_config(image_size),
         always_track(false),
-        object_box_scale_factor_for_features(1.0f) {}
+        object_box_scale_factor_for_features(1.0f),
+        num_worker_threads(0),
+        max_frames_in_flight(1),
+        max_published_objects(64),
+        num_retained_frames(0),
+        estimate_global_motion(false) {}
 };
 
 }  // namespace tf_tracking
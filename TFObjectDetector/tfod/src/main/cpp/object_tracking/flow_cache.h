@@ -16,11 +16,14 @@ limitations under the License.
 #ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_FLOW_CACHE_H_
 #define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_FLOW_CACHE_H_
 
+#include <vector>
+
 #include "geom.h"
 #include "utils.h"
 
 #include "config.h"
 #include "optical_flow.h"
+#include "worker_pool.h"
 
 namespace tf_tracking {
 
@@ -110,6 +113,53 @@ class FlowCache {
     }
   }
 
+  // Batch version of FindNewPositionOfPoint for num_points points, given as
+  // separate coordinate arrays. found[i] says whether (final_x[i], final_y[i])
+  // is valid. The cache guesses for all points are resolved first, in order,
+  // so that each cache block is filled once, and each pyramid level is then
+  // refined for every point in turn. The results are identical to calling
+  // FindNewPositionOfPoint on each point in order.
+  // If a worker pool is given, the cache blocks and then the points are split
+  // across it, still with identical results.
+  // Returns the number of points found.
+  int FindNewPositionsOfPoints(const int num_points,
+                               const float* const u_x, const float* const u_y,
+                               float* const final_x, float* const final_y,
+                               bool* const found,
+                               WorkerPool* const pool = NULL) const {
+    if (pool != NULL) {
+      FillCacheInParallel(num_points, u_x, u_y, pool);
+    }
+
+    // final_x and final_y hold the flow until the very end.
+    for (int i = 0; i < num_points; ++i) {
+      const Point2f guess_from_cache = LookupGuess(u_x[i], u_y[i]);
+      final_x[i] = guess_from_cache.x;
+      final_y[i] = guess_from_cache.y;
+      found[i] = true;
+    }
+
+    if (pool == NULL) {
+      RefinePoints(0, num_points, u_x, u_y, final_x, final_y, found);
+    } else {
+      pool->ParallelFor(num_points, [&](const int begin, const int end) {
+        RefinePoints(begin, end, u_x, u_y, final_x, final_y, found);
+      });
+    }
+
+    const float max_x = static_cast<float>(image_size_.width) - 1;
+    const float max_y = static_cast<float>(image_size_.height) - 1;
+    int num_found = 0;
+    for (int i = 0; i < num_points; ++i) {
+      final_x[i] += u_x[i];
+      final_y[i] += u_y[i];
+      found[i] = found[i] &&
+          InRange(final_x[i], 0.0f, max_x) && InRange(final_y[i], 0.0f, max_y);
+      num_found += found[i] ? 1 : 0;
+    }
+    return num_found;
+  }
+
   // Comparison function for qsort.
   static int Compare(const void* a, const void* b) {
     return *reinterpret_cast<const float*>(a) -
@@ -133,30 +183,37 @@ class FlowCache {
       return Point2f(0, 0);
     }
 
-    float x_deltas[kMaxPoints];
-    float y_deltas[kMaxPoints];
+    float x_in[kMaxPoints];
+    float y_in[kMaxPoints];
 
-    int curr_offset = 0;
+    int num_points = 0;
     for (int i = 0; i < grid_width; ++i) {
       for (int j = 0; j < grid_height; ++j) {
-        const float x_in = valid_box.left_ +
+        x_in[num_points] = valid_box.left_ +
             (valid_box.GetWidth() * i) / (grid_width - 1);
 
-        const float y_in = valid_box.top_ +
+        y_in[num_points] = valid_box.top_ +
             (valid_box.GetHeight() * j) / (grid_height - 1);
+        ++num_points;
+      }
+    }
 
-        float curr_flow_x;
-        float curr_flow_y;
-        const bool success = FindNewPositionOfPoint(x_in, y_in,
-                                                    &curr_flow_x, &curr_flow_y);
-
-        if (success) {
-          x_deltas[curr_offset] = curr_flow_x;
-          y_deltas[curr_offset] = curr_flow_y;
-          ++curr_offset;
-        } else {
-          LOGW("Tracking failure!");
-        }
+    float x_out[kMaxPoints];
+    float y_out[kMaxPoints];
+    bool success[kMaxPoints];
+    FindNewPositionsOfPoints(num_points, x_in, y_in, x_out, y_out, success);
+
+    float x_deltas[kMaxPoints];
+    float y_deltas[kMaxPoints];
+
+    int curr_offset = 0;
+    for (int i = 0; i < num_points; ++i) {
+      if (success[i]) {
+        x_deltas[curr_offset] = x_out[i];
+        y_deltas[curr_offset] = y_out[i];
+        ++curr_offset;
+      } else {
+        LOGW("Tracking failure!");
       }
     }
 
@@ -171,6 +228,11 @@ class FlowCache {
     return Point2f(0, 0);
   }
 
+  // The work the optical flow solvers have done for this cache.
+  inline FlowSolverStats GetSolverStats() const {
+    return optical_flow_.GetSolverStats();
+  }
+
   void SetFullframeAlignmentMatrix(const float* const align_matrix23) {
     if (align_matrix23 != NULL) {
       if (fullframe_matrix_ == NULL) {
@@ -183,6 +245,137 @@ class FlowCache {
   }
 
  private:
+  // A cache block to be filled, and the point whose lookup first needed it.
+  struct CacheFill {
+    int index_x;
+    int index_y;
+    float x;
+    float y;
+  };
+
+  // Refines the flow guesses of points [begin, end) over the uncached
+  // pyramid levels.
+  void RefinePoints(const int begin, const int end,
+                    const float* const u_x, const float* const u_y,
+                    float* const flow_x, float* const flow_y,
+                    bool* const success) const {
+    for (int pyramid_level = kMinNumPyramidLevelsToUseForAdjustment - 1;
+        pyramid_level >= 0; --pyramid_level) {
+      optical_flow_.FindFlowAtPointsSingleLevel(
+          pyramid_level, end - begin, u_x + begin, u_y + begin, false,
+          flow_x + begin, flow_y + begin, success + begin);
+    }
+  }
+
+  // Fills every cache block that looking up the given points in order would,
+  // with the same values, spreading the work across the pool.
+  // A block's value depends on the point that first needed it, since that
+  // point's guess from the level below seeds the block's flow. So the blocks
+  // are claimed serially in lookup order first, which is cheap, and then
+  // computed one level at a time from the coarsest, as each block only
+  // depends on the level below it.
+  void FillCacheInParallel(const int num_points,
+                           const float* const u_x, const float* const u_y,
+                           WorkerPool* const pool) const {
+    std::vector<CacheFill> fills[kNumCacheLevels];
+    for (int i = 0; i < num_points; ++i) {
+      const float x = u_x[i];
+      const float y = u_y[i];
+      if (!InImage(x, y)) {
+        continue;
+      }
+
+      for (int cache_level = 0; cache_level < kNumCacheLevels; ++cache_level) {
+        if (fullframe_matrix_ != NULL && cache_level == kCacheCutoff) {
+          break;
+        }
+
+        CacheFill fill;
+        GetCacheBlock(cache_level, x, y, &fill.index_x, &fill.index_y);
+        bool* const has_cache =
+            &(*has_cache_[cache_level])[fill.index_y][fill.index_x];
+        if (*has_cache) {
+          break;
+        }
+        *has_cache = true;
+
+        fill.x = x;
+        fill.y = y;
+        fills[cache_level].push_back(fill);
+      }
+    }
+
+    // From here on, flow computation must not lazily create images.
+    optical_flow_.ComputeLevelImages();
+
+    for (int cache_level = kNumCacheLevels - 1; cache_level >= 0;
+         --cache_level) {
+      const std::vector<CacheFill>& level_fills = fills[cache_level];
+      pool->ParallelFor(static_cast<int>(level_fills.size()),
+                        [this, cache_level, &level_fills](const int begin,
+                                                          const int end) {
+        for (int i = begin; i < end; ++i) {
+          const CacheFill& fill = level_fills[i];
+          ComputeCacheBlock(cache_level, fill.index_x, fill.index_y,
+                            fill.x, fill.y);
+        }
+      });
+    }
+  }
+
+  // Finds the block of the given cache level that (x, y) falls in.
+  void GetCacheBlock(const int cache_level, const float x, const float y,
+                     int* const index_x, int* const index_y) const {
+    const int level_dim = BlockDimForCacheLevel(cache_level);
+    const int pixels_per_cache_block_x =
+        (image_size_.width + level_dim - 1) / level_dim;
+    const int pixels_per_cache_block_y =
+        (image_size_.height + level_dim - 1) / level_dim;
+    *index_x = x / pixels_per_cache_block_x;
+    *index_y = y / pixels_per_cache_block_y;
+  }
+
+  // Computes, stores and returns the displacement of a cache block, seeding
+  // it with the guess for (x, y) from the level below.
+  Point2f ComputeCacheBlock(const int cache_level,
+                            const int index_x, const int index_y,
+                            const float x, const float y) const {
+    // Get the lower cache level's best guess, if it exists.
+    Point2f displacement = cache_level >= kNumCacheLevels - 1 ?
+        Point2f(0, 0) : LookupGuessFromLevel(cache_level + 1, x, y);
+    // LOGI("Best guess at cache level %d is %5.2f, %5.2f.", cache_level,
+    //      best_guess.x, best_guess.y);
+
+    // Find the center of the block.
+    const int level_dim = BlockDimForCacheLevel(cache_level);
+    const int pixels_per_cache_block_x =
+        (image_size_.width + level_dim - 1) / level_dim;
+    const int pixels_per_cache_block_y =
+        (image_size_.height + level_dim - 1) / level_dim;
+    const float center_x = (index_x + 0.5f) * pixels_per_cache_block_x;
+    const float center_y = (index_y + 0.5f) * pixels_per_cache_block_y;
+    const int pyramid_level = PyramidLevelForCacheLevel(cache_level);
+
+    // LOGI("cache level %d: [%d, %d (%5.2f / %d, %5.2f / %d)] "
+    //      "Querying %5.2f, %5.2f at pyramid level %d, ",
+    //      cache_level, index_x, index_y,
+    //      x, pixels_per_cache_block_x, y, pixels_per_cache_block_y,
+    //      center_x, center_y, pyramid_level);
+
+    // TODO(andrewharp): Turn on FB error filtering.
+    const bool success = optical_flow_.FindFlowAtPointSingleLevel(
+        pyramid_level, center_x, center_y, false,
+        &displacement.x, &displacement.y);
+
+    if (!success) {
+      LOGV("Computation of cached value failed for level %d!", cache_level);
+    }
+
+    // Store the value for later use.
+    (*displacements_[cache_level])[index_y][index_x] = displacement;
+    return displacement;
+  }
+
   Point2f LookupGuessFromLevel(
       const int cache_level, const float x, const float y) const {
     // LOGE("Looking up guess at %5.2f %5.2f for level %d.", x, y, cache_level);
@@ -199,57 +392,26 @@ class FlowCache {
       return Point2f(xnew - x, ynew - y);
     }
 
-    const int level_dim = BlockDimForCacheLevel(cache_level);
-    const int pixels_per_cache_block_x =
-        (image_size_.width + level_dim - 1) / level_dim;
-    const int pixels_per_cache_block_y =
-        (image_size_.height + level_dim - 1) / level_dim;
-    const int index_x = x / pixels_per_cache_block_x;
-    const int index_y = y / pixels_per_cache_block_y;
+    int index_x;
+    int index_y;
+    GetCacheBlock(cache_level, x, y, &index_x, &index_y);
 
-    Point2f displacement;
     if (!(*has_cache_[cache_level])[index_y][index_x]) {
       (*has_cache_[cache_level])[index_y][index_x] = true;
-
-      // Get the lower cache level's best guess, if it exists.
-      displacement = cache_level >= kNumCacheLevels - 1 ?
-          Point2f(0, 0) : LookupGuessFromLevel(cache_level + 1, x, y);
-      // LOGI("Best guess at cache level %d is %5.2f, %5.2f.", cache_level,
-      //      best_guess.x, best_guess.y);
-
-      // Find the center of the block.
-      const float center_x = (index_x + 0.5f) * pixels_per_cache_block_x;
-      const float center_y = (index_y + 0.5f) * pixels_per_cache_block_y;
-      const int pyramid_level = PyramidLevelForCacheLevel(cache_level);
-
-      // LOGI("cache level %d: [%d, %d (%5.2f / %d, %5.2f / %d)] "
-      //      "Querying %5.2f, %5.2f at pyramid level %d, ",
-      //      cache_level, index_x, index_y,
-      //      x, pixels_per_cache_block_x, y, pixels_per_cache_block_y,
-      //      center_x, center_y, pyramid_level);
-
-      // TODO(andrewharp): Turn on FB error filtering.
-      const bool success = optical_flow_.FindFlowAtPointSingleLevel(
-          pyramid_level, center_x, center_y, false,
-          &displacement.x, &displacement.y);
-
-      if (!success) {
-        LOGV("Computation of cached value failed for level %d!", cache_level);
-      }
-
-      // Store the value for later use.
-      (*displacements_[cache_level])[index_y][index_x] = displacement;
-    } else {
-      displacement = (*displacements_[cache_level])[index_y][index_x];
+      return ComputeCacheBlock(cache_level, index_x, index_y, x, y);
     }
 
     // LOGI("Returning %5.2f, %5.2f for level %d",
     //      displacement.x, displacement.y, cache_level);
-    return displacement;
+    return (*displacements_[cache_level])[index_y][index_x];
+  }
+
+  inline bool InImage(const float x, const float y) const {
+    return x >= 0 && x < image_size_.width && y >= 0 && y < image_size_.height;
   }
 
   Point2f LookupGuess(const float x, const float y) const {
-    if (x < 0 || x >= image_size_.width || y < 0 || y >= image_size_.height) {
+    if (!InImage(x, y)) {
       return Point2f(0, 0);
     }
 
@@ -0,0 +1,465 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <float.h>
+
+#include "config.h"
+#include "frame_history.h"
+
+namespace tf_tracking {
+
+namespace {
+
+typedef AdjustBoxScratch::WeightedDelta WeightedDelta;
+
+inline float MedianOfThree(const float a, const float b, const float c) {
+  return MAX(MIN(a, b), MIN(MAX(a, b), c));
+}
+
+// Returns the weighted median of a set of deltas with positive weights summing
+// to total_weight: going from the largest delta to the smallest, the first one
+// at which the accumulated weight reaches half of the total. Reorders the
+// deltas.
+//
+// Rather than sorting them all, this narrows in on the median quickselect
+// style, partitioning around a pivot into the deltas larger than, equal to and
+// smaller than it and keeping only the part the median is in, which takes
+// expected linear time.
+float SelectWeightedMedian(const int num_items,
+                           WeightedDelta* const weighted_deltas,
+                           const float total_weight) {
+  if (num_items == 0 || total_weight < EPSILON) {
+    return 0.0f;
+  }
+
+  const float target_weight = total_weight / 2.0f;
+
+  // Weight of the deltas already known to be larger than those in
+  // [begin, end).
+  float weight_above = 0.0f;
+  int begin = 0;
+  int end = num_items;
+  while (begin < end) {
+    const float pivot = MedianOfThree(weighted_deltas[begin].delta,
+                                      weighted_deltas[(begin + end) / 2].delta,
+                                      weighted_deltas[end - 1].delta);
+
+    // Leaves [begin, larger_end) larger than the pivot, [larger_end,
+    // smaller_begin) equal to it and [smaller_begin, end) smaller.
+    int larger_end = begin;
+    int smaller_begin = end;
+    float larger_weight = 0.0f;
+    float equal_weight = 0.0f;
+    int i = begin;
+    while (i < smaller_begin) {
+      const WeightedDelta item = weighted_deltas[i];
+      if (item.delta > pivot) {
+        larger_weight += item.weight;
+        weighted_deltas[i++] = weighted_deltas[larger_end];
+        weighted_deltas[larger_end++] = item;
+      } else if (item.delta < pivot) {
+        weighted_deltas[i] = weighted_deltas[--smaller_begin];
+        weighted_deltas[smaller_begin] = item;
+      } else {
+        equal_weight += item.weight;
+        ++i;
+      }
+    }
+
+    if (weight_above + larger_weight >= target_weight) {
+      end = larger_end;
+    } else if (weight_above + larger_weight + equal_weight >= target_weight) {
+      return pivot;
+    } else {
+      weight_above += larger_weight + equal_weight;
+      begin = smaller_begin;
+    }
+  }
+  LOGW("Median not found! %d points, sum of %.2f", num_items, total_weight);
+  return 0.0f;
+}
+
+// Returns the weighted median of the given deltas, computed independently on
+// x and y. Returns 0,0 in case of failure. The assumption is that a
+// translation of 0.0 in the degenerate case is the best that can be done, and
+// should not be considered an error.
+Point2f GetWeightedMedian(const int num_keypoints, const float* const weights,
+                          const Point2f* const deltas,
+                          WeightedDelta* const weighted_deltas) {
+  Point2f median_delta;
+
+  // Compute median X value.
+  {
+    float total_weight = 0.0f;
+    int num_weighted = 0;
+    for (int i = 0; i < num_keypoints; ++i) {
+      if (weights[i] > 0.0f) {
+        weighted_deltas[num_weighted].weight = weights[i];
+        weighted_deltas[num_weighted].delta = deltas[i].x;
+        ++num_weighted;
+        total_weight += weights[i];
+      }
+    }
+    median_delta.x =
+        SelectWeightedMedian(num_weighted, weighted_deltas, total_weight);
+  }
+
+  // Compute median Y value.
+  {
+    float total_weight = 0.0f;
+    int num_weighted = 0;
+    for (int i = 0; i < num_keypoints; ++i) {
+      if (weights[i] > 0.0f) {
+        weighted_deltas[num_weighted].weight = weights[i];
+        weighted_deltas[num_weighted].delta = deltas[i].y;
+        ++num_weighted;
+        total_weight += weights[i];
+      }
+    }
+    median_delta.y =
+        SelectWeightedMedian(num_weighted, weighted_deltas, total_weight);
+  }
+
+  return median_delta;
+}
+
+// As above, but for scale, taking the median across x and y together.
+//
+// In the case of scale,  a slight exception is made just to be safe and
+// there is a check for 0.0 explicitly, but that shouldn't ever be possible to
+// happen naturally because of the non-zero + parity checks in FillScales.
+float GetWeightedMedianScale(const int num_keypoints,
+                             const float* const weights,
+                             const Point2f* const deltas,
+                             WeightedDelta* const weighted_deltas) {
+  float total_weight = 0.0f;
+  int num_weighted = 0;
+
+  // Add X values.
+  for (int i = 0; i < num_keypoints; ++i) {
+    if (weights[i] > 0.0f) {
+      weighted_deltas[num_weighted].weight = weights[i];
+      weighted_deltas[num_weighted].delta = deltas[i].x;
+      ++num_weighted;
+      total_weight += weights[i];
+    }
+  }
+
+  // Add Y values.
+  for (int i = 0; i < num_keypoints; ++i) {
+    if (weights[i] > 0.0f) {
+      weighted_deltas[num_weighted].weight = weights[i];
+      weighted_deltas[num_weighted].delta = deltas[i].y;
+      ++num_weighted;
+      total_weight += weights[i];
+    }
+  }
+
+  return SelectWeightedMedian(num_weighted, weighted_deltas, total_weight);
+}
+
+inline bool SameBox(const BoundingBox& a, const BoundingBox& b) {
+  return a.left_ == b.left_ && a.top_ == b.top_ &&
+         a.right_ == b.right_ && a.bottom_ == b.bottom_;
+}
+
+}  // namespace
+
+FrameHistory::FrameHistory(const int max_frame_pairs, const int max_keypoints)
+    : max_frame_pairs_(max_frame_pairs),
+      max_keypoints_(max_keypoints),
+      frames_(new FrameMotion[max_frame_pairs]),
+      first_slot_(0),
+      num_frame_pairs_(0),
+      num_added_(0),
+      storage_(new float[static_cast<size_t>(max_frame_pairs) *
+                         max_keypoints * kNumFields]),
+      next_trajectory_(0) {
+  const size_t field_size =
+      static_cast<size_t>(max_frame_pairs) * max_keypoints;
+  x1_ = storage_.get();
+  y1_ = x1_ + field_size;
+  x2_ = y1_ + field_size;
+  y2_ = x2_ + field_size;
+  intrinsic_weights_ = y2_ + field_size;
+
+  for (int i = 0; i < kNumCachedTrajectories; ++i) {
+    trajectories_[i].valid = false;
+  }
+}
+
+void FrameHistory::Add(const int64_t start_time, const int64_t end_time) {
+  SCHECK(num_frame_pairs_ == 0 ||
+         end_time > GetEndTime(num_frame_pairs_ - 1),
+         "Frame pairs must be added in order!");
+
+  if (num_frame_pairs_ == max_frame_pairs_) {
+    first_slot_ = (first_slot_ + 1) % max_frame_pairs_;
+    --num_frame_pairs_;
+  }
+  ++num_frame_pairs_;
+  ++num_added_;
+
+  FrameMotion* const frame =
+      frames_.get() + GetSlot(num_frame_pairs_ - 1);
+  frame->start_time = start_time;
+  frame->end_time = end_time;
+  frame->num_keypoints = 0;
+}
+
+void FrameHistory::SetLatestCorrespondences(const FramePair& frame_pair) {
+  const int slot = GetSlot(num_frame_pairs_ - 1);
+  FrameMotion* const frame = frames_.get() + slot;
+  SCHECK(frame->end_time == frame_pair.end_time_,
+        "Correspondences are for a different frame pair!");
+
+  // Keypoints are weighted by their score relative to the others found in
+  // this frame pair, in the range [kBaseScore, 1].
+  float max_score = -FLT_MAX;
+  float min_score = FLT_MAX;
+  for (int i = 0; i < frame_pair.number_of_keypoints_; ++i) {
+    if (frame_pair.optical_flow_found_keypoint_[i]) {
+      max_score = MAX(max_score, frame_pair.frame1_keypoints_[i].score_);
+      min_score = MIN(min_score, frame_pair.frame1_keypoints_[i].score_);
+    }
+  }
+
+  const int base = slot * max_keypoints_;
+  int num_keypoints = 0;
+  for (int i = 0; i < frame_pair.number_of_keypoints_; ++i) {
+    if (!frame_pair.optical_flow_found_keypoint_[i]) {
+      continue;
+    }
+    SCHECK(num_keypoints < max_keypoints_, "Too many keypoints! %d",
+          num_keypoints);
+    const Keypoint& keypoint1 = frame_pair.frame1_keypoints_[i];
+    const Keypoint& keypoint2 = frame_pair.frame2_keypoints_[i];
+
+    float intrinsic_score = 1.0f;
+    if (max_score > min_score) {
+      static const float kBaseScore = 0.5f;
+      intrinsic_score = ((keypoint1.score_ - min_score) /
+         (max_score - min_score)) * (1.0f - kBaseScore) + kBaseScore;
+    }
+
+    const int index = base + num_keypoints;
+    x1_[index] = keypoint1.pos_.x;
+    y1_[index] = keypoint1.pos_.y;
+    x2_[index] = keypoint2.pos_.x;
+    y2_[index] = keypoint2.pos_.y;
+    intrinsic_weights_[index] = intrinsic_score;
+    ++num_keypoints;
+  }
+  frame->num_keypoints = num_keypoints;
+
+  // Anything already moved through this frame pair moved by the wrong amount.
+  for (int i = 0; i < kNumCachedTrajectories; ++i) {
+    if (trajectories_[i].next_sequence_number == num_added_) {
+      trajectories_[i].valid = false;
+    }
+  }
+}
+
+int FrameHistory::FindFirstEndingAfter(const int64_t timestamp) const {
+  int low = 0;
+  int high = num_frame_pairs_;
+  while (low < high) {
+    const int mid = low + (high - low) / 2;
+    if (GetEndTime(mid) <= timestamp) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+void FrameHistory::AdjustBox(const int index, const BoundingBox& box,
+                             AdjustBoxScratch* const scratch,
+                             float* const translation_x,
+                             float* const translation_y,
+                             float* const scale_x,
+                             float* const scale_y) const {
+  SCHECK(scratch->max_keypoints >= max_keypoints_,
+        "Scratch too small! %d vs %d", scratch->max_keypoints, max_keypoints_);
+  const int slot = GetSlot(index);
+  const int num_keypoints = frames_[slot].num_keypoints;
+  const float* const x1 = x1_ + slot * max_keypoints_;
+  const float* const y1 = y1_ + slot * max_keypoints_;
+  const float* const x2 = x2_ + slot * max_keypoints_;
+  const float* const y2 = y2_ + slot * max_keypoints_;
+  const float* const intrinsic_weights =
+      intrinsic_weights_ + slot * max_keypoints_;
+
+  float* const weights = scratch->weights.get();
+  Point2f* const deltas = scratch->deltas.get();
+
+  // Weight the points by how close they are to the middle of the box.
+  BoundingBox resized_box(box);
+  resized_box.Scale(0.4f, 0.4f);
+  const Point2f initial = resized_box.GetCenter();
+  const float squared_half_width = Square(resized_box.GetWidth() / 2.0f);
+  const float squared_half_height = Square(resized_box.GetHeight() / 2.0f);
+  for (int i = 0; i < num_keypoints; ++i) {
+    // Anything within the box has a weight of 1, and everything outside of
+    // that is within the range [0, kOutOfBoxMultiplier), falling off with the
+    // squared distance ratio.
+    float distance_score = 1.0f;
+    if (!resized_box.Contains(Point2f(x1[i], y1[i]))) {
+      const float sq_x_dist = Square(initial.x - x1[i]);
+      const float sq_y_dist = Square(initial.y - y1[i]);
+
+      static const float kOutOfBoxMultiplier = 0.5f;
+      distance_score = kOutOfBoxMultiplier *
+          MIN(squared_half_height / sq_y_dist, squared_half_width / sq_x_dist);
+    }
+
+    // The final score will be in the range [0, 1].
+    weights[i] = distance_score * intrinsic_weights[i];
+
+    deltas[i].x = x2[i] - x1[i];
+    deltas[i].y = y2[i] - y1[i];
+  }
+
+  const Point2f translation =
+      GetWeightedMedian(num_keypoints, weights, deltas,
+                        scratch->weighted_deltas.get());
+
+  *translation_x = translation.x;
+  *translation_y = translation.y;
+
+  // Reuse deltas for the relative scale factor of the points about the
+  // center of the box. Points too close to the center will result in either
+  // NaNs or infinite results for scale due to limited tracking and floating
+  // point resolution, and we can't really make sense of points whose parity
+  // with respect to x and y has flipped, so those are given no weight.
+  const Point2f old_center = box.GetCenter();
+  int good_scale_points = 0;
+  for (int i = 0; i < num_keypoints; ++i) {
+    const float dist1_x = x1[i] - old_center.x;
+    const float dist1_y = y1[i] - old_center.y;
+
+    const float dist2_x = (x2[i] - translation.x) - old_center.x;
+    const float dist2_y = (y2[i] - translation.y) - old_center.y;
+
+    if (((dist2_x > EPSILON && dist1_x > EPSILON) ||
+         (dist2_x < -EPSILON && dist1_x < -EPSILON)) &&
+         ((dist2_y > EPSILON && dist1_y > EPSILON) ||
+          (dist2_y < -EPSILON && dist1_y < -EPSILON))) {
+      deltas[i].x = dist2_x / dist1_x;
+      deltas[i].y = dist2_y / dist1_y;
+      ++good_scale_points;
+    } else {
+      weights[i] = 0.0f;
+      deltas[i].x = 1.0f;
+      deltas[i].y = 1.0f;
+    }
+  }
+
+  // Default scale factor is 1 for x and y.
+  *scale_x = 1.0f;
+  *scale_y = 1.0f;
+
+  // The check for kMinNumInRange is not a degeneracy check, but merely an
+  // attempt to ensure some sort of stability. The actual degeneracy check is
+  // the comparison to EPSILON above.
+  static const int kMinNumInRange = 5;
+  if (good_scale_points >= kMinNumInRange) {
+    const float scale_factor =
+        GetWeightedMedianScale(num_keypoints, weights, deltas,
+                               scratch->weighted_deltas.get());
+
+    if (scale_factor > 0.0f) {
+      *scale_x = scale_factor;
+      *scale_y = scale_factor;
+    }
+  }
+}
+
+BoundingBox FrameHistory::AdjustBox(const int index, const BoundingBox& box,
+                                    AdjustBoxScratch* const scratch) const {
+  float translation_x;
+  float translation_y;
+
+  float scale_x;
+  float scale_y;
+
+  AdjustBox(index, box, scratch,
+            &translation_x, &translation_y, &scale_x, &scale_y);
+
+  BoundingBox tracked_box(box);
+  tracked_box.Shift(Point2f(translation_x, translation_y));
+
+  if (scale_x > 0 && scale_y > 0) {
+    tracked_box.Scale(scale_x, scale_y);
+  }
+  return tracked_box;
+}
+
+BoundingBox FrameHistory::TrackBox(const BoundingBox& region,
+                                   const int64_t timestamp,
+                                   AdjustBoxScratch* const scratch) const {
+  // Anything that ended before the requested timestamp is of no concern to us.
+  // If even the oldest frame pair ends after it, the history is short, either
+  // because tracking only just started or because it has moved on; either way
+  // the motion it does have is the best estimate there is.
+  const int first = FindFirstEndingAfter(timestamp);
+  if (first == 0 && num_frame_pairs_ > 0 && GetStartTime(0) > timestamp) {
+    LOGW("History did not go back far enough! %lld vs %lld",
+         GetEndTime(num_frame_pairs_ - 1) - GetStartTime(0),
+         GetEndTime(num_frame_pairs_ - 1) - timestamp);
+  } else if (first < num_frame_pairs_ - 1) {
+    LOGV("Went %d out of %d frames before finding frame.",
+         num_frame_pairs_ - 1 - first, num_frame_pairs_);
+  }
+
+  // Pick up where an earlier query for the same region left off, or start a
+  // new trajectory in place of the oldest one.
+  const int64_t first_sequence_number = GetSequenceNumber(first);
+  Trajectory* trajectory = NULL;
+  for (int i = 0; i < kNumCachedTrajectories; ++i) {
+    Trajectory* const candidate = trajectories_ + i;
+    if (candidate->valid && candidate->timestamp == timestamp &&
+        SameBox(candidate->region, region) &&
+        candidate->next_sequence_number >= first_sequence_number) {
+      trajectory = candidate;
+      break;
+    }
+  }
+  if (trajectory == NULL) {
+    trajectory = trajectories_ + next_trajectory_;
+    next_trajectory_ = (next_trajectory_ + 1) % kNumCachedTrajectories;
+    trajectory->valid = true;
+    trajectory->region = region;
+    trajectory->timestamp = timestamp;
+    trajectory->next_sequence_number = first_sequence_number;
+    trajectory->position = region;
+  }
+
+  // Loop over the remaining frame pairs, tracking the accumulated delta of
+  // the box from frame to frame. It's possible the box could go out of frame,
+  // but keep tracking as best we can, using points near the edge of the
+  // screen where it went out of bounds.
+  for (int64_t i = trajectory->next_sequence_number; i < num_added_; ++i) {
+    const int index = static_cast<int>(i - GetSequenceNumber(0));
+    SCHECK(GetEndTime(index) > timestamp, "Frame timestamp was too early!");
+    trajectory->position = AdjustBox(index, trajectory->position, scratch);
+  }
+  trajectory->next_sequence_number = num_added_;
+
+  return trajectory->position;
+}
+
+}  // namespace tf_tracking
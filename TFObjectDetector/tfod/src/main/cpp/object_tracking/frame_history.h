@@ -0,0 +1,185 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_FRAME_HISTORY_H_
+#define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_FRAME_HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "geom.h"
+#include "utils.h"
+
+#include "frame_pair.h"
+
+namespace tf_tracking {
+
+// Working memory for moving a box through a frame pair, sized for a number of
+// keypoints. Owned by the caller so that any number of threads can move boxes
+// through the same FrameHistory at once, each with its own.
+struct AdjustBoxScratch {
+  struct WeightedDelta {
+    float weight;
+    float delta;
+  };
+
+  explicit AdjustBoxScratch(const int max_keypoints)
+      : max_keypoints(max_keypoints),
+        weights(new float[max_keypoints]),
+        deltas(new Point2f[max_keypoints]),
+        weighted_deltas(new WeightedDelta[2 * max_keypoints]) {}
+
+  // Bytes an AdjustBoxScratch of the given capacity allocates.
+  static size_t GetStorageSize(const int max_keypoints) {
+    return static_cast<size_t>(max_keypoints) *
+           (sizeof(float) + sizeof(Point2f) + 2 * sizeof(WeightedDelta));
+  }
+
+  const int max_keypoints;
+
+  std::unique_ptr<float[]> weights;
+  std::unique_ptr<Point2f[]> deltas;
+
+  // Room for both the x and y deltas of every keypoint.
+  std::unique_ptr<WeightedDelta[]> weighted_deltas;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(AdjustBoxScratch);
+};
+
+// A ring of the keypoint motion of the most recent frame pairs, kept so that a
+// box seen at some past time can be moved forward to the present.
+//
+// Only what moving a box needs is kept, and only for the keypoints that were
+// found: where each one was in both frames and how strongly it was weighted,
+// one array per field. Frame pairs are indexed from 0, the oldest, to
+// GetNumFramePairs() - 1, the newest, and their end times increase, so the
+// frame pairs following a timestamp are found by binary search.
+class FrameHistory {
+ public:
+  FrameHistory(const int max_frame_pairs, const int max_keypoints);
+
+  // Bytes a FrameHistory of the given capacity allocates.
+  static size_t GetStorageSize(const int max_frame_pairs,
+                               const int max_keypoints) {
+    return static_cast<size_t>(max_frame_pairs) * max_keypoints *
+           kNumFields * sizeof(float);
+  }
+
+  // Starts a new frame pair between the given times, with no keypoint motion
+  // yet, evicting the oldest frame pair if the history is full.
+  void Add(const int64_t start_time, const int64_t end_time);
+
+  // Records the found correspondences of frame_pair as the motion of the
+  // newest frame pair.
+  void SetLatestCorrespondences(const FramePair& frame_pair);
+
+  inline int GetNumFramePairs() const {
+    return num_frame_pairs_;
+  }
+
+  inline int64_t GetStartTime(const int index) const {
+    return frames_[GetSlot(index)].start_time;
+  }
+
+  inline int64_t GetEndTime(const int index) const {
+    return frames_[GetSlot(index)].end_time;
+  }
+
+  // Returns the index of the oldest frame pair ending after timestamp, or
+  // GetNumFramePairs() if there is none.
+  int FindFirstEndingAfter(const int64_t timestamp) const;
+
+  // Returns box moved by the keypoint motion of the given frame pair. Safe to
+  // call from several threads at once as long as each passes its own scratch,
+  // which must hold at least as many keypoints as this history.
+  BoundingBox AdjustBox(const int index, const BoundingBox& box,
+                        AdjustBoxScratch* const scratch) const;
+
+  // Returns region, as seen at timestamp, moved through every later frame
+  // pair. If the history does not reach back to timestamp, region is moved
+  // through all of it instead. The last few queries are remembered, so asking about the same
+  // region and timestamp again only replays the frame pairs added since.
+  // Unlike AdjustBox, this updates that cache and must not run concurrently
+  // with itself.
+  BoundingBox TrackBox(const BoundingBox& region, const int64_t timestamp,
+                       AdjustBoxScratch* const scratch) const;
+
+ private:
+  // x and y in frame 1, x and y in frame 2, and the intrinsic weight.
+  static const int kNumFields = 5;
+
+  static const int kNumCachedTrajectories = 8;
+
+  struct FrameMotion {
+    int64_t start_time;
+    int64_t end_time;
+    int num_keypoints;
+  };
+
+  // A region tracked from timestamp up to, but not including, the frame pair
+  // with sequence number next_sequence_number.
+  struct Trajectory {
+    bool valid;
+    BoundingBox region;
+    int64_t timestamp;
+    int64_t next_sequence_number;
+    BoundingBox position;
+  };
+
+  inline int GetSlot(const int index) const {
+    SCHECK(index >= 0 && index < num_frame_pairs_,
+          "Frame pair %d out of range! %d in history.", index,
+          num_frame_pairs_);
+    return (first_slot_ + index) % max_frame_pairs_;
+  }
+
+  // Every frame pair ever added is numbered in order, so that trajectories
+  // can tell which ones they have already been moved through.
+  inline int64_t GetSequenceNumber(const int index) const {
+    return num_added_ - num_frame_pairs_ + index;
+  }
+
+  void AdjustBox(const int index, const BoundingBox& box,
+                 AdjustBoxScratch* const scratch,
+                 float* const translation_x, float* const translation_y,
+                 float* const scale_x, float* const scale_y) const;
+
+  const int max_frame_pairs_;
+  const int max_keypoints_;
+
+  std::unique_ptr<FrameMotion[]> frames_;
+  int first_slot_;
+  int num_frame_pairs_;
+  int64_t num_added_;
+
+  // Each field of the keypoints of slot s starts at s * max_keypoints_.
+  std::unique_ptr<float[]> storage_;
+  float* x1_;
+  float* y1_;
+  float* x2_;
+  float* y2_;
+  float* intrinsic_weights_;
+
+  mutable Trajectory trajectories_[kNumCachedTrajectories];
+  mutable int next_trajectory_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(FrameHistory);
+};
+
+}  // namespace tf_tracking
+
+#endif  // TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_FRAME_HISTORY_H_
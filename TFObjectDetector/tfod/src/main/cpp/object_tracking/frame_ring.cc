@@ -0,0 +1,72 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "frame_ring.h"
+
+#include "image-inl.h"
+#include "logging.h"
+
+namespace tf_tracking {
+
+FrameRing::FrameRing(const int max_frames, const int width, const int height)
+    : max_frames_(max_frames),
+      newest_(-1),
+      num_frames_(0),
+      timestamps_(new int64_t[MAX(max_frames, 1)]) {
+  CHECK_ALWAYS(max_frames >= 0, "Invalid number of retained frames %d",
+               max_frames);
+  for (int i = 0; i < max_frames; ++i) {
+    frames_.push_back(
+        std::unique_ptr<Image<uint8_t> >(new Image<uint8_t>(width, height)));
+  }
+}
+
+void FrameRing::Add(const int64_t timestamp, const Image<uint8_t>& image) {
+  if (max_frames_ == 0) {
+    return;
+  }
+  SCHECK(num_frames_ == 0 || timestamps_[newest_] < timestamp,
+         "Timestamps must increase! Went from %lld to %lld",
+         static_cast<long long>(timestamps_[newest_]),
+         static_cast<long long>(timestamp));
+
+  newest_ = (newest_ + 1) % max_frames_;
+  num_frames_ = MIN(num_frames_ + 1, max_frames_);
+
+  Image<uint8_t>* const frame = frames_[newest_].get();
+  SCHECK(frame->GetWidth() == image.GetWidth() &&
+         frame->GetHeight() == image.GetHeight(),
+         "Frame is %dx%d, expected %dx%d", image.GetWidth(), image.GetHeight(),
+         frame->GetWidth(), frame->GetHeight());
+  frame->FromArray(image.data(), image.stride(), 1);
+  timestamps_[newest_] = timestamp;
+}
+
+const Image<uint8_t>* FrameRing::Find(const int64_t timestamp) const {
+  // Only a handful of frames are kept, and recent ones are the likeliest to
+  // be asked for, so look from the newest back.
+  for (int i = 0; i < num_frames_; ++i) {
+    const int slot = (newest_ - i + max_frames_) % max_frames_;
+    if (timestamps_[slot] == timestamp) {
+      return frames_[slot].get();
+    }
+    if (timestamps_[slot] < timestamp) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+}  // namespace tf_tracking
@@ -0,0 +1,81 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_FRAME_RING_H_
+#define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_FRAME_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "image.h"
+#include "utils.h"
+
+namespace tf_tracking {
+
+// Copies of the luminance of the most recent tracked frames, at tracking
+// resolution, kept so that a detection made on a frame from a while back can
+// take its appearance from the pixels it was actually found in.
+//
+// Only the base image of each frame is kept, not its pyramid or derivatives:
+// registering an object reads nothing else, and builds the integral image it
+// needs from the base image once per batch. A retained frame therefore costs
+// width * height bytes rather than the several times that of a full
+// ImageData, and cannot be tracked from. Once full, each new frame replaces
+// the oldest.
+class FrameRing {
+ public:
+  FrameRing(const int max_frames, const int width, const int height);
+
+  // Bytes a FrameRing of the given capacity allocates.
+  static size_t GetStorageSize(const int max_frames, const int width,
+                               const int height) {
+    return static_cast<size_t>(max_frames) * width * height;
+  }
+
+  // Copies image in as the frame with the given timestamp, which must be later
+  // than that of every frame added before. Does nothing if max_frames is 0.
+  void Add(const int64_t timestamp, const Image<uint8_t>& image);
+
+  // Returns the retained frame with exactly the given timestamp, or NULL if
+  // there is none.
+  const Image<uint8_t>* Find(const int64_t timestamp) const;
+
+  inline int GetNumFrames() const {
+    return num_frames_;
+  }
+
+  inline int GetMaxFrames() const {
+    return max_frames_;
+  }
+
+ private:
+  const int max_frames_;
+
+  // Slot of the newest frame, and the number of slots filled.
+  int newest_;
+  int num_frames_;
+
+  std::vector<std::unique_ptr<Image<uint8_t> > > frames_;
+  std::unique_ptr<int64_t[]> timestamps_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(FrameRing);
+};
+
+}  // namespace tf_tracking
+
+#endif  // TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_FRAME_RING_H_
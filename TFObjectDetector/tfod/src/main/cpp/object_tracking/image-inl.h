@@ -65,6 +65,21 @@ Image<T>::Image(const int width, const int height, T* const image_data,
   SCHECK(image_data_ != NULL, "Can't create image with NULL data!");
 }
 
+template <typename T>
+Image<T>::Image(const int width, const int height, const int stride,
+      T* const image_data, const bool own_data) :
+    width_less_one_(width - 1),
+    height_less_one_(height - 1),
+    data_size_(stride * height),
+    own_data_(own_data),
+    width_(width),
+    height_(height),
+    stride_(stride) {
+  SCHECK(stride >= width, "Stride %d is less than width %d!", stride, width);
+  image_data_ = image_data;
+  SCHECK(image_data_ != NULL, "Can't create image with NULL data!");
+}
+
 template <typename T>
 Image<T>::~Image() {
   if (own_data_) {
@@ -234,6 +249,17 @@ void Image<T>::DownsampleAveraged(const T* const original, const int stride,
     DownsampleAveragedNeon(original, stride, factor);
     return;
   }
+#elif defined(TF_TRACKING_X86_SIMD)
+  if ((factor == 4 || factor == 2) && width_ * factor >= 32) {
+    const X86SimdLevel level = GetX86SimdLevel();
+    if (level == X86_SIMD_AVX2) {
+      DownsampleAveragedAvx2(original, stride, factor);
+      return;
+    } else if (level == X86_SIMD_SSE41) {
+      DownsampleAveragedSse41(original, stride, factor);
+      return;
+    }
+  }
 #endif
 
   // TODO(andrewharp): delete or enable this for non-uint8_t downsamples.
@@ -630,9 +656,15 @@ inline void Image<T>::Convolve3x3(const Image<U>& original,
 template <typename T>
 inline void Image<T>::FromArray(const T* const pixels, const int stride,
                       const int factor) {
-  if (factor == 1 && stride == width_) {
-    // If not subsampling, memcpy per line should be faster.
-    memcpy(this->image_data_, pixels, data_size_ * sizeof(T));
+  if (factor == 1) {
+    if (stride == width_ && stride_ == width_) {
+      memcpy(this->image_data_, pixels, data_size_ * sizeof(T));
+    } else {
+      // If not subsampling, memcpy per line should be faster.
+      for (int y = 0; y < height_; ++y) {
+        memcpy((*this)[y], pixels + y * stride, width_ * sizeof(T));
+      }
+    }
     return;
   }
 
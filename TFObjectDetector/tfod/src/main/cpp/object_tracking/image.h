@@ -17,6 +17,7 @@ limitations under the License.
 #define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_IMAGE_H_
 
 #include <stdint.h>
+#include <string.h>
 
 #include "geom.h"
 #include "utils.h"
@@ -105,6 +106,11 @@ class Image {
   Image(const int width, const int height, T* const image_data,
         const bool own_data = true);
 
+  // As above, but with rows stride elements apart rather than width, so that
+  // rows can be padded out for aligned vector access.
+  Image(const int width, const int height, const int stride,
+        T* const image_data, const bool own_data = true);
+
   ~Image();
 
   // Extract a pixel patch from this image, starting at a subpixel location.
@@ -149,9 +155,20 @@ class Image {
 
   inline bool Contains(const BoundingBox& bounding_box) const;
 
+  // Sorts the pixels in place to find their median, so the image is
+  // scrambled afterwards. Any row padding is left out.
   inline T GetMedianValue() {
-    qsort(image_data_, data_size_, sizeof(image_data_[0]), Comp<T>);
-    return image_data_[data_size_ >> 1];
+    if (stride_ != width_) {
+      // Pack the rows at the start of the buffer first. Each moves down, so
+      // none is overwritten before it is moved.
+      for (int y = 1; y < height_; ++y) {
+        memmove(image_data_ + y * width_, image_data_ + y * stride_,
+                width_ * sizeof(T));
+      }
+    }
+    const int num_pixels = width_ * height_;
+    qsort(image_data_, num_pixels, sizeof(image_data_[0]), Comp<T>);
+    return image_data_[num_pixels >> 1];
   }
 
   // Returns true iff the pixel is in the image's boundaries for interpolation
@@ -207,6 +224,16 @@ class Image {
                               const int factor);
 #endif
 
+#ifdef TF_TRACKING_X86_SIMD
+  // x86 versions of DownsampleAveragedNeon, with the same requirements, except
+  // that the image width needs only be at least 32 / factor pixels.
+  void DownsampleAveragedSse41(const uint8_t* const original, const int stride,
+                               const int factor);
+
+  void DownsampleAveragedAvx2(const uint8_t* const original, const int stride,
+                              const int factor);
+#endif
+
   // Naive downsampler that reduces image size by factor by averaging pixels in
   // blocks of size factor x factor.
   void DownsampleAveraged(const T* const original, const int stride,
@@ -288,10 +315,17 @@ class Image {
   inline void FromArray(const T* const pixels, const int stride,
                         const int factor = 1);
 
-  // Copy the image back out to an appropriately sized data array.
+  // Copy the image back out to an appropriately sized data array, packed
+  // with no row padding.
   inline void ToArray(T* const pixels) const {
-    // If not subsampling, memcpy should be faster.
-    memcpy(pixels, this->image_data_, data_size_ * sizeof(T));
+    if (stride_ == width_) {
+      memcpy(pixels, this->image_data_, data_size_ * sizeof(T));
+    } else {
+      for (int y = 0; y < height_; ++y) {
+        memcpy(pixels + y * width_, image_data_ + y * stride_,
+               width_ * sizeof(T));
+      }
+    }
   }
 
   // Precompute these for efficiency's sake as they're used by a lot of
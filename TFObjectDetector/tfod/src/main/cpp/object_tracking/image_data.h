@@ -25,24 +25,62 @@ limitations under the License.
 #include "integral_image.h"
 #include "time_log.h"
 #include "utils.h"
+#include "worker_pool.h"
 
 #include "config.h"
 
 namespace tf_tracking {
 
+// Describes where the planes of a frame live in memory, e.g. the planes of an
+// android.media.Image, so the frame can be read in place instead of first being
+// packed into a contiguous array.
+struct FramePlanes {
+  FramePlanes()
+      : y(NULL),
+        y_row_stride(0),
+        downsample_factor(1),
+        u(NULL),
+        v(NULL),
+        uv_row_stride(0),
+        uv_pixel_stride(1),
+        uv_width(0),
+        uv_height(0) {}
+
+  // The luminance plane. It is averaged down by downsample_factor in each
+  // dimension while being read, so it must hold (at least) the image size
+  // times downsample_factor pixels.
+  const uint8_t* y;
+  int y_row_stride;
+  int downsample_factor;
+
+  // Optional chroma planes of uv_width x uv_height samples. Samples within a
+  // row are uv_pixel_stride bytes apart, so interleaved planes such as the VU
+  // plane of an NV21 frame have a pixel stride of 2.
+  const uint8_t* u;
+  const uint8_t* v;
+  int uv_row_stride;
+  int uv_pixel_stride;
+  int uv_width;
+  int uv_height;
+};
+
 // Class that encapsulates all bulky processed data for a frame.
 class ImageData {
  public:
   explicit ImageData(const int width, const int height)
       : uv_frame_width_(width << 1),
         uv_frame_height_(height << 1),
-        timestamp_(0),
-        image_(width, height) {
-    InitPyramid(width, height);
+        timestamp_(0) {
+    InitArena(width, height);
     ResetComputationCache();
   }
 
  private:
+  // Every image in the arena starts on a cache line boundary, and its rows
+  // are padded to whole vector registers.
+  static const int kArenaAlignment = 64;
+  static const int kRowAlignment = 16;
+
   void ResetComputationCache() {
     uv_data_computed_ = false;
     integral_image_computed_ = false;
@@ -54,30 +92,119 @@ class ImageData {
     }
   }
 
-  void InitPyramid(const int width, const int height) {
-    int level_width = width;
-    int level_height = height;
+  // Returns the stride, in elements, of a padded row of width Ts.
+  template <typename T>
+  static int PaddedStride(const int width) {
+    const int row_bytes = width * static_cast<int>(sizeof(T));
+    const int padded_bytes =
+        (row_bytes + kRowAlignment - 1) / kRowAlignment * kRowAlignment;
+    return padded_bytes / static_cast<int>(sizeof(T));
+  }
 
-    for (int i = 0; i < kNumPyramidLevels; ++i) {
-      pyramid_sqrt2_[i * 2] = NULL;
-      pyramid_sqrt2_[i * 2 + 1] = NULL;
-      spatial_x_[i] = NULL;
-      spatial_y_[i] = NULL;
+  // Reserves room in the arena for a width x height image of Ts, returning
+  // its offset in bytes.
+  template <typename T>
+  static size_t Reserve(const int width, const int height,
+                        size_t* const arena_size) {
+    const size_t offset = *arena_size;
+    const size_t bytes = static_cast<size_t>(PaddedStride<T>(width)) *
+                         height * sizeof(T);
+    *arena_size += (bytes + kArenaAlignment - 1) / kArenaAlignment *
+                   kArenaAlignment;
+    return offset;
+  }
+
+  template <typename T>
+  Image<T>* CarveImage(const int width, const int height,
+                       const size_t offset) const {
+    return new Image<T>(width, height, PaddedStride<T>(width),
+                        reinterpret_cast<T*>(arena_ + offset), false);
+  }
+
+  // Where each image lives in the arena for a given frame size.
+  struct ArenaLayout {
+    int level_widths[kNumPyramidLevels * 2];
+    int level_heights[kNumPyramidLevels * 2];
+    size_t pyramid_offsets[kNumPyramidLevels * 2];
+    size_t spatial_x_offsets[kNumPyramidLevels];
+    size_t spatial_y_offsets[kNumPyramidLevels];
+    size_t integral_offset;
+    size_t size;
+  };
+
+  // Sizes every pyramid level, derivative and the integral image from the
+  // frame dimensions.
+  static void LayOutArena(const int width, const int height,
+                          ArenaLayout* const layout) {
+    for (int i = 0; i < kNumPyramidLevels * 2; ++i) {
+      if (i == 0) {
+        layout->level_widths[i] = width;
+        layout->level_heights[i] = height;
+      } else if (i == 1) {
+        layout->level_widths[i] =
+            (static_cast<int>(width / sqrtf(2)) + 1) / 2 * 2;
+        layout->level_heights[i] =
+            (static_cast<int>(height / sqrtf(2)) + 1) / 2 * 2;
+      } else {
+        layout->level_widths[i] = layout->level_widths[i - 2] / 2;
+        layout->level_heights[i] = layout->level_heights[i - 2] / 2;
+      }
+    }
 
-      level_width /= 2;
-      level_height /= 2;
+    layout->size = 0;
+
+    // Each level is followed by its derivatives, so a flow query touches one
+    // contiguous stretch of the arena per level.
+    for (int i = 0; i < kNumPyramidLevels * 2; ++i) {
+      layout->pyramid_offsets[i] = Reserve<uint8_t>(
+          layout->level_widths[i], layout->level_heights[i], &layout->size);
+      if (i % 2 == 0) {
+        layout->spatial_x_offsets[i / 2] = Reserve<int16_t>(
+            layout->level_widths[i], layout->level_heights[i], &layout->size);
+        layout->spatial_y_offsets[i / 2] = Reserve<int16_t>(
+            layout->level_widths[i], layout->level_heights[i], &layout->size);
+      }
     }
+    layout->integral_offset =
+        Reserve<uint32_t>(width, height, &layout->size);
+  }
 
-    // Alias the first pyramid level to image_.
-    pyramid_sqrt2_[0] = &image_;
+  // Carves every image out of one aligned allocation, so that nothing is
+  // allocated once the frame is constructed and the levels flow walks for a
+  // point sit close together.
+  void InitArena(const int width, const int height) {
+    ArenaLayout layout;
+    LayOutArena(width, height, &layout);
+    const int* const level_widths = layout.level_widths;
+    const int* const level_heights = layout.level_heights;
+
+    arena_size_ = layout.size;
+    arena_storage_.reset(new uint8_t[layout.size + kArenaAlignment]);
+    const uintptr_t base = reinterpret_cast<uintptr_t>(arena_storage_.get());
+    arena_ = reinterpret_cast<uint8_t*>(
+        (base + kArenaAlignment - 1) & ~static_cast<uintptr_t>(
+            kArenaAlignment - 1));
+
+    for (int i = 0; i < kNumPyramidLevels * 2; ++i) {
+      pyramid_sqrt2_[i] = CarveImage<uint8_t>(
+          level_widths[i], level_heights[i], layout.pyramid_offsets[i]);
+    }
+    for (int i = 0; i < kNumPyramidLevels; ++i) {
+      spatial_x_[i] = CarveImage<int16_t>(level_widths[i * 2],
+                                          level_heights[i * 2],
+                                          layout.spatial_x_offsets[i]);
+      spatial_y_[i] = CarveImage<int16_t>(level_widths[i * 2],
+                                          level_heights[i * 2],
+                                          layout.spatial_y_offsets[i]);
+    }
+    integral_image_.reset(new IntegralImage(
+        width, height, PaddedStride<uint32_t>(width),
+        reinterpret_cast<uint32_t*>(arena_ + layout.integral_offset)));
   }
 
  public:
   ~ImageData() {
-    // The first pyramid level is actually an alias to image_,
-    // so make sure it doesn't get deleted here.
-    pyramid_sqrt2_[0] = NULL;
-
+    // The images only wrap the arena, which frees itself.
     for (int i = 0; i < kNumPyramidLevels; ++i) {
       SAFE_DELETE(pyramid_sqrt2_[i * 2]);
       SAFE_DELETE(pyramid_sqrt2_[i * 2 + 1]);
@@ -86,6 +213,18 @@ class ImageData {
     }
   }
 
+  // Total size of the arena holding the pyramid, derivatives and integral
+  // image.
+  inline size_t GetArenaSize() const { return arena_size_; }
+
+  // Bytes an ImageData of the given size allocates for its arena, including
+  // the slack needed to align it.
+  static size_t GetStorageSize(const int width, const int height) {
+    ArenaLayout layout;
+    LayOutArena(width, height, &layout);
+    return layout.size + kArenaAlignment;
+  }
+
   void SetData(const uint8_t* const new_frame, const int stride,
                const int64_t timestamp, const int downsample_factor) {
     SetData(new_frame, NULL, stride, timestamp, downsample_factor);
@@ -94,23 +233,30 @@ class ImageData {
   void SetData(const uint8_t* const new_frame, const uint8_t* const uv_frame,
                const int stride, const int64_t timestamp,
                const int downsample_factor) {
+    SetData(DescribePackedFrame(new_frame, uv_frame, stride, downsample_factor),
+            timestamp);
+  }
+
+  void SetData(const FramePlanes& planes, const int64_t timestamp) {
     ResetComputationCache();
 
     timestamp_ = timestamp;
 
     TimeLog("SetData!");
 
-    pyramid_sqrt2_[0]->FromArray(new_frame, stride, downsample_factor);
+    pyramid_sqrt2_[0]->FromArray(planes.y, planes.y_row_stride,
+                                 planes.downsample_factor);
     pyramid_sqrt2_computed_[0] = true;
     TimeLog("Downsampled image");
 
-    if (uv_frame != NULL) {
+    if (planes.u != NULL && planes.v != NULL) {
       if (u_data_.get() == NULL) {
         u_data_.reset(new Image<uint8_t>(uv_frame_width_, uv_frame_height_));
         v_data_.reset(new Image<uint8_t>(uv_frame_width_, uv_frame_height_));
       }
 
-      GetUV(uv_frame, u_data_.get(), v_data_.get());
+      GetUV(planes.u, planes.v, planes.uv_row_stride, planes.uv_pixel_stride,
+            planes.uv_width, planes.uv_height, u_data_.get(), v_data_.get());
       uv_data_computed_ = true;
       TimeLog("Copied UV data");
     } else {
@@ -120,10 +266,37 @@ class ImageData {
 #ifdef LOG_TIME
     // If profiling is enabled, precompute here to make it easier to distinguish
     // total costs.
-    Precompute();
+    PrecomputeSerial();
 #endif
   }
 
+  // Describes a packed luminance array, plus an optional interleaved VU array
+  // holding a chroma sample for every pixel of the UV images, as FramePlanes.
+  FramePlanes DescribePackedFrame(const uint8_t* const new_frame,
+                                  const uint8_t* const uv_frame,
+                                  const int stride,
+                                  const int downsample_factor) const {
+    FramePlanes planes;
+    planes.y = new_frame;
+    planes.y_row_stride = stride;
+    planes.downsample_factor = downsample_factor;
+
+    if (uv_frame != NULL) {
+#ifdef __APPLE__
+      planes.u = uv_frame;
+      planes.v = uv_frame + 1;
+#else
+      planes.v = uv_frame;
+      planes.u = uv_frame + 1;
+#endif
+      planes.uv_row_stride = uv_frame_width_ * 2;
+      planes.uv_pixel_stride = 2;
+      planes.uv_width = uv_frame_width_;
+      planes.uv_height = uv_frame_height_;
+    }
+    return planes;
+  }
+
   inline const uint64_t GetTimestamp() const { return timestamp_; }
 
   inline const Image<uint8_t>* GetImage() const {
@@ -136,22 +309,9 @@ class ImageData {
       SCHECK(level != 0, "Level equals 0!");
       if (level == 1) {
         const Image<uint8_t>& upper_level = *GetPyramidSqrt2Level(0);
-        if (pyramid_sqrt2_[level] == NULL) {
-          const int new_width =
-              (static_cast<int>(upper_level.GetWidth() / sqrtf(2)) + 1) / 2 * 2;
-          const int new_height =
-              (static_cast<int>(upper_level.GetHeight() / sqrtf(2)) + 1) / 2 *
-              2;
-
-          pyramid_sqrt2_[level] = new Image<uint8_t>(new_width, new_height);
-        }
         pyramid_sqrt2_[level]->DownsampleInterpolateLinear(upper_level);
       } else {
         const Image<uint8_t>& upper_level = *GetPyramidSqrt2Level(level - 2);
-        if (pyramid_sqrt2_[level] == NULL) {
-          pyramid_sqrt2_[level] = new Image<uint8_t>(
-              upper_level.GetWidth() / 2, upper_level.GetHeight() / 2);
-        }
         pyramid_sqrt2_[level]->DownsampleAveraged(
             upper_level.data(), upper_level.stride(), 2);
       }
@@ -160,24 +320,18 @@ class ImageData {
     return pyramid_sqrt2_[level];
   }
 
-  inline const Image<int32_t>* GetSpatialX(const int level) const {
+  inline const Image<int16_t>* GetSpatialX(const int level) const {
     if (!spatial_x_computed_[level]) {
       const Image<uint8_t>& src = *GetPyramidSqrt2Level(level * 2);
-      if (spatial_x_[level] == NULL) {
-        spatial_x_[level] = new Image<int32_t>(src.GetWidth(), src.GetHeight());
-      }
       spatial_x_[level]->DerivativeX(src);
       spatial_x_computed_[level] = true;
     }
     return spatial_x_[level];
   }
 
-  inline const Image<int32_t>* GetSpatialY(const int level) const {
+  inline const Image<int16_t>* GetSpatialY(const int level) const {
     if (!spatial_y_computed_[level]) {
       const Image<uint8_t>& src = *GetPyramidSqrt2Level(level * 2);
-      if (spatial_y_[level] == NULL) {
-        spatial_y_[level] = new Image<int32_t>(src.GetWidth(), src.GetHeight());
-      }
       spatial_y_[level]->DerivativeY(src);
       spatial_y_computed_[level] = true;
     }
@@ -185,14 +339,12 @@ class ImageData {
   }
 
   // The integral image is currently only used for object detection, so lazily
-  // initialize it on request.
+  // compute it on request.
   inline const IntegralImage* GetIntegralImage() const {
-    if (integral_image_.get() == NULL) {
-      integral_image_.reset(new IntegralImage(image_));
-    } else if (!integral_image_computed_) {
-      integral_image_->Recompute(image_);
+    if (!integral_image_computed_) {
+      integral_image_->Recompute(*pyramid_sqrt2_[0]);
+      integral_image_computed_ = true;
     }
-    integral_image_computed_ = true;
     return integral_image_.get();
   }
 
@@ -206,8 +358,53 @@ class ImageData {
     return v_data_.get();
   }
 
+  // Computes every pyramid level, the spatial derivatives and the integral
+  // image up front rather than lazily. If a worker pool is given, the odd
+  // sqrt2 levels, the derivatives of each level and the integral image are
+  // computed on it as soon as their source level is ready, while the calling
+  // thread works down the even levels. Returns once everything is computed.
+  void Precompute(WorkerPool* const pool = NULL) {
+    if (pool == NULL) {
+      PrecomputeSerial();
+      return;
+    }
+
+    // The integral image, the odd level chain, and X and Y for every level.
+    BlockingCounter pending(2 + 2 * kNumPyramidLevels);
+
+    pool->Schedule([this, &pending]() {
+      (void) GetIntegralImage();
+      pending.DecrementCount();
+    });
+
+    // Each odd level only depends on the one two above it, and the first one
+    // on level 0, so they form a chain independent of the even levels.
+    pool->Schedule([this, &pending]() {
+      for (int i = 1; i < kNumPyramidLevels * 2; i += 2) {
+        (void) GetPyramidSqrt2Level(i);
+      }
+      pending.DecrementCount();
+    });
+
+    for (int i = 0; i < kNumPyramidLevels; ++i) {
+      (void) GetPyramidSqrt2Level(i * 2);
+
+      pool->Schedule([this, i, &pending]() {
+        (void) GetSpatialX(i);
+        pending.DecrementCount();
+      });
+      pool->Schedule([this, i, &pending]() {
+        (void) GetSpatialY(i);
+        pending.DecrementCount();
+      });
+    }
+
+    pending.Wait();
+    TimeLog("Precomputed in parallel");
+  }
+
  private:
-  void Precompute() {
+  void PrecomputeSerial() {
     // Create the smoothed pyramids.
     for (int i = 0; i < kNumPyramidLevels * 2; i += 2) {
       (void) GetPyramidSqrt2Level(i);
@@ -236,25 +433,30 @@ class ImageData {
 
   int64_t timestamp_;
 
-  Image<uint8_t> image_;
+  // Backs every image below. arena_ is the aligned start of arena_storage_.
+  std::unique_ptr<uint8_t[]> arena_storage_;
+  uint8_t* arena_;
+  size_t arena_size_;
 
   bool uv_data_computed_;
   std::unique_ptr<Image<uint8_t> > u_data_;
   std::unique_ptr<Image<uint8_t> > v_data_;
 
+  // Derivatives of the uint8_t levels lie within [-255, 255], so int16_t holds
+  // them exactly at half the size of int32_t.
   mutable bool spatial_x_computed_[kNumPyramidLevels];
-  mutable Image<int32_t>* spatial_x_[kNumPyramidLevels];
+  Image<int16_t>* spatial_x_[kNumPyramidLevels];
 
   mutable bool spatial_y_computed_[kNumPyramidLevels];
-  mutable Image<int32_t>* spatial_y_[kNumPyramidLevels];
+  Image<int16_t>* spatial_y_[kNumPyramidLevels];
 
   // Mutable so the lazy initialization can work when this class is const.
   // Whether or not the integral image has been computed for the current image.
   mutable bool integral_image_computed_;
-  mutable std::unique_ptr<IntegralImage> integral_image_;
+  std::unique_ptr<IntegralImage> integral_image_;
 
   mutable bool pyramid_sqrt2_computed_[kNumPyramidLevels * 2];
-  mutable Image<uint8_t>* pyramid_sqrt2_[kNumPyramidLevels * 2];
+  Image<uint8_t>* pyramid_sqrt2_[kNumPyramidLevels * 2];
 
   TF_DISALLOW_COPY_AND_ASSIGN(ImageData);
 };
@@ -27,6 +27,8 @@ limitations under the License.
 #include "image_utils.h"
 #include "utils.h"
 
+#include "config.h"
+
 namespace tf_tracking {
 
 // This function does the bulk of the work.
@@ -237,9 +239,9 @@ void CalculateGNeon(const float* const vals_x, const float* const vals_y,
     yy = vmlaq_f32(yy, y, y);
   }
 
-  static float32_t xx_vals[4];
-  static float32_t xy_vals[4];
-  static float32_t yy_vals[4];
+  float32_t xx_vals[4];
+  float32_t xy_vals[4];
+  float32_t yy_vals[4];
 
   vst1q_f32(xx_vals, xx);
   vst1q_f32(xy_vals, xy);
@@ -264,6 +266,50 @@ void CalculateGNeon(const float* const vals_x, const float* const vals_y,
   G[2] = G[1];
 }
 
+
+// Lanes set where three consecutive of the four compass masks are set.
+static inline uint8x16_t ThreeOfFourConsecutive(
+    const uint8x16_t a0, const uint8x16_t a1,
+    const uint8x16_t a2, const uint8x16_t a3) {
+  return vorrq_u8(vandq_u8(vandq_u8(a1, a2), vorrq_u8(a0, a3)),
+                  vandq_u8(vandq_u8(a3, a0), vorrq_u8(a1, a2)));
+}
+
+uint32_t FastCompassMaskNeon(const uint8_t* const center, const int stride) {
+  const uint8x16_t diff_amount = vdupq_n_u8(kFastDiffAmount);
+
+  // The saturated thresholds can only be crossed when the unsaturated
+  // difference would be.
+  const uint8x16_t c = vld1q_u8(center);
+  const uint8x16_t above_threshold = vqaddq_u8(c, diff_amount);
+  const uint8x16_t below_threshold = vqsubq_u8(c, diff_amount);
+
+  const uint8_t* const compass[] = {center - 3, center - 3 * stride,
+                                    center + 3, center + 3 * stride};
+  uint8x16_t above[4];
+  uint8x16_t below[4];
+  for (int i = 0; i < 4; ++i) {
+    const uint8x16_t p = vld1q_u8(compass[i]);
+    above[i] = vcgtq_u8(p, above_threshold);
+    below[i] = vcltq_u8(p, below_threshold);
+  }
+
+  const uint8x16_t pass = vorrq_u8(
+      ThreeOfFourConsecutive(above[0], above[1], above[2], above[3]),
+      ThreeOfFourConsecutive(below[0], below[1], below[2], below[3]));
+
+  // Gather one bit per lane: weight each half's lanes by 1..128, then
+  // pairwise add down to one byte per half.
+  static const uint8_t kLaneBits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                        1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t bits = vandq_u8(pass, vld1q_u8(kLaneBits));
+  uint8x8_t sums = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+  sums = vpadd_u8(sums, sums);
+  sums = vpadd_u8(sums, sums);
+  return vget_lane_u8(sums, 0) |
+         (static_cast<uint32_t>(vget_lane_u8(sums, 1)) << 8);
+}
+
 }  // namespace tf_tracking
 
 #endif
@@ -26,21 +26,35 @@ limitations under the License.
 
 namespace tf_tracking {
 
-inline void GetUV(const uint8_t* const input, Image<uint8_t>* const u,
-                  Image<uint8_t>* const v) {
-  const uint8_t* pUV = input;
+// Fills u and v from a pair of chroma planes of plane_width x plane_height
+// samples, using nearest neighbor lookups if the sizes differ. Samples within
+// a row are pixel_stride bytes apart (2 for interleaved NV21/NV12 data, 1 for
+// planar data) and rows are row_stride bytes apart.
+inline void GetUV(const uint8_t* const u_plane, const uint8_t* const v_plane,
+                  const int row_stride, const int pixel_stride,
+                  const int plane_width, const int plane_height,
+                  Image<uint8_t>* const u, Image<uint8_t>* const v) {
+  const int width = u->GetWidth();
+  const int height = u->GetHeight();
+
+  for (int row = 0; row < height; ++row) {
+    const int plane_row = row * plane_height / height;
+    const uint8_t* const u_row = u_plane + plane_row * row_stride;
+    const uint8_t* const v_row = v_plane + plane_row * row_stride;
 
-  for (int row = 0; row < u->GetHeight(); ++row) {
     uint8_t* u_curr = (*u)[row];
     uint8_t* v_curr = (*v)[row];
-    for (int col = 0; col < u->GetWidth(); ++col) {
-#ifdef __APPLE__
-      *u_curr++ = *pUV++;
-      *v_curr++ = *pUV++;
-#else
-      *v_curr++ = *pUV++;
-      *u_curr++ = *pUV++;
-#endif
+    if (plane_width == width) {
+      for (int col = 0; col < width; ++col) {
+        *u_curr++ = u_row[col * pixel_stride];
+        *v_curr++ = v_row[col * pixel_stride];
+      }
+    } else {
+      for (int col = 0; col < width; ++col) {
+        const int offset = (col * plane_width / width) * pixel_stride;
+        *u_curr++ = u_row[offset];
+        *v_curr++ = v_row[offset];
+      }
     }
   }
 }
@@ -92,8 +106,42 @@ inline static void MarkImage(const int x, const int y, const int radius,
 void CalculateGNeon(
     const float* const vals_x, const float* const vals_y,
     const int num_vals, float* const G);
+
+// Runs FAST's compass pre-test on the 16 pixels starting at center: a pixel
+// passes if three consecutive of the pixels 3 to its left, above, right and
+// below are all brighter, or all darker, than it by more than
+// kFastDiffAmount. Returns a mask with bit i set iff center[i] passes. The
+// 3 pixels and rows around the 16 must be readable.
+uint32_t FastCompassMaskNeon(const uint8_t* const center, const int stride);
 #endif
 
+#ifdef TF_TRACKING_X86_SIMD
+void CalculateGSse41(
+    const float* const vals_x, const float* const vals_y,
+    const int num_vals, float* const G);
+
+void CalculateGAvx2(
+    const float* const vals_x, const float* const vals_y,
+    const int num_vals, float* const G);
+
+// x86 versions of FastCompassMaskNeon. The AVX2 one tests 32 pixels.
+uint32_t FastCompassMaskSse41(const uint8_t* const center, const int stride);
+uint32_t FastCompassMaskAvx2(const uint8_t* const center, const int stride);
+#endif
+
+// Non-accelerated version of CalculateG.
+inline void CalculateGCpu(const float* const vals_x, const float* const vals_y,
+                          const int num_vals, float* const G) {
+  for (int i = 0; i < num_vals; ++i) {
+    G[0] += Square(vals_x[i]);
+    G[1] += vals_x[i] * vals_y[i];
+    G[3] += Square(vals_y[i]);
+  }
+
+  // The matrix is symmetric, so this is a given.
+  G[2] = G[1];
+}
+
 // Puts the image gradient matrix about a pixel into the 2x2 float array G.
 // vals_x should be an array of the window x gradient values, whose indices
 // can be in any order but are parallel to the vals_y entries.
@@ -103,17 +151,18 @@ inline void CalculateG(const float* const vals_x, const float* const vals_y,
 #ifdef __ARM_NEON
   CalculateGNeon(vals_x, vals_y, num_vals, G);
   return;
-#endif
-
-  // Non-accelerated version.
-  for (int i = 0; i < num_vals; ++i) {
-    G[0] += Square(vals_x[i]);
-    G[1] += vals_x[i] * vals_y[i];
-    G[3] += Square(vals_y[i]);
+#elif defined(TF_TRACKING_X86_SIMD)
+  const X86SimdLevel level = GetX86SimdLevel();
+  if (level == X86_SIMD_AVX2) {
+    CalculateGAvx2(vals_x, vals_y, num_vals, G);
+    return;
+  } else if (level == X86_SIMD_SSE41) {
+    CalculateGSse41(vals_x, vals_y, num_vals, G);
+    return;
   }
+#endif
 
-  // The matrix is symmetric, so this is a given.
-  G[2] = G[1];
+  CalculateGCpu(vals_x, vals_y, num_vals, G);
 }
 
 inline void CalculateGInt16(const int16_t* const vals_x,
@@ -134,8 +183,8 @@ inline void CalculateGInt16(const int16_t* const vals_x,
 // Puts the image gradient matrix about a pixel into the 2x2 float array G.
 // Looks up interpolated pixels, then calls above method for implementation.
 inline void CalculateG(const int window_radius, const float center_x,
-                       const float center_y, const Image<int32_t>& I_x,
-                       const Image<int32_t>& I_y, float* const G) {
+                       const float center_y, const Image<int16_t>& I_x,
+                       const Image<int16_t>& I_y, float* const G) {
   SCHECK(I_x.ValidPixel(center_x, center_y), "Problem in calculateG!");
 
   // Hardcoded to allow for a max window radius of 5 (9 pixels x 9 pixels).
@@ -147,9 +196,9 @@ inline void CalculateG(const int window_radius, const float center_x,
   static const int kWindowBufferSize =
       (kMaxWindowRadius * 2 + 1) * (kMaxWindowRadius * 2 + 1);
 
-  // Preallocate buffers statically for efficiency.
-  static int16_t vals_x[kWindowBufferSize];
-  static int16_t vals_y[kWindowBufferSize];
+  // Small enough for the stack, which keeps concurrent callers apart.
+  int16_t vals_x[kWindowBufferSize];
+  int16_t vals_y[kWindowBufferSize];
 
   const int src_left_fixed = RealToFixed1616(center_x - window_radius);
   const int src_top_fixed = RealToFixed1616(center_y - window_radius);
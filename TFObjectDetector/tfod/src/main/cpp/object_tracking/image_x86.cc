@@ -0,0 +1,350 @@
+/* Copyright 2016 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// SSE4.1 and AVX2 versions of the NEON Image kernels in image_neon.cc. Control
+// only enters these once GetX86SimdLevel() has confirmed CPU support.
+
+#include "utils.h"
+
+#ifdef TF_TRACKING_X86_SIMD
+
+#include <immintrin.h>
+
+#include <stdint.h>
+
+#include "image-inl.h"
+#include "image.h"
+#include "image_utils.h"
+
+#include "config.h"
+
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+namespace tf_tracking {
+
+// Averages 32 pixels wide by factor rows into 32 / factor output pixels.
+TARGET_SSE41 static inline void Downsample32ColumnsSse41(
+    const uint8_t* const original, const int stride, const int factor,
+    uint8_t* const dst) {
+  const __m128i ones8 = _mm_set1_epi8(1);
+
+  // Pairwise add horizontally, then accumulate down the rows (16 bit to
+  // account for values above 255).
+  __m128i accum1 = _mm_setzero_si128();
+  __m128i accum2 = _mm_setzero_si128();
+  const uint8_t* offset = original;
+  for (int row_num = 0; row_num < factor; ++row_num) {
+    const __m128i curr_data1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(offset));
+    const __m128i curr_data2 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(offset + 16));
+    accum1 = _mm_add_epi16(accum1, _mm_maddubs_epi16(curr_data1, ones8));
+    accum2 = _mm_add_epi16(accum2, _mm_maddubs_epi16(curr_data2, ones8));
+    offset += stride;
+  }
+
+  if (factor == 2) {
+    // Divide by 4 and narrow to 16 output pixels.
+    const __m128i pixels = _mm_packus_epi16(_mm_srli_epi16(accum1, 2),
+                                            _mm_srli_epi16(accum2, 2));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), pixels);
+  } else {
+    // Add and widen neighbouring pairs, divide by 16 and narrow to 8 output
+    // pixels.
+    const __m128i ones16 = _mm_set1_epi16(1);
+    const __m128i sums1 = _mm_srli_epi32(_mm_madd_epi16(accum1, ones16), 4);
+    const __m128i sums2 = _mm_srli_epi32(_mm_madd_epi16(accum2, ones16), 4);
+    const __m128i words = _mm_packs_epi32(sums1, sums2);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst),
+                     _mm_packus_epi16(words, words));
+  }
+}
+
+// Averages 64 pixels wide by factor rows into 64 / factor output pixels.
+TARGET_AVX2 static inline void Downsample64ColumnsAvx2(
+    const uint8_t* const original, const int stride, const int factor,
+    uint8_t* const dst) {
+  const __m256i ones8 = _mm256_set1_epi8(1);
+
+  __m256i accum1 = _mm256_setzero_si256();
+  __m256i accum2 = _mm256_setzero_si256();
+  const uint8_t* offset = original;
+  for (int row_num = 0; row_num < factor; ++row_num) {
+    const __m256i curr_data1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offset));
+    const __m256i curr_data2 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offset + 32));
+    accum1 = _mm256_add_epi16(accum1, _mm256_maddubs_epi16(curr_data1, ones8));
+    accum2 = _mm256_add_epi16(accum2, _mm256_maddubs_epi16(curr_data2, ones8));
+    offset += stride;
+  }
+
+  // AVX2 packs within each 128 bit lane, so the 64 bit quarters of every
+  // packed result come out in the order 0, 2, 1, 3 and need permuting back.
+  if (factor == 2) {
+    const __m256i pixels =
+        _mm256_packus_epi16(_mm256_srli_epi16(accum1, 2),
+                            _mm256_srli_epi16(accum2, 2));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                        _mm256_permute4x64_epi64(pixels, 0xD8));
+  } else {
+    const __m256i ones16 = _mm256_set1_epi16(1);
+    const __m256i sums1 =
+        _mm256_srli_epi32(_mm256_madd_epi16(accum1, ones16), 4);
+    const __m256i sums2 =
+        _mm256_srli_epi32(_mm256_madd_epi16(accum2, ones16), 4);
+    const __m256i words = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(sums1, sums2), 0xD8);
+    const __m256i pixels = _mm256_permute4x64_epi64(
+        _mm256_packus_epi16(words, words), 0xD8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                     _mm256_castsi256_si128(pixels));
+  }
+}
+
+
+template <>
+void Image<uint8_t>::DownsampleAveragedSse41(const uint8_t* const original,
+                                             const int stride,
+                                             const int factor) {
+  SCHECK(factor == 2 || factor == 4, "Bad factor %d", factor);
+  SCHECK(width_ * factor <= stride, "Uh oh!");
+  SCHECK(width_ * factor >= 32, "Image too narrow: %d", width_);
+
+  // As with NEON, a last pass that doesn't fit is pushed to the left so that
+  // it never goes out of bounds.
+  const int last_starting_index = width_ * factor - 32;
+
+  for (int y = 0; y < height_; ++y) {
+    const uint8_t* const src_row = original + y * factor * stride;
+    uint8_t* const dst_row = (*this)[y];
+
+    int orig_x = 0;
+    for (; orig_x <= last_starting_index; orig_x += 32) {
+      Downsample32ColumnsSse41(src_row + orig_x, stride, factor,
+                               dst_row + orig_x / factor);
+    }
+    if (orig_x < last_starting_index + 32) {
+      Downsample32ColumnsSse41(src_row + last_starting_index, stride, factor,
+                               dst_row + last_starting_index / factor);
+    }
+  }
+}
+
+
+template <>
+void Image<uint8_t>::DownsampleAveragedAvx2(const uint8_t* const original,
+                                            const int stride,
+                                            const int factor) {
+  if (width_ * factor < 64) {
+    DownsampleAveragedSse41(original, stride, factor);
+    return;
+  }
+
+  SCHECK(factor == 2 || factor == 4, "Bad factor %d", factor);
+  SCHECK(width_ * factor <= stride, "Uh oh!");
+
+  const int last_starting_index = width_ * factor - 64;
+
+  for (int y = 0; y < height_; ++y) {
+    const uint8_t* const src_row = original + y * factor * stride;
+    uint8_t* const dst_row = (*this)[y];
+
+    int orig_x = 0;
+    for (; orig_x <= last_starting_index; orig_x += 64) {
+      Downsample64ColumnsAvx2(src_row + orig_x, stride, factor,
+                              dst_row + orig_x / factor);
+    }
+    if (orig_x < last_starting_index + 64) {
+      Downsample64ColumnsAvx2(src_row + last_starting_index, stride, factor,
+                              dst_row + last_starting_index / factor);
+    }
+  }
+}
+
+
+// Puts the image gradient matrix about a pixel into the 2x2 float array G.
+// See CalculateGNeon for details.
+TARGET_SSE41 void CalculateGSse41(const float* const vals_x,
+                                  const float* const vals_y,
+                                  const int num_vals, float* const G) {
+  // Running sums.
+  __m128 xx = _mm_setzero_ps();
+  __m128 xy = _mm_setzero_ps();
+  __m128 yy = _mm_setzero_ps();
+
+  // Process values 4 at a time, accumulating the sums of
+  // the pixel-wise x*x, x*y, and y*y values.
+  int i = 0;
+  for (; i <= num_vals - 4; i += 4) {
+    const __m128 x = _mm_loadu_ps(vals_x + i);
+    const __m128 y = _mm_loadu_ps(vals_y + i);
+
+    xx = _mm_add_ps(xx, _mm_mul_ps(x, x));
+    xy = _mm_add_ps(xy, _mm_mul_ps(x, y));
+    yy = _mm_add_ps(yy, _mm_mul_ps(y, y));
+  }
+
+  float xx_vals[4];
+  float xy_vals[4];
+  float yy_vals[4];
+
+  _mm_storeu_ps(xx_vals, xx);
+  _mm_storeu_ps(xy_vals, xy);
+  _mm_storeu_ps(yy_vals, yy);
+
+  // Accumulated values are stored in sets of 4, we have to manually add
+  // the last bits together.
+  for (int j = 0; j < 4; ++j) {
+    G[0] += xx_vals[j];
+    G[1] += xy_vals[j];
+    G[3] += yy_vals[j];
+  }
+
+  // Finishes off last few values (< 4) from above.
+  for (; i < num_vals; ++i) {
+    G[0] += Square(vals_x[i]);
+    G[1] += vals_x[i] * vals_y[i];
+    G[3] += Square(vals_y[i]);
+  }
+
+  // The matrix is symmetric, so this is a given.
+  G[2] = G[1];
+}
+
+
+TARGET_AVX2 void CalculateGAvx2(const float* const vals_x,
+                                const float* const vals_y,
+                                const int num_vals, float* const G) {
+  __m256 xx = _mm256_setzero_ps();
+  __m256 xy = _mm256_setzero_ps();
+  __m256 yy = _mm256_setzero_ps();
+
+  // Process values 8 at a time.
+  int i = 0;
+  for (; i <= num_vals - 8; i += 8) {
+    const __m256 x = _mm256_loadu_ps(vals_x + i);
+    const __m256 y = _mm256_loadu_ps(vals_y + i);
+
+    xx = _mm256_add_ps(xx, _mm256_mul_ps(x, x));
+    xy = _mm256_add_ps(xy, _mm256_mul_ps(x, y));
+    yy = _mm256_add_ps(yy, _mm256_mul_ps(y, y));
+  }
+
+  float xx_vals[8];
+  float xy_vals[8];
+  float yy_vals[8];
+
+  _mm256_storeu_ps(xx_vals, xx);
+  _mm256_storeu_ps(xy_vals, xy);
+  _mm256_storeu_ps(yy_vals, yy);
+
+  for (int j = 0; j < 8; ++j) {
+    G[0] += xx_vals[j];
+    G[1] += xy_vals[j];
+    G[3] += yy_vals[j];
+  }
+
+  // Finishes off last few values (< 8) from above.
+  for (; i < num_vals; ++i) {
+    G[0] += Square(vals_x[i]);
+    G[1] += vals_x[i] * vals_y[i];
+    G[3] += Square(vals_y[i]);
+  }
+
+  G[2] = G[1];
+}
+
+// Lanes set where three consecutive of the four compass masks are set.
+TARGET_SSE41 static inline __m128i ThreeOfFourConsecutive(
+    const __m128i a0, const __m128i a1, const __m128i a2, const __m128i a3) {
+  return _mm_or_si128(
+      _mm_and_si128(_mm_and_si128(a1, a2), _mm_or_si128(a0, a3)),
+      _mm_and_si128(_mm_and_si128(a3, a0), _mm_or_si128(a1, a2)));
+}
+
+TARGET_AVX2 static inline __m256i ThreeOfFourConsecutive(
+    const __m256i a0, const __m256i a1, const __m256i a2, const __m256i a3) {
+  return _mm256_or_si256(
+      _mm256_and_si256(_mm256_and_si256(a1, a2), _mm256_or_si256(a0, a3)),
+      _mm256_and_si256(_mm256_and_si256(a3, a0), _mm256_or_si256(a1, a2)));
+}
+
+// There are no unsigned byte comparisons, so everything is biased by 0x80 and
+// compared signed. The saturated center +/- kFastDiffAmount thresholds can
+// only be exceeded when the unsaturated difference would be.
+TARGET_SSE41 uint32_t FastCompassMaskSse41(const uint8_t* const center,
+                                           const int stride) {
+  const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+  const __m128i diff_amount = _mm_set1_epi8(kFastDiffAmount);
+
+  const __m128i c =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(center));
+  const __m128i above_threshold =
+      _mm_xor_si128(_mm_adds_epu8(c, diff_amount), bias);
+  const __m128i below_threshold =
+      _mm_xor_si128(_mm_subs_epu8(c, diff_amount), bias);
+
+  const uint8_t* const compass[] = {center - 3, center - 3 * stride,
+                                    center + 3, center + 3 * stride};
+  __m128i above[4];
+  __m128i below[4];
+  for (int i = 0; i < 4; ++i) {
+    const __m128i p = _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(compass[i])), bias);
+    above[i] = _mm_cmpgt_epi8(p, above_threshold);
+    below[i] = _mm_cmpgt_epi8(below_threshold, p);
+  }
+
+  const __m128i pass = _mm_or_si128(
+      ThreeOfFourConsecutive(above[0], above[1], above[2], above[3]),
+      ThreeOfFourConsecutive(below[0], below[1], below[2], below[3]));
+  return static_cast<uint32_t>(_mm_movemask_epi8(pass));
+}
+
+TARGET_AVX2 uint32_t FastCompassMaskAvx2(const uint8_t* const center,
+                                         const int stride) {
+  const __m256i bias = _mm256_set1_epi8(static_cast<char>(0x80));
+  const __m256i diff_amount = _mm256_set1_epi8(kFastDiffAmount);
+
+  const __m256i c =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(center));
+  const __m256i above_threshold =
+      _mm256_xor_si256(_mm256_adds_epu8(c, diff_amount), bias);
+  const __m256i below_threshold =
+      _mm256_xor_si256(_mm256_subs_epu8(c, diff_amount), bias);
+
+  const uint8_t* const compass[] = {center - 3, center - 3 * stride,
+                                    center + 3, center + 3 * stride};
+  __m256i above[4];
+  __m256i below[4];
+  for (int i = 0; i < 4; ++i) {
+    const __m256i p = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(compass[i])),
+        bias);
+    above[i] = _mm256_cmpgt_epi8(p, above_threshold);
+    below[i] = _mm256_cmpgt_epi8(below_threshold, p);
+  }
+
+  const __m256i pass = _mm256_or_si256(
+      ThreeOfFourConsecutive(above[0], above[1], above[2], above[3]),
+      ThreeOfFourConsecutive(below[0], below[1], below[2], below[3]));
+  return static_cast<uint32_t>(_mm256_movemask_epi8(pass));
+}
+
+}  // namespace tf_tracking
+
+#endif  // TF_TRACKING_X86_SIMD
@@ -35,6 +35,11 @@ class IntegralImage : public Image<uint32_t> {
   IntegralImage(const int width, const int height)
       : Image<uint32_t>(width, height) {}
 
+  // Creates an integral image over preallocated storage, which it doesn't own.
+  IntegralImage(const int width, const int height, const int stride,
+                uint32_t* const data)
+      : Image<uint32_t>(width, height, stride, data, false) {}
+
   void Recompute(const Image<uint8_t>& image_base) {
     SCHECK(image_base.GetWidth() == GetWidth() &&
           image_base.GetHeight() == GetHeight(), "Dimensions don't match!");
@@ -16,6 +16,9 @@ limitations under the License.
 // Various keypoint detecting functions.
 
 #include <float.h>
+#include <stdlib.h>
+
+#include <algorithm>
 
 #include "image-inl.h"
 #include "image.h"
@@ -35,8 +38,8 @@ static inline int GetDistSquaredBetween(const int* vec1, const int* vec2) {
 void KeypointDetector::ScoreKeypoints(const ImageData& image_data,
                                       const int num_candidates,
                                       Keypoint* const candidate_keypoints) {
-  const Image<int>& I_x = *image_data.GetSpatialX(0);
-  const Image<int>& I_y = *image_data.GetSpatialY(0);
+  const Image<int16_t>& I_x = *image_data.GetSpatialX(0);
+  const Image<int16_t>& I_y = *image_data.GetSpatialY(0);
 
   if (config_->detect_skin) {
     const Image<uint8_t>& u_data = *image_data.GetU();
@@ -67,42 +70,74 @@ void KeypointDetector::ScoreKeypoints(const ImageData& image_data,
 }
 
 
-inline int KeypointCompare(const void* const a, const void* const b) {
-  return (reinterpret_cast<const Keypoint*>(a)->score_ -
-          reinterpret_cast<const Keypoint*>(b)->score_) <= 0 ? 1 : -1;
-}
+// Hands out candidate keypoints in order of descending score, only ordering as
+// many of them as are asked for. Building the heap is linear and each keypoint
+// handed out costs one log(n) pop, so picking the few dozen keypoints a frame
+// keeps out of up to a thousand or so candidates costs far less than sorting
+// all of them up front.
+class RankedKeypoints {
+ public:
+  RankedKeypoints(const int num_keypoints, Keypoint* const keypoints)
+      : keypoints_(keypoints),
+        num_keypoints_(num_keypoints),
+        heap_size_(num_keypoints) {
+    std::make_heap(keypoints_, keypoints_ + num_keypoints_, ScoreLess);
+  }
+
+  inline int size() const {
+    return num_keypoints_;
+  }
+
+  // Returns the keypoint with the given rank, 0 being the best scoring one.
+  // Popped keypoints are stacked up from the back of the array, so the ranked
+  // prefix grows backwards as the heap shrinks.
+  inline const Keypoint& Get(const int rank) {
+    SCHECK(rank >= 0 && rank < num_keypoints_,
+          "Rank %d out of range! (%d keypoints)", rank, num_keypoints_);
+    while (num_keypoints_ - heap_size_ <= rank) {
+      std::pop_heap(keypoints_, keypoints_ + heap_size_, ScoreLess);
+      --heap_size_;
+    }
+    return keypoints_[num_keypoints_ - 1 - rank];
+  }
 
+ private:
+  static inline bool ScoreLess(const Keypoint& a, const Keypoint& b) {
+    return a.score_ < b.score_;
+  }
+
+  Keypoint* const keypoints_;
+  const int num_keypoints_;
 
-// Quicksorts detected keypoints by score.
-void KeypointDetector::SortKeypoints(const int num_candidates,
-                                   Keypoint* const candidate_keypoints) const {
-  qsort(candidate_keypoints, num_candidates, sizeof(Keypoint), KeypointCompare);
+  // Keypoints [0, heap_size_) are still unranked.
+  int heap_size_;
 
-#ifdef SANITY_CHECKS
-  // Verify that the array got sorted.
-  float last_score = FLT_MAX;
-  for (int i = 0; i < num_candidates; ++i) {
-    const float curr_score = candidate_keypoints[i].score_;
+  TF_DISALLOW_COPY_AND_ASSIGN(RankedKeypoints);
+};
 
-    // Scores should be monotonically increasing.
-    SCHECK(last_score >= curr_score,
-          "Quicksort failure! %d: %.5f > %d: %.5f (%d total)",
-          i - 1, last_score, i, curr_score, num_candidates);
 
-    last_score = curr_score;
+// Whether a keypoint at (x, y) lies within the circle of the given radius
+// around (center_x, center_y), as MarkImage would rasterize it: a row d_y away
+// from the center is marked out to ceil(sqrt(radius^2 - d_y^2)) either side.
+static inline bool WithinMarkedCircle(const int x, const int y,
+                                      const int center_x, const int center_y,
+                                      const int radius) {
+  const int d_x = abs(x - center_x);
+  const int d_y = abs(y - center_y);
+  if (d_y > radius) {
+    return false;
   }
-#endif
+  return d_x == 0 || Square(d_x - 1) + Square(d_y) < Square(radius);
 }
 
 
 int KeypointDetector::SelectKeypointsInBox(
     const BoundingBox& box,
-    const Keypoint* const candidate_keypoints,
-    const int num_candidates,
+    RankedKeypoints* const candidates,
     const int max_keypoints,
     const int num_existing_keypoints,
     const Keypoint* const existing_keypoints,
-    Keypoint* const final_keypoints) const {
+    Keypoint* const final_keypoints) {
   if (max_keypoints <= 0) {
     return 0;
   }
@@ -112,38 +147,103 @@ int KeypointDetector::SelectKeypointsInBox(
   const int distance =
       MAX(1, MIN(box.GetWidth(), box.GetHeight()) * kClosestPercent / 2.0f);
 
-  // First, mark keypoints that already happen to be inside this region. Ignore
-  // keypoints that are outside it, however close they might be.
-  interest_map_->Clear(false);
+  // Keypoints already placed in the box are bucketed into a grid over it whose
+  // cells are at least distance wide, so only the cell a candidate falls in and
+  // the eight around it need checking for anything too close.
+  const int image_width = config_->image_size.width;
+  const int image_height = config_->image_size.height;
+  const int grid_left = Clip(static_cast<int>(floorf(box.left_)),
+                             0, image_width - 1);
+  const int grid_top = Clip(static_cast<int>(floorf(box.top_)),
+                            0, image_height - 1);
+  const int grid_width =
+      Clip(static_cast<int>(box.right_), 0, image_width - 1) - grid_left + 1;
+  const int grid_height =
+      Clip(static_cast<int>(box.bottom_), 0, image_height - 1) - grid_top + 1;
+
+  int cell_size = distance;
+  int num_cells_x = grid_width / cell_size + 1;
+  int num_cells_y = grid_height / cell_size + 1;
+  while (num_cells_x * num_cells_y > kMaxSpacingGridCells) {
+    cell_size *= 2;
+    num_cells_x = grid_width / cell_size + 1;
+    num_cells_y = grid_height / cell_size + 1;
+  }
+  for (int i = 0; i < num_cells_x * num_cells_y; ++i) {
+    grid_heads_[i] = -1;
+  }
+
+  int* const placed_x = placed_x_.get();
+  int* const placed_y = placed_y_.get();
+  int* const next_in_cell = next_placed_in_cell_.get();
+  int num_placed = 0;
+
+  const auto get_cell = [&](const int x, const int y) {
+    const int cell_x = Clip((x - grid_left) / cell_size, 0, num_cells_x - 1);
+    const int cell_y = Clip((y - grid_top) / cell_size, 0, num_cells_y - 1);
+    return cell_y * num_cells_x + cell_x;
+  };
+
+  const auto place = [&](const int x, const int y) {
+    SCHECK(num_placed < config_->max_keypoints,
+          "Too many keypoints in box! %d", num_placed);
+    const int cell = get_cell(x, y);
+    placed_x[num_placed] = x;
+    placed_y[num_placed] = y;
+    next_in_cell[num_placed] = grid_heads_[cell];
+    grid_heads_[cell] = num_placed;
+    ++num_placed;
+  };
+
+  const auto is_crowded = [&](const int x, const int y) {
+    const int cell = get_cell(x, y);
+    const int cell_x = cell % num_cells_x;
+    const int cell_y = cell / num_cells_x;
+    for (int c_y = MAX(cell_y - 1, 0);
+         c_y <= MIN(cell_y + 1, num_cells_y - 1); ++c_y) {
+      for (int c_x = MAX(cell_x - 1, 0);
+           c_x <= MIN(cell_x + 1, num_cells_x - 1); ++c_x) {
+        for (int i = grid_heads_[c_y * num_cells_x + c_x]; i >= 0;
+             i = next_in_cell[i]) {
+          if (WithinMarkedCircle(x, y, placed_x[i], placed_y[i], distance)) {
+            return true;
+          }
+        }
+      }
+    }
+    return false;
+  };
+
+  // First, place keypoints that already happen to be inside this region.
+  // Ignore keypoints that are outside it, however close they might be.
   for (int i = 0; i < num_existing_keypoints; ++i) {
     const Keypoint& candidate = existing_keypoints[i];
-
-    const int x_pos = candidate.pos_.x;
-    const int y_pos = candidate.pos_.y;
     if (box.Contains(candidate.pos_)) {
-      MarkImage(x_pos, y_pos, distance, interest_map_.get());
+      place(candidate.pos_.x, candidate.pos_.y);
     }
   }
 
-  // Now, go through and check which keypoints will still fit in the box.
+  // Now, go through the candidates best first and check which will still fit
+  // in the box.
   int num_keypoints_selected = 0;
-  for (int i = 0; i < num_candidates; ++i) {
-    const Keypoint& candidate = candidate_keypoints[i];
+  for (int i = 0; i < candidates->size(); ++i) {
+    const Keypoint& candidate = candidates->Get(i);
 
     const int x_pos = candidate.pos_.x;
     const int y_pos = candidate.pos_.y;
 
     if (!box.Contains(candidate.pos_) ||
-        !interest_map_->ValidPixel(x_pos, y_pos)) {
+        x_pos < 0 || x_pos >= image_width ||
+        y_pos < 0 || y_pos >= image_height) {
       continue;
     }
 
-    if (!(*interest_map_)[y_pos][x_pos]) {
+    if (!is_crowded(x_pos, y_pos)) {
       final_keypoints[num_keypoints_selected++] = candidate;
       if (num_keypoints_selected >= max_keypoints) {
         break;
       }
-      MarkImage(x_pos, y_pos, distance, interest_map_.get());
+      place(x_pos, y_pos);
     }
   }
   return num_keypoints_selected;
@@ -152,9 +252,8 @@ int KeypointDetector::SelectKeypointsInBox(
 
 void KeypointDetector::SelectKeypoints(
     const std::vector<BoundingBox>& boxes,
-    const Keypoint* const candidate_keypoints,
-    const int num_candidates,
-    FramePair* const curr_change) const {
+    RankedKeypoints* const candidates,
+    FramePair* const curr_change) {
   // Now select all the interesting keypoints that fall insider our boxes.
   curr_change->number_of_keypoints_ = 0;
   for (std::vector<BoundingBox>::const_iterator iter = boxes.begin();
@@ -171,13 +270,12 @@ void KeypointDetector::SelectKeypoints(
     }
 
     const int max_keypoints_to_find_in_box =
-        MIN(kMaxKeypointsForObject - num_keypoints_already_in_box,
-            kMaxKeypoints - curr_change->number_of_keypoints_);
+        MIN(config_->max_keypoints_per_object - num_keypoints_already_in_box,
+            config_->max_keypoints - curr_change->number_of_keypoints_);
 
     const int num_new_keypoints_in_box = SelectKeypointsInBox(
         bounding_box,
-        candidate_keypoints,
-        num_candidates,
+        candidates,
         max_keypoints_to_find_in_box,
         curr_change->number_of_keypoints_,
         curr_change->frame1_keypoints_,
@@ -273,8 +371,8 @@ inline int TestCircle(const int circle_perimeter, const int threshold,
 
 // Returns a score in the range [0.0, positive infinity) which represents the
 // relative likelihood of a point being a corner.
-float KeypointDetector::HarrisFilter(const Image<int32_t>& I_x,
-                                     const Image<int32_t>& I_y, const float x,
+float KeypointDetector::HarrisFilter(const Image<int16_t>& I_x,
+                                     const Image<int16_t>& I_y, const float x,
                                      const float y) const {
   if (I_x.ValidInterpPixel(x - kHarrisWindowSize, y - kHarrisWindowSize) &&
       I_x.ValidInterpPixel(x + kHarrisWindowSize, y + kHarrisWindowSize)) {
@@ -328,54 +426,57 @@ void KeypointDetector::FindKeypoints(const ImageData& image_data,
                                    const std::vector<BoundingBox>& rois,
                                    const FramePair& prev_change,
                                    FramePair* const curr_change) {
+  Keypoint* const tmp_keypoints = tmp_keypoints_.get();
+
   // Copy keypoints from second frame of last pass to temp keypoints of this
   // pass.
-  int number_of_tmp_keypoints = CopyKeypoints(prev_change, tmp_keypoints_);
+  int number_of_tmp_keypoints = CopyKeypoints(prev_change, tmp_keypoints);
 
-  const int max_num_fast = kMaxTempKeypoints - number_of_tmp_keypoints;
+  const int max_num_fast =
+      config_->max_candidate_keypoints - number_of_tmp_keypoints;
   number_of_tmp_keypoints +=
       FindFastKeypoints(image_data, max_num_fast,
-                       tmp_keypoints_ + number_of_tmp_keypoints);
+                       tmp_keypoints + number_of_tmp_keypoints);
 
   TimeLog("Found FAST keypoints");
 
-  if (number_of_tmp_keypoints >= kMaxTempKeypoints) {
+  if (number_of_tmp_keypoints >= config_->max_candidate_keypoints) {
     LOGW("Hit cap of %d for temporary keypoints (FAST)! %d keypoints",
-         kMaxTempKeypoints, number_of_tmp_keypoints);
+         config_->max_candidate_keypoints, number_of_tmp_keypoints);
   }
 
   if (kAddArbitraryKeypoints) {
     // Add some for each object prior to scoring.
     const int max_num_box_keypoints =
-        kMaxTempKeypoints - number_of_tmp_keypoints;
+        config_->max_candidate_keypoints - number_of_tmp_keypoints;
     number_of_tmp_keypoints +=
         AddExtraCandidatesForBoxes(rois, max_num_box_keypoints,
-                                   tmp_keypoints_ + number_of_tmp_keypoints);
+                                   tmp_keypoints + number_of_tmp_keypoints);
     TimeLog("Added box keypoints");
 
-    if (number_of_tmp_keypoints >= kMaxTempKeypoints) {
+    if (number_of_tmp_keypoints >= config_->max_candidate_keypoints) {
       LOGW("Hit cap of %d for temporary keypoints (boxes)! %d keypoints",
-           kMaxTempKeypoints, number_of_tmp_keypoints);
+           config_->max_candidate_keypoints, number_of_tmp_keypoints);
     }
   }
 
   // Score them...
   LOGV("Scoring %d keypoints!", number_of_tmp_keypoints);
-  ScoreKeypoints(image_data, number_of_tmp_keypoints, tmp_keypoints_);
+  ScoreKeypoints(image_data, number_of_tmp_keypoints, tmp_keypoints);
   TimeLog("Scored keypoints");
 
   // Now pare it down a bit.
-  SortKeypoints(number_of_tmp_keypoints, tmp_keypoints_);
-  TimeLog("Sorted keypoints");
+  RankedKeypoints candidates(number_of_tmp_keypoints, tmp_keypoints);
+  TimeLog("Ranked keypoints");
 
   LOGV("%d keypoints to select from!", number_of_tmp_keypoints);
 
-  SelectKeypoints(rois, tmp_keypoints_, number_of_tmp_keypoints, curr_change);
+  SelectKeypoints(rois, &candidates, curr_change);
   TimeLog("Selected keypoints");
 
   LOGV("Picked %d (%d max) final keypoints out of %d potential.",
        curr_change->number_of_keypoints_,
-       kMaxKeypoints, number_of_tmp_keypoints);
+       config_->max_keypoints, number_of_tmp_keypoints);
 }
 
 
@@ -430,7 +531,7 @@ int KeypointDetector::FindFastKeypoints(const Image<uint8_t>& frame,
   // Precompute image offsets.
   int short_offsets[short_circle_perimeter];
   for (int i = 0; i < short_circle_perimeter; ++i) {
-    short_offsets[i] = short_circle_x[i] + short_circle_y[i] * frame.GetWidth();
+    short_offsets[i] = short_circle_x[i] + short_circle_y[i] * frame.stride();
   }
 
   // Large circle values.
@@ -444,10 +545,10 @@ int KeypointDetector::FindFastKeypoints(const Image<uint8_t>& frame,
   // Precompute image offsets.
   int full_offsets[full_circle_perimeter];
   for (int i = 0; i < full_circle_perimeter; ++i) {
-    full_offsets[i] = full_circle_x[i] + full_circle_y[i] * frame.GetWidth();
+    full_offsets[i] = full_circle_x[i] + full_circle_y[i] * frame.stride();
   }
 
-  const int scratch_stride = frame.stride();
+  const int scratch_stride = keypoint_scratch_->stride();
 
   keypoint_scratch_->Clear(0);
 
@@ -461,35 +562,70 @@ int KeypointDetector::FindFastKeypoints(const Image<uint8_t>& frame,
   const int end_x = start_x + quadrant_width;
   const int end_y = start_y + quadrant_height;
 
+  // Runs the full test on a pixel that passed the short test, and if it is a
+  // keypoint, increases the keypoint count on it and the pixels in all 4
+  // cardinal directions.
+  const auto mark_if_keypoint = [&](const int img_x, const int img_y) {
+    const int fast_score = TestCircle(full_circle_perimeter,
+                                      full_threshold,
+                                      frame[img_y] + img_x,
+                                      full_offsets);
+
+    // Non-zero score means the keypoint was found.
+    if (fast_score != 0) {
+      uint8_t* const center_ptr = (*keypoint_scratch_)[img_y] + img_x;
+      *center_ptr += 5;
+      *(center_ptr - 1) += 1;
+      *(center_ptr + 1) += 1;
+      *(center_ptr - scratch_stride) += 1;
+      *(center_ptr + scratch_stride) += 1;
+    }
+  };
+
+  // The short test, being a fixed pattern of four compass points, can be run
+  // on a whole vector of pixels at once. Only the few that pass it go on to
+  // the full test. kFastBorderBuffer leaves room for the vector loads.
+#ifdef __ARM_NEON
+  const int simd_width = 16;
+#elif defined(TF_TRACKING_X86_SIMD)
+  const X86SimdLevel simd_level = GetX86SimdLevel();
+  const int simd_width = simd_level == X86_SIMD_AVX2 ? 32 :
+                         simd_level == X86_SIMD_SSE41 ? 16 : 0;
+#else
+  const int simd_width = 0;
+#endif
+
   // Loop through once to find FAST keypoint clumps.
   for (int img_y = start_y; img_y < end_y; ++img_y) {
-    const uint8_t* curr_pixel_ptr = frame[img_y] + start_x;
+    const uint8_t* const row = frame[img_y];
+    int img_x = start_x;
+
+    if (simd_width > 0) {
+      for (; img_x + simd_width <= end_x; img_x += simd_width) {
+#ifdef __ARM_NEON
+        uint32_t mask = FastCompassMaskNeon(row + img_x, frame.stride());
+#elif defined(TF_TRACKING_X86_SIMD)
+        uint32_t mask = simd_width == 32 ?
+            FastCompassMaskAvx2(row + img_x, frame.stride()) :
+            FastCompassMaskSse41(row + img_x, frame.stride());
+#else
+        uint32_t mask = 0;
+#endif
+        while (mask != 0) {
+          const int lane = __builtin_ctz(mask);
+          mask &= mask - 1;
+          mark_if_keypoint(img_x + lane, img_y);
+        }
+      }
+    }
 
-    for (int img_x = start_x; img_x < end_x; ++img_x) {
+    for (; img_x < end_x; ++img_x) {
       // Only insert it if it meets the quick minimum requirements test.
       if (TestCircle(short_circle_perimeter, short_threshold,
-                     curr_pixel_ptr, short_offsets) != 0) {
+                     row + img_x, short_offsets) != 0) {
         // Longer test for actual keypoint score..
-        const int fast_score = TestCircle(full_circle_perimeter,
-                                          full_threshold,
-                                          curr_pixel_ptr,
-                                          full_offsets);
-
-        // Non-zero score means the keypoint was found.
-        if (fast_score != 0) {
-          uint8_t* const center_ptr = (*keypoint_scratch_)[img_y] + img_x;
-
-          // Increase the keypoint count on this pixel and the pixels in all
-          // 4 cardinal directions.
-          *center_ptr += 5;
-          *(center_ptr - 1) += 1;
-          *(center_ptr + 1) += 1;
-          *(center_ptr - scratch_stride) += 1;
-          *(center_ptr + scratch_stride) += 1;
-        }
+        mark_if_keypoint(img_x, img_y);
       }
-
-      ++curr_pixel_ptr;
     }  // x
   }  // y
 
@@ -16,7 +16,10 @@ limitations under the License.
 #ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_KEYPOINT_DETECTOR_H_
 #define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_KEYPOINT_DETECTOR_H_
 
+#include <stddef.h>
 #include <stdint.h>
+
+#include <memory>
 #include <vector>
 
 #include "image-inl.h"
@@ -27,15 +30,24 @@ limitations under the License.
 namespace tf_tracking {
 
 struct Keypoint;
+class RankedKeypoints;
 
 class KeypointDetector {
  public:
   explicit KeypointDetector(const KeypointDetectorConfig* const config)
       : config_(config),
         keypoint_scratch_(new Image<uint8_t>(config_->image_size)),
-        interest_map_(new Image<bool>(config_->image_size)),
-        fast_quadrant_(0) {
-    interest_map_->Clear(false);
+        fast_quadrant_(0),
+        tmp_keypoints_(new Keypoint[config_->max_candidate_keypoints]),
+        placed_x_(new int[config_->max_keypoints]),
+        placed_y_(new int[config_->max_keypoints]),
+        next_placed_in_cell_(new int[config_->max_keypoints]) {}
+
+  // Bytes a KeypointDetector allocates for the given config.
+  static size_t GetStorageSize(const KeypointDetectorConfig& config) {
+    return config.image_size.width * config.image_size.height +
+           config.max_candidate_keypoints * sizeof(Keypoint) +
+           config.max_keypoints * 3 * sizeof(int);
   }
 
   ~KeypointDetector() {}
@@ -51,7 +63,7 @@ class KeypointDetector {
 
  private:
   // Compute the corneriness of a point in the image.
-  float HarrisFilter(const Image<int32_t>& I_x, const Image<int32_t>& I_y,
+  float HarrisFilter(const Image<int16_t>& I_x, const Image<int16_t>& I_y,
                      const float x, const float y) const;
 
   // Adds a grid of candidate keypoints to the given box, up to
@@ -78,29 +90,24 @@ class KeypointDetector {
                       const int num_candidates,
                       Keypoint* const candidate_keypoints);
 
-  void SortKeypoints(const int num_candidates,
-                    Keypoint* const candidate_keypoints) const;
-
   // Selects a set of keypoints falling within the supplied box such that the
   // most highly rated keypoints are picked first, and so that none of them are
   // too close together.
   int SelectKeypointsInBox(
       const BoundingBox& box,
-      const Keypoint* const candidate_keypoints,
-      const int num_candidates,
+      RankedKeypoints* const candidates,
       const int max_keypoints,
       const int num_existing_keypoints,
       const Keypoint* const existing_keypoints,
-      Keypoint* const final_keypoints) const;
+      Keypoint* const final_keypoints);
 
-  // Selects from the supplied sorted keypoint pool a set of keypoints that will
-  // best cover the given set of boxes, such that each box is covered at a
+  // Selects from the ranked keypoint pool a set of keypoints that will best
+  // cover the given set of boxes, such that each box is covered at a
   // resolution proportional to its size.
   void SelectKeypoints(
       const std::vector<BoundingBox>& boxes,
-      const Keypoint* const candidate_keypoints,
-      const int num_candidates,
-      FramePair* const frame_change) const;
+      RankedKeypoints* const candidates,
+      FramePair* const frame_change);
 
   // Copies and compacts the found keypoints in the second frame of prev_change
   // into the array at new_keypoints.
@@ -112,15 +119,23 @@ class KeypointDetector {
   // Scratch memory for keypoint candidacy detection and non-max suppression.
   std::unique_ptr<Image<uint8_t> > keypoint_scratch_;
 
-  // Regions of the image to pay special attention to.
-  std::unique_ptr<Image<bool> > interest_map_;
+  // Heads of the per-cell lists of the spatial grid SelectKeypointsInBox
+  // spaces keypoints out with, or -1 for an empty cell.
+  int grid_heads_[kMaxSpacingGridCells];
 
   // The current quadrant of the image to detect FAST keypoints in.
   // Keypoint detection is staggered for performance reasons. Every four frames
   // a full scan of the frame will have been performed.
   int fast_quadrant_;
 
-  Keypoint tmp_keypoints_[kMaxTempKeypoints];
+  // Room for config_->max_candidate_keypoints candidates.
+  std::unique_ptr<Keypoint[]> tmp_keypoints_;
+
+  // The keypoints placed in the spatial grid, chained per cell, with room for
+  // config_->max_keypoints.
+  std::unique_ptr<int[]> placed_x_;
+  std::unique_ptr<int[]> placed_y_;
+  std::unique_ptr<int[]> next_placed_in_cell_;
 };
 
 }  // namespace tf_tracking
@@ -17,7 +17,11 @@ limitations under the License.
 
 #ifdef STANDALONE_DEMO_LIB
 
+#ifdef __ANDROID__
 #include <android/log.h>
+#endif
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <iostream>
@@ -54,7 +58,11 @@ void LogMessage::GenerateLogMessage() {
   const char* const partial_name = strrchr(fname_, '/');
   ss << (partial_name != nullptr ? partial_name + 1 : fname_) << ":" << line_
      << " " << str();
+#ifdef __ANDROID__
   __android_log_write(android_log_level, "native", ss.str().c_str());
+#else
+  (void) android_log_level;
+#endif
 
   // Also log to stderr (for standalone Android apps).
   std::cerr << "native : " << ss.str() << std::endl;
@@ -131,7 +139,9 @@ void LogPrintF(const int severity, const char* format, ...) {
   va_start(argptr, format);
   vsnprintf(message, 1024, format, argptr);
   va_end(argptr);
+#ifdef __ANDROID__
   __android_log_write(severity, "native", message);
+#endif
 
   // Also log to stderr (for standalone Android apps).
   std::cerr << "native : " << message << std::endl;
@@ -16,7 +16,9 @@ limitations under the License.
 #ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_LOG_STREAMING_H_
 #define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_LOG_STREAMING_H_
 
+#ifdef __ANDROID__
 #include <android/log.h>
+#endif
 #include <string.h>
 #include <ostream>
 #include <sstream>
@@ -41,6 +43,19 @@ limitations under the License.
 #define TF_PREDICT_TRUE(x) (x)
 #endif
 
+#ifndef __ANDROID__
+// Android log priorities, so the printf style macros below still work when
+// building the library for a host machine.
+enum {
+  ANDROID_LOG_VERBOSE = 2,
+  ANDROID_LOG_DEBUG = 3,
+  ANDROID_LOG_INFO = 4,
+  ANDROID_LOG_WARN = 5,
+  ANDROID_LOG_ERROR = 6,
+  ANDROID_LOG_FATAL = 7
+};
+#endif
+
 // Log levels equivalent to those defined by
 // third_party/tensorflow/core/platform/logging.h
 const int INFO = 0;            // base_logging::INFO;
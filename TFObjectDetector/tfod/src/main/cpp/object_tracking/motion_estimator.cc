@@ -0,0 +1,273 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <math.h>
+#include <string.h>
+
+#include "config.h"
+#include "logging.h"
+#include "motion_estimator.h"
+
+namespace tf_tracking {
+
+namespace {
+
+// Twice the area a three point sample must span to be fit, so that nearly
+// collinear samples, which determine the motion badly, are skipped.
+const float kMinSampleArea = 64.0f;
+
+// Correspondences further than this many inlier thresholds from the motion
+// get no weight when refining it.
+const float kTukeyScale = 2.0f;
+
+// Solves a * x = b0 and a * y = b1 for the 3x3 matrix a, stored row-wise.
+// Returns false if a is singular.
+bool Solve3x3(const double* const a, const double* const b0,
+              const double* const b1, double* const x, double* const y) {
+  const double cofactor[9] = {
+      a[4] * a[8] - a[5] * a[7],
+      a[5] * a[6] - a[3] * a[8],
+      a[3] * a[7] - a[4] * a[6],
+      a[2] * a[7] - a[1] * a[8],
+      a[0] * a[8] - a[2] * a[6],
+      a[1] * a[6] - a[0] * a[7],
+      a[1] * a[5] - a[2] * a[4],
+      a[2] * a[3] - a[0] * a[5],
+      a[0] * a[4] - a[1] * a[3]};
+  const double det =
+      a[0] * cofactor[0] + a[1] * cofactor[1] + a[2] * cofactor[2];
+  const double scale = fabs(a[0] * a[4] * a[8]) + fabs(a[1] * a[5] * a[6]) +
+                       fabs(a[2] * a[3] * a[7]);
+  if (fabs(det) <= 1e-9 * scale || det == 0.0) {
+    return false;
+  }
+
+  // The inverse is the transposed cofactor matrix over the determinant.
+  for (int row = 0; row < 3; ++row) {
+    x[row] = (cofactor[row] * b0[0] + cofactor[row + 3] * b0[1] +
+              cofactor[row + 6] * b0[2]) / det;
+    y[row] = (cofactor[row] * b1[0] + cofactor[row + 3] * b1[1] +
+              cofactor[row + 6] * b1[2]) / det;
+  }
+  return true;
+}
+
+}  // namespace
+
+MotionEstimator::MotionEstimator(const int max_points)
+    : max_points_(max_points),
+      storage_(new float[max_points * kNumFields]),
+      x1_(storage_.get()),
+      y1_(x1_ + max_points),
+      x2_(y1_ + max_points),
+      y2_(x2_ + max_points),
+      weights_(y2_ + max_points),
+      num_points_(0),
+      num_inliers_(0),
+      random_state_(kRandomNumberSeed) {}
+
+uint32_t MotionEstimator::NextRandom() {
+  // A linear congruential generator, using the better mixed high bits.
+  random_state_ = random_state_ * 1664525u + 1013904223u;
+  return random_state_ >> 8;
+}
+
+bool MotionEstimator::FitWeighted(const float* const weights,
+                                  double* const matrix23) const {
+  // Normal equations for each row of the matrix, which share their left hand
+  // side.
+  double normal[9] = {0.0};
+  double rhs_x[3] = {0.0};
+  double rhs_y[3] = {0.0};
+  for (int i = 0; i < num_points_; ++i) {
+    const double w = weights[i];
+    if (w <= 0.0) {
+      continue;
+    }
+    const double x = x1_[i];
+    const double y = y1_[i];
+    normal[0] += w * x * x;
+    normal[1] += w * x * y;
+    normal[2] += w * x;
+    normal[4] += w * y * y;
+    normal[5] += w * y;
+    normal[8] += w;
+    rhs_x[0] += w * x * x2_[i];
+    rhs_x[1] += w * y * x2_[i];
+    rhs_x[2] += w * x2_[i];
+    rhs_y[0] += w * x * y2_[i];
+    rhs_y[1] += w * y * y2_[i];
+    rhs_y[2] += w * y2_[i];
+  }
+  normal[3] = normal[1];
+  normal[6] = normal[2];
+  normal[7] = normal[5];
+
+  return Solve3x3(normal, rhs_x, rhs_y, matrix23, matrix23 + 3);
+}
+
+bool MotionEstimator::FitSample(const int a, const int b, const int c,
+                                double* const matrix23) const {
+  const float area = (x1_[b] - x1_[a]) * (y1_[c] - y1_[a]) -
+                     (x1_[c] - x1_[a]) * (y1_[b] - y1_[a]);
+  if (fabs(area) < kMinSampleArea) {
+    return false;
+  }
+
+  const double points[9] = {x1_[a], y1_[a], 1.0,
+                            x1_[b], y1_[b], 1.0,
+                            x1_[c], y1_[c], 1.0};
+  const double targets_x[3] = {x2_[a], x2_[b], x2_[c]};
+  const double targets_y[3] = {y2_[a], y2_[b], y2_[c]};
+  return Solve3x3(points, targets_x, targets_y, matrix23, matrix23 + 3);
+}
+
+float MotionEstimator::ScoreMotion(const double* const matrix23,
+                                   int* const num_inliers) const {
+  const float threshold_squared = Square(kMotionInlierThreshold);
+  float cost = 0.0f;
+  int count = 0;
+  for (int i = 0; i < num_points_; ++i) {
+    const float residual = SquaredResidual(matrix23, i);
+    if (residual < threshold_squared) {
+      cost += residual;
+      ++count;
+    } else {
+      cost += threshold_squared;
+    }
+  }
+  *num_inliers = count;
+  return cost;
+}
+
+bool MotionEstimator::EstimateAffine(const FramePair& frame_pair,
+                                     float* const matrix23) {
+  SCHECK(frame_pair.number_of_keypoints_ <= max_points_,
+         "Too many keypoints! %d vs %d", frame_pair.number_of_keypoints_,
+         max_points_);
+
+  num_points_ = 0;
+  num_inliers_ = 0;
+  for (int i = 0; i < frame_pair.number_of_keypoints_; ++i) {
+    if (frame_pair.optical_flow_found_keypoint_[i]) {
+      x1_[num_points_] = frame_pair.frame1_keypoints_[i].pos_.x;
+      y1_[num_points_] = frame_pair.frame1_keypoints_[i].pos_.y;
+      x2_[num_points_] = frame_pair.frame2_keypoints_[i].pos_.x;
+      y2_[num_points_] = frame_pair.frame2_keypoints_[i].pos_.y;
+      ++num_points_;
+    }
+  }
+
+  if (num_points_ < kMinMotionInliers) {
+    LOGV("Only %d correspondences, not estimating motion.", num_points_);
+    return false;
+  }
+
+  // Reseeding each time keeps the result a function of the correspondences
+  // alone.
+  random_state_ = kRandomNumberSeed;
+
+  double best_motion[6];
+  float best_cost = 0.0f;
+  int best_inliers = 0;
+  bool have_motion = false;
+  for (int i = 0; i < kNumMotionHypotheses; ++i) {
+    const int a = NextRandom() % num_points_;
+    int b = NextRandom() % (num_points_ - 1);
+    b += b >= a ? 1 : 0;
+    int c = NextRandom() % (num_points_ - 2);
+    c += c >= MIN(a, b) ? 1 : 0;
+    c += c >= MAX(a, b) ? 1 : 0;
+
+    double motion[6];
+    if (!FitSample(a, b, c, motion)) {
+      continue;
+    }
+
+    int num_inliers;
+    const float cost = ScoreMotion(motion, &num_inliers);
+    if (!have_motion || cost < best_cost) {
+      memcpy(best_motion, motion, sizeof(best_motion));
+      best_cost = cost;
+      best_inliers = num_inliers;
+      have_motion = true;
+    }
+  }
+
+  if (!have_motion || best_inliers < kMinMotionInliers) {
+    LOGV("No motion found for %d correspondences.", num_points_);
+    return false;
+  }
+
+  // Refine the best hypothesis against all the correspondences, giving those
+  // far from it less and less say.
+  const float tukey_squared = Square(kTukeyScale * kMotionInlierThreshold);
+  for (int iteration = 0; iteration < kNumMotionRefinementIterations;
+       ++iteration) {
+    for (int i = 0; i < num_points_; ++i) {
+      const float residual = SquaredResidual(best_motion, i);
+      weights_[i] = residual < tukey_squared ?
+          Square(1.0f - residual / tukey_squared) : 0.0f;
+    }
+
+    double refined[6];
+    if (!FitWeighted(weights_, refined)) {
+      break;
+    }
+    int num_inliers;
+    const float cost = ScoreMotion(refined, &num_inliers);
+    if (cost > best_cost) {
+      break;
+    }
+    memcpy(best_motion, refined, sizeof(best_motion));
+    best_cost = cost;
+    best_inliers = num_inliers;
+  }
+  num_inliers_ = best_inliers;
+
+  if (num_inliers_ < kMinMotionInliers ||
+      num_inliers_ < kMinMotionInlierFraction * num_points_) {
+    LOGV("Motion only explains %d of %d correspondences.", num_inliers_,
+         num_points_);
+    return false;
+  }
+
+  if (fabs(best_motion[0] - 1.0) > kMaxMotionDeformation ||
+      fabs(best_motion[1]) > kMaxMotionDeformation ||
+      fabs(best_motion[3]) > kMaxMotionDeformation ||
+      fabs(best_motion[4] - 1.0) > kMaxMotionDeformation) {
+    LOGV("Implausible motion [%.3f %.3f; %.3f %.3f].", best_motion[0],
+         best_motion[1], best_motion[3], best_motion[4]);
+    return false;
+  }
+
+  for (int i = 0; i < 6; ++i) {
+    matrix23[i] = static_cast<float>(best_motion[i]);
+  }
+  return true;
+}
+
+void MotionEstimator::ScaleMotion(const float* const matrix23,
+                                  const float ratio,
+                                  float* const scaled_matrix23) {
+  scaled_matrix23[0] = 1.0f + ratio * (matrix23[0] - 1.0f);
+  scaled_matrix23[1] = ratio * matrix23[1];
+  scaled_matrix23[2] = ratio * matrix23[2];
+  scaled_matrix23[3] = ratio * matrix23[3];
+  scaled_matrix23[4] = 1.0f + ratio * (matrix23[4] - 1.0f);
+  scaled_matrix23[5] = ratio * matrix23[5];
+}
+
+}  // namespace tf_tracking
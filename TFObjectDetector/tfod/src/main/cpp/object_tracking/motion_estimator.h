@@ -0,0 +1,119 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_MOTION_ESTIMATOR_H_
+#define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_MOTION_ESTIMATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "utils.h"
+
+#include "frame_pair.h"
+
+namespace tf_tracking {
+
+// Estimates the motion of the whole frame from the keypoint correspondences of
+// a FramePair, as a 2x3 affine matrix stored row-wise that maps positions in
+// frame 1 to positions in frame 2, the same form FlowCache takes as its
+// full-frame alignment matrix.
+//
+// Correspondences on moving objects or found wrongly by the optical flow are
+// outliers, so the fit is robust: RANSAC over random three point samples picks
+// the motion most correspondences agree with, which is then refined by
+// iteratively reweighted least squares with Tukey weights. Sampling uses a
+// fixed seed, so the same correspondences always give the same motion.
+class MotionEstimator {
+ public:
+  explicit MotionEstimator(const int max_points);
+
+  // Bytes a MotionEstimator of the given capacity allocates.
+  static size_t GetStorageSize(const int max_points) {
+    return static_cast<size_t>(max_points) * kNumFields * sizeof(float);
+  }
+
+  // Fits the motion of the found correspondences of frame_pair into
+  // matrix23. Returns true iff enough of them agree with it, within the
+  // thresholds in config.h, for it to be trusted. matrix23 is only written on
+  // success.
+  bool EstimateAffine(const FramePair& frame_pair, float* const matrix23);
+
+  // The number of correspondences the last estimated motion explained, and
+  // how many were found.
+  inline int GetNumInliers() const {
+    return num_inliers_;
+  }
+
+  inline int GetNumPoints() const {
+    return num_points_;
+  }
+
+  // Extrapolates motion, which took one frame interval, over ratio of that
+  // interval, scaling its departure from the identity, so that the motion of
+  // the last frame pair can predict that of the next one.
+  static void ScaleMotion(const float* const matrix23, const float ratio,
+                          float* const scaled_matrix23);
+
+ private:
+  // x and y in frame 1, x and y in frame 2, and the weight.
+  static const int kNumFields = 5;
+
+  // Fits the motion to the correspondences with the given weights, some of
+  // which may be 0. Returns false if they do not determine one.
+  bool FitWeighted(const float* const weights, double* const matrix23) const;
+
+  // Fits the motion to correspondences a, b and c exactly.
+  bool FitSample(const int a, const int b, const int c,
+                 double* const matrix23) const;
+
+  // Returns the squared distance from where matrix23 maps correspondence i to
+  // where it was found.
+  inline float SquaredResidual(const double* const matrix23,
+                               const int i) const {
+    const double dx = matrix23[0] * x1_[i] + matrix23[1] * y1_[i] +
+                      matrix23[2] - x2_[i];
+    const double dy = matrix23[3] * x1_[i] + matrix23[4] * y1_[i] +
+                      matrix23[5] - y2_[i];
+    return static_cast<float>(dx * dx + dy * dy);
+  }
+
+  // Returns the MSAC cost of matrix23, the sum of the squared residuals with
+  // those of outliers capped at the inlier threshold, and counts the inliers.
+  float ScoreMotion(const double* const matrix23, int* const num_inliers) const;
+
+  uint32_t NextRandom();
+
+  const int max_points_;
+
+  std::unique_ptr<float[]> storage_;
+  float* const x1_;
+  float* const y1_;
+  float* const x2_;
+  float* const y2_;
+  float* const weights_;
+
+  int num_points_;
+  int num_inliers_;
+
+  uint32_t random_state_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(MotionEstimator);
+};
+
+}  // namespace tf_tracking
+
+#endif  // TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_MOTION_ESTIMATOR_H_
@@ -48,6 +48,9 @@ namespace tf_tracking {
 // an object. It is not a specific instance of the object in the world,
 // but just the general appearance information that enables detection. An
 // ObjectModelBase can be reused across multiple-instances of TrackedObjects.
+//
+// A tracker with worker threads tracks its objects concurrently, so the models
+// of different objects may be asked to TrackStep() and score at the same time.
 class ObjectModelBase {
  public:
   ObjectModelBase(const std::string& name) : name_(name) {}
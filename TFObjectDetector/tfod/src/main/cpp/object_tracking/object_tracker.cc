@@ -18,6 +18,8 @@ limitations under the License.
 #include <GLES/glext.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <map>
 
@@ -45,114 +47,365 @@ ObjectTracker::ObjectTracker(const TrackerConfig* const config,
       frame_height_(config->image_size.height),
       curr_time_(0),
       num_frames_(0),
+      num_objects_(0),
       flow_cache_(&config->flow_config),
       keypoint_detector_(&config->keypoint_detector_config),
-      curr_num_frame_pairs_(0),
-      first_frame_index_(0),
       frame1_(new ImageData(frame_width_, frame_height_)),
       frame2_(new ImageData(frame_width_, frame_height_)),
+      frame_history_(kNumFrames,
+                     config->keypoint_detector_config.max_keypoints),
+      retained_frames_(config->num_retained_frames, frame_width_,
+                       frame_height_),
+      adjust_box_scratch_(config->keypoint_detector_config.max_keypoints),
+      motion_estimator_(config->keypoint_detector_config.max_keypoints),
+      have_frame_motion_(false),
       detector_(detector),
-      num_detected_(0) {
-  for (int i = 0; i < kNumFrames; ++i) {
+      num_detected_(0),
+      published_snapshots_(config->max_published_objects),
+      publish_scratch_(new ObjectSnapshot[config->max_published_objects]),
+      draw_scratch_(new ObjectSnapshot[config->max_published_objects]),
+      num_frames_in_flight_(0),
+      last_submitted_timestamp_(0),
+      last_tracked_timestamp_(0) {
+  const KeypointDetectorConfig& keypoint_config =
+      config->keypoint_detector_config;
+  CHECK_ALWAYS(keypoint_config.max_keypoints > 0 &&
+               keypoint_config.max_keypoints_per_object > 0,
+               "Invalid keypoint capacities! %d total, %d per object",
+               keypoint_config.max_keypoints,
+               keypoint_config.max_keypoints_per_object);
+  // Last frame's keypoints are always candidates again.
+  CHECK_ALWAYS(
+      keypoint_config.max_candidate_keypoints >= keypoint_config.max_keypoints,
+      "Need room for at least %d candidate keypoints, have %d",
+      keypoint_config.max_keypoints, keypoint_config.max_candidate_keypoints);
+
+  for (size_t i = 0; i < NELEMS(frame_pairs_); ++i) {
+    frame_pairs_[i].Allocate(keypoint_config.max_keypoints);
     frame_pairs_[i].Init(-1, -1);
   }
+  correspondence_scratch_.reset(new float[keypoint_config.max_keypoints * 4]);
+
+  if (config->num_worker_threads > 0) {
+    LOGI("Using %d worker threads.", config->num_worker_threads);
+    worker_pool_.reset(new WorkerPool(config->num_worker_threads));
+
+    // The calling thread takes a range of objects too.
+    for (int i = 0; i <= config->num_worker_threads; ++i) {
+      object_scratch_.push_back(std::unique_ptr<AdjustBoxScratch>(
+          new AdjustBoxScratch(keypoint_config.max_keypoints)));
+    }
+  }
 }
 
 
 ObjectTracker::~ObjectTracker() {
-  for (TrackedObjectMap::iterator iter = objects_.begin();
-       iter != objects_.end(); iter++) {
-    TrackedObject* object = iter->second;
-    SAFE_DELETE(object);
+  // Finish tracking any submitted frames before tearing anything down.
+  pipeline_.reset();
+
+  for (size_t i = 0; i < objects_.size(); ++i) {
+    SAFE_DELETE(objects_[i]);
   }
 }
 
 
+TrackerMemoryUsage ObjectTracker::GetMemoryUsage(const TrackerConfig& config) {
+  const KeypointDetectorConfig& keypoint_config =
+      config.keypoint_detector_config;
+  const size_t frame_size = ImageData::GetStorageSize(
+      config.image_size.width, config.image_size.height);
+
+  TrackerMemoryUsage usage;
+  usage.frame_pairs =
+      2 * FramePair::GetStorageSize(keypoint_config.max_keypoints) +
+      keypoint_config.max_keypoints * 4 * sizeof(float) +
+      MotionEstimator::GetStorageSize(keypoint_config.max_keypoints);
+  usage.frame_history =
+      FrameHistory::GetStorageSize(kNumFrames, keypoint_config.max_keypoints) +
+      (config.num_worker_threads > 0 ? config.num_worker_threads + 2 : 1) *
+          AdjustBoxScratch::GetStorageSize(keypoint_config.max_keypoints);
+  usage.keypoint_detector = KeypointDetector::GetStorageSize(keypoint_config);
+  usage.frames = 2 * frame_size;
+  usage.spare_frames = config.max_frames_in_flight * frame_size;
+  usage.retained_frames =
+      FrameRing::GetStorageSize(config.num_retained_frames,
+                                config.image_size.width,
+                                config.image_size.height);
+  return usage;
+}
+
+
 // Finds the correspondences for all the points in the current pair of frames.
 // Stores the results in the given FramePair.
 void ObjectTracker::FindCorrespondences(FramePair* const frame_pair) const {
   // Keypoints aren't found until they're found.
   memset(frame_pair->optical_flow_found_keypoint_, false,
-         sizeof(*frame_pair->optical_flow_found_keypoint_) * kMaxKeypoints);
+         sizeof(*frame_pair->optical_flow_found_keypoint_) *
+             frame_pair->GetMaxKeypoints());
   TimeLog("Cleared old found keypoints");
 
-  int num_keypoints_found = 0;
+  const int num_keypoints = frame_pair->number_of_keypoints_;
 
-  // For every keypoint...
-  for (int i_feat = 0; i_feat < frame_pair->number_of_keypoints_; ++i_feat) {
-    Keypoint* const keypoint1 = frame_pair->frame1_keypoints_ + i_feat;
-    Keypoint* const keypoint2 = frame_pair->frame2_keypoints_ + i_feat;
+  // Gather the keypoints so the flow cache can work on all of them at once.
+  const int max_keypoints = frame_pair->GetMaxKeypoints();
+  float* const x_in = correspondence_scratch_.get();
+  float* const y_in = x_in + max_keypoints;
+  for (int i_feat = 0; i_feat < num_keypoints; ++i_feat) {
+    const Keypoint& keypoint1 = frame_pair->frame1_keypoints_[i_feat];
+    x_in[i_feat] = keypoint1.pos_.x;
+    y_in[i_feat] = keypoint1.pos_.y;
+  }
 
-    if (flow_cache_.FindNewPositionOfPoint(
-        keypoint1->pos_.x, keypoint1->pos_.y,
-        &keypoint2->pos_.x, &keypoint2->pos_.y)) {
-      frame_pair->optical_flow_found_keypoint_[i_feat] = true;
-      ++num_keypoints_found;
+  float* const x_out = y_in + max_keypoints;
+  float* const y_out = x_out + max_keypoints;
+  flow_cache_.FindNewPositionsOfPoints(
+      num_keypoints, x_in, y_in, x_out, y_out,
+      frame_pair->optical_flow_found_keypoint_, worker_pool_.get());
+
+  for (int i_feat = 0; i_feat < num_keypoints; ++i_feat) {
+    if (frame_pair->optical_flow_found_keypoint_[i_feat]) {
+      Keypoint* const keypoint2 = frame_pair->frame2_keypoints_ + i_feat;
+      keypoint2->pos_.x = x_out[i_feat];
+      keypoint2->pos_.y = y_out[i_feat];
     }
   }
 
   TimeLog("Found correspondences");
 
   LOGV("Found %d of %d keypoint correspondences",
-       num_keypoints_found, frame_pair->number_of_keypoints_);
+       static_cast<int>(std::count(
+           frame_pair->optical_flow_found_keypoint_,
+           frame_pair->optical_flow_found_keypoint_ + num_keypoints, true)),
+       num_keypoints);
 }
 
-void ObjectTracker::NextFrame(const uint8_t* const new_frame,
-                              const uint8_t* const uv_frame,
+void ObjectTracker::NextFrame(const FramePlanes& planes,
                               const int64_t timestamp,
                               const float* const alignment_matrix_2x3) {
-  IncrementFrameIndex();
+  WaitForAllFrames();
+
+  ScopedStageTimer frame_timer(&stage_latencies_, TRACKER_STAGE_NEXT_FRAME);
+
+  {
+    ScopedStageTimer timer(&stage_latencies_, TRACKER_STAGE_PYRAMID);
+    // frame1_ holds the oldest frame, which is about to become frame2_.
+    frame1_->SetData(planes, timestamp);
+
+    if (worker_pool_ != NULL) {
+      frame1_->Precompute(worker_pool_.get());
+    }
+  }
+
+  // Swap the frames.
+  frame1_.swap(frame2_);
+
+  TrackFrame(timestamp, alignment_matrix_2x3);
+
+  std::lock_guard<std::mutex> lock(pipeline_mutex_);
+  last_submitted_timestamp_ = timestamp;
+  last_tracked_timestamp_ = timestamp;
+}
+
+void ObjectTracker::SubmitFrame(const FramePlanes& planes,
+                                const int64_t timestamp,
+                                const float* const alignment_matrix_2x3) {
+  const int64_t submit_time = CurrentRealTimeNanos();
+
+  std::unique_ptr<ImageData> new_frame;
+  {
+    std::unique_lock<std::mutex> lock(pipeline_mutex_);
+    CHECK_ALWAYS(last_submitted_timestamp_ < timestamp,
+                 "Timestamp must monotonically increase! Went from %lld to "
+                 "%lld.", last_submitted_timestamp_, timestamp);
+    last_submitted_timestamp_ = timestamp;
+
+    if (pipeline_ == NULL) {
+      LOGI("Pipelining up to %d frames.", config_->max_frames_in_flight);
+      CHECK_ALWAYS(config_->max_frames_in_flight > 0,
+                   "Need at least one frame in flight, got %d",
+                   config_->max_frames_in_flight);
+      for (int i = 0; i < config_->max_frames_in_flight; ++i) {
+        spare_frames_.push_back(std::unique_ptr<ImageData>(
+            new ImageData(frame_width_, frame_height_)));
+      }
+      pipeline_.reset(new WorkerPool(1));
+    }
+
+    while (spare_frames_.empty()) {
+      pipeline_cond_.wait(lock);
+    }
+    new_frame = std::move(spare_frames_.front());
+    spare_frames_.pop_front();
+    ++num_frames_in_flight_;
+  }
+
+  {
+    ScopedStageTimer timer(&stage_latencies_, TRACKER_STAGE_PYRAMID);
+    new_frame->SetData(planes, timestamp);
+
+    // Build the whole pyramid now, so the pipeline thread never has to.
+    new_frame->Precompute(worker_pool_.get());
+  }
+
+  const bool have_matrix = alignment_matrix_2x3 != NULL;
+  float matrix[6];
+  if (have_matrix) {
+    memcpy(matrix, alignment_matrix_2x3, sizeof(matrix));
+  }
+
+  ImageData* const frame = new_frame.release();
+  pipeline_->Schedule([this, frame, timestamp, have_matrix, matrix,
+                       submit_time]() {
+    TrackSubmittedFrame(frame, timestamp, have_matrix ? matrix : NULL,
+                        submit_time);
+  });
+}
+
+void ObjectTracker::TrackSubmittedFrame(ImageData* const new_frame,
+                                        const int64_t timestamp,
+                                        const float* const alignment_matrix_2x3,
+                                        const int64_t submit_time) {
+  std::unique_ptr<ImageData> stale_frame(new_frame);
+  frame1_.swap(frame2_);
+  frame2_.swap(stale_frame);
+
+  // The oldest frame can be refilled right away. The flow cache and detector
+  // still point at it, but are moved on to frame2_ before they next read it.
+  {
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+    spare_frames_.push_back(std::move(stale_frame));
+  }
+  pipeline_cond_.notify_all();
+
+  TrackFrame(timestamp, alignment_matrix_2x3);
+
+  // For submitted frames the whole-frame stage covers everything from the
+  // SubmitFrame() call, including any time spent waiting in the queue.
+  stage_latencies_.Record(TRACKER_STAGE_NEXT_FRAME,
+                          CurrentRealTimeNanos() - submit_time);
+
+  {
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+    --num_frames_in_flight_;
+    last_tracked_timestamp_ = timestamp;
+  }
+  pipeline_cond_.notify_all();
+}
+
+int64_t ObjectTracker::GetLastTrackedTimestamp() const {
+  std::lock_guard<std::mutex> lock(pipeline_mutex_);
+  return last_tracked_timestamp_;
+}
+
+void ObjectTracker::WaitForFrame(const int64_t timestamp) const {
+  std::unique_lock<std::mutex> lock(pipeline_mutex_);
+  CHECK_ALWAYS(timestamp <= last_submitted_timestamp_,
+               "Frame %lld was never submitted!", timestamp);
+  while (last_tracked_timestamp_ < timestamp) {
+    pipeline_cond_.wait(lock);
+  }
+}
+
+void ObjectTracker::WaitForAllFrames() const {
+  std::unique_lock<std::mutex> lock(pipeline_mutex_);
+  while (num_frames_in_flight_ > 0) {
+    pipeline_cond_.wait(lock);
+  }
+}
+
+void ObjectTracker::TrackFrame(const int64_t timestamp,
+                               const float* const alignment_matrix_2x3) {
+  ++num_frames_;
   LOGV("Received frame %d", num_frames_);
 
-  FramePair* const curr_change = frame_pairs_ + GetNthIndexFromEnd(0);
+  FramePair* const curr_change = GetCurrentFramePair();
   curr_change->Init(curr_time_, timestamp);
 
   CHECK_ALWAYS(curr_time_ < timestamp,
                "Timestamp must monotonically increase! Went from %lld to %lld"
                " on frame %d.",
                curr_time_, timestamp, num_frames_);
-  curr_time_ = timestamp;
 
-  // Swap the frames.
-  frame1_.swap(frame2_);
+  // Without a matrix from the caller, assume the last frame pair's motion
+  // carries on at the same rate, unless too much time has passed since.
+  const float* flow_matrix = alignment_matrix_2x3;
+  float predicted_motion[6];
+  if (flow_matrix == NULL && have_frame_motion_) {
+    const FramePair& last_change = GetPreviousFramePair();
+    const float ratio =
+        static_cast<float>(timestamp - last_change.end_time_) /
+        (last_change.end_time_ - last_change.start_time_);
+    if (ratio <= kMaxMotionExtrapolation) {
+      MotionEstimator::ScaleMotion(frame_motion_, ratio, predicted_motion);
+      flow_matrix = predicted_motion;
+    }
+  }
+  have_frame_motion_ = false;
 
-  frame2_->SetData(new_frame, uv_frame, frame_width_, timestamp, 1);
+  frame_history_.Add(curr_time_, timestamp);
+  curr_time_ = timestamp;
 
   if (detector_.get() != NULL) {
     detector_->SetImageData(frame2_.get());
   }
 
-  flow_cache_.NextFrame(frame2_.get(), alignment_matrix_2x3);
+  flow_cache_.NextFrame(frame2_.get(), flow_matrix);
+  retained_frames_.Add(timestamp, *frame2_->GetImage());
 
   if (num_frames_ == 1) {
     // This must be the first frame, so abort.
+    PublishSnapshots();
     return;
   }
 
-  if (config_->always_track || objects_.size() > 0) {
-    LOGV("Tracking %zu targets", objects_.size());
-    ComputeKeypoints(true);
+  if (config_->always_track || num_objects_ > 0) {
+    LOGV("Tracking %d targets", num_objects_);
+    {
+      ScopedStageTimer timer(&stage_latencies_, TRACKER_STAGE_KEYPOINTS);
+      ComputeKeypoints(true);
+    }
     TimeLog("Keypoints computed!");
 
-    FindCorrespondences(curr_change);
+    {
+      ScopedStageTimer timer(&stage_latencies_, TRACKER_STAGE_FLOW);
+      FindCorrespondences(curr_change);
+      frame_history_.SetLatestCorrespondences(*curr_change);
+      if (config_->estimate_global_motion) {
+        have_frame_motion_ =
+            motion_estimator_.EstimateAffine(*curr_change, frame_motion_);
+      }
+    }
     TimeLog("Flow computed!");
 
-    TrackObjects();
+    {
+      ScopedStageTimer timer(&stage_latencies_, TRACKER_STAGE_TRACK_OBJECTS);
+      TrackObjects();
+    }
   }
   TimeLog("Targets tracked!");
 
   if (detector_.get() != NULL && num_frames_ % kDetectEveryNFrames == 0) {
+    ScopedStageTimer timer(&stage_latencies_, TRACKER_STAGE_DETECT_TARGETS);
     DetectTargets();
   }
   TimeLog("Detected objects.");
+
+  PublishSnapshots();
+}
+
+void ObjectTracker::PublishSnapshots() {
+  const int num_objects = GetObjectSnapshots(
+      publish_scratch_.get(), published_snapshots_.GetCapacity());
+  published_snapshots_.Publish(publish_scratch_.get(), num_objects, curr_time_);
 }
 
-TrackedObject* ObjectTracker::MaybeAddObject(
+ObjectHandle ObjectTracker::MaybeAddObject(
     const std::string& id, const Image<uint8_t>& source_image,
     const BoundingBox& bounding_box, const ObjectModelBase* object_model) {
   // Train the detector if this is a new object.
-  if (objects_.find(id) != objects_.end()) {
-    return objects_[id];
+  const ObjectHandle existing_handle = GetObjectHandle(id);
+  if (existing_handle != kInvalidObjectHandle) {
+    return existing_handle;
   }
 
   // Need to get a non-const version of the model, or create a new one if it
@@ -166,11 +419,28 @@ TrackedObject* ObjectTracker::MaybeAddObject(
   TrackedObject* const object =
       new TrackedObject(id, source_image, bounding_box, model);
 
-  objects_[id] = object;
-  return object;
+  int slot;
+  if (!free_slots_.empty()) {
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+    const int generation =
+        ((slot_handles_[slot] >> kObjectHandleSlotBits) + 1) &
+        kObjectHandleGenerationMask;
+    slot_handles_[slot] = (generation << kObjectHandleSlotBits) | slot;
+  } else {
+    slot = static_cast<int>(objects_.size());
+    CHECK_ALWAYS(slot <= kObjectHandleSlotMask, "Too many objects! %d", slot);
+    objects_.push_back(NULL);
+    slot_handles_.push_back(slot);
+  }
+  objects_[slot] = object;
+  const ObjectHandle handle = slot_handles_[slot];
+  ++num_objects_;
+  object_handles_[id] = handle;
+  return handle;
 }
 
-void ObjectTracker::RegisterNewObjectWithAppearance(
+ObjectHandle ObjectTracker::RegisterNewObjectWithAppearance(
     const std::string& id, const uint8_t* const new_frame,
     const BoundingBox& bounding_box) {
   ObjectModelBase* object_model = NULL;
@@ -188,52 +458,154 @@ void ObjectTracker::RegisterNewObjectWithAppearance(
 
   // Create an object at this position.
   CHECK_ALWAYS(!HaveObject(id), "Already have this object!");
-  if (objects_.find(id) == objects_.end()) {
-    TrackedObject* const object =
-        MaybeAddObject(id, image, bounding_box, object_model);
-    CHECK_ALWAYS(object != NULL, "Object not created!");
+  const ObjectHandle handle =
+      MaybeAddObject(id, image, bounding_box, object_model);
+  PublishSnapshots();
+  return handle;
+}
+
+const ImageData* ObjectTracker::GetRetainedFrame(
+    const int64_t timestamp) const {
+  // Both frames are only filled once two frames have been tracked.
+  if (timestamp <= 0) {
+    return NULL;
+  }
+  const ImageData* const frames[] = {frame2_.get(), frame1_.get()};
+  for (size_t i = 0; i < NELEMS(frames); ++i) {
+    if (static_cast<int64_t>(frames[i]->GetTimestamp()) == timestamp) {
+      return frames[i];
+    }
+  }
+  return NULL;
+}
+
+bool ObjectTracker::RegisterNewObjectsInFrame(
+    const int64_t timestamp, const std::vector<std::string>& ids,
+    const std::vector<BoundingBox>& positions,
+    std::vector<ObjectHandle>* const handles) {
+  CHECK_ALWAYS(ids.size() == positions.size(),
+               "Got %zu ids for %zu positions", ids.size(), positions.size());
+  // The current and previous frames come with their integral image, older
+  // ones only with their luminance.
+  const ImageData* const frame = GetRetainedFrame(timestamp);
+  const Image<uint8_t>* const image =
+      frame != NULL ? frame->GetImage() : retained_frames_.Find(timestamp);
+  if (image == NULL) {
+    LOGV("Frame at %lld is no longer retained.",
+         static_cast<long long>(timestamp));
+    return false;
+  }
+
+  const IntegralImage* integral_image = NULL;
+  std::unique_ptr<IntegralImage> retained_integral_image;
+  if (detector_ != NULL && !ids.empty()) {
+    if (frame != NULL) {
+      integral_image = frame->GetIntegralImage();
+    } else {
+      retained_integral_image.reset(new IntegralImage(*image));
+      integral_image = retained_integral_image.get();
+    }
+  }
+
+  handles->resize(ids.size());
+  for (size_t i = 0; i < ids.size(); ++i) {
+    ObjectModelBase* object_model = NULL;
+    if (detector_ != NULL) {
+      object_model = detector_->CreateObjectModel(ids[i]);
+      CHECK_ALWAYS(object_model != NULL, "Null object model!");
+      object_model->TrackStep(positions[i], *image, *integral_image, true);
+    }
+
+    CHECK_ALWAYS(!HaveObject(ids[i]), "Already have this object!");
+    const ObjectHandle handle =
+        MaybeAddObject(ids[i], *image, positions[i], object_model);
+    MoveObjectFromPast(handle, positions[i], timestamp);
+    (*handles)[i] = handle;
   }
+  PublishSnapshots();
+  return true;
 }
 
-void ObjectTracker::SetPreviousPositionOfObject(const std::string& id,
+void ObjectTracker::SetPreviousPositionOfObject(const ObjectHandle handle,
                                                 const BoundingBox& bounding_box,
                                                 const int64_t timestamp) {
+  MoveObjectFromPast(handle, bounding_box, timestamp);
+  PublishSnapshots();
+}
+
+void ObjectTracker::MoveObjectFromPast(const ObjectHandle handle,
+                                       const BoundingBox& bounding_box,
+                                       const int64_t timestamp) {
   CHECK_ALWAYS(timestamp > 0, "Timestamp too low! %lld", timestamp);
   CHECK_ALWAYS(timestamp <= curr_time_,
                "Timestamp too great! %lld vs %lld", timestamp, curr_time_);
 
-  TrackedObject* const object = GetObject(id);
+  TrackedObject* const object = GetObject(handle);
 
   // Track this bounding box from the past to the current time.
   const BoundingBox current_position = TrackBox(bounding_box, timestamp);
 
   object->UpdatePosition(current_position, curr_time_, *frame2_, false);
 
-  VLOG(2) << "Set tracked position for " << id << " to " << bounding_box
-          << std::endl;
+  VLOG(2) << "Set tracked position for " << object->GetName() << " to "
+          << bounding_box << std::endl;
 }
 
 
 void ObjectTracker::SetCurrentPositionOfObject(
-    const std::string& id, const BoundingBox& bounding_box) {
-  SetPreviousPositionOfObject(id, bounding_box, curr_time_);
+    const ObjectHandle handle, const BoundingBox& bounding_box) {
+  SetPreviousPositionOfObject(handle, bounding_box, curr_time_);
 }
 
 
-void ObjectTracker::ForgetTarget(const std::string& id) {
+void ObjectTracker::ForgetTarget(const ObjectHandle handle) {
+  RemoveObject(handle);
+  PublishSnapshots();
+}
+
+void ObjectTracker::RemoveObject(const ObjectHandle handle) {
+  TrackedObject* const object = GetObject(handle);
+  const std::string id = object->GetName();
   LOGV("Forgetting object %s", id.c_str());
-  TrackedObject* const object = GetObject(id);
   delete object;
-  objects_.erase(id);
+  const int slot = handle & kObjectHandleSlotMask;
+  objects_[slot] = NULL;
+  free_slots_.push_back(slot);
+  --num_objects_;
+  object_handles_.erase(id);
 
   if (detector_ != NULL) {
     detector_->DeleteObjectModel(id);
   }
 }
 
+int ObjectTracker::GetObjectSnapshots(ObjectSnapshot* const snapshots,
+                                      const int max_snapshots) const {
+  int num_written = 0;
+  for (size_t i = 0; i < objects_.size() && num_written < max_snapshots;
+       ++i) {
+    const TrackedObject* const object = objects_[i];
+    if (object == NULL) {
+      continue;
+    }
+    const BoundingBox position = object->GetPosition();
+    ObjectSnapshot* const snapshot = snapshots + num_written++;
+    snapshot->handle = slot_handles_[i];
+    snapshot->left = position.left_;
+    snapshot->top = position.top_;
+    snapshot->right = position.right_;
+    snapshot->bottom = position.bottom_;
+    snapshot->correlation = object->GetCorrelation();
+    snapshot->match_score = static_cast<float>(object->GetMatchScore().value);
+    snapshot->visible = object->IsVisible() ? 1 : 0;
+    snapshot->position_time = object->GetPositionTime();
+  }
+  return num_objects_;
+}
+
 int ObjectTracker::GetKeypointsPacked(uint16_t* const out_data,
                                       const float scale) const {
-  const FramePair& change = frame_pairs_[GetNthIndexFromEnd(0)];
+  const FramePair& change = GetCurrentFramePair();
   uint16_t* curr_data = out_data;
   int num_keypoints = 0;
 
@@ -257,7 +629,7 @@ int ObjectTracker::GetKeypointsPacked(uint16_t* const out_data,
 int ObjectTracker::GetKeypoints(const bool only_found,
                                 float* const out_data) const {
   int curr_keypoint = 0;
-  const FramePair& change = frame_pairs_[GetNthIndexFromEnd(0)];
+  const FramePair& change = GetCurrentFramePair();
 
   for (int i = 0; i < change.number_of_keypoints_; ++i) {
     if (!only_found || change.optical_flow_found_keypoint_[i]) {
@@ -282,69 +654,12 @@ int ObjectTracker::GetKeypoints(const bool only_found,
 }
 
 
-BoundingBox ObjectTracker::TrackBox(const BoundingBox& region,
-                                    const FramePair& frame_pair) const {
-  float translation_x;
-  float translation_y;
-
-  float scale_x;
-  float scale_y;
-
-  BoundingBox tracked_box(region);
-  frame_pair.AdjustBox(
-      tracked_box, &translation_x, &translation_y, &scale_x, &scale_y);
-
-  tracked_box.Shift(Point2f(translation_x, translation_y));
-
-  if (scale_x > 0 && scale_y > 0) {
-    tracked_box.Scale(scale_x, scale_y);
-  }
-  return tracked_box;
-}
-
 BoundingBox ObjectTracker::TrackBox(const BoundingBox& region,
                                     const int64_t timestamp) const {
   CHECK_ALWAYS(timestamp > 0, "Timestamp too low! %lld", timestamp);
   CHECK_ALWAYS(timestamp <= curr_time_, "Timestamp is in the future!");
 
-  // Anything that ended before the requested timestamp is of no concern to us.
-  bool found_it = false;
-  int num_frames_back = -1;
-  for (int i = 0; i < curr_num_frame_pairs_; ++i) {
-    const FramePair& frame_pair =
-        frame_pairs_[GetNthIndexFromEnd(i)];
-
-    if (frame_pair.end_time_ <= timestamp) {
-      num_frames_back = i - 1;
-
-      if (num_frames_back > 0) {
-        LOGV("Went %d out of %d frames before finding frame. (index: %d)",
-             num_frames_back, curr_num_frame_pairs_, GetNthIndexFromEnd(i));
-      }
-
-      found_it = true;
-      break;
-    }
-  }
-
-  if (!found_it) {
-    LOGW("History did not go back far enough! %lld vs %lld",
-         frame_pairs_[GetNthIndexFromEnd(0)].end_time_ -
-         frame_pairs_[GetNthIndexFromStart(0)].end_time_,
-         frame_pairs_[GetNthIndexFromEnd(0)].end_time_ - timestamp);
-  }
-
-  // Loop over all the frames in the queue, tracking the accumulated delta
-  // of the point from frame to frame.  It's possible the point could
-  // go out of frame, but keep tracking as best we can, using points near
-  // the edge of the screen where it went out of bounds.
-  BoundingBox tracked_box(region);
-  for (int i = num_frames_back; i >= 0; --i) {
-    const FramePair& frame_pair = frame_pairs_[GetNthIndexFromEnd(i)];
-    SCHECK(frame_pair.end_time_ >= timestamp, "Frame timestamp was too early!");
-    tracked_box = TrackBox(tracked_box, frame_pair);
-  }
-  return tracked_box;
+  return frame_history_.TrackBox(region, timestamp, &adjust_box_scratch_);
 }
 
 
@@ -403,10 +718,15 @@ void ObjectTracker::Draw(const int canvas_width, const int canvas_height,
   glMultMatrixf(transformation);
 
   // Draw tracked object bounding boxes.
-  for (TrackedObjectMap::const_iterator iter = objects_.begin();
-    iter != objects_.end(); ++iter) {
-    TrackedObject* tracked_object = iter->second;
-    tracked_object->Draw();
+  const int num_objects = MIN(
+      GetPublishedSnapshots(draw_scratch_.get(),
+                            published_snapshots_.GetCapacity(), NULL),
+      published_snapshots_.GetCapacity());
+  for (int i = 0; i < num_objects; ++i) {
+    const ObjectSnapshot& snapshot = draw_scratch_[i];
+    TrackedObject::Draw(BoundingBox(snapshot.left, snapshot.top,
+                                    snapshot.right, snapshot.bottom),
+                        snapshot.correlation);
   }
 
   static const bool kRenderDebugPyramid = false;
@@ -421,10 +741,10 @@ void ObjectTracker::Draw(const int canvas_width, const int canvas_height,
   if (kRenderDebugDerivative) {
     glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
     for (int i = 0; i < kNumPyramidLevels; ++i) {
-      const Image<int32_t>& dx = *frame1_->GetSpatialX(i);
+      const Image<int16_t>& dx = *frame1_->GetSpatialX(i);
       Image<uint8_t> render_image(dx.GetWidth(), dx.GetHeight());
       for (int y = 0; y < dx.GetHeight(); ++y) {
-        const int32_t* dx_ptr = dx[y];
+        const int16_t* dx_ptr = dx[y];
         uint8_t* dst_ptr = render_image[y];
         for (int x = 0; x < dx.GetWidth(); ++x) {
           *dst_ptr++ = Clip(-(*dx_ptr++), 0, 255);
@@ -472,14 +792,16 @@ static void AddQuadrants(const BoundingBox& box,
 }
 
 void ObjectTracker::ComputeKeypoints(const bool cached_ok) {
-  const FramePair& prev_change = frame_pairs_[GetNthIndexFromEnd(1)];
-  FramePair* const curr_change = &frame_pairs_[GetNthIndexFromEnd(0)];
+  const FramePair& prev_change = GetPreviousFramePair();
+  FramePair* const curr_change = GetCurrentFramePair();
 
   std::vector<BoundingBox> boxes;
 
-  for (TrackedObjectMap::iterator object_iter = objects_.begin();
-       object_iter != objects_.end(); ++object_iter) {
-    BoundingBox box = object_iter->second->GetPosition();
+  for (size_t i = 0; i < objects_.size(); ++i) {
+    if (objects_[i] == NULL) {
+      continue;
+    }
+    BoundingBox box = objects_[i]->GetPosition();
     box.Scale(config_->object_box_scale_factor_for_features,
               config_->object_box_scale_factor_for_features);
     AddQuadrants(box, &boxes);
@@ -498,10 +820,12 @@ bool ObjectTracker::GetBestObjectForDetection(
   TrackedObject* best_match = NULL;
   float best_overlap = -FLT_MAX;
 
-  LOGV("Looking for matches in %zu objects!", objects_.size());
-  for (TrackedObjectMap::const_iterator object_iter = objects_.begin();
-      object_iter != objects_.end(); ++object_iter) {
-    TrackedObject* const tracked_object = object_iter->second;
+  LOGV("Looking for matches in %d objects!", num_objects_);
+  for (size_t i = 0; i < objects_.size(); ++i) {
+    TrackedObject* const tracked_object = objects_[i];
+    if (tracked_object == NULL) {
+      continue;
+    }
 
     const float overlap = tracked_object->GetPosition().PascalScore(
         detection.GetObjectBoundingBox());
@@ -604,9 +928,11 @@ void ObjectTracker::DetectTargets() {
   LOGV("Creating test vector!");
   std::vector<BoundingSquare> positions;
 
-  for (TrackedObjectMap::iterator object_iter = objects_.begin();
-      object_iter != objects_.end(); ++object_iter) {
-    TrackedObject* const tracked_object = object_iter->second;
+  for (size_t i = 0; i < objects_.size(); ++i) {
+    TrackedObject* const tracked_object = objects_[i];
+    if (tracked_object == NULL) {
+      continue;
+    }
 
 #if DEBUG_PREDATOR
   positions.push_back(GetCenteredSquare(
@@ -646,37 +972,61 @@ void ObjectTracker::DetectTargets() {
 }
 
 
+void ObjectTracker::TrackObject(TrackedObject* const object,
+                                AdjustBoxScratch* const scratch) const {
+  const BoundingBox tracked_position = frame_history_.AdjustBox(
+      frame_history_.GetNumFramePairs() - 1, object->GetPosition(), scratch);
+  object->UpdatePosition(tracked_position, curr_time_, *frame2_, false);
+}
+
+
 void ObjectTracker::TrackObjects() {
   // TODO(andrewharp): Correlation should be allowed to remove objects too.
   const bool automatic_removal_allowed = detector_.get() != NULL ?
       detector_->AllowSpontaneousDetections() : false;
 
-  LOGV("Tracking %zu objects!", objects_.size());
-  std::vector<std::string> dead_objects;
-  for (TrackedObjectMap::iterator iter = objects_.begin();
-       iter != objects_.end(); iter++) {
-    TrackedObject* object = iter->second;
-    const BoundingBox tracked_position = TrackBox(
-        object->GetPosition(), frame_pairs_[GetNthIndexFromEnd(0)]);
-    object->UpdatePosition(tracked_position, curr_time_, *frame2_, false);
-
-    if (automatic_removal_allowed &&
-        object->GetNumConsecutiveFramesBelowThreshold() >
-        kMaxNumDetectionFailures * 5) {
-      dead_objects.push_back(iter->first);
+  LOGV("Tracking %d objects!", num_objects_);
+  if (worker_pool_ != NULL && num_objects_ > 1) {
+    // Each object only touches its own state, so they can be tracked in any
+    // order with the same results.
+    objects_to_track_.clear();
+    for (size_t i = 0; i < objects_.size(); ++i) {
+      if (objects_[i] != NULL) {
+        objects_to_track_.push_back(objects_[i]);
+      }
+    }
+
+    std::atomic<int> next_scratch(0);
+    worker_pool_->ParallelFor(
+        static_cast<int>(objects_to_track_.size()),
+        [this, &next_scratch](const int begin, const int end) {
+          AdjustBoxScratch* const scratch =
+              object_scratch_[next_scratch++].get();
+          for (int i = begin; i < end; ++i) {
+            TrackObject(objects_to_track_[i], scratch);
+          }
+        });
+  } else {
+    for (size_t i = 0; i < objects_.size(); ++i) {
+      if (objects_[i] != NULL) {
+        TrackObject(objects_[i], &adjust_box_scratch_);
+      }
     }
   }
 
   if (detector_ != NULL && automatic_removal_allowed) {
-    for (std::vector<std::string>::iterator iter = dead_objects.begin();
-         iter != dead_objects.end(); iter++) {
-      LOGE("Removing object! %s", iter->c_str());
-      ForgetTarget(*iter);
+    for (size_t i = 0; i < objects_.size(); ++i) {
+      if (objects_[i] != NULL &&
+          objects_[i]->GetNumConsecutiveFramesBelowThreshold() >
+          kMaxNumDetectionFailures * 5) {
+        LOGE("Removing object! %s", objects_[i]->GetName().c_str());
+        RemoveObject(slot_handles_[i]);
+      }
     }
   }
   TimeLog("Tracked all objects.");
 
-  LOGV("%zu objects tracked!", objects_.size());
+  LOGV("%d objects tracked!", num_objects_);
 }
 
 }  // namespace tf_tracking
@@ -16,36 +16,79 @@ limitations under the License.
 #ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_OBJECT_TRACKER_H_
 #define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_OBJECT_TRACKER_H_
 
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "geom.h"
+#include "image_data.h"
 #include "integral_image.h"
 #include "logging.h"
+#include "stage_latency.h"
 #include "time_log.h"
 #include "utils.h"
+#include "worker_pool.h"
 
 #include "config.h"
 #include "flow_cache.h"
+#include "frame_history.h"
+#include "frame_ring.h"
 #include "keypoint_detector.h"
+#include "motion_estimator.h"
 #include "object_model.h"
 #include "optical_flow.h"
+#include "snapshot_publisher.h"
 #include "tracked_object.h"
 
 namespace tf_tracking {
 
-typedef std::map<const std::string, TrackedObject*> TrackedObjectMap;
+// Identifies a tracked object for as long as it is tracked. The low bits of a
+// handle index the tracker's object array, so looking one up is a bounds check
+// and a load. Once an object is forgotten its slot may be given to the next
+// object registered, but with the generation in the high bits advanced, so the
+// forgotten object's handle is refused rather than addressing the new one, at
+// least until the slot has been reused 32768 times.
+typedef int ObjectHandle;
 
-inline std::ostream& operator<<(std::ostream& stream,
-                                const TrackedObjectMap& map) {
-  for (TrackedObjectMap::const_iterator iter = map.begin();
-      iter != map.end(); ++iter) {
-    const TrackedObject& tracked_object = *iter->second;
-    const std::string& key = iter->first;
-    stream << key << ": " << tracked_object;
+static const ObjectHandle kInvalidObjectHandle = -1;
+
+static const int kObjectHandleSlotBits = 16;
+static const int kObjectHandleSlotMask = (1 << kObjectHandleSlotBits) - 1;
+static const int kObjectHandleGenerationMask =
+    (1 << (31 - kObjectHandleSlotBits)) - 1;
+
+// Bytes of memory an ObjectTracker built with a given TrackerConfig allocates
+// for its major buffers, as reported by ObjectTracker::GetMemoryUsage().
+struct TrackerMemoryUsage {
+  // Keypoint correspondences for the current and previous frame pairs, and
+  // scratch space for finding and fitting a motion to them.
+  size_t frame_pairs;
+
+  // Keypoint motion for each of the kNumFrames frame pairs of history, and
+  // scratch space for moving boxes through it on each thread.
+  size_t frame_history;
+
+  // Candidate keypoints and scratch space for keypoint detection.
+  size_t keypoint_detector;
+
+  // The two frames being tracked between.
+  size_t frames;
+
+  // The spare frames for frames in flight, only allocated by the first call
+  // to SubmitFrame().
+  size_t spare_frames;
+
+  // The luminance of the config.num_retained_frames most recent frames.
+  size_t retained_frames;
+
+  inline size_t Total() const {
+    return frame_pairs + frame_history + keypoint_detector + frames +
+           spare_frames + retained_frames;
   }
-  return stream;
-}
+};
 
 
 // ObjectTracker is the highest-level class in the tracking/detection framework.
@@ -57,6 +100,10 @@ class ObjectTracker {
                 ObjectDetectorBase* const detector);
   virtual ~ObjectTracker();
 
+  // Reports how much memory a tracker built with the given config would
+  // allocate, so that capacities can be tuned per device.
+  static TrackerMemoryUsage GetMemoryUsage(const TrackerConfig& config);
+
   virtual void NextFrame(const uint8_t* const new_frame,
                          const int64_t timestamp,
                          const float* const alignment_matrix_2x3) {
@@ -73,24 +120,110 @@ class ObjectTracker {
   // the matrix is valid for.
   virtual void NextFrame(const uint8_t* const new_frame,
                          const uint8_t* const uv_frame, const int64_t timestamp,
+                         const float* const alignment_matrix_2x3) {
+    NextFrame(frame2_->DescribePackedFrame(new_frame, uv_frame, frame_width_, 1),
+              timestamp, alignment_matrix_2x3);
+  }
+
+  // As above, but reads the frame in place from the given planes, e.g. the
+  // planes of a camera image, downsampling as it goes.
+  virtual void NextFrame(const FramePlanes& planes, const int64_t timestamp,
                          const float* const alignment_matrix_2x3);
 
-  virtual void RegisterNewObjectWithAppearance(const std::string& id,
-                                               const uint8_t* const new_frame,
-                                               const BoundingBox& bounding_box);
+  // Pipelined version of NextFrame(). Builds the image pyramid of the new
+  // frame on the calling thread, using one of a small ring of spare ImageData
+  // buffers, then queues the rest of the frame's work on the tracker's own
+  // pipeline thread and returns. The pyramid for frame N+1 is thus built while
+  // frame N is still being tracked. The planes are no longer needed once this
+  // returns. Blocks while config->max_frames_in_flight frames are queued.
+  //
+  // Until WaitForAllFrames() returns, no other method besides SubmitFrame(),
+  // GetLastTrackedTimestamp(), WaitForFrame(), GetPublishedSnapshots(), Draw()
+  // and the stage latency accessors may be called. NextFrame() waits for
+  // queued frames itself.
+  void SubmitFrame(const FramePlanes& planes, const int64_t timestamp,
+                   const float* const alignment_matrix_2x3);
+
+  // Returns the timestamp of the last frame that has been completely tracked,
+  // whether it came from NextFrame() or SubmitFrame(), without blocking.
+  int64_t GetLastTrackedTimestamp() const;
+
+  // Blocks until the frame submitted with the given timestamp, and every frame
+  // before it, has been tracked.
+  void WaitForFrame(const int64_t timestamp) const;
+
+  // Blocks until every submitted frame has been tracked.
+  void WaitForAllFrames() const;
+
+  // Starts tracking a new object with the given id at the given position in
+  // new_frame, and returns its handle.
+  virtual ObjectHandle RegisterNewObjectWithAppearance(
+      const std::string& id, const uint8_t* const new_frame,
+      const BoundingBox& bounding_box);
+
+  // Starts tracking a batch of new objects, with the given ids and positions
+  // in the already tracked frame with the given timestamp, and moves each one
+  // to where its box has moved since, as SetPreviousPositionOfObject() does.
+  // That frame may be the current or previous one, or one of the last
+  // config.num_retained_frames. The appearances come from that frame's image,
+  // and its integral image is computed at most once for the whole batch, so
+  // nothing is copied or recomputed per object. Returns false without
+  // registering anything if the frame is no longer retained, in which case
+  // RegisterNewObjectWithAppearance() needs to be given the frame itself.
+  // Otherwise the handle of each object is written to handles.
+  bool RegisterNewObjectsInFrame(const int64_t timestamp,
+                                 const std::vector<std::string>& ids,
+                                 const std::vector<BoundingBox>& positions,
+                                 std::vector<ObjectHandle>* const handles);
 
   // Updates the position of a tracked object, given that it was known to be at
   // a certain position at some point in the past.
-  virtual void SetPreviousPositionOfObject(const std::string& id,
+  virtual void SetPreviousPositionOfObject(const ObjectHandle handle,
                                            const BoundingBox& bounding_box,
                                            const int64_t timestamp);
 
   // Sets the current position of the object in the most recent frame provided.
-  virtual void SetCurrentPositionOfObject(const std::string& id,
+  virtual void SetCurrentPositionOfObject(const ObjectHandle handle,
                                           const BoundingBox& bounding_box);
 
-  // Tells the ObjectTracker to stop tracking a target.
-  void ForgetTarget(const std::string& id);
+  // Tells the ObjectTracker to stop tracking a target. Its handle becomes
+  // invalid, and stays so when its slot is reused.
+  void ForgetTarget(const ObjectHandle handle);
+
+  // As above, but for the object registered with the given id.
+  inline void SetPreviousPositionOfObject(const std::string& id,
+                                          const BoundingBox& bounding_box,
+                                          const int64_t timestamp) {
+    SetPreviousPositionOfObject(GetObjectHandleChecked(id), bounding_box,
+                                timestamp);
+  }
+
+  inline void SetCurrentPositionOfObject(const std::string& id,
+                                         const BoundingBox& bounding_box) {
+    SetCurrentPositionOfObject(GetObjectHandleChecked(id), bounding_box);
+  }
+
+  inline void ForgetTarget(const std::string& id) {
+    ForgetTarget(GetObjectHandleChecked(id));
+  }
+
+  // Writes a snapshot of each tracked object, in slot order, to snapshots,
+  // stopping after max_snapshots. Returns the number of objects tracked, which
+  // may be more than were written.
+  int GetObjectSnapshots(ObjectSnapshot* const snapshots,
+                         const int max_snapshots) const;
+
+  // Like GetObjectSnapshots(), but copies the snapshots published at the end
+  // of the last tracked frame, or since then by whichever method last added,
+  // moved or forgot an object, of at most config.max_published_objects
+  // objects. Unlike every other method, this may be called from any thread
+  // at any time, and never waits for a frame being tracked. timestamp, if
+  // not NULL, receives the time of the frame the snapshots are from.
+  inline int GetPublishedSnapshots(ObjectSnapshot* const snapshots,
+                                   const int max_snapshots,
+                                   int64_t* const timestamp) const {
+    return published_snapshots_.Read(snapshots, max_snapshots, timestamp);
+  }
 
   // Fills the given out_data buffer with the latest detected keypoint
   // correspondences, first scaled by scale_factor (to adjust for downsampling
@@ -98,8 +231,13 @@ class ObjectTracker {
   int GetKeypointsPacked(uint16_t* const out_data,
                          const float scale_factor) const;
 
+  // The most keypoints tracked per frame.
+  inline int GetMaxKeypoints() const {
+    return config_->keypoint_detector_config.max_keypoints;
+  }
+
   // Copy the keypoint arrays after computeFlow is called.
-  // out_data should be at least kMaxKeypoints * kKeypointStep long.
+  // out_data should be at least GetMaxKeypoints() * kKeypointStep long.
   // Currently, its format is [x1 y1 found x2 y2 score] repeated N times,
   // where N is the number of keypoints tracked.  N is returned as the result.
   int GetKeypoints(const bool only_found, float* const out_data) const;
@@ -109,40 +247,90 @@ class ObjectTracker {
   BoundingBox TrackBox(const BoundingBox& region,
                        const int64_t timestamp) const;
 
+  // Latency histograms for each stage of NextFrame(), recorded since
+  // construction or the last call to ResetStageLatencies().
+  inline const StageLatencies& GetStageLatencies() const {
+    return stage_latencies_;
+  }
+
+  inline void ResetStageLatencies() {
+    stage_latencies_.Reset();
+  }
+
+  // Counts of the flow solves and iterations done since construction, to
+  // see how quickly points converge.
+  inline FlowSolverStats GetFlowSolverStats() const {
+    return flow_cache_.GetSolverStats();
+  }
+
+  // The size of the images the tracker works on.
+  inline int GetFrameWidth() const {
+    return frame_width_;
+  }
+
+  inline int GetFrameHeight() const {
+    return frame_height_;
+  }
+
   // Returns the number of frames that have been passed to NextFrame().
   inline int GetNumFrames() const {
     return num_frames_;
   }
 
+  // Returns the handle of the object registered with the given id, or
+  // kInvalidObjectHandle if there is none.
+  inline ObjectHandle GetObjectHandle(const std::string& id) const {
+    std::map<std::string, ObjectHandle>::const_iterator iter =
+        object_handles_.find(id);
+    return iter != object_handles_.end() ? iter->second : kInvalidObjectHandle;
+  }
+
+  inline int GetNumObjects() const {
+    return num_objects_;
+  }
+
+  inline bool HaveObject(const ObjectHandle handle) const {
+    const int slot = handle & kObjectHandleSlotMask;
+    return handle >= 0 && slot < static_cast<int>(objects_.size()) &&
+           objects_[slot] != NULL && slot_handles_[slot] == handle;
+  }
+
   inline bool HaveObject(const std::string& id) const {
-    return objects_.find(id) != objects_.end();
+    return GetObjectHandle(id) != kInvalidObjectHandle;
+  }
+
+  // Returns the TrackedObject with the given handle.
+  inline const TrackedObject* GetObject(const ObjectHandle handle) const {
+    CHECK_ALWAYS(HaveObject(handle), "Unknown object handle! %d", handle);
+    return objects_[handle & kObjectHandleSlotMask];
+  }
+
+  inline TrackedObject* GetObject(const ObjectHandle handle) {
+    CHECK_ALWAYS(HaveObject(handle), "Unknown object handle! %d", handle);
+    return objects_[handle & kObjectHandleSlotMask];
   }
 
   // Returns the TrackedObject associated with the given id.
   inline const TrackedObject* GetObject(const std::string& id) const {
-    TrackedObjectMap::const_iterator iter = objects_.find(id);
-    CHECK_ALWAYS(iter != objects_.end(),
-                 "Unknown object key! \"%s\"", id.c_str());
-    TrackedObject* const object = iter->second;
-    return object;
+    return GetObject(GetObjectHandleChecked(id));
   }
 
-  // Returns the TrackedObject associated with the given id.
   inline TrackedObject* GetObject(const std::string& id) {
-    TrackedObjectMap::iterator iter = objects_.find(id);
-    CHECK_ALWAYS(iter != objects_.end(),
-                 "Unknown object key! \"%s\"", id.c_str());
-    TrackedObject* const object = iter->second;
-    return object;
+    return GetObject(GetObjectHandleChecked(id));
   }
 
-  bool IsObjectVisible(const std::string& id) const {
-    SCHECK(HaveObject(id), "Don't have this object.");
+  inline bool IsObjectVisible(const ObjectHandle handle) const {
+    SCHECK(HaveObject(handle), "Don't have this object.");
+    return GetObject(handle)->IsVisible();
+  }
 
-    const TrackedObject* object = GetObject(id);
-    return object->IsVisible();
+  inline bool IsObjectVisible(const std::string& id) const {
+    return IsObjectVisible(GetObjectHandleChecked(id));
   }
 
+  // Draws the objects as of the last published snapshots, so like
+  // GetPublishedSnapshots() it does not wait for a frame being tracked, as
+  // long as there is no detector. Must only be called from one thread.
   virtual void Draw(const int canvas_width, const int canvas_height,
                     const float* const frame_to_canvas) const;
 
@@ -151,10 +339,31 @@ class ObjectTracker {
   // If an object model is provided, then that model will be associated with the
   // object. If not, a new model may be created from the appearance at the
   // initial position and registered with the object detector.
-  virtual TrackedObject* MaybeAddObject(const std::string& id,
-                                        const Image<uint8_t>& image,
-                                        const BoundingBox& bounding_box,
-                                        const ObjectModelBase* object_model);
+  // Returns the handle of the object, which is the existing one if an object
+  // with this id is already tracked.
+  virtual ObjectHandle MaybeAddObject(const std::string& id,
+                                      const Image<uint8_t>& image,
+                                      const BoundingBox& bounding_box,
+                                      const ObjectModelBase* object_model);
+
+  // Returns the retained frame with the given timestamp, or NULL if there is
+  // none.
+  const ImageData* GetRetainedFrame(const int64_t timestamp) const;
+
+  // SetPreviousPositionOfObject() and ForgetTarget() without publishing the
+  // change, for when there is more to change first.
+  void MoveObjectFromPast(const ObjectHandle handle,
+                          const BoundingBox& bounding_box,
+                          const int64_t timestamp);
+
+  void RemoveObject(const ObjectHandle handle);
+
+  inline ObjectHandle GetObjectHandleChecked(const std::string& id) const {
+    const ObjectHandle handle = GetObjectHandle(id);
+    CHECK_ALWAYS(handle != kInvalidObjectHandle,
+                 "Unknown object key! \"%s\"", id.c_str());
+    return handle;
+  }
 
   // Find the keypoints in the frame before the current frame.
   // If only one frame exists, keypoints will be found in that frame.
@@ -164,33 +373,43 @@ class ObjectTracker {
   // Stores the results in the given FramePair.
   void FindCorrespondences(FramePair* const curr_change) const;
 
-  inline int GetNthIndexFromEnd(const int offset) const {
-    return GetNthIndexFromStart(curr_num_frame_pairs_ - 1 - offset);
+  // The frame pairs ending at the current and previous frames alternate
+  // between the two in frame_pairs_.
+  inline FramePair* GetCurrentFramePair() {
+    return frame_pairs_ + num_frames_ % 2;
   }
 
-  BoundingBox TrackBox(const BoundingBox& region,
-                       const FramePair& frame_pair) const;
-
-  inline void IncrementFrameIndex() {
-    // Move the current framechange index up.
-    ++num_frames_;
-    ++curr_num_frame_pairs_;
-
-    // If we've got too many, push up the start of the queue.
-    if (curr_num_frame_pairs_ > kNumFrames) {
-      first_frame_index_ = GetNthIndexFromStart(1);
-      --curr_num_frame_pairs_;
-    }
+  inline const FramePair& GetCurrentFramePair() const {
+    return frame_pairs_[num_frames_ % 2];
   }
 
-  inline int GetNthIndexFromStart(const int offset) const {
-    SCHECK(offset >= 0 && offset < curr_num_frame_pairs_,
-          "Offset out of range!  %d out of %d.", offset, curr_num_frame_pairs_);
-    return (first_frame_index_ + offset) % kNumFrames;
+  inline const FramePair& GetPreviousFramePair() const {
+    return frame_pairs_[(num_frames_ + 1) % 2];
   }
 
+  // Moves every object along with the newest frame pair and rescores it,
+  // spreading the objects over worker_pool_ if there is one. Objects that
+  // have been lost for too long are removed afterwards.
   void TrackObjects();
 
+  // Moves and rescores a single object, using the given scratch.
+  void TrackObject(TrackedObject* const object,
+                   AdjustBoxScratch* const scratch) const;
+
+  // Everything NextFrame() does once frame2_ holds the new frame's data.
+  void TrackFrame(const int64_t timestamp,
+                  const float* const alignment_matrix_2x3);
+
+  // Publishes a snapshot of every object for GetPublishedSnapshots(). Must
+  // never run on two threads at once, which holds as long as objects are only
+  // changed while no frames are in flight.
+  void PublishSnapshots();
+
+  // Runs on the pipeline thread for every frame passed to SubmitFrame().
+  void TrackSubmittedFrame(ImageData* const new_frame, const int64_t timestamp,
+                           const float* const alignment_matrix_2x3,
+                           const int64_t submit_time);
+
   const std::unique_ptr<const TrackerConfig> config_;
 
   const int frame_width_;
@@ -200,24 +419,79 @@ class ObjectTracker {
 
   int num_frames_;
 
-  TrackedObjectMap objects_;
+  // Tracked objects, indexed by the slot bits of their handles. Forgotten
+  // objects leave NULL slots behind, which are filled again before the array
+  // grows. slot_handles_ holds the handle last given out for each slot.
+  std::vector<TrackedObject*> objects_;
+  std::vector<ObjectHandle> slot_handles_;
+  std::vector<int> free_slots_;
+  int num_objects_;
+
+  // The handle of each tracked object by id.
+  std::map<std::string, ObjectHandle> object_handles_;
 
   FlowCache flow_cache_;
 
   KeypointDetector keypoint_detector_;
 
-  int curr_num_frame_pairs_;
-  int first_frame_index_;
-
   std::unique_ptr<ImageData> frame1_;
   std::unique_ptr<ImageData> frame2_;
 
-  FramePair frame_pairs_[kNumFrames];
+  FramePair frame_pairs_[2];
+
+  FrameHistory frame_history_;
+
+  // The luminance of recent frames, for RegisterNewObjectsInFrame().
+  FrameRing retained_frames_;
+
+  // For moving boxes through frame_history_ on the tracking thread.
+  mutable AdjustBoxScratch adjust_box_scratch_;
+
+  // Room for the gathered input and output positions of each keypoint in
+  // FindCorrespondences(), in that order.
+  std::unique_ptr<float[]> correspondence_scratch_;
+
+  // Fits the motion of the frame pair ending at curr_time_ when
+  // config_->estimate_global_motion is set. If have_frame_motion_, that
+  // motion is in frame_motion_ and is extrapolated to seed the flow of the
+  // next frame.
+  MotionEstimator motion_estimator_;
+  bool have_frame_motion_;
+  float frame_motion_[6];
 
   std::unique_ptr<ObjectDetectorBase> detector_;
 
   int num_detected_;
 
+  StageLatencies stage_latencies_;
+
+  // Only created if config_->num_worker_threads > 0.
+  std::unique_ptr<WorkerPool> worker_pool_;
+
+  // One per range TrackObjects() splits the objects into across
+  // worker_pool_, along with the objects being tracked, in slot order.
+  std::vector<std::unique_ptr<AdjustBoxScratch> > object_scratch_;
+  std::vector<TrackedObject*> objects_to_track_;
+
+  // Object state as of the end of the last tracked frame, for readers on
+  // other threads. The scratch arrays hold the snapshots being published and
+  // those being drawn.
+  SnapshotPublisher published_snapshots_;
+  std::unique_ptr<ObjectSnapshot[]> publish_scratch_;
+  mutable std::unique_ptr<ObjectSnapshot[]> draw_scratch_;
+
+  // SubmitFrame() state, created on its first call. The single pipeline thread
+  // tracks submitted frames in order. Spare frames cycle between SubmitFrame(),
+  // the pipeline thread and frame1_/frame2_, so the frames being tracked are
+  // never written to.
+  std::unique_ptr<WorkerPool> pipeline_;
+  mutable std::mutex pipeline_mutex_;
+  mutable std::condition_variable pipeline_cond_;
+  std::deque<std::unique_ptr<ImageData> > spare_frames_;
+  int num_frames_in_flight_;
+  int64_t last_submitted_timestamp_;
+  int64_t last_tracked_timestamp_;
+
  private:
   void TrackTarget(TrackedObject* const object);
 
@@ -246,21 +520,22 @@ inline std::ostream& operator<<(std::ostream& stream,
 
   stream << "Curr time: " << tracker.curr_time_ << std::endl;
 
-  const int first_frame_index = tracker.GetNthIndexFromStart(0);
-  const FramePair& first_frame_pair = tracker.frame_pairs_[first_frame_index];
-
-  const int last_frame_index = tracker.GetNthIndexFromEnd(0);
-  const FramePair& last_frame_pair = tracker.frame_pairs_[last_frame_index];
+  const FrameHistory& history = tracker.frame_history_;
+  const int last_frame_index = history.GetNumFramePairs() - 1;
+  const int64_t first_end_time = history.GetEndTime(0);
+  const int64_t last_end_time = history.GetEndTime(last_frame_index);
 
-  stream << "first frame: " << first_frame_index << ","
-         << first_frame_pair.end_time_ << "    "
-         << "last frame: " << last_frame_index << ","
-         << last_frame_pair.end_time_ << "   diff: "
-         << last_frame_pair.end_time_ - first_frame_pair.end_time_ << "ms"
+  stream << "first frame: 0," << first_end_time << "    "
+         << "last frame: " << last_frame_index << "," << last_end_time
+         << "   diff: " << last_end_time - first_end_time << "ms"
          << std::endl;
 
   stream << "Tracked targets:";
-  stream << tracker.objects_;
+  for (size_t i = 0; i < tracker.objects_.size(); ++i) {
+    if (tracker.objects_[i] != NULL) {
+      stream << tracker.objects_[i]->GetName() << ": " << *tracker.objects_[i];
+    }
+  }
 
   return stream;
 }
@@ -19,6 +19,8 @@ limitations under the License.
 #include <stdlib.h>
 #include <string.h>
 #include <cstdint>
+#include <string>
+#include <vector>
 
 #include "image-inl.h"
 #include "image.h"
@@ -35,72 +37,111 @@ namespace tf_tracking {
 
 JniLongField object_tracker_field("nativeObjectTracker");
 
-ObjectTracker* get_object_tracker(JNIEnv* env, jobject thiz) {
+// Returns the tracker without waiting for submitted frames. Only for the
+// methods ObjectTracker allows while frames are in flight.
+ObjectTracker* get_pipelined_object_tracker(JNIEnv* env, jobject thiz) {
   ObjectTracker* const object_tracker =
       reinterpret_cast<ObjectTracker*>(object_tracker_field.get(env, thiz));
   CHECK_ALWAYS(object_tracker != NULL, "null object tracker!");
   return object_tracker;
 }
 
+// Returns the tracker once every frame passed to submitFrameDirectNative has
+// been tracked, so the caller never races the pipeline thread.
+ObjectTracker* get_object_tracker(JNIEnv* env, jobject thiz) {
+  ObjectTracker* const object_tracker =
+      get_pipelined_object_tracker(env, thiz);
+  object_tracker->WaitForAllFrames();
+  return object_tracker;
+}
+
 void set_object_tracker(JNIEnv* env, jobject thiz,
                         const ObjectTracker* object_tracker) {
   object_tracker_field.set(env, thiz,
                            reinterpret_cast<intptr_t>(object_tracker));
 }
 
+// Fills in everything Java chooses about a tracker that changes what it
+// allocates, so that initNative and getMemoryUsageNative always agree. Java
+// never changes config->max_frames_in_flight, so that keeps its default.
+void set_tracker_capacities(const int num_worker_threads,
+                            const int max_keypoints,
+                            const int max_keypoints_per_object,
+                            const int max_candidate_keypoints,
+                            const int num_retained_frames,
+                            TrackerConfig* const config) {
+  config->num_worker_threads = num_worker_threads;
+  config->keypoint_detector_config.max_keypoints = max_keypoints;
+  config->keypoint_detector_config.max_keypoints_per_object =
+      max_keypoints_per_object;
+  config->keypoint_detector_config.max_candidate_keypoints =
+      max_candidate_keypoints;
+  config->num_retained_frames = num_retained_frames;
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(initNative)(JNIEnv* env, jobject thiz,
                                                jint width, jint height,
-                                               jboolean always_track);
+                                               jboolean always_track,
+                                               jint num_worker_threads,
+                                               jint max_keypoints,
+                                               jint max_keypoints_per_object,
+                                               jint max_candidate_keypoints,
+                                               jint num_retained_frames);
 
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(releaseMemoryNative)(JNIEnv* env,
                                                         jobject thiz);
 
 JNIEXPORT
-void JNICALL OBJECT_TRACKER_METHOD(registerNewObjectWithAppearanceNative)(
+jint JNICALL OBJECT_TRACKER_METHOD(registerNewObjectWithAppearanceNative)(
     JNIEnv* env, jobject thiz, jstring object_id, jfloat x1, jfloat y1,
     jfloat x2, jfloat y2, jbyteArray frame_data);
 
+JNIEXPORT
+jboolean JNICALL OBJECT_TRACKER_METHOD(registerNewObjectsInFrameNative)(
+    JNIEnv* env, jobject thiz, jlong timestamp, jobjectArray object_ids,
+    jfloatArray positions, jintArray handles);
+
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(setPreviousPositionNative)(
-    JNIEnv* env, jobject thiz, jstring object_id, jfloat x1, jfloat y1,
+    JNIEnv* env, jobject thiz, jint handle, jfloat x1, jfloat y1,
     jfloat x2, jfloat y2, jlong timestamp);
 
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(setCurrentPositionNative)(
-    JNIEnv* env, jobject thiz, jstring object_id, jfloat x1, jfloat y1,
+    JNIEnv* env, jobject thiz, jint handle, jfloat x1, jfloat y1,
     jfloat x2, jfloat y2);
 
 JNIEXPORT
 jboolean JNICALL OBJECT_TRACKER_METHOD(haveObject)(JNIEnv* env, jobject thiz,
-                                                   jstring object_id);
+                                                   jint handle);
 
 JNIEXPORT
 jboolean JNICALL OBJECT_TRACKER_METHOD(isObjectVisible)(JNIEnv* env,
                                                         jobject thiz,
-                                                        jstring object_id);
+                                                        jint handle);
 
 JNIEXPORT
 jstring JNICALL OBJECT_TRACKER_METHOD(getModelIdNative)(JNIEnv* env,
                                                         jobject thiz,
-                                                        jstring object_id);
+                                                        jint handle);
 
 JNIEXPORT
 jfloat JNICALL OBJECT_TRACKER_METHOD(getCurrentCorrelation)(JNIEnv* env,
                                                             jobject thiz,
-                                                            jstring object_id);
+                                                            jint handle);
 
 JNIEXPORT
 jfloat JNICALL OBJECT_TRACKER_METHOD(getMatchScore)(JNIEnv* env, jobject thiz,
-                                                    jstring object_id);
+                                                    jint handle);
 
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(getTrackedPositionNative)(
-    JNIEnv* env, jobject thiz, jstring object_id, jfloatArray rect_array);
+    JNIEnv* env, jobject thiz, jint handle, jfloatArray rect_array);
 
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(nextFrameNative)(JNIEnv* env, jobject thiz,
@@ -109,17 +150,52 @@ void JNICALL OBJECT_TRACKER_METHOD(nextFrameNative)(JNIEnv* env, jobject thiz,
                                                     jlong timestamp,
                                                     jfloatArray vg_matrix_2x3);
 
+JNIEXPORT
+void JNICALL OBJECT_TRACKER_METHOD(nextFrameDirectNative)(
+    JNIEnv* env, jobject thiz, jobject y_buffer, jint y_row_stride,
+    jobject u_buffer, jobject v_buffer, jint uv_row_stride,
+    jint uv_pixel_stride, jint downsample_factor, jlong timestamp,
+    jfloatArray vg_matrix_2x3);
+
+JNIEXPORT
+void JNICALL OBJECT_TRACKER_METHOD(submitFrameDirectNative)(
+    JNIEnv* env, jobject thiz, jobject y_buffer, jint y_row_stride,
+    jobject u_buffer, jobject v_buffer, jint uv_row_stride,
+    jint uv_pixel_stride, jint downsample_factor, jlong timestamp,
+    jfloatArray vg_matrix_2x3);
+
+JNIEXPORT
+jlong JNICALL OBJECT_TRACKER_METHOD(getLastTrackedTimestampNative)(
+    JNIEnv* env, jobject thiz);
+
+JNIEXPORT
+void JNICALL OBJECT_TRACKER_METHOD(waitForFrameNative)(JNIEnv* env,
+                                                       jobject thiz,
+                                                       jlong timestamp);
+
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(forgetNative)(JNIEnv* env, jobject thiz,
-                                                 jstring object_id);
+                                                 jint handle);
+
+JNIEXPORT
+jint JNICALL OBJECT_TRACKER_METHOD(getObjectSnapshotsNative)(
+    JNIEnv* env, jobject thiz, jobject snapshot_buffer);
 
 JNIEXPORT
-jbyteArray JNICALL OBJECT_TRACKER_METHOD(getKeypointsPacked)(
-    JNIEnv* env, jobject thiz, jfloat scale_factor);
+jint JNICALL OBJECT_TRACKER_METHOD(getKeypointsPackedNative)(
+    JNIEnv* env, jobject thiz, jfloat scale_factor, jobject keypoint_buffer);
 
 JNIEXPORT
-jfloatArray JNICALL OBJECT_TRACKER_METHOD(getKeypointsNative)(
-    JNIEnv* env, jobject thiz, jboolean only_found_);
+jint JNICALL OBJECT_TRACKER_METHOD(getKeypointsNative)(
+    JNIEnv* env, jobject thiz, jboolean only_found, jobject keypoint_buffer);
+
+JNIEXPORT
+jfloatArray JNICALL OBJECT_TRACKER_METHOD(getStageLatenciesNative)(
+    JNIEnv* env, jobject thiz);
+
+JNIEXPORT
+void JNICALL OBJECT_TRACKER_METHOD(resetStageLatenciesNative)(JNIEnv* env,
+                                                              jobject thiz);
 
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(getCurrentPositionNative)(
@@ -137,6 +213,11 @@ JNIEXPORT void JNICALL OBJECT_TRACKER_METHOD(downsampleImageNative)(
     JNIEnv* env, jobject thiz, jint width, jint height, jint row_stride,
     jbyteArray input, jint factor, jbyteArray output);
 
+JNIEXPORT jlong JNICALL OBJECT_TRACKER_METHOD(getMemoryUsageNative)(
+    JNIEnv* env, jclass clazz, jint width, jint height,
+    jint num_worker_threads, jint max_keypoints, jint max_keypoints_per_object,
+    jint max_candidate_keypoints, jint num_retained_frames);
+
 #ifdef __cplusplus
 }
 #endif
@@ -144,11 +225,21 @@ JNIEXPORT void JNICALL OBJECT_TRACKER_METHOD(downsampleImageNative)(
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(initNative)(JNIEnv* env, jobject thiz,
                                                jint width, jint height,
-                                               jboolean always_track) {
+                                               jboolean always_track,
+                                               jint num_worker_threads,
+                                               jint max_keypoints,
+                                               jint max_keypoints_per_object,
+                                               jint max_candidate_keypoints,
+                                               jint num_retained_frames) {
   LOGI("Initializing object tracker. %dx%d @%p", width, height, thiz);
   const Size image_size(width, height);
   TrackerConfig* const tracker_config = new TrackerConfig(image_size);
   tracker_config->always_track = always_track;
+  set_tracker_capacities(num_worker_threads, max_keypoints,
+                         max_keypoints_per_object, max_candidate_keypoints,
+                         num_retained_frames, tracker_config);
+  // Java has no other source of full-frame alignment to pass to NextFrame().
+  tracker_config->estimate_global_motion = true;
 
   // XXX detector
   ObjectTracker* const tracker = new ObjectTracker(tracker_config, NULL);
@@ -167,7 +258,7 @@ void JNICALL OBJECT_TRACKER_METHOD(releaseMemoryNative)(JNIEnv* env,
 }
 
 JNIEXPORT
-void JNICALL OBJECT_TRACKER_METHOD(registerNewObjectWithAppearanceNative)(
+jint JNICALL OBJECT_TRACKER_METHOD(registerNewObjectWithAppearanceNative)(
     JNIEnv* env, jobject thiz, jstring object_id, jfloat x1, jfloat y1,
     jfloat x2, jfloat y2, jbyteArray frame_data) {
   const char* const id_str = env->GetStringUTFChars(object_id, 0);
@@ -181,75 +272,100 @@ void JNICALL OBJECT_TRACKER_METHOD(registerNewObjectWithAppearanceNative)(
   jbyte* pixels = env->GetByteArrayElements(frame_data, &iCopied);
 
   BoundingBox bounding_box(x1, y1, x2, y2);
-  get_object_tracker(env, thiz)->RegisterNewObjectWithAppearance(
-      id_str, reinterpret_cast<const uint8_t*>(pixels), bounding_box);
+  const ObjectHandle handle =
+      get_object_tracker(env, thiz)->RegisterNewObjectWithAppearance(
+          id_str, reinterpret_cast<const uint8_t*>(pixels), bounding_box);
 
   env->ReleaseByteArrayElements(frame_data, pixels, JNI_ABORT);
 
   env->ReleaseStringUTFChars(object_id, id_str);
+  return handle;
+}
+
+JNIEXPORT
+jboolean JNICALL OBJECT_TRACKER_METHOD(registerNewObjectsInFrameNative)(
+    JNIEnv* env, jobject thiz, jlong timestamp, jobjectArray object_ids,
+    jfloatArray positions, jintArray handles) {
+  const int num_objects = env->GetArrayLength(object_ids);
+  CHECK_ALWAYS(env->GetArrayLength(positions) == num_objects * 4 &&
+                   env->GetArrayLength(handles) == num_objects,
+               "Need 4 coordinates and a handle for each of %d objects",
+               num_objects);
+
+  std::vector<std::string> ids(num_objects);
+  for (int i = 0; i < num_objects; ++i) {
+    const jstring object_id =
+        static_cast<jstring>(env->GetObjectArrayElement(object_ids, i));
+    const char* const id_str = env->GetStringUTFChars(object_id, 0);
+    ids[i] = id_str;
+    env->ReleaseStringUTFChars(object_id, id_str);
+    env->DeleteLocalRef(object_id);
+  }
+
+  std::vector<jfloat> coordinates(num_objects * 4);
+  env->GetFloatArrayRegion(positions, 0, num_objects * 4, coordinates.data());
+  std::vector<BoundingBox> boxes;
+  boxes.reserve(num_objects);
+  for (int i = 0; i < num_objects; ++i) {
+    const jfloat* const box = coordinates.data() + i * 4;
+    boxes.push_back(BoundingBox(box[0], box[1], box[2], box[3]));
+  }
+
+  std::vector<ObjectHandle> object_handles;
+  if (!get_object_tracker(env, thiz)->RegisterNewObjectsInFrame(
+          timestamp, ids, boxes, &object_handles)) {
+    return JNI_FALSE;
+  }
+  LOGI("Registered %d objects in the frame at %lld", num_objects,
+       static_cast<long long>(timestamp));
+
+  env->SetIntArrayRegion(handles, 0, num_objects, object_handles.data());
+  return JNI_TRUE;
 }
 
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(setPreviousPositionNative)(
-    JNIEnv* env, jobject thiz, jstring object_id, jfloat x1, jfloat y1,
+    JNIEnv* env, jobject thiz, jint handle, jfloat x1, jfloat y1,
     jfloat x2, jfloat y2, jlong timestamp) {
-  const char* const id_str = env->GetStringUTFChars(object_id, 0);
-
   LOGI(
-      "Registering the position of %s at %.2f,%.2f,%.2f,%.2f"
+      "Registering the position of %d at %.2f,%.2f,%.2f,%.2f"
       " at time %lld",
-      id_str, x1, y1, x2, y2, static_cast<int64_t>(timestamp));
+      handle, x1, y1, x2, y2, static_cast<int64_t>(timestamp));
 
   get_object_tracker(env, thiz)->SetPreviousPositionOfObject(
-      id_str, BoundingBox(x1, y1, x2, y2), timestamp);
-
-  env->ReleaseStringUTFChars(object_id, id_str);
+      handle, BoundingBox(x1, y1, x2, y2), timestamp);
 }
 
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(setCurrentPositionNative)(
-    JNIEnv* env, jobject thiz, jstring object_id, jfloat x1, jfloat y1,
+    JNIEnv* env, jobject thiz, jint handle, jfloat x1, jfloat y1,
     jfloat x2, jfloat y2) {
-  const char* const id_str = env->GetStringUTFChars(object_id, 0);
-
-  LOGI("Registering the position of %s at %.2f,%.2f,%.2f,%.2f", id_str, x1, y1,
+  LOGI("Registering the position of %d at %.2f,%.2f,%.2f,%.2f", handle, x1, y1,
        x2, y2);
 
   get_object_tracker(env, thiz)->SetCurrentPositionOfObject(
-      id_str, BoundingBox(x1, y1, x2, y2));
-
-  env->ReleaseStringUTFChars(object_id, id_str);
+      handle, BoundingBox(x1, y1, x2, y2));
 }
 
 JNIEXPORT
 jboolean JNICALL OBJECT_TRACKER_METHOD(haveObject)(JNIEnv* env, jobject thiz,
-                                                   jstring object_id) {
-  const char* const id_str = env->GetStringUTFChars(object_id, 0);
-
-  const bool haveObject = get_object_tracker(env, thiz)->HaveObject(id_str);
-  env->ReleaseStringUTFChars(object_id, id_str);
-  return haveObject;
+                                                   jint handle) {
+  return get_object_tracker(env, thiz)->HaveObject(handle);
 }
 
 JNIEXPORT
 jboolean JNICALL OBJECT_TRACKER_METHOD(isObjectVisible)(JNIEnv* env,
                                                         jobject thiz,
-                                                        jstring object_id) {
-  const char* const id_str = env->GetStringUTFChars(object_id, 0);
-
-  const bool visible = get_object_tracker(env, thiz)->IsObjectVisible(id_str);
-  env->ReleaseStringUTFChars(object_id, id_str);
-  return visible;
+                                                        jint handle) {
+  return get_object_tracker(env, thiz)->IsObjectVisible(handle);
 }
 
 JNIEXPORT
 jstring JNICALL OBJECT_TRACKER_METHOD(getModelIdNative)(JNIEnv* env,
                                                         jobject thiz,
-                                                        jstring object_id) {
-  const char* const id_str = env->GetStringUTFChars(object_id, 0);
+                                                        jint handle) {
   const TrackedObject* const object =
-      get_object_tracker(env, thiz)->GetObject(id_str);
-  env->ReleaseStringUTFChars(object_id, id_str);
+      get_object_tracker(env, thiz)->GetObject(handle);
   jstring model_name = env->NewStringUTF(object->GetModel()->GetName().c_str());
   return model_name;
 }
@@ -257,39 +373,26 @@ jstring JNICALL OBJECT_TRACKER_METHOD(getModelIdNative)(JNIEnv* env,
 JNIEXPORT
 jfloat JNICALL OBJECT_TRACKER_METHOD(getCurrentCorrelation)(JNIEnv* env,
                                                             jobject thiz,
-                                                            jstring object_id) {
-  const char* const id_str = env->GetStringUTFChars(object_id, 0);
-
-  const float correlation =
-      get_object_tracker(env, thiz)->GetObject(id_str)->GetCorrelation();
-  env->ReleaseStringUTFChars(object_id, id_str);
-  return correlation;
+                                                            jint handle) {
+  return get_object_tracker(env, thiz)->GetObject(handle)->GetCorrelation();
 }
 
 JNIEXPORT
 jfloat JNICALL OBJECT_TRACKER_METHOD(getMatchScore)(JNIEnv* env, jobject thiz,
-                                                    jstring object_id) {
-  const char* const id_str = env->GetStringUTFChars(object_id, 0);
-
-  const float match_score =
-      get_object_tracker(env, thiz)->GetObject(id_str)->GetMatchScore().value;
-  env->ReleaseStringUTFChars(object_id, id_str);
-  return match_score;
+                                                    jint handle) {
+  TrackedObject* const object = get_object_tracker(env, thiz)->GetObject(handle);
+  return object->GetMatchScore().value;
 }
 
 JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(getTrackedPositionNative)(
-    JNIEnv* env, jobject thiz, jstring object_id, jfloatArray rect_array) {
-  jboolean iCopied = JNI_FALSE;
-  const char* const id_str = env->GetStringUTFChars(object_id, 0);
-
+    JNIEnv* env, jobject thiz, jint handle, jfloatArray rect_array) {
   const BoundingBox bounding_box =
-      get_object_tracker(env, thiz)->GetObject(id_str)->GetPosition();
-  env->ReleaseStringUTFChars(object_id, id_str);
+      get_object_tracker(env, thiz)->GetObject(handle)->GetPosition();
 
-  jfloat* rect = env->GetFloatArrayElements(rect_array, &iCopied);
-  bounding_box.CopyToArray(reinterpret_cast<float*>(rect));
-  env->ReleaseFloatArrayElements(rect_array, rect, 0);
+  jfloat rect[4];
+  bounding_box.CopyToArray(rect);
+  env->SetFloatArrayRegion(rect_array, 0, 4, rect);
 }
 
 JNIEXPORT
@@ -340,61 +443,205 @@ void JNICALL OBJECT_TRACKER_METHOD(nextFrameNative)(JNIEnv* env, jobject thiz,
   ResetTimeLog();
 }
 
+// Returns the address of a direct buffer, after checking that it holds at
+// least min_size bytes.
+static const uint8_t* GetDirectPlane(JNIEnv* env, jobject buffer,
+                                     const int64_t min_size) {
+  const uint8_t* const data =
+      reinterpret_cast<const uint8_t*>(env->GetDirectBufferAddress(buffer));
+  CHECK_ALWAYS(data != NULL, "Plane is not a direct buffer!");
+
+  const int64_t capacity = env->GetDirectBufferCapacity(buffer);
+  CHECK_ALWAYS(capacity >= min_size, "Plane too small! %lld vs %lld bytes",
+               static_cast<long long>(capacity),
+               static_cast<long long>(min_size));
+  return data;
+}
+
+// Describes the given direct buffers, sized for the tracker's frames scaled up
+// by downsample_factor, as FramePlanes. The planes are read in place, so
+// nothing needs to be copied or released.
+static FramePlanes GetDirectFramePlanes(
+    JNIEnv* env, const ObjectTracker& object_tracker, jobject y_buffer,
+    jint y_row_stride, jobject u_buffer, jobject v_buffer, jint uv_row_stride,
+    jint uv_pixel_stride, jint downsample_factor) {
+  CHECK_ALWAYS(downsample_factor > 0, "Bad downsample factor %d",
+               downsample_factor);
+  const int source_width = object_tracker.GetFrameWidth() * downsample_factor;
+  const int source_height =
+      object_tracker.GetFrameHeight() * downsample_factor;
+
+  FramePlanes planes;
+  planes.y = GetDirectPlane(
+      env, y_buffer,
+      static_cast<int64_t>(source_height - 1) * y_row_stride + source_width);
+  planes.y_row_stride = y_row_stride;
+  planes.downsample_factor = downsample_factor;
+
+  if (u_buffer != NULL && v_buffer != NULL) {
+    // Chroma is subsampled by 2 in each dimension, as in all YUV 4:2:0 formats.
+    planes.uv_width = source_width / 2;
+    planes.uv_height = source_height / 2;
+    planes.uv_row_stride = uv_row_stride;
+    planes.uv_pixel_stride = uv_pixel_stride;
+
+    const int64_t min_uv_size =
+        static_cast<int64_t>(planes.uv_height - 1) * uv_row_stride +
+        static_cast<int64_t>(planes.uv_width - 1) * uv_pixel_stride + 1;
+    planes.u = GetDirectPlane(env, u_buffer, min_uv_size);
+    planes.v = GetDirectPlane(env, v_buffer, min_uv_size);
+  }
+  return planes;
+}
+
 JNIEXPORT
-void JNICALL OBJECT_TRACKER_METHOD(forgetNative)(JNIEnv* env, jobject thiz,
-                                                 jstring object_id) {
-  const char* const id_str = env->GetStringUTFChars(object_id, 0);
+void JNICALL OBJECT_TRACKER_METHOD(nextFrameDirectNative)(
+    JNIEnv* env, jobject thiz, jobject y_buffer, jint y_row_stride,
+    jobject u_buffer, jobject v_buffer, jint uv_row_stride,
+    jint uv_pixel_stride, jint downsample_factor, jlong timestamp,
+    jfloatArray vg_matrix_2x3) {
+  TimeLog("Starting object tracker");
 
-  get_object_tracker(env, thiz)->ForgetTarget(id_str);
+  ObjectTracker* const object_tracker = get_object_tracker(env, thiz);
 
-  env->ReleaseStringUTFChars(object_id, id_str);
+  const FramePlanes planes = GetDirectFramePlanes(
+      env, *object_tracker, y_buffer, y_row_stride, u_buffer, v_buffer,
+      uv_row_stride, uv_pixel_stride, downsample_factor);
+
+  float vision_gyro_matrix_array[6];
+  if (vg_matrix_2x3 != NULL) {
+    env->GetFloatArrayRegion(vg_matrix_2x3, 0, 6, vision_gyro_matrix_array);
+  }
+
+  TimeLog("Got planes");
+
+  object_tracker->NextFrame(
+      planes, timestamp,
+      vg_matrix_2x3 != NULL ? vision_gyro_matrix_array : NULL);
+
+  PrintTimeLog();
+  ResetTimeLog();
 }
 
 JNIEXPORT
-jfloatArray JNICALL OBJECT_TRACKER_METHOD(getKeypointsNative)(
-    JNIEnv* env, jobject thiz, jboolean only_found) {
-  jfloat keypoint_arr[kMaxKeypoints * kKeypointStep];
+void JNICALL OBJECT_TRACKER_METHOD(submitFrameDirectNative)(
+    JNIEnv* env, jobject thiz, jobject y_buffer, jint y_row_stride,
+    jobject u_buffer, jobject v_buffer, jint uv_row_stride,
+    jint uv_pixel_stride, jint downsample_factor, jlong timestamp,
+    jfloatArray vg_matrix_2x3) {
+  ObjectTracker* const object_tracker =
+      get_pipelined_object_tracker(env, thiz);
 
-  const int number_of_keypoints =
-      get_object_tracker(env, thiz)->GetKeypoints(only_found, keypoint_arr);
+  const FramePlanes planes = GetDirectFramePlanes(
+      env, *object_tracker, y_buffer, y_row_stride, u_buffer, v_buffer,
+      uv_row_stride, uv_pixel_stride, downsample_factor);
 
-  // Create and return the array that will be passed back to Java.
-  jfloatArray keypoints =
-      env->NewFloatArray(number_of_keypoints * kKeypointStep);
-  if (keypoints == NULL) {
-    LOGE("null array!");
-    return NULL;
+  float vision_gyro_matrix_array[6];
+  if (vg_matrix_2x3 != NULL) {
+    env->GetFloatArrayRegion(vg_matrix_2x3, 0, 6, vision_gyro_matrix_array);
   }
-  env->SetFloatArrayRegion(keypoints, 0, number_of_keypoints * kKeypointStep,
-                           keypoint_arr);
 
-  return keypoints;
+  object_tracker->SubmitFrame(
+      planes, timestamp,
+      vg_matrix_2x3 != NULL ? vision_gyro_matrix_array : NULL);
 }
 
 JNIEXPORT
-jbyteArray JNICALL OBJECT_TRACKER_METHOD(getKeypointsPacked)(
-    JNIEnv* env, jobject thiz, jfloat scale_factor) {
-  // 2 bytes to a uint16_t and two pairs of xy coordinates per keypoint.
-  const int bytes_per_keypoint = sizeof(uint16_t) * 2 * 2;
-  jbyte keypoint_arr[kMaxKeypoints * bytes_per_keypoint];
+jlong JNICALL OBJECT_TRACKER_METHOD(getLastTrackedTimestampNative)(
+    JNIEnv* env, jobject thiz) {
+  return get_pipelined_object_tracker(env, thiz)->GetLastTrackedTimestamp();
+}
 
-  const int number_of_keypoints =
-      get_object_tracker(env, thiz)->GetKeypointsPacked(
-          reinterpret_cast<uint16_t*>(keypoint_arr), scale_factor);
+JNIEXPORT
+void JNICALL OBJECT_TRACKER_METHOD(waitForFrameNative)(JNIEnv* env,
+                                                       jobject thiz,
+                                                       jlong timestamp) {
+  get_pipelined_object_tracker(env, thiz)->WaitForFrame(timestamp);
+}
 
-  // Create and return the array that will be passed back to Java.
-  jbyteArray keypoints =
-      env->NewByteArray(number_of_keypoints * bytes_per_keypoint);
+JNIEXPORT
+void JNICALL OBJECT_TRACKER_METHOD(forgetNative)(JNIEnv* env, jobject thiz,
+                                                 jint handle) {
+  get_object_tracker(env, thiz)->ForgetTarget(handle);
+}
+
+// Returns the address of a direct buffer that can hold at least min_size
+// bytes of type T. ByteBuffer.allocateDirect() buffers are 8 byte aligned.
+template <typename T>
+static T* GetDirectOutputBuffer(JNIEnv* env, jobject buffer,
+                                const int64_t min_size) {
+  void* const data = env->GetDirectBufferAddress(buffer);
+  CHECK_ALWAYS(data != NULL, "Output is not a direct buffer!");
+  CHECK_ALWAYS(reinterpret_cast<uintptr_t>(data) % alignof(T) == 0,
+               "Output buffer is misaligned!");
+
+  const int64_t capacity = env->GetDirectBufferCapacity(buffer);
+  CHECK_ALWAYS(capacity >= min_size, "Output too small! %lld vs %lld bytes",
+               static_cast<long long>(capacity),
+               static_cast<long long>(min_size));
+  return reinterpret_cast<T*>(data);
+}
+
+JNIEXPORT
+jint JNICALL OBJECT_TRACKER_METHOD(getObjectSnapshotsNative)(
+    JNIEnv* env, jobject thiz, jobject snapshot_buffer) {
+  const ObjectTracker* const tracker = get_object_tracker(env, thiz);
+  ObjectSnapshot* const snapshots =
+      GetDirectOutputBuffer<ObjectSnapshot>(env, snapshot_buffer, 0);
+  const int64_t capacity = env->GetDirectBufferCapacity(snapshot_buffer);
+  return tracker->GetObjectSnapshots(
+      snapshots, static_cast<int>(capacity / sizeof(ObjectSnapshot)));
+}
 
-  if (keypoints == NULL) {
+JNIEXPORT
+jint JNICALL OBJECT_TRACKER_METHOD(getKeypointsPackedNative)(
+    JNIEnv* env, jobject thiz, jfloat scale_factor, jobject keypoint_buffer) {
+  // Two pairs of xy coordinates per keypoint.
+  const ObjectTracker* const tracker = get_object_tracker(env, thiz);
+  uint16_t* const keypoints = GetDirectOutputBuffer<uint16_t>(
+      env, keypoint_buffer,
+      static_cast<int64_t>(tracker->GetMaxKeypoints()) * 2 * 2 *
+          sizeof(uint16_t));
+  return tracker->GetKeypointsPacked(keypoints, scale_factor);
+}
+
+JNIEXPORT
+jint JNICALL OBJECT_TRACKER_METHOD(getKeypointsNative)(
+    JNIEnv* env, jobject thiz, jboolean only_found, jobject keypoint_buffer) {
+  const ObjectTracker* const tracker = get_object_tracker(env, thiz);
+  float* const keypoints = GetDirectOutputBuffer<float>(
+      env, keypoint_buffer,
+      static_cast<int64_t>(tracker->GetMaxKeypoints()) * kKeypointStep *
+          sizeof(float));
+  return tracker->GetKeypoints(only_found, keypoints);
+}
+
+JNIEXPORT
+jfloatArray JNICALL OBJECT_TRACKER_METHOD(getStageLatenciesNative)(
+    JNIEnv* env, jobject thiz) {
+  jfloat latency_arr[NUM_TRACKER_STAGES * kStageLatencyStep];
+
+  const int number_of_stages =
+      get_object_tracker(env, thiz)->GetStageLatencies().GetSummaries(
+          latency_arr);
+
+  // Create and return the array that will be passed back to Java.
+  jfloatArray latencies =
+      env->NewFloatArray(number_of_stages * kStageLatencyStep);
+  if (latencies == NULL) {
     LOGE("null array!");
     return NULL;
   }
+  env->SetFloatArrayRegion(latencies, 0, number_of_stages * kStageLatencyStep,
+                           latency_arr);
 
-  env->SetByteArrayRegion(
-      keypoints, 0, number_of_keypoints * bytes_per_keypoint, keypoint_arr);
+  return latencies;
+}
 
-  return keypoints;
+JNIEXPORT
+void JNICALL OBJECT_TRACKER_METHOD(resetStageLatenciesNative)(JNIEnv* env,
+                                                              jobject thiz) {
+  get_object_tracker(env, thiz)->ResetStageLatencies();
 }
 
 JNIEXPORT
@@ -416,7 +663,7 @@ JNIEXPORT
 void JNICALL OBJECT_TRACKER_METHOD(drawNative)(
     JNIEnv* env, jobject thiz, jint view_width, jint view_height,
     jfloatArray frame_to_canvas_arr) {
-  ObjectTracker* object_tracker = get_object_tracker(env, thiz);
+  ObjectTracker* object_tracker = get_pipelined_object_tracker(env, thiz);
   if (object_tracker != NULL) {
     jfloat* frame_to_canvas =
         env->GetFloatArrayElements(frame_to_canvas_arr, NULL);
@@ -456,4 +703,15 @@ JNIEXPORT void JNICALL OBJECT_TRACKER_METHOD(downsampleImageNative)(
   env->ReleaseByteArrayElements(output, output_array, 0);
 }
 
+JNIEXPORT jlong JNICALL OBJECT_TRACKER_METHOD(getMemoryUsageNative)(
+    JNIEnv* env, jclass clazz, jint width, jint height,
+    jint num_worker_threads, jint max_keypoints, jint max_keypoints_per_object,
+    jint max_candidate_keypoints, jint num_retained_frames) {
+  TrackerConfig config(Size(width, height));
+  set_tracker_capacities(num_worker_threads, max_keypoints,
+                         max_keypoints_per_object, max_candidate_keypoints,
+                         num_retained_frames, &config);
+  return ObjectTracker::GetMemoryUsage(config).Total();
+}
+
 }  // namespace tf_tracking
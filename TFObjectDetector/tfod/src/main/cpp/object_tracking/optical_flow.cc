@@ -35,7 +35,13 @@ OpticalFlow::OpticalFlow(const OpticalFlowConfig* const config)
     : config_(config),
       frame1_(NULL),
       frame2_(NULL),
-      working_size_(config->image_size) {}
+      working_size_(config->image_size),
+      num_solves_(0),
+      num_iterations_(0),
+      num_converged_(0) {
+  CHECK_ALWAYS(config->max_iterations > 0, "Invalid iteration limit %d",
+               config->max_iterations);
+}
 
 
 void OpticalFlow::NextFrame(const ImageData* const image_data) {
@@ -46,14 +52,72 @@ void OpticalFlow::NextFrame(const ImageData* const image_data) {
 }
 
 
+#if USE_FIXED_POINT_FLOW
+// Interpolates the patch_size x patch_size window of image whose top left
+// sample is at (left_fixed, top_fixed), clipping each sample position to
+// [0, fixed_x_max] x [0, fixed_y_max]. This is the same as calling
+// GetPixelInterpFixed1616 for every sample, but when nothing needs clipping,
+// which is nearly always, every sample shares the same weights, so those and
+// the row pointers are worked out once for the whole patch.
+template <typename T>
+static inline void GatherPatchFixed1616(const Image<T>& image,
+                                        const int left_fixed,
+                                        const int top_fixed,
+                                        const int fixed_x_max,
+                                        const int fixed_y_max,
+                                        const int patch_size,
+                                        float* const patch) {
+  const int last_offset = (patch_size - 1) << 16;
+  if (left_fixed < 0 || top_fixed < 0 ||
+      left_fixed + last_offset > fixed_x_max ||
+      top_fixed + last_offset > fixed_y_max) {
+    float* patch_ptr = patch;
+    for (int y = 0; y < patch_size; ++y) {
+      const int fp_y = Clip(top_fixed + (y << 16), 0, fixed_y_max);
+      for (int x = 0; x < patch_size; ++x) {
+        const int fp_x = Clip(left_fixed + (x << 16), 0, fixed_x_max);
+        *patch_ptr++ = image.GetPixelInterpFixed1616(fp_x, fp_y);
+      }
+    }
+    return;
+  }
+
+  static const int kFixedPointOne = 0x00010000;
+  static const int kFixedPointHalf = 0x00008000;
+
+  const int fp_x = left_fixed & 0xFFFF;
+  const int fp_y = top_fixed & 0xFFFF;
+  const int one_minus_fp_x = kFixedPointOne - fp_x;
+  const int one_minus_fp_y = kFixedPointOne - fp_y;
+  const int stride = image.stride();
+
+  const T* row = image[top_fixed >> 16] + (left_fixed >> 16);
+  float* patch_row = patch;
+  for (int y = 0; y < patch_size; ++y, row += stride, patch_row += patch_size) {
+    for (int x = 0; x < patch_size; ++x) {
+      const T* const p = row + x;
+      patch_row[x] = static_cast<T>(
+          (one_minus_fp_y *
+               static_cast<int64_t>(one_minus_fp_x * p[0] + fp_x * p[1]) +
+           fp_y * static_cast<int64_t>(one_minus_fp_x * p[stride] +
+                                       fp_x * p[stride + 1]) +
+           kFixedPointHalf) >>
+          32);
+    }
+  }
+}
+#endif
+
 // Static heart of the optical flow computation.
 // Lucas Kanade algorithm.
 bool OpticalFlow::FindFlowAtPoint_LK(const Image<uint8_t>& img_I,
                                      const Image<uint8_t>& img_J,
-                                     const Image<int32_t>& I_x,
-                                     const Image<int32_t>& I_y, const float p_x,
-                                     const float p_y, float* out_g_x,
-                                     float* out_g_y) {
+                                     const Image<int16_t>& I_x,
+                                     const Image<int16_t>& I_y, const float p_x,
+                                     const float p_y,
+                                     const OpticalFlowConfig& config,
+                                     float* out_g_x, float* out_g_y,
+                                     FlowSolverStats* const stats) {
   float g_x = *out_g_x;
   float g_y = *out_g_y;
   // Get values for frame 1.  They remain constant through the inner
@@ -84,17 +148,12 @@ bool OpticalFlow::FindFlowAtPoint_LK(const Image<uint8_t>& img_I,
   const int src_left_fixed = RealToFixed1616(src_left_real);
   const int src_top_fixed = RealToFixed1616(src_top_real);
 
-  for (int y = 0; y < kPatchSize; ++y) {
-    const int fp_y = Clip(src_top_fixed + (y << 16), 0, fixed_y_max);
-
-    for (int x = 0; x < kPatchSize; ++x) {
-      const int fp_x = Clip(src_left_fixed + (x << 16), 0, fixed_x_max);
-
-      *vals_I_ptr++ = img_I.GetPixelInterpFixed1616(fp_x, fp_y);
-      *vals_I_x_ptr++ = I_x.GetPixelInterpFixed1616(fp_x, fp_y);
-      *vals_I_y_ptr++ = I_y.GetPixelInterpFixed1616(fp_x, fp_y);
-    }
-  }
+  GatherPatchFixed1616(img_I, src_left_fixed, src_top_fixed, fixed_x_max,
+                       fixed_y_max, kPatchSize, vals_I);
+  GatherPatchFixed1616(I_x, src_left_fixed, src_top_fixed, fixed_x_max,
+                       fixed_y_max, kPatchSize, vals_I_x);
+  GatherPatchFixed1616(I_y, src_left_fixed, src_top_fixed, fixed_x_max,
+                       fixed_y_max, kPatchSize, vals_I_y);
 #else
   for (int y = 0; y < kPatchSize; ++y) {
     const float y_pos = Clip(src_top_real + y, 0.0f, real_y_max);
@@ -124,8 +183,13 @@ bool OpticalFlow::FindFlowAtPoint_LK(const Image<uint8_t>& img_I,
   const float std_dev_I = ComputeStdDev(vals_I, kFlowArraySize, mean_I);
 #endif
 
-  // Iterate kNumIterations times or until we converge.
-  for (int iteration = 0; iteration < kNumIterations; ++iteration) {
+  const float convergence_squared = Square(config.convergence_threshold);
+  ++stats->num_solves;
+
+  // Iterate config.max_iterations times or until we converge.
+  for (int iteration = 0; iteration < config.max_iterations; ++iteration) {
+    ++stats->num_iterations;
+
     // Get values for frame 2.
     float vals_J[kFlowArraySize];
 
@@ -139,13 +203,8 @@ bool OpticalFlow::FindFlowAtPoint_LK(const Image<uint8_t>& img_I,
     const int left_fixed = RealToFixed1616(left_real);
     const int top_fixed  = RealToFixed1616(top_real);
 
-    for (int win_y = 0; win_y < kPatchSize; ++win_y) {
-      const int fp_y = Clip(top_fixed + (win_y << 16), 0, fixed_y_max);
-      for (int win_x = 0; win_x < kPatchSize; ++win_x) {
-        const int fp_x = Clip(left_fixed + (win_x << 16), 0, fixed_x_max);
-        *vals_J_ptr++ = img_J.GetPixelInterpFixed1616(fp_x, fp_y);
-      }
-    }
+    GatherPatchFixed1616(img_J, left_fixed, top_fixed, fixed_x_max,
+                         fixed_y_max, kPatchSize, vals_J);
 #else
     for (int win_y = 0; win_y < kPatchSize; ++win_y) {
       const float y_pos = Clip(top_real + win_y, 0.0f, real_y_max);
@@ -200,7 +259,8 @@ bool OpticalFlow::FindFlowAtPoint_LK(const Image<uint8_t>& img_I,
     // LOGV("Iteration %d: delta (%.3f, %.3f)", iteration, n_x, n_y);
 
     // Abort early if we're already below the threshold.
-    if (Square(n_x) + Square(n_y) < Square(kTrackingAbortThreshold)) {
+    if (Square(n_x) + Square(n_y) < convergence_squared) {
+      ++stats->num_converged;
       break;
     }
   }  // Iteration.
@@ -215,9 +275,10 @@ bool OpticalFlow::FindFlowAtPoint_LK(const Image<uint8_t>& img_I,
 // Pointwise flow using translational 2dof ESM.
 bool OpticalFlow::FindFlowAtPoint_ESM(
     const Image<uint8_t>& img_I, const Image<uint8_t>& img_J,
-    const Image<int32_t>& I_x, const Image<int32_t>& I_y,
-    const Image<int32_t>& J_x, const Image<int32_t>& J_y, const float p_x,
-    const float p_y, float* out_g_x, float* out_g_y) {
+    const Image<int16_t>& I_x, const Image<int16_t>& I_y,
+    const Image<int16_t>& J_x, const Image<int16_t>& J_y, const float p_x,
+    const float p_y, const OpticalFlowConfig& config, float* out_g_x,
+    float* out_g_y, FlowSolverStats* const stats) {
   float g_x = *out_g_x;
   float g_y = *out_g_y;
   const float area_inv = 1.0f / static_cast<float>(kFlowArraySize);
@@ -279,8 +340,12 @@ bool OpticalFlow::FindFlowAtPoint_ESM(
     bright_offset = static_cast<int>(static_cast<float>(sum_diff) * area_inv);
   }
 
-  // Iterate kNumIterations times or until we go out of image.
-  for (int iteration = 0; iteration < kNumIterations; ++iteration) {
+  const float convergence_squared = Square(config.convergence_threshold);
+  ++stats->num_solves;
+
+  // Iterate config.max_iterations times or until we converge or go out of
+  // image.
+  for (int iteration = 0; iteration < config.max_iterations; ++iteration) {
     int jtj[3] = { 0, 0, 0 };
     int jtr[2] = { 0, 0 };
     sum_diff = 0;
@@ -293,6 +358,7 @@ bool OpticalFlow::FindFlowAtPoint_ESM(
                                                vals_J)) {
       break;
     }
+    ++stats->num_iterations;
 
     const uint8_t* templ_row = vals_I;
     const uint8_t* extract_row = vals_J;
@@ -346,8 +412,18 @@ bool OpticalFlow::FindFlowAtPoint_ESM(
                              static_cast<float>(jtj[0]) };
     const double det_inv = 1.0 / static_cast<double>(prod1 - prod2);
 
-    g_x -= det_inv * (jtj_1[0] * jtr1_float + jtj_1[1] * jtr2_float);
-    g_y -= det_inv * (jtj_1[2] * jtr1_float + jtj_1[3] * jtr2_float);
+    const double n_x =
+        det_inv * (jtj_1[0] * jtr1_float + jtj_1[1] * jtr2_float);
+    const double n_y =
+        det_inv * (jtj_1[2] * jtr1_float + jtj_1[3] * jtr2_float);
+    g_x -= n_x;
+    g_y -= n_y;
+
+    // Stop once the step is below the threshold.
+    if (Square(n_x) + Square(n_y) < convergence_squared) {
+      ++stats->num_converged;
+      break;
+    }
 
     if (kDoBrightnessNormalize) {
       bright_offset +=
@@ -376,25 +452,40 @@ bool OpticalFlow::FindFlowAtPoint_ESM(
 }
 
 
-bool OpticalFlow::FindFlowAtPointReversible(
-    const int level, const float u_x, const float u_y,
-    const bool reverse_flow,
-    float* flow_x, float* flow_y) const {
+void OpticalFlow::GetLevelImages(const int level, const bool reverse_flow,
+                                 LevelImages* const images) const {
   const ImageData& frame_a = reverse_flow ? *frame2_ : *frame1_;
   const ImageData& frame_b = reverse_flow ? *frame1_ : *frame2_;
 
   // Images I (prev) and J (next).
-  const Image<uint8_t>& img_I = *frame_a.GetPyramidSqrt2Level(level * 2);
-  const Image<uint8_t>& img_J = *frame_b.GetPyramidSqrt2Level(level * 2);
+  images->img_I = frame_a.GetPyramidSqrt2Level(level * 2);
+  images->img_J = frame_b.GetPyramidSqrt2Level(level * 2);
 
   // Computed gradients.
-  const Image<int32_t>& I_x = *frame_a.GetSpatialX(level);
-  const Image<int32_t>& I_y = *frame_a.GetSpatialY(level);
-  const Image<int32_t>& J_x = *frame_b.GetSpatialX(level);
-  const Image<int32_t>& J_y = *frame_b.GetSpatialY(level);
+  images->I_x = frame_a.GetSpatialX(level);
+  images->I_y = frame_a.GetSpatialY(level);
+  images->J_x = frame_b.GetSpatialX(level);
+  images->J_y = frame_b.GetSpatialY(level);
+
+  images->shrink_factor = (1 << level);
+}
+
+
+void OpticalFlow::ComputeLevelImages() const {
+  LevelImages images;
+  for (int level = 0; level < kNumPyramidLevels; ++level) {
+    GetLevelImages(level, false, &images);
+    GetLevelImages(level, true, &images);
+  }
+}
 
-  // Shrink factor from original.
-  const float shrink_factor = (1 << level);
+
+bool OpticalFlow::FindFlowAtPointOnLevel(const LevelImages& images,
+                                         const float u_x, const float u_y,
+                                         float* const flow_x,
+                                         float* const flow_y,
+                                         FlowSolverStats* const stats) const {
+  const float shrink_factor = images.shrink_factor;
 
   // Image position vector (p := u^l), scaled for this level.
   const float scaled_p_x = u_x / shrink_factor;
@@ -406,13 +497,14 @@ bool OpticalFlow::FindFlowAtPointReversible(
   // LOGE("FindFlowAtPoint level %d: %5.2f, %5.2f (%5.2f, %5.2f)", level,
   //     scaled_p_x, scaled_p_y, &scaled_flow_x, &scaled_flow_y);
 
-  const bool success = kUseEsm ?
-    FindFlowAtPoint_ESM(img_I, img_J, I_x, I_y, J_x, J_y,
-                        scaled_p_x, scaled_p_y,
-                        &scaled_flow_x, &scaled_flow_y) :
-    FindFlowAtPoint_LK(img_I, img_J, I_x, I_y,
-                       scaled_p_x, scaled_p_y,
-                       &scaled_flow_x, &scaled_flow_y);
+  const bool success = config_->solver == FLOW_SOLVER_ESM ?
+    FindFlowAtPoint_ESM(*images.img_I, *images.img_J, *images.I_x,
+                        *images.I_y, *images.J_x, *images.J_y,
+                        scaled_p_x, scaled_p_y, *config_,
+                        &scaled_flow_x, &scaled_flow_y, stats) :
+    FindFlowAtPoint_LK(*images.img_I, *images.img_J, *images.I_x,
+                       *images.I_y, scaled_p_x, scaled_p_y, *config_,
+                       &scaled_flow_x, &scaled_flow_y, stats);
 
   *flow_x = scaled_flow_x * shrink_factor;
   *flow_y = scaled_flow_y * shrink_factor;
@@ -421,12 +513,28 @@ bool OpticalFlow::FindFlowAtPointReversible(
 }
 
 
-bool OpticalFlow::FindFlowAtPointSingleLevel(
-    const int level,
-    const float u_x, const float u_y,
-    const bool filter_by_fb_error,
+bool OpticalFlow::FindFlowAtPointReversible(
+    const int level, const float u_x, const float u_y,
+    const bool reverse_flow,
     float* flow_x, float* flow_y) const {
-  if (!FindFlowAtPointReversible(level, u_x, u_y, false, flow_x, flow_y)) {
+  LevelImages images;
+  GetLevelImages(level, reverse_flow, &images);
+  FlowSolverStats stats;
+  const bool success =
+      FindFlowAtPointOnLevel(images, u_x, u_y, flow_x, flow_y, &stats);
+  RecordSolverStats(stats);
+  return success;
+}
+
+
+bool OpticalFlow::FindFlowAtPointFiltered(const LevelImages& forward,
+                                          const LevelImages& backward,
+                                          const float u_x, const float u_y,
+                                          const bool filter_by_fb_error,
+                                          float* const flow_x,
+                                          float* const flow_y,
+                                          FlowSolverStats* const stats) const {
+  if (!FindFlowAtPointOnLevel(forward, u_x, u_y, flow_x, flow_y, stats)) {
     return false;
   }
 
@@ -439,9 +547,8 @@ bool OpticalFlow::FindFlowAtPointSingleLevel(
 
     // Now find the backwards flow and confirm it lines up with the original
     // starting point.
-    if (!FindFlowAtPointReversible(level, new_position_x, new_position_y,
-                                   true,
-                                   &reverse_flow_x, &reverse_flow_y)) {
+    if (!FindFlowAtPointOnLevel(backward, new_position_x, new_position_y,
+                                &reverse_flow_x, &reverse_flow_y, stats)) {
       LOGE("Backward error!");
       return false;
     }
@@ -460,6 +567,68 @@ bool OpticalFlow::FindFlowAtPointSingleLevel(
 }
 
 
+bool OpticalFlow::FindFlowAtPointSingleLevel(
+    const int level,
+    const float u_x, const float u_y,
+    const bool filter_by_fb_error,
+    float* flow_x, float* flow_y) const {
+  LevelImages forward;
+  LevelImages backward;
+  GetLevelImages(level, false, &forward);
+  if (filter_by_fb_error) {
+    GetLevelImages(level, true, &backward);
+  }
+  FlowSolverStats stats;
+  const bool success = FindFlowAtPointFiltered(
+      forward, backward, u_x, u_y, filter_by_fb_error, flow_x, flow_y, &stats);
+  RecordSolverStats(stats);
+  return success;
+}
+
+
+void OpticalFlow::FindFlowAtPointsSingleLevel(const int level,
+                                              const int num_points,
+                                              const float* const u_x,
+                                              const float* const u_y,
+                                              const bool filter_by_fb_error,
+                                              float* const flow_x,
+                                              float* const flow_y,
+                                              bool* const success) const {
+  LevelImages forward;
+  LevelImages backward;
+  GetLevelImages(level, false, &forward);
+  if (filter_by_fb_error) {
+    GetLevelImages(level, true, &backward);
+  }
+
+  FlowSolverStats stats;
+  for (int i = 0; i < num_points; ++i) {
+    if (success[i]) {
+      success[i] = FindFlowAtPointFiltered(forward, backward, u_x[i], u_y[i],
+                                           filter_by_fb_error, flow_x + i,
+                                           flow_y + i, &stats);
+    }
+  }
+  RecordSolverStats(stats);
+}
+
+
+void OpticalFlow::RecordSolverStats(const FlowSolverStats& stats) const {
+  num_solves_.fetch_add(stats.num_solves, std::memory_order_relaxed);
+  num_iterations_.fetch_add(stats.num_iterations, std::memory_order_relaxed);
+  num_converged_.fetch_add(stats.num_converged, std::memory_order_relaxed);
+}
+
+
+FlowSolverStats OpticalFlow::GetSolverStats() const {
+  FlowSolverStats stats;
+  stats.num_solves = num_solves_.load(std::memory_order_relaxed);
+  stats.num_iterations = num_iterations_.load(std::memory_order_relaxed);
+  stats.num_converged = num_converged_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+
 // An implementation of the Pyramidal Lucas-Kanade Optical Flow algorithm.
 // See http://robots.stanford.edu/cs223b04/algo_tracking.pdf for details.
 bool OpticalFlow::FindFlowAtPointPyramidal(const float u_x, const float u_y,
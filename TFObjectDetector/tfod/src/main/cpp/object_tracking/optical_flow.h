@@ -16,6 +16,10 @@ limitations under the License.
 #ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_OPTICAL_FLOW_H_
 #define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_OPTICAL_FLOW_H_
 
+#include <stdint.h>
+
+#include <atomic>
+
 #include "geom.h"
 #include "image-inl.h"
 #include "image.h"
@@ -30,6 +34,22 @@ namespace tf_tracking {
 
 class FlowCache;
 
+// Counts of the work the flow solvers have done. See
+// OpticalFlow::GetSolverStats().
+struct FlowSolverStats {
+  FlowSolverStats() : num_solves(0), num_iterations(0), num_converged(0) {}
+
+  // Points solved at a single pyramid level, in either direction.
+  int64_t num_solves;
+
+  // Gauss-Newton steps taken over all of those.
+  int64_t num_iterations;
+
+  // Solves that stopped because their update fell below the convergence
+  // threshold, rather than at the iteration limit or the image border.
+  int64_t num_converged;
+};
+
 // Class encapsulating all the data and logic necessary for performing optical
 // flow.
 class OpticalFlow {
@@ -48,19 +68,25 @@ class OpticalFlow {
   void NextFrame(const ImageData* const image_data);
 
   // An implementation of the Lucas-Kanade Optical Flow algorithm.
+  // Both solvers take up to config.max_iterations steps, stopping early once
+  // a step is shorter than config.convergence_threshold, and add the work
+  // done to stats.
   static bool FindFlowAtPoint_LK(const Image<uint8_t>& img_I,
                                  const Image<uint8_t>& img_J,
-                                 const Image<int32_t>& I_x,
-                                 const Image<int32_t>& I_y, const float p_x,
-                                 const float p_y, float* out_g_x,
-                                 float* out_g_y);
+                                 const Image<int16_t>& I_x,
+                                 const Image<int16_t>& I_y, const float p_x,
+                                 const float p_y,
+                                 const OpticalFlowConfig& config,
+                                 float* out_g_x, float* out_g_y,
+                                 FlowSolverStats* const stats);
 
   // Pointwise flow using translational 2dof ESM.
   static bool FindFlowAtPoint_ESM(
       const Image<uint8_t>& img_I, const Image<uint8_t>& img_J,
-      const Image<int32_t>& I_x, const Image<int32_t>& I_y,
-      const Image<int32_t>& J_x, const Image<int32_t>& J_y, const float p_x,
-      const float p_y, float* out_g_x, float* out_g_y);
+      const Image<int16_t>& I_x, const Image<int16_t>& I_y,
+      const Image<int16_t>& J_x, const Image<int16_t>& J_y, const float p_x,
+      const float p_y, const OpticalFlowConfig& config, float* out_g_x,
+      float* out_g_y, FlowSolverStats* const stats);
 
   // Finds the flow using a specific level, in either direction.
   // If reversed, the coordinates are in the context of the latest
@@ -78,12 +104,71 @@ class OpticalFlow {
                                   const bool filter_by_fb_error,
                                   float* flow_x, float* flow_y) const;
 
+  // Batch version of FindFlowAtPointSingleLevel for num_points points, given
+  // as separate coordinate arrays. flow_x and flow_y hold the initial guesses
+  // and receive the refined flow. Points whose success flag is already false
+  // are skipped, and the flag is cleared for points whose flow fails. The
+  // results are identical to calling FindFlowAtPointSingleLevel per point, but
+  // the level's images are only looked up once.
+  void FindFlowAtPointsSingleLevel(const int level, const int num_points,
+                                   const float* const u_x,
+                                   const float* const u_y,
+                                   const bool filter_by_fb_error,
+                                   float* const flow_x, float* const flow_y,
+                                   bool* const success) const;
+
+  // Computes every image of both frames that the FindFlowAtPoint methods may
+  // read, which would otherwise happen lazily on first use. After this those
+  // methods only read shared state, so they may run on several threads at
+  // once.
+  void ComputeLevelImages() const;
+
   // Pyramidal optical-flow using all levels.
   bool FindFlowAtPointPyramidal(const float u_x, const float u_y,
                                 const bool filter_by_fb_error,
                                 float* flow_x, float* flow_y) const;
 
+  // Returns the work the solvers have done since construction. Safe to call
+  // while flow is being found on other threads, though the counts may then
+  // be from slightly different moments.
+  FlowSolverStats GetSolverStats() const;
+
  private:
+  // The images used to find flow at one pyramid level in one direction.
+  struct LevelImages {
+    const Image<uint8_t>* img_I;
+    const Image<uint8_t>* img_J;
+    const Image<int16_t>* I_x;
+    const Image<int16_t>* I_y;
+    const Image<int16_t>* J_x;
+    const Image<int16_t>* J_y;
+
+    // Shrink factor from original.
+    float shrink_factor;
+  };
+
+  void GetLevelImages(const int level, const bool reverse_flow,
+                      LevelImages* const images) const;
+
+  // FindFlowAtPointReversible, given the level's images, with the config's
+  // solver.
+  bool FindFlowAtPointOnLevel(const LevelImages& images,
+                              const float u_x, const float u_y,
+                              float* const flow_x, float* const flow_y,
+                              FlowSolverStats* const stats) const;
+
+  // FindFlowAtPointSingleLevel, given the level's images in each direction.
+  // backward is only used when filtering by forward-backward error.
+  bool FindFlowAtPointFiltered(const LevelImages& forward,
+                               const LevelImages& backward,
+                               const float u_x, const float u_y,
+                               const bool filter_by_fb_error,
+                               float* const flow_x, float* const flow_y,
+                               FlowSolverStats* const stats) const;
+
+  // Adds the work of one or more solves to the running totals.
+  void RecordSolverStats(const FlowSolverStats& stats) const;
+
   const OpticalFlowConfig* const config_;
 
   const ImageData* frame1_;
@@ -92,6 +177,12 @@ class OpticalFlow {
   // Size of the internally allocated images (after original is downsampled).
   const Size working_size_;
 
+  // Running totals of FlowSolverStats. Batches are added in one go, so the
+  // threads finding flow rarely touch these.
+  mutable std::atomic<int64_t> num_solves_;
+  mutable std::atomic<int64_t> num_iterations_;
+  mutable std::atomic<int64_t> num_converged_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(OpticalFlow);
 };
 
@@ -0,0 +1,151 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_SNAPSHOT_PUBLISHER_H_
+#define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_SNAPSHOT_PUBLISHER_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "logging.h"
+#include "utils.h"
+
+namespace tf_tracking {
+
+// The state of one tracked object after a frame, in a fixed layout so that
+// all objects can be copied out in one go, e.g. into a direct ByteBuffer
+// shared with Java. ObjectTracker.java mirrors the offsets, so fields must
+// only ever be appended.
+struct ObjectSnapshot {
+  int32_t handle;
+  float left;
+  float top;
+  float right;
+  float bottom;
+  float correlation;
+  float match_score;
+  int32_t visible;
+  int64_t position_time;
+};
+
+// Holds the latest ObjectSnapshots published by a single writer thread, for
+// any number of reader threads to copy out without ever waiting on the writer.
+//
+// This is a seqlock: the sequence number is odd while a Publish() is under
+// way, and a reader that saw it change while copying simply copies again.
+// Publishing only takes as long as copying the snapshots, so readers retry
+// rarely and never for long. The snapshots are stored as relaxed atomic words
+// so that the copies a reader throws away are not data races.
+class SnapshotPublisher {
+ public:
+  explicit SnapshotPublisher(const int capacity)
+      : capacity_(capacity),
+        sequence_(0),
+        num_snapshots_(0),
+        timestamp_(0),
+        words_(new std::atomic<uint64_t>[capacity * kWordsPerSnapshot]) {
+    SCHECK(capacity >= 0, "Invalid capacity %d", capacity);
+    for (int i = 0; i < capacity * kWordsPerSnapshot; ++i) {
+      words_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Replaces the published snapshots. Only the first GetCapacity() are kept,
+  // but readers are told num_snapshots. Must not be called concurrently with
+  // itself.
+  void Publish(const ObjectSnapshot* const snapshots, const int num_snapshots,
+               const int64_t timestamp) {
+    const uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const int num_stored = MIN(num_snapshots, capacity_);
+    for (int i = 0; i < num_stored; ++i) {
+      uint64_t words[kWordsPerSnapshot];
+      memcpy(words, snapshots + i, sizeof(words));
+      std::atomic<uint64_t>* const dst = words_.get() + i * kWordsPerSnapshot;
+      for (int j = 0; j < kWordsPerSnapshot; ++j) {
+        dst[j].store(words[j], std::memory_order_relaxed);
+      }
+    }
+    num_snapshots_.store(num_snapshots, std::memory_order_relaxed);
+    timestamp_.store(timestamp, std::memory_order_relaxed);
+
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  // Copies up to max_snapshots of the latest published snapshots, all from the
+  // same Publish() call, into snapshots. Returns the number that were
+  // published, which may be more than were copied. Safe to call from any
+  // thread at any time.
+  int Read(ObjectSnapshot* const snapshots, const int max_snapshots,
+           int64_t* const timestamp) const {
+    while (true) {
+      const uint32_t sequence = sequence_.load(std::memory_order_acquire);
+      if (sequence & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      const int num_snapshots = num_snapshots_.load(std::memory_order_relaxed);
+      const int64_t published_time = timestamp_.load(std::memory_order_relaxed);
+      const int num_copied = MIN(MIN(num_snapshots, capacity_), max_snapshots);
+      for (int i = 0; i < num_copied; ++i) {
+        uint64_t words[kWordsPerSnapshot];
+        const std::atomic<uint64_t>* const src =
+            words_.get() + i * kWordsPerSnapshot;
+        for (int j = 0; j < kWordsPerSnapshot; ++j) {
+          words[j] = src[j].load(std::memory_order_relaxed);
+        }
+        memcpy(snapshots + i, words, sizeof(words));
+      }
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence_.load(std::memory_order_relaxed) == sequence) {
+        if (timestamp != NULL) {
+          *timestamp = published_time;
+        }
+        return num_snapshots;
+      }
+    }
+  }
+
+  inline int GetCapacity() const {
+    return capacity_;
+  }
+
+ private:
+  static const int kWordsPerSnapshot =
+      sizeof(ObjectSnapshot) / sizeof(uint64_t);
+  static_assert(sizeof(ObjectSnapshot) % sizeof(uint64_t) == 0,
+                "ObjectSnapshot must be a whole number of words");
+
+  const int capacity_;
+
+  std::atomic<uint32_t> sequence_;
+  std::atomic<int> num_snapshots_;
+  std::atomic<int64_t> timestamp_;
+  std::unique_ptr<std::atomic<uint64_t>[]> words_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(SnapshotPublisher);
+};
+
+}  // namespace tf_tracking
+
+#endif  // TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_SNAPSHOT_PUBLISHER_H_
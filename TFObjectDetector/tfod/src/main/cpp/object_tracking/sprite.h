@@ -140,7 +140,8 @@ class Sprite {
     // source image with some alignment modifications.
     if (left != 0 || top != 0 ||
         actual_width_ != texture_source.GetWidth() ||
-        actual_height_ != texture_source.GetHeight()) {
+        actual_height_ != texture_source.GetHeight() ||
+        texture_source.stride() != texture_source.GetWidth()) {
       texture_data = new uint8_t[actual_width_ * actual_height_];
 
       for (int y = 0; y < actual_height_; ++y) {
@@ -0,0 +1,253 @@
+/* Copyright 2016 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Always-on latency instrumentation for the stages of ObjectTracker::NextFrame.
+// Unlike time_log.h this does not need LOG_TIME, and recording a sample is a
+// couple of relaxed atomic operations.
+
+#ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_STAGE_LATENCY_H_
+#define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_STAGE_LATENCY_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "logging.h"
+#include "utils.h"
+
+namespace tf_tracking {
+
+// The timed stages of ObjectTracker::NextFrame.
+enum TrackerStage {
+  TRACKER_STAGE_PYRAMID = 0,
+  TRACKER_STAGE_KEYPOINTS = 1,
+  TRACKER_STAGE_FLOW = 2,
+  TRACKER_STAGE_TRACK_OBJECTS = 3,
+  TRACKER_STAGE_DETECT_TARGETS = 4,
+  // The whole NextFrame call.
+  TRACKER_STAGE_NEXT_FRAME = 5,
+  NUM_TRACKER_STAGES = 6
+};
+
+inline const char* GetTrackerStageName(const TrackerStage stage) {
+  static const char* const kNames[NUM_TRACKER_STAGES] = {
+      "pyramid", "keypoints", "flow", "TrackObjects", "DetectTargets",
+      "NextFrame"};
+  return kNames[stage];
+}
+
+// Summary of the samples recorded for one stage. All durations are in
+// milliseconds.
+struct StageLatencySummary {
+  int64_t count;
+  float mean_ms;
+  float p50_ms;
+  float p90_ms;
+  float p99_ms;
+  float max_ms;
+};
+
+// Number of floats each StageLatencySummary takes up when exported to an
+// array, in the order of the struct fields.
+static const int kStageLatencyStep = 6;
+
+// A fixed-bucket latency histogram in the style of HdrHistogram. Values are
+// bucketed by their power of two, which is then split into kSubBuckets linear
+// sub-buckets, so any recorded value is reported with at most ~6% error
+// without ever allocating. Recording is safe from any thread.
+class LatencyHistogram {
+ public:
+  LatencyHistogram() {
+    Reset();
+  }
+
+  void Reset() {
+    for (int i = 0; i < kNumBuckets; ++i) {
+      counts_[i].store(0, std::memory_order_relaxed);
+    }
+    total_count_.store(0, std::memory_order_relaxed);
+    total_micros_.store(0, std::memory_order_relaxed);
+    max_micros_.store(0, std::memory_order_relaxed);
+  }
+
+  void Record(const int64_t micros) {
+    const int64_t value = MAX(micros, 0);
+    counts_[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+    total_count_.fetch_add(1, std::memory_order_relaxed);
+    total_micros_.fetch_add(value, std::memory_order_relaxed);
+
+    int64_t curr_max = max_micros_.load(std::memory_order_relaxed);
+    while (value > curr_max &&
+           !max_micros_.compare_exchange_weak(curr_max, value,
+                                              std::memory_order_relaxed)) {
+    }
+  }
+
+  inline int64_t GetCount() const {
+    return total_count_.load(std::memory_order_relaxed);
+  }
+
+  inline int64_t GetMaxMicros() const {
+    return max_micros_.load(std::memory_order_relaxed);
+  }
+
+  inline float GetMeanMicros() const {
+    const int64_t count = GetCount();
+    return count > 0 ?
+        static_cast<float>(total_micros_.load(std::memory_order_relaxed)) /
+        count : 0.0f;
+  }
+
+  // Returns the smallest bucket bound that at least percent% of the samples
+  // fall under, clamped to the largest sample seen.
+  int64_t GetPercentileMicros(const float percent) const {
+    const int64_t count = GetCount();
+    if (count == 0) {
+      return 0;
+    }
+
+    const int64_t target =
+        MAX(static_cast<int64_t>(ceil(percent / 100.0f * count)), 1);
+
+    int64_t seen = 0;
+    for (int i = 0; i < kNumBuckets; ++i) {
+      seen += counts_[i].load(std::memory_order_relaxed);
+      if (seen >= target) {
+        return MIN(GetHighestValueInBucket(i), GetMaxMicros());
+      }
+    }
+    return GetMaxMicros();
+  }
+
+ private:
+  static const int kSubBucketBits = 4;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+
+  // Values at or above 2^(kMaxExponent + 1) microseconds (~71 minutes) all
+  // land in the last bucket.
+  static const int kMaxExponent = 31;
+
+  static const int kNumBuckets =
+      (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+  static int GetBucket(const int64_t value) {
+    if (value < kSubBuckets) {
+      return static_cast<int>(value);
+    }
+    const int64_t clamped = MIN(value, (1LL << (kMaxExponent + 1)) - 1);
+    const int exponent = 63 - __builtin_clzll(clamped);
+    const int shift = exponent - kSubBucketBits;
+    return (shift + 1) * kSubBuckets +
+        static_cast<int>((clamped >> shift) & (kSubBuckets - 1));
+  }
+
+  static int64_t GetHighestValueInBucket(const int bucket) {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    const int shift = bucket / kSubBuckets - 1;
+    const int64_t lowest =
+        static_cast<int64_t>(kSubBuckets + bucket % kSubBuckets) << shift;
+    return lowest + (1LL << shift) - 1;
+  }
+
+  std::atomic<uint32_t> counts_[kNumBuckets];
+  std::atomic<int64_t> total_count_;
+  std::atomic<int64_t> total_micros_;
+  std::atomic<int64_t> max_micros_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+};
+
+// One LatencyHistogram per TrackerStage.
+class StageLatencies {
+ public:
+  StageLatencies() {}
+
+  inline void Record(const TrackerStage stage, const int64_t nanos) {
+    histograms_[stage].Record(nanos / 1000);
+  }
+
+  void Reset() {
+    for (int i = 0; i < NUM_TRACKER_STAGES; ++i) {
+      histograms_[i].Reset();
+    }
+  }
+
+  inline const LatencyHistogram& GetHistogram(const TrackerStage stage) const {
+    return histograms_[stage];
+  }
+
+  void GetSummary(const TrackerStage stage,
+                  StageLatencySummary* const summary) const {
+    const LatencyHistogram& histogram = histograms_[stage];
+    summary->count = histogram.GetCount();
+    summary->mean_ms = histogram.GetMeanMicros() / 1000.0f;
+    summary->p50_ms = histogram.GetPercentileMicros(50.0f) / 1000.0f;
+    summary->p90_ms = histogram.GetPercentileMicros(90.0f) / 1000.0f;
+    summary->p99_ms = histogram.GetPercentileMicros(99.0f) / 1000.0f;
+    summary->max_ms = histogram.GetMaxMicros() / 1000.0f;
+  }
+
+  // Fills out_data with kStageLatencyStep floats for every stage, in
+  // TrackerStage order. out_data should be at least
+  // NUM_TRACKER_STAGES * kStageLatencyStep long. Returns the number of stages.
+  int GetSummaries(float* const out_data) const {
+    for (int i = 0; i < NUM_TRACKER_STAGES; ++i) {
+      StageLatencySummary summary;
+      GetSummary(static_cast<TrackerStage>(i), &summary);
+
+      float* const curr_data = out_data + i * kStageLatencyStep;
+      curr_data[0] = static_cast<float>(summary.count);
+      curr_data[1] = summary.mean_ms;
+      curr_data[2] = summary.p50_ms;
+      curr_data[3] = summary.p90_ms;
+      curr_data[4] = summary.p99_ms;
+      curr_data[5] = summary.max_ms;
+    }
+    return NUM_TRACKER_STAGES;
+  }
+
+ private:
+  LatencyHistogram histograms_[NUM_TRACKER_STAGES];
+
+  TF_DISALLOW_COPY_AND_ASSIGN(StageLatencies);
+};
+
+// Records the wall time between its construction and destruction into the
+// given stage. Lives on the stack of the thread doing the work, so nested and
+// concurrent timers never share any state besides the histogram itself.
+class ScopedStageTimer {
+ public:
+  ScopedStageTimer(StageLatencies* const latencies, const TrackerStage stage)
+      : latencies_(latencies),
+        stage_(stage),
+        start_time_(CurrentRealTimeNanos()) {}
+
+  ~ScopedStageTimer() {
+    latencies_->Record(stage_, CurrentRealTimeNanos() - start_time_);
+  }
+
+ private:
+  StageLatencies* const latencies_;
+  const TrackerStage stage_;
+  const int64_t start_time_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedStageTimer);
+};
+
+}  // namespace tf_tracking
+
+#endif  // TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_STAGE_LATENCY_H_
@@ -17,9 +17,9 @@ limitations under the License.
 
 #ifdef LOG_TIME
 // Storage for logging functionality.
-int num_time_logs = 0;
-LogEntry time_logs[NUM_LOGS];
+thread_local int num_time_logs = 0;
+thread_local LogEntry time_logs[NUM_LOGS];
 
-int num_avg_entries = 0;
-AverageEntry avg_entries[NUM_LOGS];
+thread_local int num_avg_entries = 0;
+thread_local AverageEntry avg_entries[NUM_LOGS];
 #endif
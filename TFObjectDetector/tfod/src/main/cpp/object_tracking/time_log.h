@@ -13,12 +13,14 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
-// Utility functions for performance profiling.
+// Utility functions for debug tracing of individual steps when built with
+// LOG_TIME. See stage_latency.h for the always-on per-stage histograms.
 
 #ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_TIME_LOG_H_
 #define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_TIME_LOG_H_
 
 #include <stdint.h>
+#include <string.h>
 
 #include "logging.h"
 #include "utils.h"
@@ -39,14 +41,15 @@ struct AverageEntry {
   float average_duration;
 };
 
-// Storage for keeping track of this frame's values.
-extern int num_time_logs;
-extern LogEntry time_logs[NUM_LOGS];
+// Storage for keeping track of this frame's values. Each thread keeps its own
+// log, so concurrent trackers do not trample each other's entries.
+extern thread_local int num_time_logs;
+extern thread_local LogEntry time_logs[NUM_LOGS];
 
 // Storage for keeping track of average values (each entry may not be printed
 // out each frame).
-extern AverageEntry avg_entries[NUM_LOGS];
-extern int num_avg_entries;
+extern thread_local AverageEntry avg_entries[NUM_LOGS];
+extern thread_local int num_avg_entries;
 
 // Call this at the start of a logging phase.
 inline static void ResetTimeLog() {
@@ -77,7 +80,7 @@ inline static float Blend(float old_val, float new_val) {
 inline static float UpdateAverage(const char* str, const float new_val) {
   for (int entry_num = 0; entry_num < num_avg_entries; ++entry_num) {
     AverageEntry* const entry = avg_entries + entry_num;
-    if (str == entry->id) {
+    if (str == entry->id || strcmp(str, entry->id) == 0) {
       entry->average_duration = Blend(entry->average_duration, new_val);
       return entry->average_duration;
     }
@@ -85,6 +88,7 @@ inline static float UpdateAverage(const char* str, const float new_val) {
 
   if (num_avg_entries >= NUM_LOGS) {
     LOGE("Too many log entries!");
+    return new_val;
   }
 
   // If it wasn't there already, add it.
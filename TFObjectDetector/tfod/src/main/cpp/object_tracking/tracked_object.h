@@ -58,14 +58,19 @@ class TrackedObject {
         num_consecutive_frames_below_threshold_ < kMaxNumDetectionFailures;
   }
 
-  inline float GetCorrelation() {
+  inline float GetCorrelation() const {
     return tracked_correlation_;
   }
 
-  inline MatchScore GetMatchScore() {
+  inline MatchScore GetMatchScore() const {
     return tracked_match_score_;
   }
 
+  // The time of the frame the current position was computed for.
+  inline int64_t GetPositionTime() const {
+    return position_last_computed_time_;
+  }
+
   inline BoundingBox GetPosition() const {
     return last_known_position_;
   }
@@ -83,21 +88,27 @@ class TrackedObject {
   }
 
   inline void Draw() const {
+    Draw(last_known_position_, tracked_correlation_);
+  }
+
+  // Draws a box at position, colored by the given correlation.
+  static inline void Draw(const BoundingBox& position,
+                          const float correlation) {
 #ifdef __RENDER_OPENGL__
-    if (tracked_correlation_ < kMinimumCorrelationForTracking) {
-      glColor4f(MAX(0.0f, -tracked_correlation_),
-                MAX(0.0f, tracked_correlation_),
+    if (correlation < kMinimumCorrelationForTracking) {
+      glColor4f(MAX(0.0f, -correlation),
+                MAX(0.0f, correlation),
                 0.0f,
                 1.0f);
     } else {
-      glColor4f(MAX(0.0f, -tracked_correlation_),
-                MAX(0.0f, tracked_correlation_),
+      glColor4f(MAX(0.0f, -correlation),
+                MAX(0.0f, correlation),
                 1.0f,
                 1.0f);
     }
 
     // Render the box itself.
-    BoundingBox temp_box(last_known_position_);
+    BoundingBox temp_box(position);
     DrawBox(temp_box);
 
     // Render a box inside this one (in case the actual box is hidden).
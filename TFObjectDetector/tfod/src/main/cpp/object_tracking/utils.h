@@ -96,6 +96,18 @@ inline static int64_t CurrentThreadTimeNanos() {
 #endif
 }
 
+inline static int64_t CurrentRealTimeNanos() {
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec tm;
+  clock_gettime(CLOCK_MONOTONIC, &tm);
+  return tm.tv_sec * 1000000000LL + tm.tv_nsec;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL;
+#endif
+}
+
 inline static int64_t CurrentRealTimeMillis() {
 #ifdef HAVE_CLOCK_GETTIME
   struct timespec tm;
@@ -227,8 +239,51 @@ inline T FastAtan2(const T y, const T x) {
 
 #define NELEMS(X) (sizeof(X) / sizeof(X[0]))
 
+// x86 builds carry SSE4.1 and AVX2 versions of the NEON kernels, which are
+// chosen at runtime based on what the CPU supports.
+#if !defined(__ARM_NEON) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__GNUC__)
+#define TF_TRACKING_X86_SIMD
+#endif
+
 namespace tf_tracking {
 
+#ifdef TF_TRACKING_X86_SIMD
+// The x86 instruction set extensions the accelerated kernels can use, in order
+// of preference.
+enum X86SimdLevel {
+  X86_SIMD_NONE = 0,
+  X86_SIMD_SSE41 = 1,
+  X86_SIMD_AVX2 = 2
+};
+
+// Returns the best level supported by the CPU and OS. Detected once.
+X86SimdLevel GetX86SimdLevel();
+
+float ComputeMeanSse41(const float* const values, const int num_vals);
+float ComputeMeanAvx2(const float* const values, const int num_vals);
+
+float ComputeStdDevSse41(const float* const values, const int num_vals,
+                         const float mean);
+float ComputeStdDevAvx2(const float* const values, const int num_vals,
+                        const float mean);
+
+float ComputeCrossCorrelationSse41(const float* const values1,
+                                   const float* const values2,
+                                   const int num_vals);
+float ComputeCrossCorrelationAvx2(const float* const values1,
+                                  const float* const values2,
+                                  const int num_vals);
+
+// Dispatch to the best of the above, or the Cpu versions below.
+float ComputeMeanX86(const float* const values, const int num_vals);
+float ComputeStdDevX86(const float* const values, const int num_vals,
+                       const float mean);
+float ComputeCrossCorrelationX86(const float* const values1,
+                                 const float* const values2,
+                                 const int num_vals);
+#endif
+
 #ifdef __ARM_NEON
 float ComputeMeanNeon(const float* const values, const int num_vals);
 
@@ -257,6 +312,8 @@ inline float ComputeMean(const float* const values, const int num_vals) {
   return
 #ifdef __ARM_NEON
       (num_vals >= 8) ? ComputeMeanNeon(values, num_vals) :
+#elif defined(TF_TRACKING_X86_SIMD)
+      (num_vals >= 8) ? ComputeMeanX86(values, num_vals) :
 #endif
                       ComputeMeanCpu(values, num_vals);
 }
@@ -280,6 +337,8 @@ inline float ComputeStdDev(const float* const values,
   return
 #ifdef __ARM_NEON
       (num_vals >= 8) ? ComputeStdDevNeon(values, num_vals, mean) :
+#elif defined(TF_TRACKING_X86_SIMD)
+      (num_vals >= 8) ? ComputeStdDevX86(values, num_vals, mean) :
 #endif
                       ComputeStdDevCpu(values, num_vals, mean);
 }
@@ -320,6 +379,9 @@ inline float ComputeCrossCorrelation(const float* const values1,
 #ifdef __ARM_NEON
       (num_vals >= 8) ? ComputeCrossCorrelationNeon(values1, values2, num_vals)
                       :
+#elif defined(TF_TRACKING_X86_SIMD)
+      (num_vals >= 8) ? ComputeCrossCorrelationX86(values1, values2, num_vals)
+                      :
 #endif
                       ComputeCrossCorrelationCpu(values1, values2, num_vals);
 }
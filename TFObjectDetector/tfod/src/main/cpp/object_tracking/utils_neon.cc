@@ -28,7 +28,7 @@ limitations under the License.
 namespace tf_tracking {
 
 inline static float GetSum(const float32x4_t& values) {
-  static float32_t summed_values[4];
+  float32_t summed_values[4];
   vst1q_f32(summed_values, values);
   return summed_values[0]
        + summed_values[1]
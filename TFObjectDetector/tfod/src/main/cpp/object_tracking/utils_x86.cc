@@ -0,0 +1,312 @@
+/* Copyright 2016 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// SSE4.1 and AVX2 versions of the NEON kernels in utils_neon.cc. Each kernel
+// is compiled for its own instruction set via target attributes, so the rest
+// of the library needs no special flags, and is only entered when
+// GetX86SimdLevel() says the CPU supports it.
+
+#include "utils.h"
+
+#ifdef TF_TRACKING_X86_SIMD
+
+#include <immintrin.h>
+
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+namespace tf_tracking {
+
+static X86SimdLevel DetectX86SimdLevel() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return X86_SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return X86_SIMD_SSE41;
+  }
+  return X86_SIMD_NONE;
+}
+
+X86SimdLevel GetX86SimdLevel() {
+  static const X86SimdLevel level = DetectX86SimdLevel();
+  return level;
+}
+
+TARGET_SSE41 inline static float GetSum(const __m128 values) {
+  const __m128 pairs = _mm_add_ps(values, _mm_movehl_ps(values, values));
+  return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+
+TARGET_AVX2 inline static float GetSum(const __m256 values) {
+  const __m128 halves = _mm_add_ps(_mm256_castps256_ps128(values),
+                                   _mm256_extractf128_ps(values, 1));
+  const __m128 pairs = _mm_add_ps(halves, _mm_movehl_ps(halves, halves));
+  return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+
+
+TARGET_SSE41 float ComputeMeanSse41(const float* const values,
+                                    const int num_vals) {
+  SCHECK(num_vals >= 8, "Not enough values to merit SSE: %d", num_vals);
+
+  __m128 accum = _mm_setzero_ps();
+
+  int offset = 0;
+  for (; offset <= num_vals - 4; offset += 4) {
+    accum = _mm_add_ps(accum, _mm_loadu_ps(values + offset));
+  }
+
+  // Pull the accumulated values into a single variable.
+  float sum = GetSum(accum);
+
+  // Get the remaining 1 to 3 values.
+  for (; offset < num_vals; ++offset) {
+    sum += values[offset];
+  }
+
+  const float mean_sse = sum / static_cast<float>(num_vals);
+
+#ifdef SANITY_CHECKS
+  const float mean_cpu = ComputeMeanCpu(values, num_vals);
+  SCHECK(NearlyEqual(mean_sse, mean_cpu, EPSILON * num_vals),
+        "SSE mismatch with CPU mean! %.10f vs %.10f",
+        mean_sse, mean_cpu);
+#endif
+
+  return mean_sse;
+}
+
+
+TARGET_AVX2 float ComputeMeanAvx2(const float* const values,
+                                  const int num_vals) {
+  SCHECK(num_vals >= 8, "Not enough values to merit AVX: %d", num_vals);
+
+  __m256 accum = _mm256_setzero_ps();
+
+  int offset = 0;
+  for (; offset <= num_vals - 8; offset += 8) {
+    accum = _mm256_add_ps(accum, _mm256_loadu_ps(values + offset));
+  }
+
+  // Pull the accumulated values into a single variable.
+  float sum = GetSum(accum);
+
+  // Get the remaining 1 to 7 values.
+  for (; offset < num_vals; ++offset) {
+    sum += values[offset];
+  }
+
+  const float mean_avx = sum / static_cast<float>(num_vals);
+
+#ifdef SANITY_CHECKS
+  const float mean_cpu = ComputeMeanCpu(values, num_vals);
+  SCHECK(NearlyEqual(mean_avx, mean_cpu, EPSILON * num_vals),
+        "AVX mismatch with CPU mean! %.10f vs %.10f",
+        mean_avx, mean_cpu);
+#endif
+
+  return mean_avx;
+}
+
+
+TARGET_SSE41 float ComputeStdDevSse41(const float* const values,
+                                      const int num_vals, const float mean) {
+  SCHECK(num_vals >= 8, "Not enough values to merit SSE: %d", num_vals);
+
+  const __m128 mean_vec = _mm_set1_ps(mean);
+
+  __m128 accum = _mm_setzero_ps();
+
+  int offset = 0;
+  for (; offset <= num_vals - 4; offset += 4) {
+    const __m128 deltas =
+        _mm_sub_ps(_mm_loadu_ps(values + offset), mean_vec);
+
+    accum = _mm_add_ps(accum, _mm_mul_ps(deltas, deltas));
+  }
+
+  // Pull the accumulated values into a single variable.
+  float squared_sum = GetSum(accum);
+
+  // Get the remaining 1 to 3 values.
+  for (; offset < num_vals; ++offset) {
+    squared_sum += Square(values[offset] - mean);
+  }
+
+  const float std_dev_sse = sqrt(squared_sum / static_cast<float>(num_vals));
+
+#ifdef SANITY_CHECKS
+  const float std_dev_cpu = ComputeStdDevCpu(values, num_vals, mean);
+  SCHECK(NearlyEqual(std_dev_sse, std_dev_cpu, EPSILON * num_vals),
+        "SSE mismatch with CPU std dev! %.10f vs %.10f",
+        std_dev_sse, std_dev_cpu);
+#endif
+
+  return std_dev_sse;
+}
+
+
+TARGET_AVX2 float ComputeStdDevAvx2(const float* const values,
+                                    const int num_vals, const float mean) {
+  SCHECK(num_vals >= 8, "Not enough values to merit AVX: %d", num_vals);
+
+  const __m256 mean_vec = _mm256_set1_ps(mean);
+
+  __m256 accum = _mm256_setzero_ps();
+
+  int offset = 0;
+  for (; offset <= num_vals - 8; offset += 8) {
+    const __m256 deltas =
+        _mm256_sub_ps(_mm256_loadu_ps(values + offset), mean_vec);
+
+    accum = _mm256_add_ps(accum, _mm256_mul_ps(deltas, deltas));
+  }
+
+  // Pull the accumulated values into a single variable.
+  float squared_sum = GetSum(accum);
+
+  // Get the remaining 1 to 7 values.
+  for (; offset < num_vals; ++offset) {
+    squared_sum += Square(values[offset] - mean);
+  }
+
+  const float std_dev_avx = sqrt(squared_sum / static_cast<float>(num_vals));
+
+#ifdef SANITY_CHECKS
+  const float std_dev_cpu = ComputeStdDevCpu(values, num_vals, mean);
+  SCHECK(NearlyEqual(std_dev_avx, std_dev_cpu, EPSILON * num_vals),
+        "AVX mismatch with CPU std dev! %.10f vs %.10f",
+        std_dev_avx, std_dev_cpu);
+#endif
+
+  return std_dev_avx;
+}
+
+
+TARGET_SSE41 float ComputeCrossCorrelationSse41(const float* const values1,
+                                                const float* const values2,
+                                                const int num_vals) {
+  SCHECK(num_vals >= 8, "Not enough values to merit SSE: %d", num_vals);
+
+  __m128 accum = _mm_setzero_ps();
+
+  int offset = 0;
+  for (; offset <= num_vals - 4; offset += 4) {
+    accum = _mm_add_ps(accum, _mm_mul_ps(_mm_loadu_ps(values1 + offset),
+                                         _mm_loadu_ps(values2 + offset)));
+  }
+
+  // Pull the accumulated values into a single variable.
+  float sxy = GetSum(accum);
+
+  // Get the remaining 1 to 3 values.
+  for (; offset < num_vals; ++offset) {
+    sxy += values1[offset] * values2[offset];
+  }
+
+  const float cross_correlation_sse = sxy / num_vals;
+
+#ifdef SANITY_CHECKS
+  const float cross_correlation_cpu =
+      ComputeCrossCorrelationCpu(values1, values2, num_vals);
+  SCHECK(NearlyEqual(cross_correlation_sse, cross_correlation_cpu,
+                    EPSILON * num_vals),
+        "SSE mismatch with CPU cross correlation! %.10f vs %.10f",
+        cross_correlation_sse, cross_correlation_cpu);
+#endif
+
+  return cross_correlation_sse;
+}
+
+
+TARGET_AVX2 float ComputeCrossCorrelationAvx2(const float* const values1,
+                                              const float* const values2,
+                                              const int num_vals) {
+  SCHECK(num_vals >= 8, "Not enough values to merit AVX: %d", num_vals);
+
+  __m256 accum = _mm256_setzero_ps();
+
+  int offset = 0;
+  for (; offset <= num_vals - 8; offset += 8) {
+    accum = _mm256_add_ps(
+        accum, _mm256_mul_ps(_mm256_loadu_ps(values1 + offset),
+                             _mm256_loadu_ps(values2 + offset)));
+  }
+
+  // Pull the accumulated values into a single variable.
+  float sxy = GetSum(accum);
+
+  // Get the remaining 1 to 7 values.
+  for (; offset < num_vals; ++offset) {
+    sxy += values1[offset] * values2[offset];
+  }
+
+  const float cross_correlation_avx = sxy / num_vals;
+
+#ifdef SANITY_CHECKS
+  const float cross_correlation_cpu =
+      ComputeCrossCorrelationCpu(values1, values2, num_vals);
+  SCHECK(NearlyEqual(cross_correlation_avx, cross_correlation_cpu,
+                    EPSILON * num_vals),
+        "AVX mismatch with CPU cross correlation! %.10f vs %.10f",
+        cross_correlation_avx, cross_correlation_cpu);
+#endif
+
+  return cross_correlation_avx;
+}
+
+
+float ComputeMeanX86(const float* const values, const int num_vals) {
+  switch (GetX86SimdLevel()) {
+    case X86_SIMD_AVX2:
+      return ComputeMeanAvx2(values, num_vals);
+    case X86_SIMD_SSE41:
+      return ComputeMeanSse41(values, num_vals);
+    default:
+      return ComputeMeanCpu(values, num_vals);
+  }
+}
+
+
+float ComputeStdDevX86(const float* const values, const int num_vals,
+                       const float mean) {
+  switch (GetX86SimdLevel()) {
+    case X86_SIMD_AVX2:
+      return ComputeStdDevAvx2(values, num_vals, mean);
+    case X86_SIMD_SSE41:
+      return ComputeStdDevSse41(values, num_vals, mean);
+    default:
+      return ComputeStdDevCpu(values, num_vals, mean);
+  }
+}
+
+
+float ComputeCrossCorrelationX86(const float* const values1,
+                                 const float* const values2,
+                                 const int num_vals) {
+  switch (GetX86SimdLevel()) {
+    case X86_SIMD_AVX2:
+      return ComputeCrossCorrelationAvx2(values1, values2, num_vals);
+    case X86_SIMD_SSE41:
+      return ComputeCrossCorrelationSse41(values1, values2, num_vals);
+    default:
+      return ComputeCrossCorrelationCpu(values1, values2, num_vals);
+  }
+}
+
+}  // namespace tf_tracking
+
+#endif  // TF_TRACKING_X86_SIMD
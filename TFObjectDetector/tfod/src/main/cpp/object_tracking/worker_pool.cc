@@ -0,0 +1,94 @@
+/* Copyright 2016 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "worker_pool.h"
+
+#include "utils.h"
+
+namespace tf_tracking {
+
+WorkerPool::WorkerPool(const int num_threads) : stopping_(false) {
+  CHECK_ALWAYS(num_threads > 0, "Need at least one worker thread, got %d",
+               num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.push_back(std::thread(&WorkerPool::WorkerLoop, this));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cond_.notify_all();
+
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    threads_[i].join();
+  }
+}
+
+void WorkerPool::Schedule(const std::function<void()>& task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(task);
+  }
+  cond_.notify_one();
+}
+
+void WorkerPool::ParallelFor(const int num_items,
+                             const std::function<void(int, int)>& fn) {
+  const int num_ranges = MIN(num_items, GetNumThreads() + 1);
+  if (num_ranges <= 1) {
+    if (num_items > 0) {
+      fn(0, num_items);
+    }
+    return;
+  }
+
+  BlockingCounter pending(num_ranges - 1);
+  for (int i = 1; i < num_ranges; ++i) {
+    const int begin = num_items * i / num_ranges;
+    const int end = num_items * (i + 1) / num_ranges;
+    Schedule([&fn, &pending, begin, end]() {
+      fn(begin, end);
+      pending.DecrementCount();
+    });
+  }
+
+  // The calling thread takes the first range rather than sitting idle.
+  fn(0, num_items / num_ranges);
+  pending.Wait();
+}
+
+void WorkerPool::WorkerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (tasks_.empty() && !stopping_) {
+        cond_.wait(lock);
+      }
+      if (tasks_.empty()) {
+        // Only reachable once stopping, with every task drained.
+        return;
+      }
+      task = tasks_.front();
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+}  // namespace tf_tracking
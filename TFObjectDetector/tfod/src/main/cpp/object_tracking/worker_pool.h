@@ -0,0 +1,93 @@
+/* Copyright 2016 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_WORKER_POOL_H_
+#define TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "logging.h"
+
+namespace tf_tracking {
+
+// Blocks in Wait() until DecrementCount() has been called count times.
+class BlockingCounter {
+ public:
+  explicit BlockingCounter(const int count) : count_(count) {}
+
+  void DecrementCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --count_;
+    if (count_ == 0) {
+      cond_.notify_all();
+    }
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (count_ > 0) {
+      cond_.wait(lock);
+    }
+  }
+
+ private:
+  int count_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(BlockingCounter);
+};
+
+// A fixed set of worker threads that run scheduled tasks in FIFO order.
+// Pending tasks are still run before the destructor returns.
+class WorkerPool {
+ public:
+  explicit WorkerPool(const int num_threads);
+  ~WorkerPool();
+
+  // Queues a task to be run on one of the worker threads.
+  void Schedule(const std::function<void()>& task);
+
+  // Splits [0, num_items) into contiguous ranges, one per worker thread plus
+  // one for the calling thread, and calls fn(begin, end) on each. Returns
+  // once every range is done. fn must be safe to call concurrently.
+  void ParallelFor(const int num_items,
+                   const std::function<void(int, int)>& fn);
+
+  inline int GetNumThreads() const {
+    return static_cast<int>(threads_.size());
+  }
+
+ private:
+  void WorkerLoop();
+
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::function<void()> > tasks_;
+  bool stopping_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+};
+
+}  // namespace tf_tracking
+
+#endif  // TENSORFLOW_EXAMPLES_ANDROID_JNI_OBJECT_TRACKING_WORKER_POOL_H_
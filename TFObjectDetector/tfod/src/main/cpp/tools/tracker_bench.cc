@@ -0,0 +1,382 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Replays a directory of raw NV21 frames through ObjectTracker::NextFrame and
+// reports the latency of each tracking stage, as recorded by the tracker's
+// stage latency histograms.
+//
+// Usage:
+//   tracker_bench <frame_dir> <width> <height> [options]
+//
+// Every regular file in frame_dir is read in name order and must hold exactly
+// one width x height NV21 frame. Options:
+//   --downsample N      Downsampling factor applied before tracking (2).
+//   --loops N           Number of times to replay the whole directory (1).
+//   --box l,t,r,b       Register an object at this full frame position on the
+//                       first frame, so TrackObjects has work to do. May be
+//                       given several times, once per object.
+//   --frame_interval N  Timestamp delta between frames in ns (33333333).
+//   --threads N         Worker threads the tracker may use (0).
+//   --pipelined         Use ObjectTracker::SubmitFrame after the first frame,
+//                       so each frame's pyramid overlaps the previous frame's
+//                       tracking.
+//   --estimate_motion   Seed each frame's flow with the global motion
+//                       estimated from the previous frame pair.
+//   --packed            Downsample frames up front and feed packed luminance
+//                       arrays, as the byte[] Java path does, instead of
+//                       handing the tracker the raw NV21 planes.
+//   --max_keypoints N   Keypoints tracked per frame (kMaxKeypoints).
+//   --max_keypoints_per_object N
+//                       Keypoints picked per object (kMaxKeypointsForObject).
+//   --max_candidates N  Candidate keypoints ranked per frame
+//                       (kMaxTempKeypoints).
+//   --retained_frames N Recent frames kept for registering late detections
+//                       (0).
+//   --solver lk|esm     Optical flow solver (lk).
+//   --max_iterations N  Most solver steps per point and pyramid level
+//                       (kNumIterations).
+//   --convergence PX    Step length below which a point stops iterating
+//                       (kTrackingAbortThreshold). 0 always takes every step.
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "geom.h"
+#include "image-inl.h"
+#include "image.h"
+#include "object_tracker.h"
+#include "stage_latency.h"
+#include "utils.h"
+
+using namespace tf_tracking;
+
+namespace {
+
+bool ReadFile(const std::string& path, std::vector<uint8_t>* const contents) {
+  FILE* const file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  contents->resize(size > 0 ? size : 0);
+  const size_t num_read =
+      contents->empty() ? 0 : fread(&(*contents)[0], 1, contents->size(), file);
+  fclose(file);
+  return num_read == contents->size();
+}
+
+bool ListFrames(const std::string& dir, std::vector<std::string>* const paths) {
+  DIR* const dirp = opendir(dir.c_str());
+  if (dirp == NULL) {
+    return false;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dirp)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    paths->push_back(dir + "/" + entry->d_name);
+  }
+  closedir(dirp);
+  std::sort(paths->begin(), paths->end());
+  return true;
+}
+
+void PrintUsage(const char* const program) {
+  fprintf(stderr,
+          "Usage: %s <frame_dir> <width> <height> [--downsample N] "
+          "[--loops N] [--box l,t,r,b] [--frame_interval ns] [--threads N] "
+          "[--pipelined] [--estimate_motion] [--packed] [--max_keypoints N] "
+          "[--max_keypoints_per_object N] [--max_candidates N] "
+          "[--retained_frames N] [--solver lk|esm] [--max_iterations N] "
+          "[--convergence px]\n",
+          program);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  const std::string frame_dir = argv[1];
+  const int width = atoi(argv[2]);
+  const int height = atoi(argv[3]);
+
+  int downsample = 2;
+  int loops = 1;
+  int num_threads = 0;
+  int64_t frame_interval = 33333333;
+  bool packed = false;
+  bool pipelined = false;
+  bool estimate_motion = false;
+  // Four coordinates per object to register.
+  std::vector<float> boxes;
+  int max_keypoints = kMaxKeypoints;
+  int max_keypoints_per_object = kMaxKeypointsForObject;
+  int max_candidates = kMaxTempKeypoints;
+  int retained_frames = 0;
+  FlowSolver solver = FLOW_SOLVER_LK;
+  int max_iterations = kNumIterations;
+  float convergence_threshold = kTrackingAbortThreshold;
+
+  for (int i = 4; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--packed") {
+      packed = true;
+      continue;
+    }
+    if (arg == "--pipelined") {
+      pipelined = true;
+      continue;
+    }
+    if (arg == "--estimate_motion") {
+      estimate_motion = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+    const char* const value = argv[++i];
+    if (arg == "--downsample") {
+      downsample = atoi(value);
+    } else if (arg == "--loops") {
+      loops = atoi(value);
+    } else if (arg == "--threads") {
+      num_threads = atoi(value);
+    } else if (arg == "--max_keypoints") {
+      max_keypoints = atoi(value);
+    } else if (arg == "--max_keypoints_per_object") {
+      max_keypoints_per_object = atoi(value);
+    } else if (arg == "--max_candidates") {
+      max_candidates = atoi(value);
+    } else if (arg == "--retained_frames") {
+      retained_frames = atoi(value);
+    } else if (arg == "--solver") {
+      if (strcmp(value, "lk") == 0) {
+        solver = FLOW_SOLVER_LK;
+      } else if (strcmp(value, "esm") == 0) {
+        solver = FLOW_SOLVER_ESM;
+      } else {
+        PrintUsage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--max_iterations") {
+      max_iterations = atoi(value);
+    } else if (arg == "--convergence") {
+      convergence_threshold = atof(value);
+    } else if (arg == "--frame_interval") {
+      frame_interval = atoll(value);
+    } else if (arg == "--box") {
+      float box[4];
+      if (sscanf(value, "%f,%f,%f,%f",
+                 &box[0], &box[1], &box[2], &box[3]) == 4) {
+        boxes.insert(boxes.end(), box, box + 4);
+      } else {
+        PrintUsage(argv[0]);
+        return 1;
+      }
+    } else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (width <= 0 || height <= 0 || downsample <= 0 || loops <= 0 ||
+      num_threads < 0 || frame_interval <= 0 || max_keypoints <= 0 ||
+      max_keypoints_per_object <= 0 || max_candidates < max_keypoints ||
+      retained_frames < 0 || max_iterations <= 0 ||
+      convergence_threshold < 0.0f) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> paths;
+  if (!ListFrames(frame_dir, &paths) || paths.empty()) {
+    fprintf(stderr, "No frames found in %s\n", frame_dir.c_str());
+    return 1;
+  }
+
+  // Load every frame up front so file IO stays out of the measurements.
+  const int frame_size = width * height * 3 / 2;
+  const int tracker_width = width / downsample;
+  const int tracker_height = height / downsample;
+
+  std::vector<std::vector<uint8_t> > frames(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (!ReadFile(paths[i], &frames[i]) ||
+        static_cast<int>(frames[i].size()) != frame_size) {
+      fprintf(stderr, "%s is not a %dx%d NV21 frame.\n", paths[i].c_str(),
+              width, height);
+      return 1;
+    }
+  }
+
+  // The packed path only uses the luminance plane, as in ObjectTracker.java.
+  std::vector<std::vector<uint8_t> > packed_frames;
+  if (packed) {
+    packed_frames.resize(frames.size());
+    for (size_t i = 0; i < frames.size(); ++i) {
+      packed_frames[i].resize(tracker_width * tracker_height);
+      Image<uint8_t> downsampled(tracker_width, tracker_height,
+                                 &packed_frames[i][0], false);
+      downsampled.DownsampleAveraged(&frames[i][0], width, downsample);
+    }
+  }
+
+  TrackerConfig* const config =
+      new TrackerConfig(Size(tracker_width, tracker_height));
+  config->always_track = true;
+  config->num_worker_threads = num_threads;
+  config->keypoint_detector_config.max_keypoints = max_keypoints;
+  config->keypoint_detector_config.max_keypoints_per_object =
+      max_keypoints_per_object;
+  config->keypoint_detector_config.max_candidate_keypoints = max_candidates;
+  config->num_retained_frames = retained_frames;
+  config->estimate_global_motion = estimate_motion;
+  config->flow_config.solver = solver;
+  config->flow_config.max_iterations = max_iterations;
+  config->flow_config.convergence_threshold = convergence_threshold;
+  TrackerMemoryUsage memory_usage = ObjectTracker::GetMemoryUsage(*config);
+  if (!pipelined) {
+    // Only SubmitFrame() allocates spare frames.
+    memory_usage.spare_frames = 0;
+  }
+  ObjectTracker tracker(config, NULL);
+
+  int64_t timestamp = 0;
+  int64_t start_time = 0;
+  for (int loop = 0; loop < loops; ++loop) {
+    for (size_t i = 0; i < frames.size(); ++i) {
+      timestamp += frame_interval;
+      FramePlanes planes;
+      if (packed) {
+        planes.y = &packed_frames[i][0];
+        planes.y_row_stride = tracker_width;
+        planes.downsample_factor = 1;
+      } else {
+        planes.y = &frames[i][0];
+        planes.y_row_stride = width;
+        planes.downsample_factor = downsample;
+
+        // NV21 stores interleaved VU samples after the luminance plane.
+        planes.v = &frames[i][0] + width * height;
+        planes.u = planes.v + 1;
+        planes.uv_row_stride = width;
+        planes.uv_pixel_stride = 2;
+        planes.uv_width = width / 2;
+        planes.uv_height = height / 2;
+      }
+
+      const bool first_frame = loop == 0 && i == 0;
+      if (pipelined && !first_frame) {
+        tracker.SubmitFrame(planes, timestamp, NULL);
+      } else {
+        tracker.NextFrame(planes, timestamp, NULL);
+      }
+
+      if (first_frame) {
+        // The first frame only builds the pyramid, so it is left out.
+        tracker.ResetStageLatencies();
+        start_time = CurrentRealTimeNanos();
+
+        if (!boxes.empty()) {
+          std::vector<uint8_t> appearance(tracker_width * tracker_height);
+          Image<uint8_t> downsampled(tracker_width, tracker_height,
+                                     &appearance[0], false);
+          downsampled.DownsampleAveraged(&frames[i][0], width, downsample);
+          for (size_t j = 0; j < boxes.size(); j += 4) {
+            const BoundingBox position(
+                boxes[j] / downsample, boxes[j + 1] / downsample,
+                boxes[j + 2] / downsample, boxes[j + 3] / downsample);
+            char id[32];
+            snprintf(id, sizeof(id), "bench%zu", j / 4);
+            tracker.RegisterNewObjectWithAppearance(id, &appearance[0],
+                                                    position);
+          }
+        }
+      }
+    }
+  }
+
+  tracker.WaitForAllFrames();
+  const int64_t elapsed = CurrentRealTimeNanos() - start_time;
+
+  printf("%zu frames of %dx%d (tracked at %dx%d), %d loop(s), %d worker(s)\n",
+         frames.size(), width, height, tracker_width, tracker_height, loops,
+         num_threads);
+  printf("%d keypoints (%d per object) from %d candidates, %.1f KiB: "
+         "%.1f frame pairs, %.1f frame history, %.1f keypoint detector, "
+         "%.1f frames",
+         max_keypoints, max_keypoints_per_object, max_candidates,
+         memory_usage.Total() / 1024.0, memory_usage.frame_pairs / 1024.0,
+         memory_usage.frame_history / 1024.0,
+         memory_usage.keypoint_detector / 1024.0,
+         memory_usage.frames / 1024.0);
+  if (pipelined) {
+    printf(", %.1f spare frames", memory_usage.spare_frames / 1024.0);
+  }
+  if (retained_frames > 0) {
+    printf(", %.1f retained frames", memory_usage.retained_frames / 1024.0);
+  }
+  printf("\n");
+  const FlowSolverStats solver_stats = tracker.GetFlowSolverStats();
+  if (solver_stats.num_solves > 0) {
+    printf("%s flow: %lld solves, %.2f iterations each, %.1f%% converged\n",
+           solver == FLOW_SOLVER_ESM ? "ESM" : "LK",
+           static_cast<long long>(solver_stats.num_solves),
+           static_cast<double>(solver_stats.num_iterations) /
+               solver_stats.num_solves,
+           100.0 * solver_stats.num_converged / solver_stats.num_solves);
+  }
+  printf("%-14s %8s %8s %8s %8s %8s %8s\n", "stage (ms)", "count", "mean",
+         "p50", "p90", "p99", "max");
+  const StageLatencies& latencies = tracker.GetStageLatencies();
+  for (int i = 0; i < NUM_TRACKER_STAGES; ++i) {
+    const TrackerStage stage = static_cast<TrackerStage>(i);
+    StageLatencySummary summary;
+    latencies.GetSummary(stage, &summary);
+    printf("%-14s %8lld %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+           GetTrackerStageName(stage), static_cast<long long>(summary.count),
+           summary.mean_ms, summary.p50_ms, summary.p90_ms, summary.p99_ms,
+           summary.max_ms);
+  }
+
+  StageLatencySummary total;
+  latencies.GetSummary(TRACKER_STAGE_NEXT_FRAME, &total);
+  if (total.p50_ms > 0.0f) {
+    printf("median frames/sec: %.1f\n", 1000.0f / total.p50_ms);
+  }
+  if (total.count > 0 && elapsed > 0) {
+    // With --pipelined this is higher than the median suggests, as frames
+    // overlap.
+    printf("throughput frames/sec: %.1f\n", total.count * 1e9 / elapsed);
+  }
+
+  return 0;
+}
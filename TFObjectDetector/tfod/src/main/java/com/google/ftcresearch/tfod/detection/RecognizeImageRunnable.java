@@ -135,11 +135,6 @@ class RecognizeImageRunnable implements Runnable {
     final Timer timer = new Timer(TAG);
     timer.start("Overall Preprocessing");
 
-    timer.start("Resizing image");
-    YuvRgbFrame smallFrame = frame.resize(new Size(imageSize, imageSize));
-    int[] rgbArray = smallFrame.getRgbData().array();
-    timer.end();
-
     timer.start("Allocations");
     // Allocate the ByteBuffer to be passed as the input to the network
     int numBytesPerChannel = isModelQuantized ? 1 /* Quantized */ : 4 /* Floating Point */;
@@ -150,24 +145,10 @@ class RecognizeImageRunnable implements Runnable {
     imgData.rewind();
     timer.end();
 
-    timer.start("Copy data into bytebuffer pixel by pixel");
-    // Copy the data into the ByteBuffer
-    for (int i = 0; i < imageSize; ++i) {
-      for (int j = 0; j < imageSize; ++j) {
-        int pixelValue = rgbArray[i * imageSize + j];
-        if (isModelQuantized) { // Quantized model
-          // Copy as-is
-          imgData.put((byte) ((pixelValue >> 16) & 0xFF));
-          imgData.put((byte) ((pixelValue >> 8) & 0xFF));
-          imgData.put((byte) (pixelValue & 0xFF));
-        } else { // Float model
-          // Copy with normalization
-          imgData.putFloat((((pixelValue >> 16) & 0xFF) - IMAGE_MEAN) / IMAGE_STD);
-          imgData.putFloat((((pixelValue >> 8) & 0xFF) - IMAGE_MEAN) / IMAGE_STD);
-          imgData.putFloat(((pixelValue & 0xFF) - IMAGE_MEAN) / IMAGE_STD);
-        }
-      }
-    }
+    timer.start("Resize and copy data into bytebuffer");
+    // Quantized models take the pixels as-is, float models normalized.
+    frame.writeRgbTensor(new Size(imageSize, imageSize), !isModelQuantized, IMAGE_MEAN, IMAGE_STD,
+        imgData);
     timer.end();
     timer.end();
 
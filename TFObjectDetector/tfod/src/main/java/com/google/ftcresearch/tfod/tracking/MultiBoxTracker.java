@@ -331,15 +331,30 @@ public class MultiBoxTracker {
     }
 
     Log.i(TAG, String.format("%d rects to track", rectsToTrack.size()));
+
+    // Register all of them against the tracker's own copy of the frame if it still has it, rather
+    // than downsampling and copying the frame for each one.
+    final List<RectF> locations = new ArrayList<RectF>(rectsToTrack.size());
+    for (final Pair<Float, Recognition> potential : rectsToTrack) {
+      locations.add(potential.second.getLocation());
+    }
+    final List<ObjectTracker.TrackedObject> potentialObjects =
+        objectTracker.trackObjects(locations, timestamp);
+
+    int i = 0;
     for (final Pair<Float, Recognition> potential : rectsToTrack) {
-      handleDetection(originalFrame, timestamp, potential);
+      final ObjectTracker.TrackedObject potentialObject =
+          potentialObjects != null
+              ? potentialObjects.get(i)
+              : objectTracker.trackObject(potential.second.getLocation(), timestamp, originalFrame);
+      handleDetection(potentialObject, potential);
+      ++i;
     }
   }
 
   private void handleDetection(
-      final byte[] frameCopy, final long timestamp, final Pair<Float, Recognition> potential) {
-    final ObjectTracker.TrackedObject potentialObject =
-        objectTracker.trackObject(potential.second.getLocation(), timestamp, frameCopy);
+      final ObjectTracker.TrackedObject potentialObject,
+      final Pair<Float, Recognition> potential) {
 
     final float potentialCorrelation = potentialObject.getCurrentCorrelation();
     Log.v(
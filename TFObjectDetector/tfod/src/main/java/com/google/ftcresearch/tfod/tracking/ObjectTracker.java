@@ -23,13 +23,20 @@ import android.graphics.PointF;
 import android.graphics.RectF;
 import android.graphics.Typeface;
 import android.util.Log;
+import android.util.SparseArray;
 import com.google.ftcresearch.tfod.util.Size;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.FloatBuffer;
 import java.util.ArrayList;
+import java.util.Arrays;
 import java.util.HashMap;
 import java.util.LinkedList;
 import java.util.List;
 import java.util.Map;
 import java.util.Vector;
+import java.util.concurrent.locks.ReadWriteLock;
+import java.util.concurrent.locks.ReentrantReadWriteLock;
 import javax.microedition.khronos.opengles.GL10;
 
 /**
@@ -75,35 +82,102 @@ public class ObjectTracker {
 
   private static final int DOWNSAMPLE_FACTOR = 2;
 
+  /** Default keypoint capacities of the native tracker. These match the defaults in config.h. */
+  public static final int DEFAULT_MAX_KEYPOINTS = 76;
+  public static final int DEFAULT_MAX_KEYPOINTS_PER_OBJECT = 16;
+  public static final int DEFAULT_MAX_CANDIDATE_KEYPOINTS = 1024;
+
+  /**
+   * How many recent frames the native tracker keeps the luminance of by default, beyond the two it
+   * tracks between. None, as in config.h, so retention is opt-in: pass numRetainedFrames to {@link
+   * #getInstance(int, int, int, boolean, int, int, int, int, int)} for {@link #trackObjects} to
+   * reach further back than the previous frame.
+   */
+  public static final int DEFAULT_NUM_RETAINED_FRAMES = 0;
+
   private final byte[] downsampledFrame;
 
   protected static ObjectTracker instance;
 
   private final Map<String, TrackedObject> trackedObjects;
 
+  /** The same objects as trackedObjects, by native handle. */
+  private final SparseArray<TrackedObject> trackedObjectsByHandle;
+
   private long lastTimestamp;
 
-  private FrameChange lastKeypoints;
+  private long lastSubmittedTimestamp;
+
+  /**
+   * Read-held by the calls that wait on the native tracker without the tracker lock, and
+   * write-held by release(), so that the native tracker is never freed under a waiting thread.
+   * Always taken before the tracker lock.
+   */
+  private final ReadWriteLock lifecycleLock = new ReentrantReadWriteLock();
+
+  /** Set by release(), under the write lock of lifecycleLock. */
+  private boolean released;
+
+  /** Replaced, never modified, so that drawing code may read it without the tracker lock. */
+  private volatile FrameChange lastKeypoints;
 
   private final Vector<PointF> debugHistory;
 
   private final LinkedList<TimestampedDeltas> timestampedDeltas;
 
+  /** Entries evicted from timestampedDeltas, whose arrays are reused for later frames. */
+  private final LinkedList<TimestampedDeltas> spareDeltas;
+
+  /**
+   * Direct buffers the native tracker writes its per frame output into, so that no Java arrays
+   * are allocated for it on every frame.
+   */
+  private ByteBuffer objectSnapshots;
+
+  private final ByteBuffer packedKeypoints;
+  private final ByteBuffer debugKeypoints;
+
   protected final int frameWidth;
   protected final int frameHeight;
   private final int rowStride;
   protected final boolean alwaysTrack;
+  protected final int numWorkerThreads;
+  protected final int maxKeypoints;
+  protected final int maxKeypointsPerObject;
+  protected final int maxCandidateKeypoints;
+  protected final int numRetainedFrames;
 
   private static class TimestampedDeltas {
-    final long timestamp;
+    long timestamp;
     final byte[] deltas;
 
-    public TimestampedDeltas(final long timestamp, final byte[] deltas) {
-      this.timestamp = timestamp;
-      this.deltas = deltas;
+    /** Number of valid bytes at the start of deltas. */
+    int length;
+
+    public TimestampedDeltas(final int capacity) {
+      this.deltas = new byte[capacity];
     }
   }
 
+  /**
+   * Layout of the records written by getObjectSnapshotsNative(), one per tracked object in native
+   * byte order. This mirrors ObjectSnapshot in snapshot_publisher.h.
+   */
+  private static final int SNAPSHOT_SIZE = 40;
+
+  private static final int SNAPSHOT_HANDLE_OFFSET = 0;
+  private static final int SNAPSHOT_LEFT_OFFSET = 4;
+  private static final int SNAPSHOT_TOP_OFFSET = 8;
+  private static final int SNAPSHOT_RIGHT_OFFSET = 12;
+  private static final int SNAPSHOT_BOTTOM_OFFSET = 16;
+  private static final int SNAPSHOT_CORRELATION_OFFSET = 20;
+  private static final int SNAPSHOT_MATCH_SCORE_OFFSET = 24;
+  private static final int SNAPSHOT_VISIBLE_OFFSET = 28;
+  private static final int SNAPSHOT_POSITION_TIME_OFFSET = 32;
+
+  /** Bytes per keypoint written by getKeypointsPackedNative(): two pairs of 16 bit coordinates. */
+  private static final int PACKED_KEYPOINT_SIZE = 8;
+
   /**
    * A simple class that records keypoint information, which includes local location, score and
    * type. This will be used in calculating FrameChange.
@@ -175,21 +249,26 @@ public class ObjectTracker {
     private final float maxScore;
 
     public FrameChange(final float[] framePoints) {
+      this(FloatBuffer.wrap(framePoints), framePoints.length / KEYPOINT_STEP);
+    }
+
+    /** Reads numKeypoints keypoints of KEYPOINT_STEP values each from the start of framePoints. */
+    public FrameChange(final FloatBuffer framePoints, final int numKeypoints) {
       float minScore = 100.0f;
       float maxScore = -100.0f;
 
-      pointDeltas = new Vector<PointChange>(framePoints.length / KEYPOINT_STEP);
+      pointDeltas = new Vector<PointChange>(numKeypoints);
 
-      for (int i = 0; i < framePoints.length; i += KEYPOINT_STEP) {
-        final float x1 = framePoints[i + 0] * DOWNSAMPLE_FACTOR;
-        final float y1 = framePoints[i + 1] * DOWNSAMPLE_FACTOR;
+      for (int i = 0; i < numKeypoints * KEYPOINT_STEP; i += KEYPOINT_STEP) {
+        final float x1 = framePoints.get(i + 0) * DOWNSAMPLE_FACTOR;
+        final float y1 = framePoints.get(i + 1) * DOWNSAMPLE_FACTOR;
 
-        final boolean wasFound = framePoints[i + 2] > 0.0f;
+        final boolean wasFound = framePoints.get(i + 2) > 0.0f;
 
-        final float x2 = framePoints[i + 3] * DOWNSAMPLE_FACTOR;
-        final float y2 = framePoints[i + 4] * DOWNSAMPLE_FACTOR;
-        final float score = framePoints[i + 5];
-        final int type = (int) framePoints[i + 6];
+        final float x2 = framePoints.get(i + 3) * DOWNSAMPLE_FACTOR;
+        final float y2 = framePoints.get(i + 4) * DOWNSAMPLE_FACTOR;
+        final float score = framePoints.get(i + 5);
+        final int type = (int) framePoints.get(i + 6);
 
         minScore = Math.min(minScore, score);
         maxScore = Math.max(maxScore, score);
@@ -202,8 +281,111 @@ public class ObjectTracker {
     }
   }
 
+  /** Latency statistics for one stage of the native NextFrame call, in milliseconds. */
+  public static class StageLatency {
+    public static final int STAGE_LATENCY_STEP = 6;
+
+    /** Stage names, in the order the native tracker reports them. */
+    public static final String[] STAGE_NAMES = {
+      "pyramid", "keypoints", "flow", "trackObjects", "detectTargets", "nextFrame"
+    };
+
+    public final String stage;
+    public final long count;
+    public final float meanMs;
+    public final float p50Ms;
+    public final float p90Ms;
+    public final float p99Ms;
+    public final float maxMs;
+
+    public StageLatency(final String stage, final float[] latencies, final int offset) {
+      this.stage = stage;
+      this.count = (long) latencies[offset + 0];
+      this.meanMs = latencies[offset + 1];
+      this.p50Ms = latencies[offset + 2];
+      this.p90Ms = latencies[offset + 3];
+      this.p99Ms = latencies[offset + 4];
+      this.maxMs = latencies[offset + 5];
+    }
+
+    @Override
+    public String toString() {
+      return String.format(
+          "%s: n=%d mean=%.2fms p50=%.2fms p90=%.2fms p99=%.2fms max=%.2fms",
+          stage, count, meanMs, p50Ms, p90Ms, p99Ms, maxMs);
+    }
+  }
+
   public static synchronized ObjectTracker getInstance(
       final int frameWidth, final int frameHeight, final int rowStride, final boolean alwaysTrack) {
+    return getInstance(frameWidth, frameHeight, rowStride, alwaysTrack, 0);
+  }
+
+  /**
+   * Like {@link #getInstance(int, int, int, boolean)}, but lets the native tracker use up to
+   * numWorkerThreads extra threads to parallelize per-frame work. 0 keeps all of the work on the
+   * thread calling nextFrame.
+   */
+  public static synchronized ObjectTracker getInstance(
+      final int frameWidth,
+      final int frameHeight,
+      final int rowStride,
+      final boolean alwaysTrack,
+      final int numWorkerThreads) {
+    return getInstance(
+        frameWidth,
+        frameHeight,
+        rowStride,
+        alwaysTrack,
+        numWorkerThreads,
+        DEFAULT_MAX_KEYPOINTS,
+        DEFAULT_MAX_KEYPOINTS_PER_OBJECT,
+        DEFAULT_MAX_CANDIDATE_KEYPOINTS);
+  }
+
+  /**
+   * Like {@link #getInstance(int, int, int, boolean, int)}, but also sets the keypoint capacities
+   * the native tracker allocates for up front: at most maxKeypoints keypoints are tracked per frame,
+   * at most maxKeypointsPerObject of them in any one object, picked from at most
+   * maxCandidateKeypoints candidates, which may not be fewer than maxKeypoints. Use {@link
+   * #getMemoryUsage} to see what a choice costs.
+   */
+  public static synchronized ObjectTracker getInstance(
+      final int frameWidth,
+      final int frameHeight,
+      final int rowStride,
+      final boolean alwaysTrack,
+      final int numWorkerThreads,
+      final int maxKeypoints,
+      final int maxKeypointsPerObject,
+      final int maxCandidateKeypoints) {
+    return getInstance(
+        frameWidth,
+        frameHeight,
+        rowStride,
+        alwaysTrack,
+        numWorkerThreads,
+        maxKeypoints,
+        maxKeypointsPerObject,
+        maxCandidateKeypoints,
+        DEFAULT_NUM_RETAINED_FRAMES);
+  }
+
+  /**
+   * Like {@link #getInstance(int, int, int, boolean, int, int, int, int)}, but also sets how many
+   * recent frames the native tracker keeps for {@link #trackObjects}. Each costs a quarter of a
+   * full frame's luminance.
+   */
+  public static synchronized ObjectTracker getInstance(
+      final int frameWidth,
+      final int frameHeight,
+      final int rowStride,
+      final boolean alwaysTrack,
+      final int numWorkerThreads,
+      final int maxKeypoints,
+      final int maxKeypointsPerObject,
+      final int maxCandidateKeypoints,
+      final int numRetainedFrames) {
     if (!libraryFound) {
       Log.e(
           TAG,
@@ -213,7 +395,17 @@ public class ObjectTracker {
     }
 
     if (instance == null) {
-      instance = new ObjectTracker(frameWidth, frameHeight, rowStride, alwaysTrack);
+      instance =
+          new ObjectTracker(
+              frameWidth,
+              frameHeight,
+              rowStride,
+              alwaysTrack,
+              numWorkerThreads,
+              maxKeypoints,
+              maxKeypointsPerObject,
+              maxCandidateKeypoints,
+              numRetainedFrames);
       instance.init();
     } else {
       throw new RuntimeException(
@@ -222,6 +414,53 @@ public class ObjectTracker {
     return instance;
   }
 
+  /**
+   * Returns roughly how many bytes of native memory a tracker created by {@link #getInstance(int,
+   * int, int, boolean, int, int, int, int)} with the same arguments would allocate, including the
+   * spare frame {@link #submitFrame} uses, or -1 if native tracking is unavailable.
+   */
+  public static long getMemoryUsage(
+      final int frameWidth,
+      final int frameHeight,
+      final int numWorkerThreads,
+      final int maxKeypoints,
+      final int maxKeypointsPerObject,
+      final int maxCandidateKeypoints) {
+    return getMemoryUsage(
+        frameWidth,
+        frameHeight,
+        numWorkerThreads,
+        maxKeypoints,
+        maxKeypointsPerObject,
+        maxCandidateKeypoints,
+        DEFAULT_NUM_RETAINED_FRAMES);
+  }
+
+  /**
+   * Like {@link #getMemoryUsage(int, int, int, int, int, int)}, for a tracker created by {@link
+   * #getInstance(int, int, int, boolean, int, int, int, int, int)}.
+   */
+  public static long getMemoryUsage(
+      final int frameWidth,
+      final int frameHeight,
+      final int numWorkerThreads,
+      final int maxKeypoints,
+      final int maxKeypointsPerObject,
+      final int maxCandidateKeypoints,
+      final int numRetainedFrames) {
+    if (!libraryFound) {
+      return -1;
+    }
+    return getMemoryUsageNative(
+        frameWidth / DOWNSAMPLE_FACTOR,
+        frameHeight / DOWNSAMPLE_FACTOR,
+        numWorkerThreads,
+        maxKeypoints,
+        maxKeypointsPerObject,
+        maxCandidateKeypoints,
+        numRetainedFrames);
+  }
+
   public static synchronized void clearInstance() {
     if (instance != null) {
       instance.release();
@@ -229,14 +468,33 @@ public class ObjectTracker {
   }
 
   protected ObjectTracker(
-      final int frameWidth, final int frameHeight, final int rowStride, final boolean alwaysTrack) {
+      final int frameWidth,
+      final int frameHeight,
+      final int rowStride,
+      final boolean alwaysTrack,
+      final int numWorkerThreads,
+      final int maxKeypoints,
+      final int maxKeypointsPerObject,
+      final int maxCandidateKeypoints,
+      final int numRetainedFrames) {
     this.frameWidth = frameWidth;
     this.frameHeight = frameHeight;
     this.rowStride = rowStride;
     this.alwaysTrack = alwaysTrack;
+    this.numWorkerThreads = numWorkerThreads;
+    this.maxKeypoints = maxKeypoints;
+    this.maxKeypointsPerObject = maxKeypointsPerObject;
+    this.maxCandidateKeypoints = maxCandidateKeypoints;
+    this.numRetainedFrames = numRetainedFrames;
     this.timestampedDeltas = new LinkedList<TimestampedDeltas>();
+    this.spareDeltas = new LinkedList<TimestampedDeltas>();
 
     trackedObjects = new HashMap<String, TrackedObject>();
+    trackedObjectsByHandle = new SparseArray<TrackedObject>();
+
+    objectSnapshots = allocateNativeOrder(SNAPSHOT_SIZE);
+    packedKeypoints = allocateNativeOrder(maxKeypoints * PACKED_KEYPOINT_SIZE);
+    debugKeypoints = allocateNativeOrder(maxKeypoints * FrameChange.KEYPOINT_STEP * 4);
 
     debugHistory = new Vector<PointF>(MAX_DEBUG_HISTORY_SIZE);
 
@@ -251,20 +509,36 @@ public class ObjectTracker {
   protected void init() {
     // The native tracker never sees the full frame, so pre-scale dimensions
     // by the downsample factor.
-    initNative(frameWidth / DOWNSAMPLE_FACTOR, frameHeight / DOWNSAMPLE_FACTOR, alwaysTrack);
+    initNative(
+        frameWidth / DOWNSAMPLE_FACTOR,
+        frameHeight / DOWNSAMPLE_FACTOR,
+        alwaysTrack,
+        numWorkerThreads,
+        maxKeypoints,
+        maxKeypointsPerObject,
+        maxCandidateKeypoints,
+        numRetainedFrames);
   }
 
   private final float[] matrixValues = new float[9];
 
+  /**
+   * Held while drawing and while releasing the native tracker, instead of the tracker lock, so that
+   * drawing never waits for a frame being tracked. The native tracker draws the object state it
+   * published at the end of the last frame, which is safe to read while the next one is tracked.
+   */
+  private final Object drawLock = new Object();
+
   private long downsampledTimestamp;
 
   @SuppressWarnings("unused")
-  public synchronized void drawOverlay(
-      final GL10 gl, final Size cameraViewSize, final Matrix matrix) {
-    final Matrix tempMatrix = new Matrix(matrix);
-    tempMatrix.preScale(DOWNSAMPLE_FACTOR, DOWNSAMPLE_FACTOR);
-    tempMatrix.getValues(matrixValues);
-    drawNative(cameraViewSize.width, cameraViewSize.height, matrixValues);
+  public void drawOverlay(final GL10 gl, final Size cameraViewSize, final Matrix matrix) {
+    synchronized (drawLock) {
+      final Matrix tempMatrix = new Matrix(matrix);
+      tempMatrix.preScale(DOWNSAMPLE_FACTOR, DOWNSAMPLE_FACTOR);
+      tempMatrix.getValues(matrixValues);
+      drawNative(cameraViewSize.width, cameraViewSize.height, matrixValues);
+    }
   }
 
   public synchronized void nextFrame(
@@ -282,15 +556,144 @@ public class ObjectTracker {
     // Do Lucas Kanade using the fullframe initializer.
     nextFrameNative(downsampledFrame, uvData, timestamp, transformationMatrix);
 
-    timestampedDeltas.add(new TimestampedDeltas(timestamp, getKeypointsPacked(DOWNSAMPLE_FACTOR)));
-    while (timestampedDeltas.size() > MAX_FRAME_HISTORY_SIZE) {
-      timestampedDeltas.removeFirst();
+    onNativeFrameProcessed(timestamp, updateDebugInfo);
+  }
+
+  /**
+   * Processes a frame straight from the planes of a camera image (e.g. {@code Image.getPlanes()}
+   * of a YUV_420_888 Camera2 image), without copying or separately downsampling it first.
+   *
+   * @param yPlane Direct buffer holding the full resolution luminance plane.
+   * @param yRowStride Distance in bytes between rows of the luminance plane.
+   * @param uPlane Direct buffer holding the U plane, or null.
+   * @param vPlane Direct buffer holding the V plane, or null.
+   * @param uvRowStride Distance in bytes between rows of the chroma planes.
+   * @param uvPixelStride Distance in bytes between samples in a row of the chroma planes.
+   */
+  public synchronized void nextFrame(
+      final ByteBuffer yPlane,
+      final int yRowStride,
+      final ByteBuffer uPlane,
+      final ByteBuffer vPlane,
+      final int uvRowStride,
+      final int uvPixelStride,
+      final long timestamp,
+      final float[] transformationMatrix,
+      final boolean updateDebugInfo) {
+    if (!yPlane.isDirect()
+        || (uPlane != null && !uPlane.isDirect())
+        || (vPlane != null && !vPlane.isDirect())) {
+      throw new IllegalArgumentException("Planes must be direct buffers!");
     }
 
-    for (final TrackedObject trackedObject : trackedObjects.values()) {
-      trackedObject.updateTrackedPosition();
+    nextFrameDirectNative(
+        yPlane,
+        yRowStride,
+        uPlane,
+        vPlane,
+        uvRowStride,
+        uvPixelStride,
+        DOWNSAMPLE_FACTOR,
+        timestamp,
+        transformationMatrix);
+
+    onNativeFrameProcessed(timestamp, updateDebugInfo);
+  }
+
+  /**
+   * Pipelined version of {@link #nextFrame(ByteBuffer, int, ByteBuffer, ByteBuffer, int, int, long,
+   * float[], boolean)}. Builds the frame's image pyramid and returns while the native tracker is
+   * still tracking earlier frames on its own thread, so that camera frames can be fed faster than
+   * one full nextFrame call each. The planes may be reused as soon as this returns. Call {@link
+   * #awaitFrame(long, boolean)} to pick up the results; any other call waits for every submitted
+   * frame to be tracked first.
+   */
+  public synchronized void submitFrame(
+      final ByteBuffer yPlane,
+      final int yRowStride,
+      final ByteBuffer uPlane,
+      final ByteBuffer vPlane,
+      final int uvRowStride,
+      final int uvPixelStride,
+      final long timestamp,
+      final float[] transformationMatrix) {
+    if (!yPlane.isDirect()
+        || (uPlane != null && !uPlane.isDirect())
+        || (vPlane != null && !vPlane.isDirect())) {
+      throw new IllegalArgumentException("Planes must be direct buffers!");
     }
 
+    submitFrameDirectNative(
+        yPlane,
+        yRowStride,
+        uPlane,
+        vPlane,
+        uvRowStride,
+        uvPixelStride,
+        DOWNSAMPLE_FACTOR,
+        timestamp,
+        transformationMatrix);
+    lastSubmittedTimestamp = timestamp;
+  }
+
+  /** Returns whether the frame submitted with the given timestamp has been tracked yet. */
+  public boolean pollFrame(final long timestamp) {
+    lifecycleLock.readLock().lock();
+    try {
+      return !released && getLastTrackedTimestampNative() >= timestamp;
+    } finally {
+      lifecycleLock.readLock().unlock();
+    }
+  }
+
+  /**
+   * Blocks until the frame submitted with the given timestamp has been tracked, then updates the
+   * tracked objects and keypoint history to the most recently submitted frame, as nextFrame would.
+   * Other threads may keep submitting frames while this waits. Returns right away once the
+   * tracker has been released, and release() waits for this to return.
+   */
+  public void awaitFrame(final long timestamp, final boolean updateDebugInfo) {
+    lifecycleLock.readLock().lock();
+    try {
+      if (released) {
+        return;
+      }
+      waitForFrameNative(timestamp);
+
+      synchronized (this) {
+        if (lastTimestamp >= lastSubmittedTimestamp) {
+          // An earlier call already caught up.
+          return;
+        }
+        waitForFrameNative(lastSubmittedTimestamp);
+        onNativeFrameProcessed(lastSubmittedTimestamp, updateDebugInfo);
+      }
+    } finally {
+      lifecycleLock.readLock().unlock();
+    }
+  }
+
+  private static ByteBuffer allocateNativeOrder(final int capacity) {
+    return ByteBuffer.allocateDirect(capacity).order(ByteOrder.nativeOrder());
+  }
+
+  private void onNativeFrameProcessed(final long timestamp, final boolean updateDebugInfo) {
+    final int numKeypoints = getKeypointsPackedNative(DOWNSAMPLE_FACTOR, packedKeypoints);
+    final TimestampedDeltas deltas =
+        spareDeltas.isEmpty()
+            ? new TimestampedDeltas(packedKeypoints.capacity())
+            : spareDeltas.removeFirst();
+    deltas.timestamp = timestamp;
+    deltas.length = numKeypoints * PACKED_KEYPOINT_SIZE;
+    packedKeypoints.position(0);
+    packedKeypoints.get(deltas.deltas, 0, deltas.length);
+    timestampedDeltas.add(deltas);
+    while (timestampedDeltas.size() > MAX_FRAME_HISTORY_SIZE) {
+      spareDeltas.add(timestampedDeltas.removeFirst());
+    }
+
+    updateTrackedObjects();
+
     if (updateDebugInfo) {
       updateDebugHistory();
     }
@@ -298,8 +701,41 @@ public class ObjectTracker {
     lastTimestamp = timestamp;
   }
 
-  public synchronized void release() {
-    releaseMemoryNative();
+  /** Updates every TrackedObject from a single snapshot of the native tracker. */
+  private void updateTrackedObjects() {
+    int numObjects = getObjectSnapshotsNative(objectSnapshots);
+    if (numObjects * SNAPSHOT_SIZE > objectSnapshots.capacity()) {
+      objectSnapshots = allocateNativeOrder(2 * numObjects * SNAPSHOT_SIZE);
+      numObjects = getObjectSnapshotsNative(objectSnapshots);
+    }
+
+    for (int i = 0; i < numObjects; ++i) {
+      final int offset = i * SNAPSHOT_SIZE;
+      final TrackedObject trackedObject =
+          trackedObjectsByHandle.get(objectSnapshots.getInt(offset + SNAPSHOT_HANDLE_OFFSET));
+      if (trackedObject != null) {
+        trackedObject.updateFromSnapshot(objectSnapshots, offset);
+      }
+    }
+  }
+
+  public void release() {
+    // Waits for any awaitFrame() or pollFrame() call to return, which only takes until the frames
+    // already submitted have been tracked.
+    lifecycleLock.writeLock().lock();
+    try {
+      if (released) {
+        return;
+      }
+      synchronized (this) {
+        synchronized (drawLock) {
+          releaseMemoryNative();
+        }
+        released = true;
+      }
+    } finally {
+      lifecycleLock.writeLock().unlock();
+    }
     synchronized (ObjectTracker.class) {
       instance = null;
     }
@@ -348,6 +784,7 @@ public class ObjectTracker {
 
   private void drawKeypointsDebug(final Canvas canvas) {
     final Paint p = new Paint();
+    final FrameChange lastKeypoints = this.lastKeypoints;
     if (lastKeypoints == null) {
       return;
     }
@@ -422,7 +859,8 @@ public class ObjectTracker {
   }
 
   private void updateDebugHistory() {
-    lastKeypoints = new FrameChange(getKeypointsNative(false));
+    final int numKeypoints = getKeypointsNative(false, debugKeypoints);
+    lastKeypoints = new FrameChange(debugKeypoints.asFloatBuffer(), numKeypoints);
 
     if (lastTimestamp == 0) {
       return;
@@ -441,7 +879,8 @@ public class ObjectTracker {
     }
   }
 
-  public synchronized void drawDebug(final Canvas canvas, final Matrix frameToCanvas) {
+  /** Draws the flow history and last keypoints. Does not wait for a frame being tracked. */
+  public void drawDebug(final Canvas canvas, final Matrix frameToCanvas) {
     canvas.save();
     canvas.setMatrix(frameToCanvas);
 
@@ -453,6 +892,7 @@ public class ObjectTracker {
 
   public Vector<String> getDebugText() {
     final Vector<String> lines = new Vector<String>();
+    final FrameChange lastKeypoints = this.lastKeypoints;
 
     if (lastKeypoints != null) {
       lines.add("Num keypoints " + lastKeypoints.pointDeltas.size());
@@ -463,13 +903,37 @@ public class ObjectTracker {
     return lines;
   }
 
+  /** Returns the latency histogram summaries for each stage of the native tracker. */
+  public synchronized List<StageLatency> getStageLatencies() {
+    final float[] latencies = getStageLatenciesNative();
+    final List<StageLatency> stages = new ArrayList<StageLatency>();
+    if (latencies == null) {
+      return stages;
+    }
+
+    for (int i = 0;
+        i < StageLatency.STAGE_NAMES.length
+            && (i + 1) * StageLatency.STAGE_LATENCY_STEP <= latencies.length;
+        ++i) {
+      stages.add(
+          new StageLatency(
+              StageLatency.STAGE_NAMES[i], latencies, i * StageLatency.STAGE_LATENCY_STEP));
+    }
+    return stages;
+  }
+
+  /** Clears the latency histograms of the native tracker. */
+  public synchronized void resetStageLatencies() {
+    resetStageLatenciesNative();
+  }
+
   public synchronized List<byte[]> pollAccumulatedFlowData(final long endFrameTime) {
     final List<byte[]> frameDeltas = new ArrayList<byte[]>();
     while (timestampedDeltas.size() > 0) {
       final TimestampedDeltas currentDeltas = timestampedDeltas.peek();
       if (currentDeltas.timestamp <= endFrameTime) {
-        frameDeltas.add(currentDeltas.deltas);
-        timestampedDeltas.removeFirst();
+        frameDeltas.add(Arrays.copyOf(currentDeltas.deltas, currentDeltas.length));
+        spareDeltas.add(timestampedDeltas.removeFirst());
       } else {
         break;
       }
@@ -494,6 +958,30 @@ public class ObjectTracker {
         downsampledFrameRect.bottom * DOWNSAMPLE_FACTOR);
   }
 
+  /** Immutable state of a TrackedObject, in downsampled frame coordinates. */
+  private static class TrackedState {
+    final RectF position;
+    final boolean visible;
+    final float correlation;
+    final float matchScore;
+
+    /** When the native tracker last computed position. */
+    final long positionTime;
+
+    TrackedState(
+        final RectF position,
+        final boolean visible,
+        final float correlation,
+        final float matchScore,
+        final long positionTime) {
+      this.position = position;
+      this.visible = visible;
+      this.correlation = correlation;
+      this.matchScore = matchScore;
+      this.positionTime = positionTime;
+    }
+  }
+
   /**
    * A TrackedObject represents a native TrackedObject, and provides access to the relevant native
    * tracking information available after every frame update. They may be safely passed around and
@@ -505,25 +993,42 @@ public class ObjectTracker {
   public class TrackedObject {
     private final String id;
 
-    private long lastExternalPositionTime;
+    /** Handle of the native object, passed instead of id on every native call. */
+    private int handle;
+
+    private volatile long lastExternalPositionTime;
 
-    private RectF lastTrackedPosition;
-    private boolean visibleInLastFrame;
+    /**
+     * The object's state after the last frame or position update. Each update replaces it as a
+     * whole, so that the accessors below never take a lock and never see a mix of two updates.
+     */
+    private volatile TrackedState trackedState;
 
-    private boolean isDead;
+    private volatile boolean isDead;
 
     TrackedObject(final RectF position, final long timestamp, final byte[] data) {
+      this(timestamp);
+
+      synchronized (ObjectTracker.this) {
+        registerInitialAppearance(position, data);
+        setPreviousPosition(position, timestamp);
+        onRegistered();
+      }
+    }
+
+    /** Creates an object that is not registered with the native tracker yet. */
+    private TrackedObject(final long timestamp) {
       isDead = false;
 
       id = Integer.toString(this.hashCode());
 
       lastExternalPositionTime = timestamp;
+    }
 
-      synchronized (ObjectTracker.this) {
-        registerInitialAppearance(position, data);
-        setPreviousPosition(position, timestamp);
-        trackedObjects.put(id, this);
-      }
+    /** Must be called with the tracker lock held, once handle is set. */
+    private void onRegistered() {
+      trackedObjects.put(id, this);
+      trackedObjectsByHandle.put(handle, this);
     }
 
     public void stopTracking() {
@@ -531,19 +1036,32 @@ public class ObjectTracker {
 
       synchronized (ObjectTracker.this) {
         isDead = true;
-        forgetNative(id);
+        forgetNative(handle);
         trackedObjects.remove(id);
+        trackedObjectsByHandle.remove(handle);
       }
     }
 
+    /** Returns the correlation as of the last processed frame or position update. */
     public float getCurrentCorrelation() {
       checkValidObject();
-      return ObjectTracker.this.getCurrentCorrelation(id);
+      final TrackedState state = trackedState;
+      return state != null ? state.correlation : 0.0f;
+    }
+
+    float getMatchScore() {
+      final TrackedState state = trackedState;
+      return state != null ? state.matchScore : 0.0f;
+    }
+
+    long getLastTrackedPositionTime() {
+      final TrackedState state = trackedState;
+      return state != null ? state.positionTime : 0;
     }
 
     void registerInitialAppearance(final RectF position, final byte[] data) {
       final RectF externalPosition = downscaleRect(position);
-      registerNewObjectWithAppearanceNative(
+      handle = registerNewObjectWithAppearanceNative(
           id,
           externalPosition.left,
           externalPosition.top,
@@ -552,7 +1070,7 @@ public class ObjectTracker {
           data);
     }
 
-    synchronized void setPreviousPosition(final RectF position, final long timestamp) {
+    void setPreviousPosition(final RectF position, final long timestamp) {
       checkValidObject();
       synchronized (ObjectTracker.this) {
         if (lastExternalPositionTime > timestamp) {
@@ -563,7 +1081,7 @@ public class ObjectTracker {
         lastExternalPositionTime = timestamp;
 
         setPreviousPositionNative(
-            id,
+            handle,
             externalPosition.left,
             externalPosition.top,
             externalPosition.right,
@@ -579,7 +1097,7 @@ public class ObjectTracker {
       final RectF downsampledPosition = downscaleRect(position);
       synchronized (ObjectTracker.this) {
         setCurrentPositionNative(
-            id,
+            handle,
             downsampledPosition.left,
             downsampledPosition.top,
             downsampledPosition.right,
@@ -587,31 +1105,55 @@ public class ObjectTracker {
       }
     }
 
-    private synchronized void updateTrackedPosition() {
+    /** Must be called with the tracker lock held. */
+    private void updateTrackedPosition() {
       checkValidObject();
 
       final float[] delta = new float[4];
-      getTrackedPositionNative(id, delta);
-      lastTrackedPosition = new RectF(delta[0], delta[1], delta[2], delta[3]);
+      getTrackedPositionNative(handle, delta);
+      trackedState =
+          new TrackedState(
+              new RectF(delta[0], delta[1], delta[2], delta[3]),
+              isObjectVisible(handle),
+              ObjectTracker.this.getCurrentCorrelation(handle),
+              ObjectTracker.this.getMatchScore(handle),
+              trackedState != null ? trackedState.positionTime : 0);
+    }
 
-      visibleInLastFrame = isObjectVisible(id);
+    /** Copies this object's state out of the snapshot record at offset. */
+    private void updateFromSnapshot(final ByteBuffer snapshots, final int offset) {
+      checkValidObject();
+
+      trackedState =
+          new TrackedState(
+              new RectF(
+                  snapshots.getFloat(offset + SNAPSHOT_LEFT_OFFSET),
+                  snapshots.getFloat(offset + SNAPSHOT_TOP_OFFSET),
+                  snapshots.getFloat(offset + SNAPSHOT_RIGHT_OFFSET),
+                  snapshots.getFloat(offset + SNAPSHOT_BOTTOM_OFFSET)),
+              snapshots.getInt(offset + SNAPSHOT_VISIBLE_OFFSET) != 0,
+              snapshots.getFloat(offset + SNAPSHOT_CORRELATION_OFFSET),
+              snapshots.getFloat(offset + SNAPSHOT_MATCH_SCORE_OFFSET),
+              snapshots.getLong(offset + SNAPSHOT_POSITION_TIME_OFFSET));
     }
 
-    public synchronized RectF getTrackedPositionInPreviewFrame() {
+    public RectF getTrackedPositionInPreviewFrame() {
       checkValidObject();
 
-      if (lastTrackedPosition == null) {
+      final TrackedState state = trackedState;
+      if (state == null) {
         return null;
       }
-      return upscaleRect(lastTrackedPosition);
+      return upscaleRect(state.position);
     }
 
-    synchronized long getLastExternalPositionTime() {
+    long getLastExternalPositionTime() {
       return lastExternalPositionTime;
     }
 
-    public synchronized boolean visibleInLastPreviewFrame() {
-      return visibleInLastFrame;
+    public boolean visibleInLastPreviewFrame() {
+      final TrackedState state = trackedState;
+      return state != null && state.visible;
     }
 
     private void checkValidObject() {
@@ -637,39 +1179,123 @@ public class ObjectTracker {
     return new TrackedObject(position, lastTimestamp, frameData);
   }
 
+  /**
+   * Starts tracking a batch of objects at the given positions in the frame with the given
+   * timestamp, which must be one of the last two frames passed to nextFrame(), or one of the last
+   * numRetainedFrames given to {@link #getInstance(int, int, int, boolean, int, int, int, int,
+   * int)}. The native tracker takes their appearance from its own copy of that frame, so a late
+   * detection starts out with the pixels it was actually found in, and nothing is downsampled or
+   * copied per object.
+   *
+   * @return the new objects, in the order of positions, or null if the native tracker no longer
+   *     retains that frame, in which case trackObject() needs to be given the frame data instead.
+   */
+  public synchronized List<TrackedObject> trackObjects(
+      final List<RectF> positions, final long timestamp) {
+    final int numObjects = positions.size();
+    final TrackedObject[] objects = new TrackedObject[numObjects];
+    final String[] ids = new String[numObjects];
+    final float[] boxes = new float[numObjects * 4];
+    for (int i = 0; i < numObjects; ++i) {
+      objects[i] = new TrackedObject(timestamp);
+      ids[i] = objects[i].id;
+
+      final RectF box = downscaleRect(positions.get(i));
+      boxes[i * 4 + 0] = box.left;
+      boxes[i * 4 + 1] = box.top;
+      boxes[i * 4 + 2] = box.right;
+      boxes[i * 4 + 3] = box.bottom;
+    }
+
+    final int[] handles = new int[numObjects];
+    if (!registerNewObjectsInFrameNative(timestamp, ids, boxes, handles)) {
+      return null;
+    }
+
+    for (int i = 0; i < numObjects; ++i) {
+      objects[i].handle = handles[i];
+      objects[i].onRegistered();
+      objects[i].updateTrackedPosition();
+    }
+    return Arrays.asList(objects);
+  }
+
   /** ********************* NATIVE CODE ************************************ */
 
   /** This will contain an opaque pointer to the native ObjectTracker */
   private long nativeObjectTracker;
 
-  private native void initNative(int imageWidth, int imageHeight, boolean alwaysTrack);
-
-  protected native void registerNewObjectWithAppearanceNative(
+  private native void initNative(
+      int imageWidth,
+      int imageHeight,
+      boolean alwaysTrack,
+      int numWorkerThreads,
+      int maxKeypoints,
+      int maxKeypointsPerObject,
+      int maxCandidateKeypoints,
+      int numRetainedFrames);
+
+  /** Returns the handle the native tracker uses for the new object in the calls below. */
+  protected native int registerNewObjectWithAppearanceNative(
       String objectId, float x1, float y1, float x2, float y2, byte[] data);
 
+  /**
+   * Registers one object per id, with the boxes given as 4 floats each, in the frame with the
+   * given timestamp, and moves each to its current position. Writes their handles into handles.
+   * Returns false without registering anything if that frame is no longer retained.
+   */
+  protected native boolean registerNewObjectsInFrameNative(
+      long timestamp, String[] objectIds, float[] boxes, int[] handles);
+
   protected native void setPreviousPositionNative(
-      String objectId, float x1, float y1, float x2, float y2, long timestamp);
+      int handle, float x1, float y1, float x2, float y2, long timestamp);
 
   protected native void setCurrentPositionNative(
-      String objectId, float x1, float y1, float x2, float y2);
+      int handle, float x1, float y1, float x2, float y2);
 
-  protected native void forgetNative(String key);
+  protected native void forgetNative(int handle);
 
-  protected native String getModelIdNative(String key);
+  protected native String getModelIdNative(int handle);
 
-  protected native boolean haveObject(String key);
+  protected native boolean haveObject(int handle);
 
-  protected native boolean isObjectVisible(String key);
+  protected native boolean isObjectVisible(int handle);
 
-  protected native float getCurrentCorrelation(String key);
+  protected native float getCurrentCorrelation(int handle);
 
-  protected native float getMatchScore(String key);
+  protected native float getMatchScore(int handle);
 
-  protected native void getTrackedPositionNative(String key, float[] points);
+  protected native void getTrackedPositionNative(int handle, float[] points);
 
   protected native void nextFrameNative(
       byte[] frameData, byte[] uvData, long timestamp, float[] frameAlignMatrix);
 
+  protected native void nextFrameDirectNative(
+      ByteBuffer yPlane,
+      int yRowStride,
+      ByteBuffer uPlane,
+      ByteBuffer vPlane,
+      int uvRowStride,
+      int uvPixelStride,
+      int downsampleFactor,
+      long timestamp,
+      float[] frameAlignMatrix);
+
+  protected native void submitFrameDirectNative(
+      ByteBuffer yPlane,
+      int yRowStride,
+      ByteBuffer uPlane,
+      ByteBuffer vPlane,
+      int uvRowStride,
+      int uvPixelStride,
+      int downsampleFactor,
+      long timestamp,
+      float[] frameAlignMatrix);
+
+  protected native long getLastTrackedTimestampNative();
+
+  protected native void waitForFrameNative(long timestamp);
+
   protected native void releaseMemoryNative();
 
   protected native void getCurrentPositionNative(
@@ -680,12 +1306,40 @@ public class ObjectTracker {
       final float positionY2,
       final float[] delta);
 
-  protected native byte[] getKeypointsPacked(float scaleFactor);
+  /**
+   * Writes one SNAPSHOT_SIZE record per tracked object into the direct buffer snapshots, as many
+   * as fit, and returns the number of tracked objects.
+   */
+  protected native int getObjectSnapshotsNative(ByteBuffer snapshots);
+
+  /**
+   * Writes PACKED_KEYPOINT_SIZE bytes per found keypoint into the direct buffer keypoints, which
+   * must hold maxKeypoints of them, and returns the number written.
+   */
+  protected native int getKeypointsPackedNative(float scaleFactor, ByteBuffer keypoints);
 
-  protected native float[] getKeypointsNative(boolean onlyReturnCorrespondingKeypoints);
+  /**
+   * Writes FrameChange.KEYPOINT_STEP floats per keypoint into the direct buffer keypoints, which
+   * must hold maxKeypoints of them, and returns the number written.
+   */
+  protected native int getKeypointsNative(
+      boolean onlyReturnCorrespondingKeypoints, ByteBuffer keypoints);
+
+  protected native float[] getStageLatenciesNative();
+
+  protected native void resetStageLatenciesNative();
 
   protected native void drawNative(int viewWidth, int viewHeight, float[] frameToCanvas);
 
   protected static native void downsampleImageNative(
       int width, int height, int rowStride, byte[] input, int factor, byte[] output);
+
+  private static native long getMemoryUsageNative(
+      int imageWidth,
+      int imageHeight,
+      int numWorkerThreads,
+      int maxKeypoints,
+      int maxKeypointsPerObject,
+      int maxCandidateKeypoints,
+      int numRetainedFrames);
 }
@@ -16,6 +16,7 @@ limitations under the License.
 package com.google.ftcresearch.tfod.util;
 
 import android.graphics.Matrix;
+import android.graphics.Rect;
 import android.util.Log;
 
 import java.nio.ByteBuffer;
@@ -208,6 +209,15 @@ public class ImageUtils {
     return Size.getRotatedSize(new Size(width, height), rotation);
   }
 
+  /**
+   * Sets how many threads each of the conversions below may split its rows across, including the
+   * calling thread. The default of 1 converts entirely on the calling thread. The output is the
+   * same regardless.
+   *
+   * @param numThreads The maximum number of threads per conversion.
+   */
+  public static native void setNumConversionThreads(int numThreads);
+
   /**
    * Converts YUV420 semi-planar data to ARGB 8888 data using the supplied width and height. The
    * input and output must already be allocated and non-null. For efficiency, no error checking is
@@ -287,4 +297,64 @@ public class ImageUtils {
     argb8888ToYuv420sp(input, inputArray, isInputDirect, output, outputArray, isOutputDirect,
         width, height);
   }
-}
\ No newline at end of file
+
+
+  private static native void yuv420spToRgbTensor(
+      ByteBuffer inputBuffer, byte[] inputArray, boolean isInputDirect,
+      int width, int height, boolean uvFlipped,
+      int cropLeft, int cropTop, int cropWidth, int cropHeight,
+      int outputWidth, int outputHeight, boolean floatOutput, float mean, float std,
+      ByteBuffer output);
+
+  /**
+   * Converts a crop of YUV420SP data straight to an NHWC RGB tensor, such as the input buffer of
+   * a TensorFlow Lite model, in a single native pass with no intermediate ARGB image. The crop is
+   * scaled to the output size by taking the nearest pixel, as an unfiltered
+   * Bitmap.createScaledBitmap does, and every pixel converts exactly as it would through
+   * {@link #convertBuffersYUV420SPToARGB8888}.
+   *
+   * @param input The YUV 4:2:0 input data.
+   * @param width The width of the input image.
+   * @param height The height of the input image.
+   * @param uvFlipped Whether the U and V channels are flipped.
+   * @param crop The part of the input image to convert, which must lie within it.
+   * @param outputSize The width and height of the output tensor.
+   * @param floatOutput Whether to write floats normalized to (value - mean) / std, rather than
+   *                    bytes as they are.
+   * @param mean The mean to subtract from each channel of float output.
+   * @param std The standard deviation to divide each channel of float output by.
+   * @param output A direct buffer in native byte order to hold the tensor, at least
+   *               outputSize.width * outputSize.height * 3 elements long.
+   */
+  public static void convertBuffersYUV420SPToRGBTensor(
+      ByteBuffer input, int width, int height, boolean uvFlipped, Rect crop, Size outputSize,
+      boolean floatOutput, float mean, float std, ByteBuffer output) {
+
+    boolean isInputDirect = input.isDirect();
+    byte[] inputArray = input.hasArray() ? input.array() : null;
+
+    if (!isInputDirect && inputArray == null) {
+      throw new RuntimeException("Input buffer is not direct and doesn't have array!");
+    }
+
+    if (crop.left < 0 || crop.top < 0 || crop.right > width || crop.bottom > height
+        || crop.isEmpty()) {
+      throw new IllegalArgumentException("Crop " + crop + " is not within the "
+          + width + "x" + height + " image!");
+    }
+
+    if (outputSize.width <= 0 || outputSize.height <= 0) {
+      throw new IllegalArgumentException("Output size " + outputSize + " is empty!");
+    }
+
+    int bytesPerChannel = floatOutput ? 4 : 1;
+    if (!output.isDirect()
+        || output.capacity() < outputSize.width * outputSize.height * 3 * bytesPerChannel) {
+      throw new IllegalArgumentException("Output buffer is not direct or is too small!");
+    }
+
+    yuv420spToRgbTensor(input, inputArray, isInputDirect, width, height, uvFlipped,
+        crop.left, crop.top, crop.width(), crop.height(),
+        outputSize.width, outputSize.height, floatOutput, mean, std, output);
+  }
+}
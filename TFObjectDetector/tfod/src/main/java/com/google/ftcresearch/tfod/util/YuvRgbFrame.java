@@ -18,6 +18,7 @@ package com.google.ftcresearch.tfod.util;
 
 import android.graphics.Bitmap;
 import android.graphics.Matrix;
+import android.graphics.Rect;
 import android.support.annotation.NonNull;
 import android.util.Log;
 
@@ -40,6 +41,7 @@ public class YuvRgbFrame {
   private static final String TAG = "YuvRgbFrame";
 
   private final boolean uvFlipped; // Whether the U and V channels are flipped (NV21 vs NV12)
+  private final boolean yuvSource; // Whether the frame was created from YUV420SP data
   private ByteBuffer yuvFrame; // YUV420SP format, aka Y, U, V appended in a single array
   private IntBuffer rgbFrame; // ARGB_8888 format
   private final Size size;
@@ -54,6 +56,7 @@ public class YuvRgbFrame {
    */
   public YuvRgbFrame(@NonNull IntBuffer rgbFrame, Size size) {
     this.uvFlipped = false; // Will never be flipped if starting as an RGB frame
+    this.yuvSource = false;
     this.rgbFrame = rgbFrame;
     this.size = size;
     this.yuvFrame = null;
@@ -72,6 +75,7 @@ public class YuvRgbFrame {
    */
   public YuvRgbFrame(@NonNull ByteBuffer yuvFrame, Size size, boolean uvFlipped) {
     this.uvFlipped = uvFlipped; // May be flipped.
+    this.yuvSource = true;
     this.yuvFrame = yuvFrame;
     this.size = size;
     this.rgbFrame = null;
@@ -247,6 +251,52 @@ public class YuvRgbFrame {
     return newYuvRgbFrame;
   }
 
+  /**
+   * Write this frame, scaled to the given size, into a buffer as an NHWC RGB tensor, such as the
+   * input buffer of a TensorFlow Lite model.
+   *
+   * Frames created from YUV420SP data are converted, scaled and written natively in one pass,
+   * without building the full size ARGB_8888 data. Other frames go through {@link #resize}. Both
+   * scale by taking the nearest pixel.
+   *
+   * Either way, the tensor is written from the start of the buffer, whatever its position, and the
+   * buffer is left rewound, ready to be read from the start.
+   *
+   * @param tensorSize Width and height of the tensor.
+   * @param floatOutput Whether to write floats normalized to (value - mean) / std, rather than
+   *                    bytes as they are.
+   * @param mean The mean to subtract from each channel of float output.
+   * @param std The standard deviation to divide each channel of float output by.
+   * @param output Direct buffer in native byte order to write the tensor to.
+   */
+  public void writeRgbTensor(Size tensorSize, boolean floatOutput, float mean, float std,
+      ByteBuffer output) {
+    if (yuvSource) {
+      ImageUtils.convertBuffersYUV420SPToRGBTensor(getYuvData(), getWidth(), getHeight(),
+          uvFlipped, new Rect(0, 0, getWidth(), getHeight()), tensorSize, floatOutput, mean, std,
+          output);
+      output.rewind();
+      return;
+    }
+
+    int[] rgbArray = resize(tensorSize).getRgbData().array();
+    output.rewind();
+    for (int pixelValue : rgbArray) {
+      if (floatOutput) {
+        // Copy with normalization
+        output.putFloat((((pixelValue >> 16) & 0xFF) - mean) / std);
+        output.putFloat((((pixelValue >> 8) & 0xFF) - mean) / std);
+        output.putFloat(((pixelValue & 0xFF) - mean) / std);
+      } else {
+        // Copy as-is
+        output.put((byte) ((pixelValue >> 16) & 0xFF));
+        output.put((byte) ((pixelValue >> 8) & 0xFF));
+        output.put((byte) (pixelValue & 0xFF));
+      }
+    }
+    output.rewind();
+  }
+
   /**
    * Return a new YuvRgbFrame which has been rotated clockwise.
    *
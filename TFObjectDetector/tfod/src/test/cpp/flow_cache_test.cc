@@ -0,0 +1,153 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Checks that the batched and parallel FlowCache queries give exactly the
+// results of looking the points up one at a time, with either flow solver.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "config.h"
+#include "flow_cache.h"
+#include "image_data.h"
+#include "test_util.h"
+#include "utils.h"
+#include "worker_pool.h"
+
+using namespace tf_tracking;
+
+namespace {
+
+const int kWidth = 320;
+const int kHeight = 240;
+
+void TestBatchMatchesSingle(const float* const align_matrix23,
+                            const int num_threads, const FlowSolver solver) {
+  const std::vector<uint8_t> texture1 = MakeTexture(kWidth, kHeight, 40.0f);
+  const std::vector<uint8_t> texture2 =
+      Shift(texture1, kWidth, kHeight, 3, -2);
+
+  ImageData frame1(kWidth, kHeight);
+  ImageData frame2(kWidth, kHeight);
+  frame1.SetData(&texture1[0], kWidth, 1, 1);
+  frame2.SetData(&texture2[0], kWidth, 2, 1);
+
+  // A grid of points, plus some on and past the borders.
+  std::vector<float> x_in;
+  std::vector<float> y_in;
+  for (int i = 0; i < kMaxKeypoints - 6; ++i) {
+    x_in.push_back(5.0f + (i * 37) % (kWidth - 10) + 0.25f * (i % 4));
+    y_in.push_back(5.0f + (i * 53) % (kHeight - 10) + 0.5f * (i % 2));
+  }
+  const float kEdgeX[] = {0.0f, kWidth - 1.0f, -3.0f, 2.5f, 160.0f, 400.0f};
+  const float kEdgeY[] = {0.0f, kHeight - 1.0f, 10.0f, 1.5f, 238.5f, 12.0f};
+  for (size_t i = 0; i < NELEMS(kEdgeX); ++i) {
+    x_in.push_back(kEdgeX[i]);
+    y_in.push_back(kEdgeY[i]);
+  }
+  const int num_points = static_cast<int>(x_in.size());
+
+  OpticalFlowConfig config((Size(kWidth, kHeight)));
+  config.solver = solver;
+
+  FlowCache single_cache(&config);
+  single_cache.NextFrame(&frame1, NULL);
+  single_cache.NextFrame(&frame2, align_matrix23);
+
+  FlowCache batch_cache(&config);
+  batch_cache.NextFrame(&frame1, NULL);
+  batch_cache.NextFrame(&frame2, align_matrix23);
+
+  std::vector<float> expected_x(num_points, 0.0f);
+  std::vector<float> expected_y(num_points, 0.0f);
+  std::vector<bool> expected_found(num_points);
+  for (int i = 0; i < num_points; ++i) {
+    expected_found[i] = single_cache.FindNewPositionOfPoint(
+        x_in[i], y_in[i], &expected_x[i], &expected_y[i]);
+  }
+
+  std::unique_ptr<WorkerPool> pool;
+  if (num_threads > 0) {
+    pool.reset(new WorkerPool(num_threads));
+  }
+
+  std::vector<float> x_out(num_points);
+  std::vector<float> y_out(num_points);
+  bool found[kMaxKeypoints];
+  const int num_found = batch_cache.FindNewPositionsOfPoints(
+      num_points, &x_in[0], &y_in[0], &x_out[0], &y_out[0], found,
+      pool.get());
+
+  int expected_num_found = 0;
+  for (int i = 0; i < num_points; ++i) {
+    EXPECT_TRUE(found[i] == expected_found[i],
+                "found mismatch at point %d (%.2f, %.2f), %d threads", i,
+                x_in[i], y_in[i], num_threads);
+    if (expected_found[i]) {
+      ++expected_num_found;
+      EXPECT_TRUE(x_out[i] == expected_x[i] && y_out[i] == expected_y[i],
+                  "point %d moved to (%f, %f), expected (%f, %f), %d threads",
+                  i, x_out[i], y_out[i], expected_x[i], expected_y[i],
+                  num_threads);
+    }
+  }
+  EXPECT_TRUE(num_found == expected_num_found,
+              "found %d points, expected %d", num_found, expected_num_found);
+  EXPECT_TRUE(expected_num_found > num_points / 2,
+              "only %d of %d points tracked", expected_num_found, num_points);
+
+  // Both caches must now hold the same blocks, so later lookups agree too.
+  for (int i = 0; i < 20; ++i) {
+    const float x = 7.0f + i * 15.5f;
+    const float y = 230.0f - i * 11.25f;
+    float single_x = 0.0f;
+    float single_y = 0.0f;
+    float batch_x = 0.0f;
+    float batch_y = 0.0f;
+    const bool single_found =
+        single_cache.FindNewPositionOfPoint(x, y, &single_x, &single_y);
+    const bool batch_found =
+        batch_cache.FindNewPositionOfPoint(x, y, &batch_x, &batch_y);
+    EXPECT_TRUE(single_found == batch_found &&
+                    (!single_found ||
+                     (single_x == batch_x && single_y == batch_y)),
+                "cached lookup at (%.2f, %.2f) differs, %d threads", x, y,
+                num_threads);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const float kAlignment[] = {1.0f, 0.01f, 2.5f, -0.01f, 1.0f, -1.5f};
+  const int kThreadCounts[] = {0, 1, 3};
+
+  const FlowSolver kSolvers[] = {FLOW_SOLVER_LK, FLOW_SOLVER_ESM};
+
+  for (size_t s = 0; s < NELEMS(kSolvers); ++s) {
+    for (size_t i = 0; i < NELEMS(kThreadCounts); ++i) {
+      srand(42);
+      TestBatchMatchesSingle(NULL, kThreadCounts[i], kSolvers[s]);
+      srand(42);
+      TestBatchMatchesSingle(kAlignment, kThreadCounts[i], kSolvers[s]);
+    }
+  }
+
+  return ReportResults();
+}
@@ -0,0 +1,250 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Checks that FrameHistory moves boxes by the weighted median keypoint motion,
+// from any number of threads at once, and through its trajectory cache.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "config.h"
+#include "frame_history.h"
+#include "frame_pair.h"
+#include "geom.h"
+#include "test_util.h"
+#include "utils.h"
+#include "worker_pool.h"
+
+using namespace tf_tracking;
+
+namespace {
+
+const int kMaxKeypoints = 76;
+
+// Boxes are centered here, so that keypoints on the vertical line through it
+// get full weight for translation and none for scale.
+const float kCenter = 200.0f;
+
+struct Motion {
+  Keypoint from;
+  Keypoint to;
+};
+
+void AddFramePair(const int64_t start_time, const int64_t end_time,
+                  const std::vector<Motion>& motions,
+                  FramePair* const frame_pair, FrameHistory* const history) {
+  frame_pair->Init(start_time, end_time);
+  for (size_t i = 0; i < motions.size(); ++i) {
+    frame_pair->frame1_keypoints_[i] = motions[i].from;
+    frame_pair->frame2_keypoints_[i] = motions[i].to;
+    frame_pair->optical_flow_found_keypoint_[i] = true;
+  }
+  frame_pair->number_of_keypoints_ = static_cast<int>(motions.size());
+
+  history->Add(start_time, end_time);
+  history->SetLatestCorrespondences(*frame_pair);
+}
+
+// Keypoints on the center line, moved by small integer amounts with plenty of
+// ties. Scores span [0, 4], so that weights and their sums are exact in
+// floating point whatever order they are added in.
+std::vector<Motion> MakeMotions(const int num_keypoints) {
+  std::vector<Motion> motions(num_keypoints);
+  for (int i = 0; i < num_keypoints; ++i) {
+    const float y = kCenter - 40.0f + rand() % 81;
+    motions[i].from = Keypoint(kCenter, y);
+    motions[i].from.score_ = static_cast<float>(rand() % 5);
+    motions[i].to =
+        Keypoint(kCenter + rand() % 41 - 20, y + rand() % 41 - 20);
+  }
+  motions[0].from.score_ = 0.0f;
+  motions[num_keypoints - 1].from.score_ = 4.0f;
+  return motions;
+}
+
+// Going from the largest delta to the smallest, the first at which the
+// accumulated weight reaches half of the total, found by sorting.
+float SortedWeightedMedian(std::vector<std::pair<float, float> > deltas) {
+  std::sort(deltas.begin(), deltas.end());
+  std::reverse(deltas.begin(), deltas.end());
+  float total_weight = 0.0f;
+  for (size_t i = 0; i < deltas.size(); ++i) {
+    total_weight += deltas[i].second;
+  }
+  float weight = 0.0f;
+  for (size_t i = 0; i < deltas.size(); ++i) {
+    weight += deltas[i].second;
+    if (weight >= total_weight / 2.0f) {
+      return deltas[i].first;
+    }
+  }
+  return 0.0f;
+}
+
+void TestMatchesSortedMedian() {
+  FramePair frame_pair;
+  frame_pair.Allocate(kMaxKeypoints);
+  AdjustBoxScratch scratch(kMaxKeypoints);
+
+  for (int trial = 0; trial < 500; ++trial) {
+    FrameHistory history(4, kMaxKeypoints);
+    const int num_keypoints = 1 + rand() % kMaxKeypoints;
+    const std::vector<Motion> motions = MakeMotions(num_keypoints);
+    AddFramePair(1, 2, motions, &frame_pair, &history);
+
+    float min_score = motions[0].from.score_;
+    float max_score = motions[0].from.score_;
+    for (int i = 0; i < num_keypoints; ++i) {
+      min_score = std::min(min_score, motions[i].from.score_);
+      max_score = std::max(max_score, motions[i].from.score_);
+    }
+
+    std::vector<std::pair<float, float> > x_deltas;
+    std::vector<std::pair<float, float> > y_deltas;
+    for (int i = 0; i < num_keypoints; ++i) {
+      float weight = 1.0f;
+      if (max_score > min_score) {
+        weight = (motions[i].from.score_ - min_score) /
+                 (max_score - min_score) * 0.5f + 0.5f;
+      }
+      x_deltas.push_back(std::make_pair(
+          motions[i].to.pos_.x - motions[i].from.pos_.x, weight));
+      y_deltas.push_back(std::make_pair(
+          motions[i].to.pos_.y - motions[i].from.pos_.y, weight));
+    }
+    const float expected_x = SortedWeightedMedian(x_deltas);
+    const float expected_y = SortedWeightedMedian(y_deltas);
+
+    const BoundingBox box(kCenter - 100.0f, kCenter - 100.0f,
+                          kCenter + 100.0f, kCenter + 100.0f);
+    const BoundingBox moved = history.AdjustBox(0, box, &scratch);
+    EXPECT_TRUE(moved.left_ == box.left_ + expected_x &&
+                    moved.top_ == box.top_ + expected_y &&
+                    moved.right_ == box.right_ + expected_x &&
+                    moved.bottom_ == box.bottom_ + expected_y,
+                "trial %d, %d keypoints: moved by (%.1f, %.1f), expected "
+                "(%.1f, %.1f)", trial, num_keypoints, moved.left_ - box.left_,
+                moved.top_ - box.top_, expected_x, expected_y);
+  }
+}
+
+void TestConcurrentAdjustBox(const int num_threads) {
+  FramePair frame_pair;
+  frame_pair.Allocate(kMaxKeypoints);
+  FrameHistory history(8, kMaxKeypoints);
+
+  // Keypoints spread over the whole frame, so that every box weights them
+  // differently.
+  std::vector<Motion> motions(kMaxKeypoints);
+  for (int i = 0; i < kMaxKeypoints; ++i) {
+    const float x = 10.0f + rand() % 380;
+    const float y = 10.0f + rand() % 380;
+    motions[i].from = Keypoint(x, y);
+    motions[i].from.score_ = rand() / static_cast<float>(RAND_MAX);
+    motions[i].to = Keypoint(x * 1.1f - 15.0f + rand() % 5,
+                             y * 1.1f - 25.0f + rand() % 5);
+  }
+  AddFramePair(1, 2, motions, &frame_pair, &history);
+
+  const int kNumBoxes = 200;
+  std::vector<BoundingBox> boxes;
+  std::vector<BoundingBox> expected;
+  AdjustBoxScratch scratch(kMaxKeypoints);
+  for (int i = 0; i < kNumBoxes; ++i) {
+    const float left = rand() % 300;
+    const float top = rand() % 300;
+    boxes.push_back(BoundingBox(left, top, left + 20.0f + rand() % 80,
+                                top + 20.0f + rand() % 80));
+    expected.push_back(history.AdjustBox(0, boxes[i], &scratch));
+  }
+
+  std::vector<BoundingBox> moved(kNumBoxes);
+  WorkerPool pool(num_threads);
+  pool.ParallelFor(kNumBoxes, [&](const int begin, const int end) {
+    AdjustBoxScratch range_scratch(kMaxKeypoints);
+    for (int i = begin; i < end; ++i) {
+      moved[i] = history.AdjustBox(0, boxes[i], &range_scratch);
+    }
+  });
+
+  for (int i = 0; i < kNumBoxes; ++i) {
+    EXPECT_TRUE(moved[i].left_ == expected[i].left_ &&
+                    moved[i].top_ == expected[i].top_ &&
+                    moved[i].right_ == expected[i].right_ &&
+                    moved[i].bottom_ == expected[i].bottom_,
+                "box %d differs with %d threads", i, num_threads);
+  }
+}
+
+void TestTrackBox() {
+  FramePair frame_pair;
+  frame_pair.Allocate(kMaxKeypoints);
+  AdjustBoxScratch scratch(kMaxKeypoints);
+  const int kNumFramePairs = 16;
+  FrameHistory history(kNumFramePairs, kMaxKeypoints);
+
+  // Everything moves one pixel right per frame pair.
+  std::vector<Motion> motions(kMaxKeypoints);
+  for (int i = 0; i < kMaxKeypoints; ++i) {
+    const float x = 10.0f + rand() % 380;
+    const float y = 10.0f + rand() % 380;
+    motions[i].from = Keypoint(x, y);
+    motions[i].to = Keypoint(x + 1.0f, y);
+  }
+
+  const BoundingBox region(100.0f, 100.0f, 200.0f, 200.0f);
+  for (int i = 0; i < 2 * kNumFramePairs; ++i) {
+    AddFramePair(i * 10, (i + 1) * 10, motions, &frame_pair, &history);
+
+    // A region seen at time 10 * k has since moved through the frame pairs
+    // ending after it, or through all of them if the oldest that is left
+    // starts after it.
+    const int oldest = MAX(0, i - kNumFramePairs + 1);
+    for (int k = MAX(0, i - kNumFramePairs); k <= i + 1; ++k) {
+      for (int repeat = 0; repeat < 2; ++repeat) {
+        const BoundingBox tracked =
+            history.TrackBox(region, k * 10, &scratch);
+        const float expected_shift = static_cast<float>(i + 1 - MAX(k, oldest));
+        EXPECT_TRUE(tracked.left_ == region.left_ + expected_shift &&
+                        tracked.top_ == region.top_,
+                    "after %d frame pairs, box from time %d moved by %.1f, "
+                    "expected %.1f", i + 1, k * 10,
+                    tracked.left_ - region.left_, expected_shift);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  srand(42);
+  TestMatchesSortedMedian();
+
+  const int kThreadCounts[] = {1, 3};
+  for (size_t i = 0; i < NELEMS(kThreadCounts); ++i) {
+    srand(42);
+    TestConcurrentAdjustBox(kThreadCounts[i]);
+  }
+
+  srand(42);
+  TestTrackBox();
+
+  return ReportResults();
+}
@@ -0,0 +1,197 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Checks that FrameRing keeps the right frames, and that objects registered in
+// a retained frame start out exactly as if they had been given that frame.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "frame_ring.h"
+#include "geom.h"
+#include "image-inl.h"
+#include "image.h"
+#include "object_tracker.h"
+#include "test_util.h"
+#include "utils.h"
+
+using namespace tf_tracking;
+
+namespace {
+
+const int kWidth = 160;
+const int kHeight = 120;
+
+void FillFrame(const int seed, Image<uint8_t>* const image) {
+  for (int y = 0; y < image->GetHeight(); ++y) {
+    for (int x = 0; x < image->GetWidth(); ++x) {
+      (*image)[y][x] = static_cast<uint8_t>(seed * 31 + x * 7 + y * 13);
+    }
+  }
+}
+
+void TestRing() {
+  const int kMaxFrames = 4;
+  FrameRing ring(kMaxFrames, kWidth, kHeight);
+  Image<uint8_t> image(kWidth, kHeight);
+
+  EXPECT_TRUE(ring.Find(0) == NULL, "empty ring found a frame");
+  for (int i = 1; i <= 10; ++i) {
+    FillFrame(i, &image);
+    ring.Add(i * 100, image);
+    EXPECT_TRUE(ring.GetNumFrames() == MIN(i, kMaxFrames),
+                "%d frames retained after %d", ring.GetNumFrames(), i);
+
+    for (int j = 1; j <= i; ++j) {
+      const Image<uint8_t>* const frame = ring.Find(j * 100);
+      if (j <= i - kMaxFrames) {
+        EXPECT_TRUE(frame == NULL, "frame %d not evicted after %d", j, i);
+        continue;
+      }
+      FillFrame(j, &image);
+      EXPECT_TRUE(frame != NULL && frame->GetWidth() == kWidth &&
+                      (*frame)[kHeight - 1][kWidth - 1] ==
+                          image[kHeight - 1][kWidth - 1] &&
+                      (*frame)[7][3] == image[7][3],
+                  "frame %d wrong after %d", j, i);
+      EXPECT_TRUE(ring.Find(j * 100 + 1) == NULL,
+                  "found a frame at %d", j * 100 + 1);
+    }
+  }
+
+  FrameRing empty(0, kWidth, kHeight);
+  empty.Add(100, image);
+  EXPECT_TRUE(empty.Find(100) == NULL && empty.GetNumFrames() == 0,
+              "ring without capacity kept a frame");
+}
+
+// Random 4x4 blocks drifting right and down by a pixel per frame, so that
+// there is something to track.
+void MakeFrames(const int num_frames,
+                std::vector<std::vector<uint8_t> >* const frames) {
+  const int texture_width = kWidth + num_frames;
+  const int texture_height = kHeight + num_frames;
+  std::vector<uint8_t> blocks((texture_width / 4 + 1) *
+                              (texture_height / 4 + 1));
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    blocks[i] = static_cast<uint8_t>(rand() % 256);
+  }
+
+  frames->resize(num_frames);
+  for (int f = 0; f < num_frames; ++f) {
+    (*frames)[f].resize(kWidth * kHeight);
+    const int offset = num_frames - 1 - f;
+    for (int y = 0; y < kHeight; ++y) {
+      for (int x = 0; x < kWidth; ++x) {
+        (*frames)[f][y * kWidth + x] =
+            blocks[(y + offset) / 4 * (texture_width / 4 + 1) +
+                   (x + offset) / 4];
+      }
+    }
+  }
+}
+
+void TestRegisterInRetainedFrame() {
+  const int kNumFrames = 12;
+  const int kRegisterFrame = 6;
+  const int kLatency = 4;
+  std::vector<std::vector<uint8_t> > frames;
+  MakeFrames(kNumFrames, &frames);
+
+  const BoundingBox boxes[] = {BoundingBox(20, 20, 60, 60),
+                               BoundingBox(70, 30, 130, 90),
+                               BoundingBox(10, 60, 50, 110)};
+  const int kNumObjects = NELEMS(boxes);
+
+  // Objects registered with the frame itself, and in the retained frame.
+  BoundingBox positions[2][kNumObjects];
+  float correlations[2][kNumObjects];
+  for (int mode = 0; mode < 2; ++mode) {
+    TrackerConfig* const config = new TrackerConfig(Size(kWidth, kHeight));
+    config->always_track = true;
+    config->num_retained_frames = kLatency + 1;
+    ObjectTracker tracker(config, NULL);
+
+    std::vector<std::string> ids;
+    for (int i = 0; i < kNumObjects; ++i) {
+      char id[8];
+      snprintf(id, sizeof(id), "o%d", i);
+      ids.push_back(id);
+    }
+
+    for (int f = 0; f < kNumFrames; ++f) {
+      tracker.NextFrame(&frames[f][0], (f + 1) * 1000, NULL);
+      if (f != kRegisterFrame + kLatency) {
+        continue;
+      }
+
+      const int64_t detection_time = (kRegisterFrame + 1) * 1000;
+      if (mode == 0) {
+        for (int i = 0; i < kNumObjects; ++i) {
+          const ObjectHandle handle = tracker.RegisterNewObjectWithAppearance(
+              ids[i], &frames[kRegisterFrame][0], boxes[i]);
+          tracker.SetPreviousPositionOfObject(handle, boxes[i],
+                                              detection_time);
+        }
+      } else {
+        std::vector<BoundingBox> batch(boxes, boxes + kNumObjects);
+        std::vector<ObjectHandle> handles;
+        EXPECT_TRUE(!tracker.RegisterNewObjectsInFrame(
+                        detection_time - (kLatency + 1) * 1000, ids, batch,
+                        &handles),
+                    "registered in a frame that is no longer retained");
+        EXPECT_TRUE(tracker.GetNumObjects() == 0,
+                    "failed registration added objects");
+        EXPECT_TRUE(tracker.RegisterNewObjectsInFrame(detection_time, ids,
+                                                      batch, &handles) &&
+                        handles.size() == ids.size(),
+                    "could not register in a retained frame");
+      }
+    }
+
+    for (int i = 0; i < kNumObjects; ++i) {
+      const TrackedObject* const object = tracker.GetObject(ids[i]);
+      positions[mode][i] = object->GetPosition();
+      correlations[mode][i] = object->GetCorrelation();
+    }
+  }
+
+  for (int i = 0; i < kNumObjects; ++i) {
+    const BoundingBox& a = positions[0][i];
+    const BoundingBox& b = positions[1][i];
+    EXPECT_TRUE(a.left_ == b.left_ && a.top_ == b.top_ &&
+                    a.right_ == b.right_ && a.bottom_ == b.bottom_ &&
+                    correlations[0][i] == correlations[1][i],
+                "object %d differs: %.3f,%.3f,%.3f,%.3f (%.4f) vs "
+                "%.3f,%.3f,%.3f,%.3f (%.4f)", i, a.left_, a.top_, a.right_,
+                a.bottom_, correlations[0][i], b.left_, b.top_, b.right_,
+                b.bottom_, correlations[1][i]);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  srand(42);
+  TestRing();
+  TestRegisterInRetainedFrame();
+
+  return ReportResults();
+}
@@ -0,0 +1,190 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Checks that MotionEstimator recovers known affine motions from
+// correspondences with noise and outliers, and refuses to fit ones that no
+// single motion explains.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "frame_pair.h"
+#include "motion_estimator.h"
+#include "test_util.h"
+#include "utils.h"
+
+using namespace tf_tracking;
+
+namespace {
+
+const int kWidth = 320;
+const int kHeight = 240;
+const int kNumPoints = 64;
+
+// Fills frame_pair with num_points correspondences moved by motion, with up to
+// noise pixels of error, and replaces the first num_outliers of them by
+// random ones. Every other correspondence after those is marked as lost.
+void MakeCorrespondences(const float* const motion, const float noise,
+                         const int num_points, const int num_outliers,
+                         const bool lose_some, FramePair* const frame_pair) {
+  frame_pair->Init(0, 1);
+  frame_pair->number_of_keypoints_ = num_points;
+  for (int i = 0; i < num_points; ++i) {
+    Keypoint& keypoint1 = frame_pair->frame1_keypoints_[i];
+    Keypoint& keypoint2 = frame_pair->frame2_keypoints_[i];
+    keypoint1.pos_.x = randf(0.0f, kWidth - 1);
+    keypoint1.pos_.y = randf(0.0f, kHeight - 1);
+    if (i < num_outliers) {
+      keypoint2.pos_.x = keypoint1.pos_.x + randf(-20.0f, 20.0f);
+      keypoint2.pos_.y = keypoint1.pos_.y + randf(-20.0f, 20.0f);
+    } else {
+      keypoint2.pos_.x = motion[0] * keypoint1.pos_.x +
+                         motion[1] * keypoint1.pos_.y + motion[2] +
+                         randf(-noise, noise);
+      keypoint2.pos_.y = motion[3] * keypoint1.pos_.x +
+                         motion[4] * keypoint1.pos_.y + motion[5] +
+                         randf(-noise, noise);
+    }
+    frame_pair->optical_flow_found_keypoint_[i] =
+        !lose_some || i < num_outliers || (i - num_outliers) % 2 == 0;
+  }
+}
+
+// Returns the furthest apart the two motions take any corner of the frame.
+float MaxCornerError(const float* const a, const float* const b) {
+  float max_error = 0.0f;
+  for (int corner = 0; corner < 4; ++corner) {
+    const float x = (corner & 1) ? kWidth - 1 : 0.0f;
+    const float y = (corner & 2) ? kHeight - 1 : 0.0f;
+    const float dx = (a[0] - b[0]) * x + (a[1] - b[1]) * y + (a[2] - b[2]);
+    const float dy = (a[3] - b[3]) * x + (a[4] - b[4]) * y + (a[5] - b[5]);
+    max_error = MAX(max_error, sqrtf(dx * dx + dy * dy));
+  }
+  return max_error;
+}
+
+void TestRecoversMotion() {
+  FramePair frame_pair;
+  frame_pair.Allocate(kNumPoints);
+  MotionEstimator estimator(kNumPoints);
+
+  // A pan, a slight zoom with rotation, and a shear.
+  const float motions[3][6] = {
+      {1.0f, 0.0f, 4.5f, 0.0f, 1.0f, -2.25f},
+      {1.03f, -0.02f, -3.0f, 0.02f, 1.03f, 1.5f},
+      {0.98f, 0.05f, 1.0f, -0.01f, 1.01f, 6.0f}};
+  for (int m = 0; m < 3; ++m) {
+    for (int num_outliers = 0; num_outliers <= kNumPoints * 3 / 10;
+         num_outliers += kNumPoints / 10) {
+      for (int lose_some = 0; lose_some < 2; ++lose_some) {
+        MakeCorrespondences(motions[m], 0.25f, kNumPoints, num_outliers,
+                            lose_some != 0, &frame_pair);
+
+        float estimate[6];
+        const bool found = estimator.EstimateAffine(frame_pair, estimate);
+        EXPECT_TRUE(found, "motion %d with %d outliers not found", m,
+                    num_outliers);
+        if (!found) {
+          continue;
+        }
+
+        const int num_inliers = estimator.GetNumPoints() - num_outliers;
+        EXPECT_TRUE(estimator.GetNumInliers() >= num_inliers &&
+                        estimator.GetNumInliers() <= num_inliers + 2,
+                    "motion %d: %d inliers of %d, expected %d", m,
+                    estimator.GetNumInliers(), estimator.GetNumPoints(),
+                    num_inliers);
+
+        const float error = MaxCornerError(motions[m], estimate);
+        EXPECT_TRUE(error < 0.3f,
+                    "motion %d with %d outliers off by %.3f pixels", m,
+                    num_outliers, error);
+
+        // The same correspondences always give the same motion.
+        float again[6];
+        estimator.EstimateAffine(frame_pair, again);
+        for (int i = 0; i < 6; ++i) {
+          EXPECT_TRUE(again[i] == estimate[i],
+                      "motion %d not repeatable, %.6f vs %.6f", m, again[i],
+                      estimate[i]);
+        }
+      }
+    }
+  }
+}
+
+void TestRejectsUnexplainedMotion() {
+  FramePair frame_pair;
+  frame_pair.Allocate(kNumPoints);
+  MotionEstimator estimator(kNumPoints);
+  const float identity[6] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f};
+  float estimate[6];
+
+  // Mostly outliers.
+  MakeCorrespondences(identity, 0.25f, kNumPoints, kNumPoints * 7 / 10, false,
+                      &frame_pair);
+  EXPECT_TRUE(!estimator.EstimateAffine(frame_pair, estimate),
+              "fit a motion to mostly outliers");
+
+  // Too few correspondences to trust.
+  MakeCorrespondences(identity, 0.0f, kMinMotionInliers - 1, 0, false,
+                      &frame_pair);
+  EXPECT_TRUE(!estimator.EstimateAffine(frame_pair, estimate),
+              "fit a motion to %d correspondences", kMinMotionInliers - 1);
+
+  // Consistent, but far too deformed to be camera motion between frames.
+  const float squash[6] = {1.5f, 0.0f, 0.0f, 0.0f, 0.6f, 0.0f};
+  MakeCorrespondences(squash, 0.0f, kNumPoints, 0, false, &frame_pair);
+  EXPECT_TRUE(!estimator.EstimateAffine(frame_pair, estimate),
+              "fit an implausible motion");
+}
+
+void TestScaleMotion() {
+  const float motion[6] = {1.02f, -0.01f, 3.0f, 0.01f, 1.02f, -1.0f};
+  float scaled[6];
+
+  MotionEstimator::ScaleMotion(motion, 1.0f, scaled);
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_TRUE(fabs(scaled[i] - motion[i]) < EPSILON,
+                "unit scaling changed element %d", i);
+  }
+
+  const float identity[6] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f};
+  MotionEstimator::ScaleMotion(motion, 0.0f, scaled);
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_TRUE(fabs(scaled[i] - identity[i]) < EPSILON,
+                "zero scaling left element %d at %.4f", i, scaled[i]);
+  }
+
+  MotionEstimator::ScaleMotion(motion, 2.0f, scaled);
+  EXPECT_TRUE(fabs(scaled[0] - 1.04f) < EPSILON &&
+                  fabs(scaled[2] - 6.0f) < EPSILON &&
+                  fabs(scaled[5] + 2.0f) < EPSILON,
+              "double scaling gave %.4f %.4f %.4f", scaled[0], scaled[2],
+              scaled[5]);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  srand(42);
+  TestRecoversMotion();
+  TestRejectsUnexplainedMotion();
+  TestScaleMotion();
+
+  return ReportResults();
+}
@@ -0,0 +1,148 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Checks that both flow solvers find a known translation, that stopping on
+// convergence saves iterations while barely moving the results, and that the
+// solver stats count the work done.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "config.h"
+#include "flow_cache.h"
+#include "image_data.h"
+#include "test_util.h"
+#include "utils.h"
+
+using namespace tf_tracking;
+
+namespace {
+
+const int kWidth = 320;
+const int kHeight = 240;
+const int kShiftX = 3;
+const int kShiftY = -2;
+const int kNumPoints = 60;
+
+const char* const kSolverNames[] = {"LK", "ESM"};
+
+// Tracks a grid of interior points from frame1 to frame2 with the given
+// config, storing where each went, and returns the solver stats.
+FlowSolverStats TrackPoints(const OpticalFlowConfig& config,
+                            ImageData* const frame1, ImageData* const frame2,
+                            std::vector<float>* const x_out,
+                            std::vector<float>* const y_out,
+                            std::vector<bool>* const found) {
+  FlowCache cache(&config);
+  cache.NextFrame(frame1, NULL);
+  cache.NextFrame(frame2, NULL);
+
+  x_out->assign(kNumPoints, 0.0f);
+  y_out->assign(kNumPoints, 0.0f);
+  found->assign(kNumPoints, false);
+  for (int i = 0; i < kNumPoints; ++i) {
+    const float x = 30.0f + (i % 10) * 26.0f + 0.25f * (i % 3);
+    const float y = 30.0f + (i / 10) * 32.0f + 0.5f * (i % 2);
+    (*found)[i] = cache.FindNewPositionOfPoint(x, y, &(*x_out)[i],
+                                               &(*y_out)[i]);
+    (*x_out)[i] -= x;
+    (*y_out)[i] -= y;
+  }
+  return cache.GetSolverStats();
+}
+
+void TestSolver(const FlowSolver solver) {
+  const char* const name = kSolverNames[solver];
+  const std::vector<uint8_t> texture1 = MakeTexture(kWidth, kHeight, 0.0f);
+  const std::vector<uint8_t> texture2 =
+      Shift(texture1, kWidth, kHeight, kShiftX, kShiftY);
+
+  ImageData frame1(kWidth, kHeight);
+  ImageData frame2(kWidth, kHeight);
+  frame1.SetData(&texture1[0], kWidth, 1, 1);
+  frame2.SetData(&texture2[0], kWidth, 2, 1);
+
+  OpticalFlowConfig config((Size(kWidth, kHeight)));
+  config.solver = solver;
+  config.max_iterations = 5;
+
+  // Every step taken.
+  config.convergence_threshold = 0.0f;
+  std::vector<float> full_x;
+  std::vector<float> full_y;
+  std::vector<bool> full_found;
+  const FlowSolverStats full_stats =
+      TrackPoints(config, &frame1, &frame2, &full_x, &full_y, &full_found);
+
+  // Stopping once converged.
+  config.convergence_threshold = kTrackingAbortThreshold;
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<bool> found;
+  const FlowSolverStats stats =
+      TrackPoints(config, &frame1, &frame2, &x, &y, &found);
+
+  int num_found = 0;
+  for (int i = 0; i < kNumPoints; ++i) {
+    if (!found[i]) {
+      continue;
+    }
+    ++num_found;
+    EXPECT_TRUE(fabs(x[i] - kShiftX) < 0.25f && fabs(y[i] - kShiftY) < 0.25f,
+                "%s: point %d moved by (%.3f, %.3f), expected (%d, %d)", name,
+                i, x[i], y[i], kShiftX, kShiftY);
+    // ESM keeps adjusting its brightness offset, so its later steps can still
+    // move a point a little.
+    EXPECT_TRUE(full_found[i] && fabs(x[i] - full_x[i]) < 0.2f &&
+                    fabs(y[i] - full_y[i]) < 0.2f,
+                "%s: point %d moved by (%.3f, %.3f) when converging early, "
+                "(%.3f, %.3f) otherwise", name, i, x[i], y[i], full_x[i],
+                full_y[i]);
+  }
+  EXPECT_TRUE(num_found > kNumPoints * 9 / 10, "%s: only %d of %d points found",
+              name, num_found, kNumPoints);
+
+  EXPECT_TRUE(full_stats.num_solves > 0 && full_stats.num_converged == 0 &&
+                  full_stats.num_iterations <=
+                      full_stats.num_solves * config.max_iterations,
+              "%s: %lld iterations and %lld converged over %lld solves with "
+              "no threshold", name,
+              static_cast<long long>(full_stats.num_iterations),
+              static_cast<long long>(full_stats.num_converged),
+              static_cast<long long>(full_stats.num_solves));
+  EXPECT_TRUE(stats.num_converged > stats.num_solves / 2 &&
+                  stats.num_iterations < full_stats.num_iterations,
+              "%s: %lld iterations and %lld converged over %lld solves, vs "
+              "%lld iterations with no threshold", name,
+              static_cast<long long>(stats.num_iterations),
+              static_cast<long long>(stats.num_converged),
+              static_cast<long long>(stats.num_solves),
+              static_cast<long long>(full_stats.num_iterations));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  srand(42);
+  TestSolver(FLOW_SOLVER_LK);
+  srand(42);
+  TestSolver(FLOW_SOLVER_ESM);
+
+  return ReportResults();
+}
@@ -0,0 +1,259 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Checks the SSE4.1 and AVX2 kernels against the scalar code they replace.
+// Kernels the CPU doesn't support are skipped.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "config.h"
+#include "image-inl.h"
+#include "image.h"
+#include "image_utils.h"
+#include "test_util.h"
+#include "utils.h"
+
+using namespace tf_tracking;
+
+namespace {
+
+// The scalar sums run in a different order, so allow for rounding.
+bool FloatsMatch(const float actual, const float expected,
+                 const int num_vals) {
+  return NearlyEqual(actual, expected,
+                     EPSILON * num_vals * MAX(1.0f, std::abs(expected)));
+}
+
+std::vector<float> RandomFloats(const int count, const float scale) {
+  std::vector<float> values(count);
+  for (int i = 0; i < count; ++i) {
+    values[i] = scale * (rand() / static_cast<float>(RAND_MAX) - 0.5f);
+  }
+  return values;
+}
+
+#ifdef TF_TRACKING_X86_SIMD
+
+typedef float (*MeanFunction)(const float* const, const int);
+typedef float (*StdDevFunction)(const float* const, const int, const float);
+typedef float (*CrossCorrelationFunction)(const float* const,
+                                          const float* const, const int);
+typedef void (*CalculateGFunction)(const float* const, const float* const,
+                                   const int, float* const);
+typedef void (Image<uint8_t>::*DownsampleFunction)(const uint8_t* const,
+                                                  const int, const int);
+typedef uint32_t (*FastCompassFunction)(const uint8_t* const, const int);
+
+struct Kernels {
+  const char* name;
+  X86SimdLevel level;
+  MeanFunction mean;
+  StdDevFunction std_dev;
+  CrossCorrelationFunction cross_correlation;
+  CalculateGFunction calculate_g;
+  DownsampleFunction downsample;
+  FastCompassFunction fast_compass;
+  int fast_compass_width;
+};
+
+void TestStatistics(const Kernels& kernels) {
+  static const int kSizes[] = {8, 9, 15, 16, 17, 31, 81, 100, 1024};
+  for (size_t i = 0; i < NELEMS(kSizes); ++i) {
+    const int num_vals = kSizes[i];
+    const std::vector<float> values1 = RandomFloats(num_vals, 10.0f);
+    const std::vector<float> values2 = RandomFloats(num_vals, 10.0f);
+
+    const float mean_cpu = ComputeMeanCpu(&values1[0], num_vals);
+    const float mean = kernels.mean(&values1[0], num_vals);
+    EXPECT_TRUE(FloatsMatch(mean, mean_cpu, num_vals),
+                "%s mean of %d: %.8f vs %.8f", kernels.name, num_vals, mean,
+                mean_cpu);
+
+    const float std_dev_cpu = ComputeStdDevCpu(&values1[0], num_vals, mean_cpu);
+    const float std_dev = kernels.std_dev(&values1[0], num_vals, mean_cpu);
+    EXPECT_TRUE(FloatsMatch(std_dev, std_dev_cpu, num_vals),
+                "%s std dev of %d: %.8f vs %.8f", kernels.name, num_vals,
+                std_dev, std_dev_cpu);
+
+    const float cross_cpu =
+        ComputeCrossCorrelationCpu(&values1[0], &values2[0], num_vals);
+    const float cross =
+        kernels.cross_correlation(&values1[0], &values2[0], num_vals);
+    EXPECT_TRUE(FloatsMatch(cross, cross_cpu, num_vals),
+                "%s cross correlation of %d: %.8f vs %.8f", kernels.name,
+                num_vals, cross, cross_cpu);
+
+    // G is accumulated into, so start from something other than zero.
+    float g_cpu[4] = {1.0f, 2.0f, 0.0f, 3.0f};
+    float g[4] = {1.0f, 2.0f, 0.0f, 3.0f};
+    CalculateGCpu(&values1[0], &values2[0], num_vals, g_cpu);
+    kernels.calculate_g(&values1[0], &values2[0], num_vals, g);
+    for (int j = 0; j < 4; ++j) {
+      EXPECT_TRUE(FloatsMatch(g[j], g_cpu[j], num_vals),
+                  "%s G[%d] of %d: %.8f vs %.8f", kernels.name, j, num_vals,
+                  g[j], g_cpu[j]);
+    }
+  }
+}
+
+// Same as the scalar path of Image::DownsampleAveraged.
+void DownsampleReference(const uint8_t* const original, const int stride,
+                         const int factor, Image<uint8_t>* const image) {
+  for (int y = 0; y < image->GetHeight(); ++y) {
+    for (int x = 0; x < image->GetWidth(); ++x) {
+      int32_t pixel_sum = 0;
+      for (int dy = 0; dy < factor; ++dy) {
+        for (int dx = 0; dx < factor; ++dx) {
+          pixel_sum += original[(y * factor + dy) * stride + x * factor + dx];
+        }
+      }
+      (*image)[y][x] = pixel_sum / (factor * factor);
+    }
+  }
+}
+
+void TestDownsample(const Kernels& kernels) {
+  // Output widths covering exact multiples of the vector width, the
+  // overlapping last pass, and the narrowest supported images.
+  static const int kWidths[] = {8, 16, 20, 24, 33, 40, 160, 165, 320};
+  static const int kFactors[] = {2, 4};
+
+  for (size_t f = 0; f < NELEMS(kFactors); ++f) {
+    const int factor = kFactors[f];
+    for (size_t w = 0; w < NELEMS(kWidths); ++w) {
+      const int width = kWidths[w];
+      if (width * factor < 32) {
+        continue;
+      }
+      const int height = 7;
+
+      // Pad the rows, as camera planes often are.
+      const int stride = width * factor + 13;
+      std::vector<uint8_t> original(stride * height * factor);
+      for (size_t i = 0; i < original.size(); ++i) {
+        original[i] = rand() & 0xFF;
+      }
+
+      Image<uint8_t> expected(width, height);
+      DownsampleReference(&original[0], stride, factor, &expected);
+
+      Image<uint8_t> actual(width, height);
+      (actual.*kernels.downsample)(&original[0], stride, factor);
+
+      int num_mismatches = 0;
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          num_mismatches += actual[y][x] != expected[y][x];
+        }
+      }
+      EXPECT_TRUE(num_mismatches == 0,
+                  "%s downsample %dx%d by %d: %d pixels differ", kernels.name,
+                  width, height, factor, num_mismatches);
+    }
+  }
+}
+
+// The short FAST test as KeypointDetector's TestCircle runs it: three
+// consecutive compass points all brighter, or all darker, by more than
+// kFastDiffAmount.
+bool FastCompassReference(const uint8_t* const center, const int stride) {
+  const int offsets[] = {-3, -3 * stride, 3, 3 * stride};
+  int state[4];
+  for (int i = 0; i < 4; ++i) {
+    const int difference = center[offsets[i]] - center[0];
+    state[i] = difference > kFastDiffAmount ? 1 :
+               difference < -kFastDiffAmount ? -1 : 0;
+  }
+  for (int i = 0; i < 4; ++i) {
+    const int s = state[i];
+    if (s != 0 && state[(i + 1) % 4] == s && state[(i + 2) % 4] == s) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TestFastCompass(const Kernels& kernels) {
+  const int width = 80;
+  const int height = 40;
+  const int stride = width + 5;
+
+  // Few distinct levels, so that equal and just-over-threshold differences
+  // come up often, plus the extremes for the saturating thresholds.
+  static const uint8_t kLevels[] = {0, 5, 9, 10, 11, 20, 21, 31, 128,
+                                    234, 235, 245, 246, 250, 255};
+  std::vector<uint8_t> pixels(stride * height);
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = kLevels[rand() % NELEMS(kLevels)];
+  }
+
+  int num_mismatches = 0;
+  int num_passed = 0;
+  for (int y = 3; y < height - 3; ++y) {
+    for (int x = 3; x + kernels.fast_compass_width + 3 <= width;
+         x += kernels.fast_compass_width) {
+      const uint8_t* const center = &pixels[y * stride + x];
+      const uint32_t mask = kernels.fast_compass(center, stride);
+      for (int lane = 0; lane < kernels.fast_compass_width; ++lane) {
+        const bool expected = FastCompassReference(center + lane, stride);
+        num_mismatches += ((mask >> lane) & 1) != expected;
+        num_passed += expected;
+      }
+    }
+  }
+  EXPECT_TRUE(num_mismatches == 0, "%s FAST compass test: %d pixels differ",
+              kernels.name, num_mismatches);
+  EXPECT_TRUE(num_passed > 0, "%s FAST compass test: nothing passed",
+              kernels.name);
+}
+
+#endif  // TF_TRACKING_X86_SIMD
+
+}  // namespace
+
+int main() {
+  srand(1234);
+
+#ifdef TF_TRACKING_X86_SIMD
+  const Kernels kAllKernels[] = {
+      {"SSE4.1", X86_SIMD_SSE41, ComputeMeanSse41, ComputeStdDevSse41,
+       ComputeCrossCorrelationSse41, CalculateGSse41,
+       &Image<uint8_t>::DownsampleAveragedSse41, FastCompassMaskSse41, 16},
+      {"AVX2", X86_SIMD_AVX2, ComputeMeanAvx2, ComputeStdDevAvx2,
+       ComputeCrossCorrelationAvx2, CalculateGAvx2,
+       &Image<uint8_t>::DownsampleAveragedAvx2, FastCompassMaskAvx2, 32},
+  };
+
+  for (size_t i = 0; i < NELEMS(kAllKernels); ++i) {
+    const Kernels& kernels = kAllKernels[i];
+    if (GetX86SimdLevel() < kernels.level) {
+      printf("Skipping %s, not supported by this CPU.\n", kernels.name);
+      continue;
+    }
+    printf("Testing %s.\n", kernels.name);
+    TestStatistics(kernels);
+    TestDownsample(kernels);
+    TestFastCompass(kernels);
+  }
+#else
+  printf("No x86 SIMD kernels in this build.\n");
+#endif
+
+  return ReportResults();
+}
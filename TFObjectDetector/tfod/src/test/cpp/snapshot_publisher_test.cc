@@ -0,0 +1,298 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Checks that readers of a SnapshotPublisher only ever see whole publications,
+// however the reads interleave with a writer on another thread, and that
+// ObjectTracker publishes every change to its objects as it is made, to
+// readers that never wait for a frame being tracked.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "geom.h"
+#include "image_data.h"
+#include "object_tracker.h"
+#include "snapshot_publisher.h"
+#include "test_util.h"
+
+using namespace tf_tracking;
+
+namespace {
+
+const int kCapacity = 16;
+
+// Every field of every snapshot in publication n is derived from n, and the
+// number of snapshots varies with it, so a torn read shows up as a mismatch.
+int NumSnapshotsFor(const int n) {
+  return n % (kCapacity + 4);
+}
+
+void FillSnapshots(const int n, ObjectSnapshot* const snapshots) {
+  for (int i = 0; i < MIN(NumSnapshotsFor(n), kCapacity); ++i) {
+    ObjectSnapshot* const snapshot = snapshots + i;
+    snapshot->handle = i;
+    snapshot->left = n;
+    snapshot->top = n + 1;
+    snapshot->right = n + 2;
+    snapshot->bottom = n + 3;
+    snapshot->correlation = n + 4;
+    snapshot->match_score = n + 5;
+    snapshot->visible = n & 1;
+    snapshot->position_time = n;
+  }
+}
+
+bool IsConsistent(const ObjectSnapshot* const snapshots,
+                  const int num_snapshots, const int64_t timestamp) {
+  const int n = static_cast<int>(timestamp);
+  if (num_snapshots != NumSnapshotsFor(n)) {
+    return false;
+  }
+  for (int i = 0; i < MIN(num_snapshots, kCapacity); ++i) {
+    const ObjectSnapshot& snapshot = snapshots[i];
+    if (snapshot.handle != i || snapshot.left != n || snapshot.top != n + 1 ||
+        snapshot.right != n + 2 || snapshot.bottom != n + 3 ||
+        snapshot.correlation != n + 4 || snapshot.match_score != n + 5 ||
+        snapshot.visible != (n & 1) || snapshot.position_time != n) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TestEmpty() {
+  SnapshotPublisher publisher(kCapacity);
+  ObjectSnapshot snapshots[kCapacity];
+  int64_t timestamp = -1;
+  EXPECT_TRUE(publisher.Read(snapshots, kCapacity, &timestamp) == 0 &&
+                  timestamp == 0,
+              "nothing published yet, but read something");
+}
+
+void TestTruncation() {
+  SnapshotPublisher publisher(kCapacity);
+  ObjectSnapshot snapshots[kCapacity];
+  const int n = kCapacity + 3;
+  FillSnapshots(n, snapshots);
+  publisher.Publish(snapshots, NumSnapshotsFor(n), n);
+
+  // Only what fits in both the publisher and the reader's array is copied,
+  // but the full count is reported.
+  ObjectSnapshot read[4];
+  int64_t timestamp = 0;
+  EXPECT_TRUE(publisher.Read(read, 4, &timestamp) == NumSnapshotsFor(n) &&
+                  timestamp == n && read[3].handle == 3 && read[3].left == n,
+              "truncated read is wrong");
+}
+
+void TestConcurrentReads(const int num_readers) {
+  SnapshotPublisher publisher(kCapacity);
+  std::atomic<bool> done(false);
+  std::atomic<int> num_bad_reads(0);
+  std::atomic<int> num_reads(0);
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < num_readers; ++r) {
+    readers.push_back(std::thread([&]() {
+      ObjectSnapshot snapshots[kCapacity];
+      while (!done.load()) {
+        int64_t timestamp = 0;
+        const int num_snapshots =
+            publisher.Read(snapshots, kCapacity, &timestamp);
+        if (!IsConsistent(snapshots, num_snapshots, timestamp)) {
+          ++num_bad_reads;
+        }
+        ++num_reads;
+      }
+    }));
+  }
+
+  ObjectSnapshot snapshots[kCapacity];
+  for (int n = 1; n <= 20000; ++n) {
+    FillSnapshots(n, snapshots);
+    publisher.Publish(snapshots, NumSnapshotsFor(n), n);
+    if (n % 64 == 0) {
+      std::this_thread::yield();
+    }
+  }
+  done.store(true);
+  for (size_t r = 0; r < readers.size(); ++r) {
+    readers[r].join();
+  }
+
+  EXPECT_TRUE(num_bad_reads.load() == 0,
+              "%d of %d reads with %d reader(s) saw a torn publication",
+              num_bad_reads.load(), num_reads.load(), num_readers);
+}
+
+// Returns whether the published snapshots are those of the tracker's objects
+// as they are now, as of its current frame.
+bool PublishedCurrentObjects(const ObjectTracker& tracker,
+                             const int64_t frame_time) {
+  ObjectSnapshot expected[kCapacity];
+  ObjectSnapshot published[kCapacity];
+  const int num_expected = tracker.GetObjectSnapshots(expected, kCapacity);
+  int64_t published_time = 0;
+  const int num_published =
+      tracker.GetPublishedSnapshots(published, kCapacity, &published_time);
+  if (num_published != num_expected || published_time != frame_time) {
+    return false;
+  }
+  for (int i = 0; i < num_expected; ++i) {
+    if (published[i].handle != expected[i].handle ||
+        published[i].left != expected[i].left ||
+        published[i].top != expected[i].top ||
+        published[i].right != expected[i].right ||
+        published[i].bottom != expected[i].bottom ||
+        published[i].position_time != expected[i].position_time) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TestPublishedAfterChanges() {
+  const int kWidth = 160;
+  const int kHeight = 120;
+  std::vector<uint8_t> frame(kWidth * kHeight);
+  for (size_t i = 0; i < frame.size(); ++i) {
+    frame[i] = static_cast<uint8_t>(rand() % 256);
+  }
+
+  TrackerConfig* const config = new TrackerConfig(Size(kWidth, kHeight));
+  config->always_track = true;
+  config->num_retained_frames = 2;
+  ObjectTracker tracker(config, NULL);
+
+  tracker.NextFrame(&frame[0], 1000, NULL);
+  EXPECT_TRUE(PublishedCurrentObjects(tracker, 1000),
+              "first frame not published");
+
+  const ObjectHandle a = tracker.RegisterNewObjectWithAppearance(
+      "a", &frame[0], BoundingBox(10, 10, 50, 50));
+  EXPECT_TRUE(PublishedCurrentObjects(tracker, 1000) &&
+                  tracker.GetNumObjects() == 1,
+              "registered object not published");
+
+  tracker.NextFrame(&frame[0], 2000, NULL);
+  std::vector<std::string> ids;
+  ids.push_back("b");
+  ids.push_back("c");
+  std::vector<BoundingBox> positions;
+  positions.push_back(BoundingBox(60, 20, 100, 60));
+  positions.push_back(BoundingBox(20, 60, 60, 100));
+  std::vector<ObjectHandle> handles;
+  EXPECT_TRUE(tracker.RegisterNewObjectsInFrame(1000, ids, positions,
+                                                &handles) &&
+                  PublishedCurrentObjects(tracker, 2000) &&
+                  tracker.GetNumObjects() == 3,
+              "batch of registered objects not published");
+
+  tracker.SetPreviousPositionOfObject(a, BoundingBox(30, 30, 70, 70), 1000);
+  EXPECT_TRUE(PublishedCurrentObjects(tracker, 2000),
+              "moved object not published");
+
+  tracker.ForgetTarget(handles[0]);
+  EXPECT_TRUE(PublishedCurrentObjects(tracker, 2000) &&
+                  tracker.GetNumObjects() == 2,
+              "forgotten object still published");
+
+  // The next object takes the forgotten one's slot, but not its handle.
+  const ObjectHandle d = tracker.RegisterNewObjectWithAppearance(
+      "d", &frame[0], BoundingBox(100, 60, 140, 100));
+  EXPECT_TRUE((d & kObjectHandleSlotMask) ==
+                      (handles[0] & kObjectHandleSlotMask) &&
+                  d != handles[0] && !tracker.HaveObject(handles[0]) &&
+                  tracker.HaveObject(d),
+              "handle %d of a forgotten object addresses its successor %d",
+              handles[0], d);
+  EXPECT_TRUE(PublishedCurrentObjects(tracker, 2000),
+              "object in a reused slot not published");
+}
+
+// Tracking a frame takes far longer than Draw() or GetPublishedSnapshots(), so
+// unless they wait for it, some submitted frames are still being tracked when
+// they return.
+void TestReadsDuringFrames() {
+  const int kWidth = 320;
+  const int kHeight = 240;
+  const int kNumFrames = 16;
+  const int64_t kFrameTime = 1000;
+
+  // Frames scrolling up a random texture a row at a time.
+  std::vector<uint8_t> texture(kWidth * (kHeight + kNumFrames));
+  for (size_t i = 0; i < texture.size(); ++i) {
+    texture[i] = static_cast<uint8_t>(rand() % 256);
+  }
+
+  TrackerConfig* const config = new TrackerConfig(Size(kWidth, kHeight));
+  config->always_track = true;
+  ObjectTracker tracker(config, NULL);
+  tracker.NextFrame(&texture[0], kFrameTime, NULL);
+  tracker.RegisterNewObjectWithAppearance("o", &texture[0],
+                                          BoundingBox(100, 80, 200, 160));
+
+  const float kFrameToCanvas[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+                                   0.0f, 0.0f, 0.0f, 1.0f};
+  ObjectSnapshot snapshots[kCapacity];
+  int num_in_flight = 0;
+  for (int f = 1; f < kNumFrames; ++f) {
+    FramePlanes planes;
+    planes.y = &texture[f * kWidth];
+    planes.y_row_stride = kWidth;
+    const int64_t timestamp = (f + 1) * kFrameTime;
+    tracker.SubmitFrame(planes, timestamp, NULL);
+
+    tracker.Draw(kWidth, kHeight, kFrameToCanvas);
+    int64_t published_time = 0;
+    tracker.GetPublishedSnapshots(snapshots, kCapacity, &published_time);
+    if (tracker.GetLastTrackedTimestamp() < timestamp) {
+      ++num_in_flight;
+      EXPECT_TRUE(published_time < timestamp,
+                  "snapshots from frame %lld published before it was tracked",
+                  static_cast<long long>(timestamp));
+    }
+  }
+  tracker.WaitForAllFrames();
+
+  EXPECT_TRUE(num_in_flight > 0,
+              "every one of %d frames was tracked by the time Draw() and "
+              "GetPublishedSnapshots() returned", kNumFrames - 1);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  TestEmpty();
+  TestTruncation();
+
+  const int kReaderCounts[] = {1, 3};
+  for (size_t i = 0; i < NELEMS(kReaderCounts); ++i) {
+    TestConcurrentReads(kReaderCounts[i]);
+  }
+
+  srand(42);
+  TestPublishedAfterChanges();
+  TestReadsDuringFrames();
+
+  return ReportResults();
+}
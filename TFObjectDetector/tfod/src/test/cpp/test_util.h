@@ -0,0 +1,107 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// The check harness shared by the native tests, and the textures the flow
+// tests track. Only the standard library is used, so tests linking either
+// native library can include this.
+
+#ifndef TFOD_TEST_CPP_TEST_UTIL_H_
+#define TFOD_TEST_CPP_TEST_UTIL_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+int num_failures = 0;
+
+// Counts a failed check and prints why, without stopping the test, so that
+// one run reports every check that fails.
+#define EXPECT_TRUE(condition, ...)        \
+  do {                                     \
+    if (!(condition)) {                    \
+      fprintf(stderr, "FAILED: " __VA_ARGS__); \
+      fprintf(stderr, "\n");               \
+      ++num_failures;                      \
+    }                                      \
+  } while (0)
+
+// Prints the outcome of the checks so far, and returns the exit code for
+// main().
+inline int ReportResults() {
+  if (num_failures > 0) {
+    fprintf(stderr, "%d check(s) failed.\n", num_failures);
+    return 1;
+  }
+  printf("PASSED\n");
+  return 0;
+}
+
+// A smooth random width x height texture from rand(), so that there is flow
+// to find everywhere, plus diagonal waves of the given amplitude.
+inline std::vector<uint8_t> MakeTexture(const int width, const int height,
+                                        const float wave_amplitude) {
+  std::vector<float> noise(width * height);
+  for (size_t i = 0; i < noise.size(); ++i) {
+    noise[i] = rand() / static_cast<float>(RAND_MAX);
+  }
+
+  std::vector<uint8_t> texture(width * height);
+  const int kRadius = 2;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      float sum = 0.0f;
+      int count = 0;
+      for (int dy = -kRadius; dy <= kRadius; ++dy) {
+        for (int dx = -kRadius; dx <= kRadius; ++dx) {
+          const int sx = std::min(std::max(x + dx, 0), width - 1);
+          const int sy = std::min(std::max(y + dy, 0), height - 1);
+          sum += noise[sy * width + sx];
+          ++count;
+        }
+      }
+      const float value = sum / count * 255.0f +
+                          wave_amplitude * sinf(x * 0.05f + y * 0.03f);
+      texture[y * width + x] =
+          static_cast<uint8_t>(std::min(std::max(value, 0.0f), 255.0f));
+    }
+  }
+  return texture;
+}
+
+// Returns the width x height texture moved by (shift_x, shift_y), clamping at
+// the edges.
+inline std::vector<uint8_t> Shift(const std::vector<uint8_t>& texture,
+                                  const int width, const int height,
+                                  const int shift_x, const int shift_y) {
+  std::vector<uint8_t> shifted(texture.size());
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const int sx = std::min(std::max(x - shift_x, 0), width - 1);
+      const int sy = std::min(std::max(y - shift_y, 0), height - 1);
+      shifted[y * width + x] = texture[sy * width + sx];
+    }
+  }
+  return shifted;
+}
+
+}  // namespace
+
+#endif  // TFOD_TEST_CPP_TEST_UTIL_H_
@@ -0,0 +1,406 @@
+/* Copyright 2018 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Checks ConvertYUV420SPToARGB8888 and ConvertARGB8888ToYUV420SP, with every
+// kernel the CPU supports and with and without row bands, against copies of
+// the original per-pixel code. The output must match bit for bit. Also checks
+// ConvertYUV420SPToRGBTensor against converting the whole frame to ARGB and
+// then cropping and scaling it, and that it refuses crops outside the image
+// and empty outputs.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "rgb2yuv.h"
+#include "simd_level.h"
+#include "test_util.h"
+#include "yuv2rgb.h"
+
+namespace {
+
+// The original yuv2rgb.cc, before it was vectorized.
+uint32_t ReferenceYUV2RGB(int nY, int nU, int nV) {
+  nY -= 16;
+  nU -= 128;
+  nV -= 128;
+  if (nY < 0) nY = 0;
+
+  int nR = 1192 * nY + 1634 * nV;
+  int nG = 1192 * nY - 833 * nV - 400 * nU;
+  int nB = 1192 * nY + 2066 * nU;
+
+  nR = nR < 0 ? 0 : (nR > 262143 ? 262143 : nR);
+  nG = nG < 0 ? 0 : (nG > 262143 ? 262143 : nG);
+  nB = nB < 0 ? 0 : (nB > 262143 ? 262143 : nB);
+
+  nR = (nR >> 10) & 0xff;
+  nG = (nG >> 10) & 0xff;
+  nB = (nB >> 10) & 0xff;
+
+  return 0xff000000 | (nR << 16) | (nG << 8) | nB;
+}
+
+void ReferenceYUV420SPToARGB8888(const uint8_t* const yData,
+                                 const uint8_t* const uvData,
+                                 uint32_t* const output, const int width,
+                                 const int height, const bool uv_flipped) {
+  const uint8_t* pY = yData;
+  const uint8_t* pUV = uvData;
+  uint32_t* out = output;
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int nY = *pY++;
+      int offset = (y >> 1) * width + 2 * (x >> 1);
+#ifdef __APPLE__
+      int nU = pUV[offset];
+      int nV = pUV[offset + 1];
+#else
+      int nV = pUV[offset];
+      int nU = pUV[offset + 1];
+#endif
+
+      if (uv_flipped) {
+        *out++ = ReferenceYUV2RGB(nY, nV, nU);
+      } else {
+        *out++ = ReferenceYUV2RGB(nY, nU, nV);
+      }
+    }
+  }
+}
+
+// The original rgb2yuv.cc, before it was vectorized.
+void ReferenceWriteYUV(const int x, const int y, const int width,
+                       const int r8, const int g8, const int b8,
+                       uint8_t* const pY, uint8_t* const pUV) {
+  *pY = ((66 * r8 + 129 * g8 + 25 * b8 + 128) >> 8) + 16;
+
+  const int blocks_per_row = (width + 1) / 2;
+  const int offset = 2 * (((y / 2) * blocks_per_row + (x / 2)));
+
+  if (!(x & 1) && !(y & 1)) {
+    pUV[offset] = 0;
+    pUV[offset + 1] = 0;
+  }
+
+#ifdef __APPLE__
+  const int u_offset = 0;
+  const int v_offset = 1;
+#else
+  const int u_offset = 1;
+  const int v_offset = 0;
+#endif
+  pUV[offset + v_offset] += ((112 * r8 - 94 * g8 - 18 * b8 + 128) >> 10) + 32;
+  pUV[offset + u_offset] += ((-38 * r8 - 74 * g8 + 112 * b8 + 128) >> 10) + 32;
+}
+
+void ReferenceARGB8888ToYUV420SP(const uint32_t* const input,
+                                 uint8_t* const output, int width,
+                                 int height) {
+  uint8_t* pY = output;
+  uint8_t* pUV = output + (width * height);
+  const uint32_t* in = input;
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      const uint32_t rgb = *in++;
+#ifdef __APPLE__
+      const int nB = (rgb >> 8) & 0xFF;
+      const int nG = (rgb >> 16) & 0xFF;
+      const int nR = (rgb >> 24) & 0xFF;
+#else
+      const int nR = (rgb >> 16) & 0xFF;
+      const int nG = (rgb >> 8) & 0xFF;
+      const int nB = rgb & 0xFF;
+#endif
+      ReferenceWriteYUV(x, y, width, nR, nG, nB, pY++, pUV);
+    }
+  }
+}
+
+struct ImageSize {
+  int width;
+  int height;
+};
+
+// Exact multiples of every kernel width, ragged column tails, odd heights
+// and images too small for any kernel.
+const ImageSize kSizes[] = {{1, 1},   {2, 2},    {15, 3},   {16, 2},
+                            {17, 5},  {31, 4},   {32, 2},   {33, 7},
+                            {48, 6},  {63, 9},   {64, 64},  {100, 75},
+                            {320, 240}, {645, 13}};
+
+const int kThreadCounts[] = {1, 2, 3, 8};
+
+template <typename T>
+int CountMismatches(const std::vector<T>& actual,
+                    const std::vector<T>& expected) {
+  int num_mismatches = 0;
+  for (size_t i = 0; i < actual.size(); ++i) {
+    num_mismatches += actual[i] != expected[i];
+  }
+  return num_mismatches;
+}
+
+void TestYUVToARGB(const char* const level_name, const ImageSize& size) {
+  const int width = size.width;
+  const int height = size.height;
+
+  // The original code reads a chroma byte past the end of the plane for the
+  // last pixel of odd width images, so leave room for it.
+  std::vector<uint8_t> yuv(width * height + ((height + 1) / 2) * width + 2);
+  for (size_t i = 0; i < yuv.size(); ++i) {
+    yuv[i] = rand() & 0xFF;
+  }
+  const uint8_t* const y_plane = &yuv[0];
+  const uint8_t* const uv_plane = y_plane + width * height;
+
+  for (int flipped = 0; flipped < 2; ++flipped) {
+    std::vector<uint32_t> expected(width * height);
+    ReferenceYUV420SPToARGB8888(y_plane, uv_plane, &expected[0], width,
+                                height, flipped);
+
+    std::vector<uint32_t> actual(width * height, 0);
+    ConvertYUV420SPToARGB8888(y_plane, uv_plane, &actual[0], width, height,
+                              flipped);
+    EXPECT_TRUE(CountMismatches(actual, expected) == 0,
+                "%s YUV to ARGB %dx%d flipped %d: %d pixels differ",
+                level_name, width, height, flipped,
+                CountMismatches(actual, expected));
+
+    for (size_t t = 0; t < sizeof(kThreadCounts) / sizeof(int); ++t) {
+      std::vector<uint32_t> banded(width * height, 0);
+      ConvertYUV420SPToARGB8888Parallel(y_plane, uv_plane, &banded[0], width,
+                                        height, flipped, kThreadCounts[t]);
+      EXPECT_TRUE(CountMismatches(banded, expected) == 0,
+                  "%s YUV to ARGB %dx%d flipped %d on %d threads: %d pixels "
+                  "differ", level_name, width, height, flipped,
+                  kThreadCounts[t], CountMismatches(banded, expected));
+    }
+  }
+}
+
+void TestARGBToYUV(const char* const level_name, const ImageSize& size) {
+  const int width = size.width;
+  const int height = size.height;
+  const int output_size =
+      width * height + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+
+  std::vector<uint32_t> argb(width * height);
+  for (size_t i = 0; i < argb.size(); ++i) {
+    argb[i] = (static_cast<uint32_t>(rand() & 0xFFFF) << 16) |
+              (rand() & 0xFFFF);
+  }
+
+  // Saturated pixels exercise the ends of every fixed point range.
+  static const uint32_t kExtremes[] = {0x00000000, 0xFFFFFFFF, 0xFFFF0000,
+                                       0xFF00FF00, 0xFF0000FF, 0x00FFFF00};
+  for (size_t i = 0; i < argb.size() && i < 6; ++i) {
+    argb[i * 7 % argb.size()] = kExtremes[i];
+  }
+
+  // Start from garbage, as the chroma blocks are accumulated in place.
+  std::vector<uint8_t> expected(output_size, 0xAB);
+  ReferenceARGB8888ToYUV420SP(&argb[0], &expected[0], width, height);
+
+  std::vector<uint8_t> actual(output_size, 0xCD);
+  ConvertARGB8888ToYUV420SP(&argb[0], &actual[0], width, height);
+  EXPECT_TRUE(CountMismatches(actual, expected) == 0,
+              "%s ARGB to YUV %dx%d: %d bytes differ", level_name, width,
+              height, CountMismatches(actual, expected));
+
+  for (size_t t = 0; t < sizeof(kThreadCounts) / sizeof(int); ++t) {
+    std::vector<uint8_t> banded(output_size, 0xEF);
+    ConvertARGB8888ToYUV420SPParallel(&argb[0], &banded[0], width, height,
+                                      kThreadCounts[t]);
+    EXPECT_TRUE(CountMismatches(banded, expected) == 0,
+                "%s ARGB to YUV %dx%d on %d threads: %d bytes differ",
+                level_name, width, height, kThreadCounts[t],
+                CountMismatches(banded, expected));
+  }
+}
+
+struct TensorCase {
+  int width;
+  int height;
+  int crop_left;
+  int crop_top;
+  int crop_width;
+  int crop_height;
+  int output_width;
+  int output_height;
+};
+
+// Whole frames and crops, scaled down, up and not at all.
+const TensorCase kTensorCases[] = {
+    {640, 480, 0, 0, 640, 480, 300, 300},
+    {640, 480, 80, 0, 480, 480, 300, 300},
+    {33, 17, 3, 5, 21, 11, 21, 11},
+    {33, 17, 1, 1, 7, 9, 40, 25},
+    {64, 48, 0, 0, 64, 48, 1, 1},
+};
+
+void TestRGBTensor(const TensorCase& test_case) {
+  const int width = test_case.width;
+  const int height = test_case.height;
+  std::vector<uint8_t> yuv(width * height + ((height + 1) / 2) * width + 2);
+  for (size_t i = 0; i < yuv.size(); ++i) {
+    yuv[i] = rand() & 0xFF;
+  }
+  const uint8_t* const y_plane = &yuv[0];
+  const uint8_t* const uv_plane = y_plane + width * height;
+
+  const int output_width = test_case.output_width;
+  const int output_height = test_case.output_height;
+  const int num_values = output_width * output_height * 3;
+  const float kMean = 128.0f;
+  const float kStd = 128.0f;
+
+  for (int flipped = 0; flipped < 2; ++flipped) {
+    std::vector<uint32_t> argb(width * height);
+    ReferenceYUV420SPToARGB8888(y_plane, uv_plane, &argb[0], width, height,
+                                flipped);
+
+    // Nearest neighbour sampling at pixel centers, then the same channel
+    // extraction and normalization as RecognizeImageRunnable.java.
+    std::vector<uint8_t> expected_bytes(num_values);
+    std::vector<float> expected_floats(num_values);
+    for (int out_y = 0; out_y < output_height; ++out_y) {
+      const int y = test_case.crop_top +
+                    static_cast<int>((out_y + 0.5) * test_case.crop_height /
+                                     output_height);
+      for (int out_x = 0; out_x < output_width; ++out_x) {
+        const int x = test_case.crop_left +
+                      static_cast<int>((out_x + 0.5) * test_case.crop_width /
+                                       output_width);
+        const uint32_t pixel = argb[y * width + x];
+        const int channels[3] = {static_cast<int>((pixel >> 16) & 0xFF),
+                                 static_cast<int>((pixel >> 8) & 0xFF),
+                                 static_cast<int>(pixel & 0xFF)};
+        for (int c = 0; c < 3; ++c) {
+          const int index = (out_y * output_width + out_x) * 3 + c;
+          expected_bytes[index] = channels[c];
+          expected_floats[index] = (channels[c] - kMean) / kStd;
+        }
+      }
+    }
+
+    for (size_t t = 0; t < sizeof(kThreadCounts) / sizeof(int); ++t) {
+      std::vector<uint8_t> bytes(num_values, 0);
+      EXPECT_TRUE(ConvertYUV420SPToRGBTensor(
+                      y_plane, uv_plane, width, height, flipped,
+                      test_case.crop_left, test_case.crop_top,
+                      test_case.crop_width, test_case.crop_height,
+                      output_width, output_height, RGB_TENSOR_UINT8, kMean,
+                      kStd, &bytes[0], kThreadCounts[t]),
+                  "uint8 tensor %dx%d from %dx%d rejected its crop",
+                  output_width, output_height, width, height);
+      EXPECT_TRUE(CountMismatches(bytes, expected_bytes) == 0,
+                  "uint8 tensor %dx%d from %dx%d on %d threads: %d values "
+                  "differ", output_width, output_height, width, height,
+                  kThreadCounts[t], CountMismatches(bytes, expected_bytes));
+
+      std::vector<float> floats(num_values, 0.0f);
+      EXPECT_TRUE(ConvertYUV420SPToRGBTensor(
+                      y_plane, uv_plane, width, height, flipped,
+                      test_case.crop_left, test_case.crop_top,
+                      test_case.crop_width, test_case.crop_height,
+                      output_width, output_height, RGB_TENSOR_FLOAT, kMean,
+                      kStd, &floats[0], kThreadCounts[t]),
+                  "float tensor %dx%d from %dx%d rejected its crop",
+                  output_width, output_height, width, height);
+      EXPECT_TRUE(memcmp(&floats[0], &expected_floats[0],
+                         num_values * sizeof(float)) == 0,
+                  "float tensor %dx%d from %dx%d on %d threads differs",
+                  output_width, output_height, width, height,
+                  kThreadCounts[t]);
+    }
+  }
+}
+
+// Crops reaching outside the image or empty, and empty outputs, must be
+// refused without touching the output.
+void TestRGBTensorRejectsBadSizes() {
+  const int kWidth = 64;
+  const int kHeight = 48;
+  // Crop left, top, width and height, then output width and height.
+  const int kBadSizes[][6] = {
+      {-1, 0, 32, 32, 16, 16}, {0, -1, 32, 32, 16, 16},
+      {40, 0, 25, 32, 16, 16}, {0, 20, 32, 29, 16, 16},
+      {0, 0, 0, 32, 16, 16},   {0, 0, 32, 0, 16, 16},
+      {0, 0, 65, 48, 16, 16},  {0, 0, 64, 49, 16, 16},
+      {0, 0, 64, 48, 0, 16},   {0, 0, 64, 48, 16, 0},
+      {0, 0, 64, 48, -16, 16}, {0, 0, 64, 48, 16, -1},
+  };
+  std::vector<uint8_t> yuv(kWidth * kHeight * 3 / 2, 0x80);
+  for (size_t i = 0; i < sizeof(kBadSizes) / sizeof(kBadSizes[0]); ++i) {
+    const int* const sizes = kBadSizes[i];
+    std::vector<uint8_t> output(16 * 16 * 3, 0xAB);
+    const bool converted = ConvertYUV420SPToRGBTensor(
+        &yuv[0], &yuv[kWidth * kHeight], kWidth, kHeight, false, sizes[0],
+        sizes[1], sizes[2], sizes[3], sizes[4], sizes[5], RGB_TENSOR_UINT8,
+        0.0f, 1.0f, &output[0], 1);
+    EXPECT_TRUE(!converted,
+                "crop %dx%d at (%d, %d) of %dx%d to %dx%d accepted", sizes[2],
+                sizes[3], sizes[0], sizes[1], kWidth, kHeight, sizes[4],
+                sizes[5]);
+    EXPECT_TRUE(std::count(output.begin(), output.end(), 0xAB) ==
+                    static_cast<long>(output.size()),
+                "rejected case %d wrote to the output", static_cast<int>(i));
+  }
+}
+
+}  // namespace
+
+int main() {
+  srand(1234);
+
+  struct Level {
+    SimdLevel level;
+    const char* name;
+  };
+  const Level kLevels[] = {
+      {SIMD_LEVEL_NONE, "Scalar"},
+      {SIMD_LEVEL_NEON, "NEON"},
+      {SIMD_LEVEL_SSE41, "SSE4.1"},
+      {SIMD_LEVEL_AVX2, "AVX2"},
+  };
+
+  for (size_t i = 0; i < sizeof(kLevels) / sizeof(Level); ++i) {
+    SetMaxSimdLevel(kLevels[i].level);
+    if (GetSimdLevel() != kLevels[i].level) {
+      printf("Skipping %s, not available in this build.\n", kLevels[i].name);
+      continue;
+    }
+    printf("Testing %s.\n", kLevels[i].name);
+    for (size_t s = 0; s < sizeof(kSizes) / sizeof(ImageSize); ++s) {
+      TestYUVToARGB(kLevels[i].name, kSizes[s]);
+      TestARGBToYUV(kLevels[i].name, kSizes[s]);
+    }
+  }
+
+  printf("Testing RGB tensors.\n");
+  for (size_t i = 0; i < sizeof(kTensorCases) / sizeof(TensorCase); ++i) {
+    TestRGBTensor(kTensorCases[i]);
+  }
+  TestRGBTensorRejectsBadSizes();
+
+  return ReportResults();
+}